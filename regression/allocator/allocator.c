@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#define COPIES			(2000)	/* of the input, for a parallel parse */
+#define MANY			(20)	/* attributes and children, indexed */
+
+/* counts what goes through it, fails once `fail' calls are left */
+struct counter {
+	long			 calls;
+	long			 live;
+	long			 fail;	/* -1 never */
+};
+
+static void *
+c_malloc(void *arg, size_t sz)
+{
+	struct counter		*c = arg;
+
+	__atomic_add_fetch(&c->calls, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&c->fail, __ATOMIC_RELAXED) >= 0 &&
+	    __atomic_sub_fetch(&c->fail, 1, __ATOMIC_RELAXED) < 0)
+		return (NULL);
+	__atomic_add_fetch(&c->live, 1, __ATOMIC_RELAXED);
+	return (malloc(sz));
+}
+
+static void *
+c_realloc(void *arg, void *p, size_t sz)
+{
+	struct counter		*c = arg;
+
+	if (p == NULL)
+		return (c_malloc(arg, sz));
+	__atomic_add_fetch(&c->calls, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&c->fail, __ATOMIC_RELAXED) >= 0 &&
+	    __atomic_sub_fetch(&c->fail, 1, __ATOMIC_RELAXED) < 0)
+		return (NULL);
+	return (realloc(p, sz));
+}
+
+static void
+c_free(void *arg, void *p)
+{
+	struct counter		*c = arg;
+
+	__atomic_sub_fetch(&c->live, 1, __ATOMIC_RELAXED);
+	free(p);
+}
+
+static char *
+gen(struct xmlsd_document *xd)
+{
+	char			*s;
+
+	if ((s = xmlsd_generate(xd, malloc, NULL, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	return (s);
+}
+
+/* allocator calls to parse `b' into a new document, which must match `s' */
+static long
+parse(struct xmlsd_allocator *mm, const char *b, size_t sz, int flags,
+    int pflags, const char *s)
+{
+	struct counter		*c = mm->xal_arg;
+	struct xmlsd_document	*xd;
+	char			*t;
+	long			 calls;
+
+	if (xmlsd_doc_alloc_mm(&xd, flags, mm) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_mm");
+	calls = c->calls;
+	if (xmlsd_parse_mem_flags(b, sz, xd, pflags) != XMLSD_ERR_SUCCES)
+		errx(1, "parse");
+	calls = c->calls - calls;
+	if (strcmp(s, t = gen(xd)))
+		errx(1, "parsed something else");
+	free(t);
+	xmlsd_doc_free(xd);
+	if (c->live != 0)
+		errx(1, "%ld blocks not given back", c->live);
+
+	return (calls);
+}
+
+/* `what' took memory from `c' */
+static void
+used(struct counter *c, long calls, const char *what)
+{
+	if (c->calls == calls)
+		errx(1, "%s not made with the allocator", what);
+}
+
+/* changes and lookups after the parse allocate from the document's too */
+static void
+later(struct xmlsd_allocator *mm, const char *b, size_t sz)
+{
+	struct counter		*c = mm->xal_arg;
+	struct xmlsd_document	*xd;
+	struct xmlsd_element	*root, *xe;
+	struct xmlsd_attribute	*xa;
+	char			 name[16];
+	long			 n;
+	int			 i;
+
+	if (xmlsd_doc_alloc_mm(&xd, XMLSD_DOC_F_BORROW, mm) !=
+	    XMLSD_ERR_SUCCES || xmlsd_parse_mem(b, sz, xd) != XMLSD_ERR_SUCCES)
+		errx(1, "parse");
+	root = xmlsd_doc_get_root(xd);
+
+	n = c->calls;
+	if (xmlsd_elem_set_value(root, "a value too long to be kept inline"))
+		errx(1, "xmlsd_elem_set_value");
+	used(c, n, "value");
+	n = c->calls;
+	if (xmlsd_elem_set_value_b64(root, "binary", 6))
+		errx(1, "xmlsd_elem_set_value_b64");
+	if (xmlsd_elem_get_value(root) == NULL)
+		errx(1, "xmlsd_elem_get_value");
+	used(c, n, "binary value");
+
+	n = c->calls;
+	for (i = 0; i < MANY; i++) {
+		snprintf(name, sizeof name, "a%d", i);
+		if (xmlsd_elem_set_attr(root, name, "v"))
+			errx(1, "xmlsd_elem_set_attr");
+		if (xmlsd_doc_add_elem(xd, root, name) == NULL)
+			errx(1, "xmlsd_doc_add_elem");
+	}
+	used(c, n, "attribute");
+	n = c->calls;
+	if (xmlsd_elem_get_attr(root, name) == NULL)
+		errx(1, "xmlsd_elem_get_attr");
+	used(c, n, "attribute index");
+	n = c->calls;
+	if (xmlsd_elem_count_children(root, name) != 1)
+		errx(1, "xmlsd_elem_count_children");
+	used(c, n, "child index");
+	n = c->calls;
+	if (xmlsd_doc_index_paths(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_index_paths");
+	used(c, n, "path index");
+
+	/* borrowed values are copied out of the input when asked for */
+	XMLSD_ELEM_FOREACH_CHILDREN(xe, root)
+		XMLSD_ELEM_FOREACH_ATTR(xa, xe)
+			xmlsd_attr_get_value(xa);
+	xmlsd_doc_free(xd);
+	if (c->live != 0)
+		errx(1, "%ld blocks not given back", c->live);
+}
+
+/* documents of batches and caches come from the allocator given */
+static void
+shared(struct xmlsd_allocator *mm, const char *b, size_t sz, const char *s)
+{
+	struct counter		*c = mm->xal_arg;
+	struct xmlsd_pool	*pool;
+	struct xmlsd_cache	*xc;
+	struct xmlsd_document	*docs[8], *xd;
+	struct iovec		 bufs[8];
+	char			*t;
+	long			 n;
+	size_t			 i;
+
+	if (xmlsd_pool_alloc_mm(&pool, 2, XMLSD_PARSE_NATIVE, mm) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_pool_alloc_mm");
+	for (i = 0; i < sizeof docs / sizeof docs[0]; i++) {
+		bufs[i].iov_base = (void *)b;
+		bufs[i].iov_len = sz;
+		docs[i] = NULL;
+	}
+	n = c->live;
+	if (xmlsd_parse_batch(bufs, sizeof docs / sizeof docs[0], docs, NULL,
+	    pool) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_batch");
+	if (c->live <= n)
+		errx(1, "batch not parsed with the allocator");
+	for (i = 0; i < sizeof docs / sizeof docs[0]; i++) {
+		if (strcmp(s, t = gen(docs[i])))
+			errx(1, "batch parsed something else");
+		free(t);
+		xmlsd_doc_free(docs[i]);
+	}
+	xmlsd_pool_free(pool);
+	if (c->live != 0)
+		errx(1, "%ld blocks not given back by the pool", c->live);
+
+	if (xmlsd_cache_alloc_mm(&xc, 1 << 20, NULL, 0, mm) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc_mm");
+	n = c->live;
+	if (xmlsd_cache_parse(xc, b, sz, &xd, NULL) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_parse");
+	if (c->live <= n)
+		errx(1, "cached document not made with the allocator");
+	if (strcmp(s, t = gen(xd)))
+		errx(1, "cache parsed something else");
+	free(t);
+	xmlsd_cache_release(xc, xd);
+	xmlsd_cache_free(xc);
+	if (c->live != 0)
+		errx(1, "%ld blocks not given back by the cache", c->live);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct counter		 c = { 0, 0, -1 };
+	struct xmlsd_allocator	 mm = { c_malloc, c_realloc, c_free, &c };
+	struct xmlsd_allocator	 bad = mm;
+	struct xmlsd_document	*xd, *copy;
+	struct stat		 st;
+	char			*b, *big, *s, *t;
+	size_t			 bigsz, len;
+	long			 expat, native, live, n;
+	int			 fd, i, rv;
+
+	if (argc != 2)
+		errx(1, "usage: allocator file.xml");
+	if ((fd = open(argv[1], O_RDONLY, 0)) == -1)
+		err(1, "open %s", argv[1]);
+	if (fstat(fd, &st) == -1)
+		err(1, "fstat");
+	if ((b = malloc(st.st_size)) == NULL)
+		err(1, "malloc");
+	if (read(fd, b, st.st_size) != st.st_size)
+		err(1, "read");
+	close(fd);
+
+	bad.xal_realloc = NULL;
+	if (xmlsd_doc_alloc_mm(&xd, 0, &bad) != XMLSD_ERR_INTEGRITY)
+		errx(1, "allocator without realloc accepted");
+
+	/* the reference output, from the system allocator */
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+	    xmlsd_parse_mem(b, st.st_size, xd) != XMLSD_ERR_SUCCES)
+		errx(1, "parse %s", argv[1]);
+	s = gen(xd);
+	xmlsd_doc_free(xd);
+
+	/* expat's parser comes from the allocator as well */
+	expat = parse(&mm, b, st.st_size, 0, 0, s);
+	native = parse(&mm, b, st.st_size, 0, XMLSD_PARSE_NATIVE, s);
+	if (expat <= native)
+		errx(1, "expat allocated %ld times, the tokenizer %ld",
+		    expat, native);
+	parse(&mm, b, st.st_size, XMLSD_DOC_F_BORROW | XMLSD_DOC_F_FREEZE, 0,
+	    s);
+
+	/* running out at any point fails the parse and leaks nothing */
+	for (n = 0; ; n++) {
+		if (xmlsd_doc_alloc_mm(&xd, 0, &mm) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc_mm");
+		c.fail = n;
+		rv = xmlsd_parse_mem(b, st.st_size, xd);
+		c.fail = -1;
+		xmlsd_doc_free(xd);
+		if (c.live != 0)
+			errx(1, "%ld blocks leaked failing call %ld", c.live,
+			    n);
+		if (rv == XMLSD_ERR_SUCCES)
+			break;
+		if (rv != XMLSD_ERR_RESOURCE)
+			errx(1, "failing call %ld returned %d", n, rv);
+	}
+	if (n != expat)
+		errx(1, "parse succeeded after %ld calls, not %ld", n, expat);
+
+	/*
+	 * A recycling document keeps its memory and gives all of it back,
+	 * expat still allocates a little on every parse.
+	 */
+	if (xmlsd_doc_alloc_mm(&xd, XMLSD_DOC_F_RECYCLE, &mm) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_mm");
+	for (i = 0; i < 10; i++) {
+		xmlsd_doc_clear(xd);
+		n = c.calls;
+		if (xmlsd_parse_mem(b, st.st_size, xd) != XMLSD_ERR_SUCCES)
+			errx(1, "recycled parse");
+		if (i == 0) {
+			expat = c.calls - n;
+			live = c.live;
+		} else if (c.calls - n >= expat || c.live != live)
+			errx(1, "recycled parse %d allocated %ld, holds %ld",
+			    i, c.calls - n, c.live);
+	}
+	if (strcmp(s, t = gen(xd)))
+		errx(1, "recycled parse differs");
+	free(t);
+
+	/* copies share it, and may be freed on another thread */
+	n = c.live;
+	if (xmlsd_doc_clone(&copy, xd) != XMLSD_ERR_SUCCES || c.live <= n)
+		errx(1, "copy not made with the allocator");
+	if (strcmp(s, t = gen(copy)))
+		errx(1, "copy differs");
+	free(t);
+	xmlsd_doc_free(xd);
+	xmlsd_doc_free_async(copy);
+	xmlsd_doc_free_shutdown();
+	if (c.live != 0)
+		errx(1, "%ld blocks not given back", c.live);
+
+	later(&mm, b, st.st_size);
+	shared(&mm, b, st.st_size, s);
+
+	/* large enough to be split between threads, without declarations */
+	t = b;
+	if (!strncmp(b, "<?", 2) && (t = memchr(b, '>', st.st_size)) != NULL)
+		t++;
+	len = st.st_size - (t - b);
+	bigsz = 0;
+	if ((big = malloc(COPIES * len + 64)) == NULL)
+		err(1, "malloc");
+	memcpy(big, "<root>", 6);
+	bigsz += 6;
+	for (i = 0; i < COPIES; i++, bigsz += len)
+		memcpy(big + bigsz, t, len);
+	memcpy(big + bigsz, "</root>", 7);
+	bigsz += 7;
+	if (xmlsd_doc_alloc_mm(&xd, 0, &mm) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_mm");
+	if (xmlsd_parse_mem_parallel(big, bigsz, xd, 0, 4) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem_parallel");
+	if (xmlsd_elem_count_children(xmlsd_doc_get_root(xd),
+	    xmlsd_elem_get_name(xmlsd_elem_get_first_child(
+	    xmlsd_doc_get_root(xd)))) != COPIES)
+		errx(1, "parallel parse");
+	xmlsd_doc_free(xd);
+	if (c.live != 0)
+		errx(1, "%ld blocks not given back", c.live);
+
+	free(big);
+	free(s);
+	free(b);
+	return (0);
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <err.h>
+#include <string.h>
+
+#define NATTRS		(60)
+
+/* every attribute must be found and iteration must be in insertion order */
+static void
+check(struct xmlsd_element *xe, int n)
+{
+	struct xmlsd_attribute		*xa;
+	const char			*errstr;
+	char				 name[16];
+	int				 i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof name, "attr%d", i);
+		if (xmlsd_elem_get_attr_strtonum(xe, name, 0, NATTRS * 2,
+		    &errstr) != i || errstr != NULL)
+			errx(1, "%s: wrong value", name);
+		if ((xa = xmlsd_elem_find_attr(xe, name)) == NULL ||
+		    strcmp(xmlsd_attr_get_name(xa), name))
+			errx(1, "%s: not found", name);
+	}
+	if (xmlsd_elem_get_attr(xe, "missing") != NULL)
+		errx(1, "found missing attribute");
+
+	i = 0;
+	XMLSD_ELEM_FOREACH_ATTR(xa, xe) {
+		snprintf(name, sizeof name, "attr%d", i < n ? i : 0);
+		if (strcmp(xmlsd_attr_get_name(xa), name))
+			errx(1, "attribute %d is %s", i,
+			    xmlsd_attr_get_name(xa));
+		i++;
+	}
+}
+
+/* batch lookups must agree with single ones */
+static void
+check_batch(struct xmlsd_element *xe)
+{
+	struct xmlsd_attr_set		*as;
+	const char			*names[NATTRS + 4], *out[NATTRS + 4];
+	const char			*errstr[NATTRS + 4];
+	long long			 num[NATTRS + 4];
+	char				 buf[NATTRS + 4][16];
+	size_t				 i, n, want;
+
+	/* every third attribute, backwards, with a duplicate and misses */
+	for (n = 0, i = NATTRS + 2; i-- > 0; ) {
+		if (i % 3)
+			continue;
+		snprintf(buf[n], sizeof buf[n], "attr%zu", i);
+		names[n] = buf[n];
+		n++;
+	}
+	names[n++] = "attr3";
+	for (i = 0, want = 0; i < n; i++)
+		if (xmlsd_elem_get_attr(xe, names[i]) != NULL)
+			want++;
+
+	if (xmlsd_elem_get_attrs(xe, names, out, n) != want)
+		errx(1, "xmlsd_elem_get_attrs");
+	for (i = 0; i < n; i++)
+		if (out[i] != xmlsd_elem_get_attr(xe, names[i]))
+			errx(1, "xmlsd_elem_get_attrs: %s", names[i]);
+
+	if (xmlsd_attr_set_alloc(&as, names, n) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_attr_set_alloc");
+	if (xmlsd_elem_get_attr_set(xe, as, out) != want)
+		errx(1, "xmlsd_elem_get_attr_set");
+	for (i = 0; i < n; i++)
+		if (out[i] != xmlsd_elem_get_attr(xe, names[i]))
+			errx(1, "xmlsd_elem_get_attr_set: %s", names[i]);
+	xmlsd_attr_set_free(as);
+
+	if (xmlsd_elem_get_attrs_strtonum(xe, names, num, errstr, n, 0,
+	    NATTRS * 2) != want)
+		errx(1, "xmlsd_elem_get_attrs_strtonum");
+	for (i = 0; i < n; i++) {
+		if (out[i] == NULL) {
+			if (errstr[i] == NULL)
+				errx(1, "%s: found", names[i]);
+			continue;
+		}
+		if (errstr[i] != NULL || num[i] != strtonum(out[i], 0,
+		    NATTRS * 2, &errstr[i]))
+			errx(1, "%s: wrong value", names[i]);
+	}
+
+	/* more names than fit on the stack */
+	for (i = 0; i < NATTRS; i++) {
+		snprintf(buf[i], sizeof buf[i], "attr%zu", NATTRS - 1 - i);
+		names[i] = buf[i];
+	}
+	if (xmlsd_elem_get_attrs(xe, names, out, NATTRS) != NATTRS)
+		errx(1, "xmlsd_elem_get_attrs all");
+	for (i = 0; i < NATTRS; i++)
+		if (out[i] != xmlsd_elem_get_attr(xe, names[i]))
+			errx(1, "xmlsd_elem_get_attrs all: %s", names[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document		*xd;
+	struct xmlsd_element		*xe;
+	char				*s, name[16];
+	int				 i;
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if ((xe = xmlsd_doc_add_elem(xd, NULL, "wide")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+
+	/* look everything up as the element grows past the index size */
+	for (i = 0; i < NATTRS; i++) {
+		snprintf(name, sizeof name, "attr%d", i);
+		if (xmlsd_elem_set_attr_int32(xe, name, i))
+			errx(1, "xmlsd_elem_set_attr_int32");
+		check(xe, i + 1);
+	}
+	check_batch(xe);
+
+	/* and the same for parsed and frozen documents */
+	if ((s = xmlsd_generate(xd, malloc, NULL, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	xmlsd_doc_clear(xd);
+	if (xmlsd_parse_mem(s, strlen(s), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	free(s);
+	check(xmlsd_doc_get_root(xd), NATTRS);
+	if (xmlsd_doc_freeze(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_freeze");
+	check(xmlsd_doc_get_root(xd), NATTRS);
+
+	/* the first attribute of a name wins, as without an index */
+	if (xmlsd_elem_set_attr(xmlsd_doc_get_root(xd), "attr0", "duplicate"))
+		errx(1, "xmlsd_elem_set_attr");
+	check(xmlsd_doc_get_root(xd), NATTRS);
+	check_batch(xmlsd_doc_get_root(xd));
+
+	xmlsd_doc_free(xd);
+
+	printf("attrindex: PASS\n");
+
+	return (0);
+}
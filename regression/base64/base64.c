@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <err.h>
+#include <string.h>
+
+#define MAXLEN		(300)
+
+/* rfc 4648 test vectors */
+struct vector {
+	const char		*data, *text;
+} vectors[] = {
+	{ "",		"" },
+	{ "f",		"Zg==" },
+	{ "fo",		"Zm8=" },
+	{ "foo",	"Zm9v" },
+	{ "foob",	"Zm9vYg==" },
+	{ "fooba",	"Zm9vYmE=" },
+	{ "foobar",	"Zm9vYmFy" },
+	{ NULL,		NULL }
+};
+
+/* text that decodes, with what it decodes to */
+struct vector good[] = {
+	{ "foobar",	"Zm9v\r\n  YmFy\n" },
+	{ "foob",	"Zm9vYg" },
+	{ "fooba",	"Zm9v YmE =" },
+	{ "fo",		"Zm8\t=" },
+	{ "",		"  " },
+	{ NULL,		NULL }
+};
+
+const char *bad[] = {
+	"Z", "Zm9vY", "Zg=", "Zg===", "Zm9v=", "Zg==Zg==", "Zm9v!", "Zm9\xff",
+	"Z===", "====",
+	NULL
+};
+
+static void
+check_text(struct xmlsd_element *xe, const char *text, const char *data)
+{
+	unsigned char		 buf[64];
+	size_t			 len, dlen = strlen(data);
+	int			 rv;
+
+	if (xmlsd_elem_set_value(xe, text))
+		errx(1, "xmlsd_elem_set_value");
+	if ((rv = xmlsd_elem_get_value_b64(xe, NULL, &len)) != XMLSD_ERR_SUCCES)
+		errx(1, "\"%s\": size failed %d", text, rv);
+	if (len != dlen)
+		errx(1, "\"%s\": size %zu", text, len);
+	len = sizeof buf;
+	if (xmlsd_elem_get_value_b64(xe, buf, &len) != XMLSD_ERR_SUCCES ||
+	    len != dlen || memcmp(buf, data, len))
+		errx(1, "\"%s\": decode", text);
+	if (dlen > 0) {
+		len = dlen - 1;
+		if (xmlsd_elem_get_value_b64(xe, buf, &len) !=
+		    XMLSD_ERR_OVERFLOW || len != dlen)
+			errx(1, "\"%s\": no overflow", text);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd;
+	struct xmlsd_element	*root, *xe;
+	unsigned char		 data[MAXLEN], buf[MAXLEN];
+	const char		*s;
+	char			*out;
+	size_t			 i, len, sz;
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if ((root = xmlsd_doc_add_elem(xd, NULL, "root")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	if ((xe = xmlsd_doc_add_elem(xd, root, "v")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+
+	for (i = 0; vectors[i].data != NULL; i++) {
+		if (xmlsd_elem_set_value_b64(xe, vectors[i].data,
+		    strlen(vectors[i].data)))
+			errx(1, "xmlsd_elem_set_value_b64");
+		if (xmlsd_elem_get_value_len(xe) != strlen(vectors[i].text))
+			errx(1, "encoded length \"%s\"", vectors[i].data);
+		if ((s = xmlsd_elem_get_value(xe)) == NULL ||
+		    strcmp(s, vectors[i].text))
+			errx(1, "encode \"%s\": %s", vectors[i].data, s);
+		check_text(xe, vectors[i].text, vectors[i].data);
+	}
+	for (i = 0; good[i].data != NULL; i++)
+		check_text(xe, good[i].text, good[i].data);
+	for (i = 0; bad[i] != NULL; i++) {
+		if (xmlsd_elem_set_value(xe, bad[i]))
+			errx(1, "xmlsd_elem_set_value");
+		len = sizeof buf;
+		if (xmlsd_elem_get_value_b64(xe, buf, &len) !=
+		    XMLSD_ERR_INTEGRITY)
+			errx(1, "\"%s\" decoded", bad[i]);
+	}
+
+	/*
+	 * every length and byte value survives a round trip, empty values
+	 * do not as the parser drops them
+	 */
+	xmlsd_doc_remove_elem(xd, xe);
+	for (i = 0; i < MAXLEN; i++)
+		data[i] = i * 7 + (i >> 3);
+	for (i = 1; i < MAXLEN; i++) {
+		if ((xe = xmlsd_doc_add_elem(xd, root, "v")) == NULL ||
+		    xmlsd_elem_set_value_b64(xe, data, i))
+			errx(1, "xmlsd_elem_set_value_b64");
+	}
+	if ((out = xmlsd_generate(xd, malloc, &sz, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	xmlsd_doc_clear(xd);
+	if (xmlsd_parse_mem(out, strlen(out), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	free(out);
+	if (xmlsd_doc_freeze(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_freeze");
+
+	i = 1;
+	XMLSD_ELEM_FOREACH_CHILDREN(xe, xmlsd_doc_get_root(xd)) {
+		len = sizeof buf;
+		if (xmlsd_elem_get_value_b64(xe, buf, &len) != XMLSD_ERR_SUCCES)
+			errx(1, "length %zu: decode", i);
+		if (len != i || memcmp(buf, data, len))
+			errx(1, "length %zu: wrong data", i);
+		i++;
+	}
+	if (i != MAXLEN)
+		errx(1, "%zu values", i);
+
+	xmlsd_doc_free(xd);
+
+	fprintf(stderr, "base64: %zu lengths ok\n", i);
+
+	return (0);
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <err.h>
+#include <string.h>
+
+#define MSGS			(5000)
+#define MSG_MAX			(512)
+#define BENCH_LOOPS		(20)
+
+struct caller {
+	struct xmlsd_pool	*pool;
+	int			 flags;
+	int			 seed;
+};
+
+/* message `i', every 97th is broken */
+static size_t
+message(char *b, int i)
+{
+	if (i % 97 == 96)
+		return (snprintf(b, MSG_MAX, "<msg id='%d'><open></msg>", i));
+	if (i % 11 == 0)
+		return (snprintf(b, MSG_MAX, "<msg id='%d'>%0*d</msg>", i,
+		    i % 400 + 1, i));
+	return (snprintf(b, MSG_MAX,
+	    "<?xml version='1.0'?>\n<msg id='%d' kind=\"update\">\n"
+	    "  <user name='u%d'>someone &amp; other</user>\n"
+	    "  <item n='1'>%d</item><item n='2'/>\n</msg>\n", i, i, i * 7));
+}
+
+static struct iovec *
+messages(int n, int seed)
+{
+	struct iovec		*iov;
+	int			 i;
+
+	if ((iov = calloc(n, sizeof *iov)) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++) {
+		if ((iov[i].iov_base = malloc(MSG_MAX)) == NULL)
+			err(1, "malloc");
+		iov[i].iov_len = message(iov[i].iov_base, i + seed);
+	}
+
+	return (iov);
+}
+
+static void
+messages_free(struct iovec *iov, int n)
+{
+	int			 i;
+
+	for (i = 0; i < n; i++)
+		free(iov[i].iov_base);
+	free(iov);
+}
+
+/* every document must be what a parse of its own gives */
+static void
+check(const char *what, struct iovec *iov, int n,
+    struct xmlsd_document **docs, int *errors, int flags)
+{
+	struct xmlsd_document	*xd;
+	char			*a, *b;
+	size_t			 asz, bsz;
+	int			 i, rv;
+
+	for (i = 0; i < n; i++) {
+		if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc");
+		rv = xmlsd_parse_mem_flags(iov[i].iov_base, iov[i].iov_len,
+		    xd, flags);
+		if (rv != errors[i])
+			errx(1, "%s: message %d: %d, batch %d", what, i, rv,
+			    errors[i]);
+		if (docs[i] == NULL)
+			errx(1, "%s: message %d has no document", what, i);
+		if (rv == XMLSD_ERR_SUCCES) {
+			if ((a = xmlsd_generate(xd, malloc, &asz, 0)) == NULL ||
+			    (b = xmlsd_generate(docs[i], malloc, &bsz, 0)) ==
+			    NULL)
+				errx(1, "xmlsd_generate");
+			if (asz != bsz || strcmp(a, b))
+				errx(1, "%s: message %d differs", what, i);
+			free(a);
+			free(b);
+		}
+		xmlsd_doc_free(xd);
+	}
+}
+
+static void
+docs_free(struct xmlsd_document **docs, int n)
+{
+	int			 i;
+
+	for (i = 0; i < n; i++) {
+		xmlsd_doc_free(docs[i]);
+		docs[i] = NULL;
+	}
+}
+
+/* batches of different sizes into new and into recycled documents */
+static void
+run(const char *what, struct xmlsd_pool *pool, int flags, int seed)
+{
+	struct xmlsd_document	*docs[MSGS];
+	struct iovec		*iov;
+	int			 errors[MSGS], sizes[] = { 1, 7, 300, MSGS };
+	int			 i, j, rv;
+
+	iov = messages(MSGS, seed);
+	for (j = 0; j < sizeof sizes / sizeof sizes[0]; j++) {
+		memset(docs, 0, sizeof docs);
+		memset(errors, 0xff, sizeof errors);
+		rv = xmlsd_parse_batch(iov, sizes[j], docs, errors, pool);
+		if (rv != (sizes[j] > 96 - seed % 97 ? XMLSD_ERR_PARSER :
+		    XMLSD_ERR_SUCCES))
+			errx(1, "%s: batch of %d returned %d", what, sizes[j],
+			    rv);
+		check(what, iov, sizes[j], docs, errors, flags);
+		docs_free(docs, sizes[j]);
+	}
+
+	for (i = 0; i < MSGS; i++)
+		if (xmlsd_doc_alloc_flags(&docs[i], XMLSD_DOC_F_RECYCLE) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc_flags");
+	for (j = 0; j < 3; j++) {
+		if (j > 0)
+			for (i = 0; i < MSGS; i++)
+				xmlsd_doc_clear(docs[i]);
+		xmlsd_parse_batch(iov, MSGS, docs, errors, pool);
+		check(what, iov, MSGS, docs, errors, flags);
+	}
+	docs_free(docs, MSGS);
+
+	messages_free(iov, MSGS);
+}
+
+void *
+caller_main(void *arg)
+{
+	struct caller		*c = arg;
+
+	run("concurrent", c->pool, c->flags, c->seed);
+	return (NULL);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval		 now, d;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &d);
+	return (d.tv_sec + d.tv_usec / 1e6);
+}
+
+static void
+bench(void)
+{
+	struct xmlsd_document	*docs[MSGS];
+	struct xmlsd_pool	*pool;
+	struct timeval		 start;
+	struct iovec		*iov;
+	int			 i, j;
+
+	iov = messages(MSGS, 1);
+	if (xmlsd_pool_alloc(&pool, 0, XMLSD_PARSE_NATIVE) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_pool_alloc");
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < BENCH_LOOPS; j++) {
+		for (i = 0; i < MSGS; i++) {
+			if (xmlsd_doc_alloc(&docs[i]) != XMLSD_ERR_SUCCES)
+				errx(1, "xmlsd_doc_alloc");
+			xmlsd_parse_mem_flags(iov[i].iov_base, iov[i].iov_len,
+			    docs[i], XMLSD_PARSE_NATIVE);
+		}
+		docs_free(docs, MSGS);
+	}
+	printf("loop:  %.3fs (%d messages x %d)\n", elapsed(&start), MSGS,
+	    BENCH_LOOPS);
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < BENCH_LOOPS; j++) {
+		memset(docs, 0, sizeof docs);
+		xmlsd_parse_batch(iov, MSGS, docs, NULL, pool);
+		docs_free(docs, MSGS);
+	}
+	printf("batch: %.3fs (%d messages x %d)\n", elapsed(&start), MSGS,
+	    BENCH_LOOPS);
+
+	xmlsd_pool_free(pool);
+	messages_free(iov, MSGS);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd = NULL;
+	struct xmlsd_pool	*pool;
+	struct caller		 c[3];
+	pthread_t		 t[3];
+	struct iovec		 iov;
+	int			 nthreads[] = { 1, 2, 4, 0 };
+	int			 i, flags, ch, bflag = 0;
+	char			 what[32];
+
+	while ((ch = getopt(argc, argv, "b")) != -1) {
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		default:
+			errx(1, "usage: batch [-b]");
+		}
+	}
+
+	for (flags = 0; flags <= XMLSD_PARSE_NATIVE; flags++) {
+		if (flags == 0)
+			run("no pool", NULL, 0, 0);
+		for (i = 0; i < sizeof nthreads / sizeof nthreads[0]; i++) {
+			snprintf(what, sizeof what, "%d threads flags %d",
+			    nthreads[i], flags);
+			if (xmlsd_pool_alloc(&pool, nthreads[i], flags) !=
+			    XMLSD_ERR_SUCCES)
+				errx(1, "xmlsd_pool_alloc");
+			run(what, pool, flags, 0);
+			xmlsd_pool_free(pool);
+		}
+	}
+
+	/* one pool shared by several callers */
+	if (xmlsd_pool_alloc(&pool, 3, XMLSD_PARSE_NATIVE) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_pool_alloc");
+	for (i = 0; i < 3; i++) {
+		c[i].pool = pool;
+		c[i].flags = XMLSD_PARSE_NATIVE;
+		c[i].seed = i * 13;
+		if (pthread_create(&t[i], NULL, caller_main, &c[i]))
+			errx(1, "pthread_create");
+	}
+	for (i = 0; i < 3; i++)
+		if (pthread_join(t[i], NULL))
+			errx(1, "pthread_join");
+	xmlsd_pool_free(pool);
+
+	/* arguments */
+	iov.iov_base = "<a/>";
+	iov.iov_len = 4;
+	if (xmlsd_pool_alloc(&pool, -1, 0) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_pool_alloc(&pool, 1, 0x100) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_parse_batch(NULL, 1, &xd, NULL, NULL) !=
+	    XMLSD_ERR_INTEGRITY ||
+	    xmlsd_parse_batch(&iov, 0, &xd, NULL, NULL) != XMLSD_ERR_SUCCES ||
+	    xd != NULL)
+		errx(1, "bad arguments accepted");
+	if (xmlsd_parse_batch(&iov, 1, &xd, NULL, NULL) != XMLSD_ERR_SUCCES ||
+	    xmlsd_parse_batch(&iov, 1, &xd, NULL, NULL) !=
+	    XMLSD_ERR_INTEGRITY)
+		errx(1, "parsed into a document that wasn't empty");
+	xmlsd_doc_free(xd);
+
+	if (bflag)
+		bench();
+
+	return (0);
+}
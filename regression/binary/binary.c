@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <limits.h>
+#include <string.h>
+
+#define XMLSD_MEM_MAXSIZE	(10 * 1024 * 1024)
+
+const char *doc =
+    "<root a='1' long='an attribute value too long for the node itself'>"
+    "<item id='1'>one</item><item id='2'/>"
+    "<deep><deeper><deepest>a value long enough to be borrowed from the"
+    " input</deepest></deeper><after/></deep>text of the root</root>";
+
+static char *
+gen(struct xmlsd_document *xd)
+{
+	char			*s;
+	size_t			 sz;
+
+	/* nothing is written for an empty document, not even the NUL */
+	if (xmlsd_doc_is_empty(xd))
+		return (strdup(""));
+	if ((s = xmlsd_generate(xd, malloc, &sz, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	return (s);
+}
+
+/* `xd' must come back the same from its snapshot */
+static void
+roundtrip(const char *what, struct xmlsd_document *xd)
+{
+	struct xmlsd_document	*nd;
+	struct xmlsd_walk	 xw, nw;
+	struct xmlsd_element	*xe, *ne;
+	char			*snap, *a, *b;
+	size_t			 sz;
+	int			 i, flags[] = { 0, XMLSD_DOC_F_BORROW,
+				    XMLSD_DOC_F_RECYCLE | XMLSD_DOC_F_BORROW };
+
+	if ((snap = xmlsd_doc_save_binary(xd, malloc, &sz)) == NULL)
+		errx(1, "%s: xmlsd_doc_save_binary", what);
+	a = gen(xd);
+
+	for (i = 0; i < sizeof flags / sizeof flags[0]; i++) {
+		if (xmlsd_doc_alloc_flags(&nd, flags[i]) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc_flags");
+		if (xmlsd_doc_load_binary(nd, snap, sz) != XMLSD_ERR_SUCCES)
+			errx(1, "%s: xmlsd_doc_load_binary", what);
+
+		b = gen(nd);
+		if (strcmp(a, b))
+			errx(1, "%s: loaded document differs", what);
+		free(b);
+
+		xmlsd_walk_init(&xw, xmlsd_doc_get_root(xd), XMLSD_WALK_PRE);
+		xmlsd_walk_init(&nw, xmlsd_doc_get_root(nd), XMLSD_WALK_PRE);
+		while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+			if ((ne = xmlsd_walk_next(&nw)) == NULL ||
+			    xmlsd_elem_get_depth(ne) !=
+			    xmlsd_elem_get_depth(xe) -
+			    xmlsd_elem_get_depth(xmlsd_doc_get_root(xd)))
+				errx(1, "%s: depth differs", what);
+		}
+
+		/* loading again after a clear reuses the memory */
+		xmlsd_doc_clear(nd);
+		if (xmlsd_doc_load_binary(nd, snap, sz) != XMLSD_ERR_SUCCES ||
+		    (!xmlsd_doc_is_empty(nd) &&
+		    xmlsd_doc_load_binary(nd, snap, sz) != XMLSD_ERR_INTEGRITY))
+			errx(1, "%s: second load", what);
+		xmlsd_doc_free(nd);
+	}
+
+	free(a);
+	free(snap);
+}
+
+/* typed values keep their type, binary values become text */
+static void
+typed(void)
+{
+	struct xmlsd_document	*xd, *nd;
+	struct xmlsd_element	*root, *xe;
+	const char		*errstr;
+	char			*snap;
+	size_t			 sz;
+	uint8_t			 bin[] = { 0, 1, 2, 0xfe, 0xff }, out[16];
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+	    (root = xmlsd_doc_add_elem(xd, NULL, "root")) == NULL ||
+	    (xe = xmlsd_doc_add_elem(xd, root, "n")) == NULL ||
+	    xmlsd_elem_set_value_int64(xe, -1234567890123LL) ||
+	    xmlsd_elem_set_attr_x64(xe, "x", 0xdeadbeefULL) ||
+	    xmlsd_elem_set_attr_uint64(xe, "u", 18446744073709551615ULL) ||
+	    (xe = xmlsd_doc_add_elem(xd, root, "b")) == NULL ||
+	    xmlsd_elem_set_value_b64(xe, bin, sizeof bin) ||
+	    (xe = xmlsd_doc_add_elem(xd, root, "empty")) == NULL)
+		errx(1, "building typed document");
+	roundtrip("typed", xd);
+
+	if ((snap = xmlsd_doc_save_binary(xd, malloc, &sz)) == NULL ||
+	    xmlsd_doc_alloc(&nd) != XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_load_binary(nd, snap, sz) != XMLSD_ERR_SUCCES)
+		errx(1, "typed load");
+	root = xmlsd_doc_get_root(nd);
+	xe = xmlsd_elem_find_child(root, "n");
+	if (xmlsd_elem_get_value_strtonum(xe, LLONG_MIN, LLONG_MAX,
+	    &errstr) != -1234567890123LL || errstr != NULL ||
+	    xmlsd_elem_get_attr_hexnum(xe, "x", 0, ULLONG_MAX, &errstr) !=
+	    0xdeadbeefULL || errstr != NULL ||
+	    strcmp(xmlsd_elem_get_attr(xe, "u"), "18446744073709551615"))
+		errx(1, "typed values differ");
+	xe = xmlsd_elem_find_child(root, "b");
+	sz = sizeof out;
+	if (xmlsd_elem_get_value_b64(xe, out, &sz) != XMLSD_ERR_SUCCES ||
+	    sz != sizeof bin || memcmp(out, bin, sz))
+		errx(1, "binary value differs");
+	if (xmlsd_elem_get_value(xmlsd_elem_find_child(root, "empty")) !=
+	    NULL)
+		errx(1, "empty element has a value");
+
+	free(snap);
+	xmlsd_doc_free(nd);
+	xmlsd_doc_free(xd);
+}
+
+/* damaged snapshots are refused or at least load into something sane */
+static void
+damaged(void)
+{
+	struct xmlsd_document	*xd, *nd;
+	struct xmlsd_walk	 xw;
+	char			*snap, *copy;
+	size_t			 sz, i;
+	int			 rv, v;
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+	    xmlsd_parse_mem(doc, strlen(doc), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	if ((snap = xmlsd_doc_save_binary(xd, malloc, &sz)) == NULL)
+		errx(1, "xmlsd_doc_save_binary");
+	if (xmlsd_doc_alloc_flags(&nd, XMLSD_DOC_F_BORROW) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+
+	/* every truncation, copied so that reading past the end is caught */
+	for (i = 0; i < sz; i++) {
+		if ((copy = malloc(i + 1)) == NULL)
+			err(1, "malloc");
+		memcpy(copy, snap, i);
+		if (xmlsd_doc_load_binary(nd, copy, i) != XMLSD_ERR_PARSER)
+			errx(1, "truncated to %zu bytes accepted", i);
+		xmlsd_doc_clear(nd);
+		free(copy);
+	}
+
+	/* every byte set to a few values */
+	if ((copy = malloc(sz)) == NULL)
+		err(1, "malloc");
+	for (i = 0; i < sz; i++) {
+		for (v = 0; v < 256; v += 85) {
+			memcpy(copy, snap, sz);
+			copy[i] = v;
+			rv = xmlsd_doc_load_binary(nd, copy, sz);
+			if (rv == XMLSD_ERR_SUCCES) {
+				free(gen(nd));
+				xmlsd_walk_init(&xw, xmlsd_doc_get_root(nd),
+				    XMLSD_WALK_PRE);
+				while (xmlsd_walk_next(&xw) != NULL)
+					;
+			} else if (rv != XMLSD_ERR_PARSER)
+				errx(1, "byte %zu: %d", i, rv);
+			xmlsd_doc_clear(nd);
+		}
+	}
+	free(copy);
+
+	if (xmlsd_doc_load_binary(nd, doc, strlen(doc)) != XMLSD_ERR_PARSER)
+		errx(1, "xml accepted as a snapshot");
+
+	free(snap);
+	xmlsd_doc_free(nd);
+	xmlsd_doc_free(xd);
+}
+
+/* a snapshot in a file is used straight from a read only mapping */
+static void
+mapped(struct xmlsd_document *xd)
+{
+	struct xmlsd_document	*nd;
+	char			 path[] = "/tmp/xmlsd.XXXXXXXXXX";
+	char			*snap, *a, *b;
+	void			*m;
+	size_t			 sz;
+	int			 fd;
+
+	if ((snap = xmlsd_doc_save_binary(xd, malloc, &sz)) == NULL)
+		errx(1, "xmlsd_doc_save_binary");
+	if ((fd = mkstemp(path)) == -1)
+		err(1, "mkstemp");
+	unlink(path);
+	if (write(fd, snap, sz) != sz)
+		err(1, "write");
+	free(snap);
+	if ((m = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		err(1, "mmap");
+	close(fd);
+
+	if (xmlsd_doc_alloc_flags(&nd, XMLSD_DOC_F_BORROW) !=
+	    XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_load_binary(nd, m, sz) != XMLSD_ERR_SUCCES)
+		errx(1, "mapped load");
+	a = gen(xd);
+	b = gen(nd);
+	if (strcmp(a, b))
+		errx(1, "mapped document differs");
+	free(a);
+	free(b);
+	xmlsd_doc_free(nd);
+	munmap(m, sz);
+}
+
+static char *
+readfile(const char *name, size_t *sz)
+{
+	struct stat		 sb;
+	char			*b;
+	int			 f;
+
+	if ((f = open(name, O_RDONLY, 0)) == -1)
+		err(1, "%s", name);
+	if (fstat(f, &sb) == -1)
+		err(1, "stat");
+	if (sb.st_size > XMLSD_MEM_MAXSIZE)
+		errx(1, "%s: file too big", name);
+	if ((b = malloc(sb.st_size)) == NULL)
+		err(1, "malloc");
+	if (read(f, b, sb.st_size) != sb.st_size)
+		err(1, "read");
+	close(f);
+	*sz = sb.st_size;
+
+	return (b);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd;
+	char			*b;
+	size_t			 sz;
+	int			 i;
+
+	/* empty documents have a snapshot too */
+	if (xmlsd_doc_alloc_flags(&xd, XMLSD_DOC_F_BORROW) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+	roundtrip("empty", xd);
+
+	if (xmlsd_parse_mem(doc, strlen(doc), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	roundtrip("borrowed", xd);
+	mapped(xd);
+	xmlsd_doc_free(xd);
+
+	typed();
+	damaged();
+
+	for (i = 1; i < argc; i++) {
+		b = readfile(argv[i], &sz);
+		if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc");
+		if (xmlsd_parse_mem(b, sz, xd) != XMLSD_ERR_SUCCES)
+			errx(1, "%s: xmlsd_parse_mem", argv[i]);
+		roundtrip(argv[i], xd);
+		mapped(xd);
+		xmlsd_doc_free(xd);
+		free(b);
+	}
+
+	return (0);
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <err.h>
+#include <string.h>
+
+const char *doc =
+    "<root a=\"this attribute value is long enough\" b=\"x\""
+    " c=\"fish &amp; chips and some more text\""
+    " d = 'another long single quoted value here'>\n"
+    "  <plain>this element value is long enough to borrow</plain>\n"
+    "  <ent>an entity &lt; in a long element value here</ent>\n"
+    "  <multi>first line of a value\nsecond line of the same value</multi>\n"
+    "  <short>short</short>\n"
+    "  <num>  000000000000000000000012345  </num>\n"
+    "  <b64>Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy</b64>\n"
+    "  <tab b=\"tabs\tare\tturned\tinto\tspaces\"/>\n"
+    "</root>\n";
+
+/* element or attribute, whether its value must still be in the input */
+struct check {
+	const char		*elem, *attr;
+	int			 borrowed;
+} checks[] = {
+	{ NULL,		"a",	1 },
+	{ NULL,		"b",	0 },
+	{ NULL,		"c",	0 },
+	{ NULL,		"d",	1 },
+	{ "plain",	NULL,	1 },
+	{ "ent",	NULL,	0 },
+	{ "multi",	NULL,	0 },
+	{ "short",	NULL,	0 },
+	{ "num",	NULL,	1 },
+	{ "b64",	NULL,	1 },
+	{ "tab",	"b",	0 },
+	{ NULL,		NULL,	0 }
+};
+
+static const char *
+span(struct xmlsd_document *xd, struct check *c, size_t *len)
+{
+	struct xmlsd_element	*xe = xmlsd_doc_get_root(xd);
+
+	if (c->elem != NULL)
+		xe = xmlsd_elem_find_child(xe, c->elem);
+	if (xe == NULL)
+		errx(1, "no element %s", c->elem);
+	if (c->attr == NULL)
+		return (xmlsd_elem_get_value_span(xe, len));
+	return (xmlsd_attr_get_value_span(xmlsd_elem_find_attr(xe, c->attr),
+	    len));
+}
+
+static int
+count(struct xmlsd_element *xe, void *arg)
+{
+	(*(int *)arg)++;
+	return (0);
+}
+
+/* every value of `xd' must be the same as in `ref' */
+static void
+compare(struct xmlsd_document *xd, struct xmlsd_document *ref,
+    const char *buf, size_t sz, int frozen)
+{
+	struct check		*c;
+	const char		*s, *r;
+	size_t			 len, rlen;
+	int			 in;
+
+	for (c = checks; c->elem != NULL || c->attr != NULL; c++) {
+		s = span(xd, c, &len);
+		r = span(ref, c, &rlen);
+		if (s == NULL || r == NULL || len != rlen || memcmp(s, r, len))
+			errx(1, "%s@%s: value differs", c->elem, c->attr);
+		in = s >= buf && s < buf + sz;
+		if (in != (c->borrowed && !frozen))
+			errx(1, "%s@%s: %sborrowed", c->elem, c->attr,
+			    in ? "" : "not ");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd, *ref;
+	struct xmlsd_element	*root, *xe;
+	struct xmlsd_query	*q;
+	const char		*errstr, *s;
+	char			*buf, *gen, *rgen;
+	unsigned char		 bin[64];
+	size_t			 sz, len, gsz, rgsz;
+	int			 flags, n;
+
+	sz = strlen(doc);
+	if ((buf = malloc(sz)) == NULL)
+		err(1, "malloc");
+	memcpy(buf, doc, sz);	/* not terminated, neither are the spans */
+
+	if (xmlsd_doc_alloc(&ref) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem(doc, sz, ref) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+
+	for (flags = XMLSD_DOC_F_BORROW;
+	    flags <= (XMLSD_DOC_F_BORROW | XMLSD_DOC_F_RECYCLE);
+	    flags += XMLSD_DOC_F_RECYCLE) {
+		if (xmlsd_doc_alloc_flags(&xd, flags) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc_flags");
+		if (xmlsd_parse_mem(buf, sz, xd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_parse_mem borrow");
+		compare(xd, ref, buf, sz, 0);
+		root = xmlsd_doc_get_root(xd);
+
+		/* numbers and binary data decode straight from the input */
+		xe = xmlsd_elem_find_child(root, "num");
+		if (xmlsd_elem_get_value_strtonum(xe, 0, 100000, &errstr) !=
+		    12345 || errstr != NULL)
+			errx(1, "strtonum");
+		len = sizeof bin;
+		xe = xmlsd_elem_find_child(root, "b64");
+		if (xmlsd_elem_get_value_b64(xe, bin, &len) !=
+		    XMLSD_ERR_SUCCES || len != 24 ||
+		    memcmp(bin, "foobarfoobarfoobarfoobar", len))
+			errx(1, "b64");
+
+		/* so do queries */
+		if (xmlsd_query_compile(
+		    "/root[@a='this attribute value is long enough']", &q) != 0)
+			errx(1, "xmlsd_query_compile");
+		n = 0;
+		if (xmlsd_query_exec(q, xd, count, &n) != 0 || n != 1)
+			errx(1, "xmlsd_query_exec");
+		xmlsd_query_free(q);
+
+		/* and so does the generator */
+		if ((gen = xmlsd_generate(xd, malloc, &gsz, 0)) == NULL ||
+		    (rgen = xmlsd_generate(ref, malloc, &rgsz, 0)) == NULL)
+			errx(1, "xmlsd_generate");
+		if (gsz != rgsz || strcmp(gen, rgen))
+			errx(1, "generated documents differ");
+		free(gen);
+		free(rgen);
+
+		/* asking for a string copies it out of the input */
+		xe = xmlsd_elem_find_child(root, "plain");
+		if ((s = xmlsd_elem_get_value(xe)) == NULL ||
+		    strcmp(s, "this element value is long enough to borrow"))
+			errx(1, "xmlsd_elem_get_value");
+		if (s >= buf && s < buf + sz)
+			errx(1, "xmlsd_elem_get_value borrowed");
+		checks[4].borrowed = 0;
+		compare(xd, ref, buf, sz, 0);
+		checks[4].borrowed = 1;
+
+		/* a frozen copy no longer needs the input */
+		if (xmlsd_doc_freeze(xd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_freeze");
+		memset(buf, 'x', sz);
+		compare(xd, ref, buf, sz, 1);
+		memcpy(buf, doc, sz);
+
+		xmlsd_doc_free(xd);
+	}
+
+	xmlsd_doc_free(ref);
+	free(buf);
+
+	return (0);
+}
@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <string.h>
+
+#define MSGS			(1000)
+#define MSG_MAX			(256)
+#define THREADS			(4)
+#define THREAD_LOOPS		(2000)
+#define THREAD_MSGS		(50)
+
+struct xmlsd_v_attr	version_attr[] = {
+	{ "version", XMLSD_V_ATTR_F_REQUIRED },
+	{ NULL }
+};
+
+struct xmlsd_v_elem	vauth[] = {
+	{ "auth", "", version_attr },
+	{ "session_key", "session_key.auth", NULL, 1, 1 },
+	{ "trans_token", "trans_token.auth", NULL, 1, 1 },
+	{ NULL, NULL, NULL },
+};
+
+/* knows nothing of the address, preauth.xml does not validate */
+struct xmlsd_v_elem	vpreauth[] = {
+	{ "preauth", "", version_attr },
+	{ "session_key", "session_key.preauth", NULL, 1, 1 },
+	{ NULL, NULL, NULL },
+};
+
+struct xmlsd_v_elements	commands[] = {
+	{ "auth", vauth },
+	{ "preauth", vpreauth },
+	{ NULL, NULL },
+};
+
+struct file {
+	char			*buf;
+	size_t			 sz;
+	char			*xml;	/* as generated from a plain parse */
+	struct xmlsd_validate_failure xvf;
+};
+
+struct worker {
+	struct xmlsd_cache	*xc;
+	char			**msgs;
+	char			**xml;
+	int			 seed;
+};
+
+static char *
+gen(struct xmlsd_document *xd)
+{
+	char			*s;
+	size_t			 sz;
+
+	if ((s = xmlsd_generate(xd, malloc, &sz, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	return (s);
+}
+
+static void
+load(struct file *f, const char *name)
+{
+	struct xmlsd_document	*xd;
+	struct stat		 st;
+	int			 fd;
+
+	if ((fd = open(name, O_RDONLY, 0)) == -1)
+		err(1, "open %s", name);
+	if (fstat(fd, &st) == -1)
+		err(1, "fstat");
+	f->sz = st.st_size;
+	if ((f->buf = malloc(f->sz)) == NULL)
+		err(1, "malloc");
+	if (read(fd, f->buf, f->sz) != f->sz)
+		err(1, "read %s", name);
+	close(fd);
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+	    xmlsd_parse_mem(f->buf, f->sz, xd) != XMLSD_ERR_SUCCES)
+		errx(1, "%s: xmlsd_parse_mem", name);
+	f->xml = gen(xd);
+	xmlsd_validate_info(xd, commands, &f->xvf);
+	f->xvf.xvf_elem = NULL;	/* in a document about to go */
+	f->xvf.xvf_attr = NULL;
+	xmlsd_doc_free(xd);
+}
+
+static void
+stats(struct xmlsd_cache *xc, const char *what, uint64_t hits,
+    uint64_t misses, uint64_t evictions, size_t entries)
+{
+	struct xmlsd_cache_stats xcs;
+
+	xmlsd_cache_get_stats(xc, &xcs);
+	if (xcs.xcs_hits != hits || xcs.xcs_misses != misses ||
+	    xcs.xcs_evictions != evictions || xcs.xcs_entries != entries)
+		errx(1, "%s: %llu hits %llu misses %llu evictions %zu entries",
+		    what, (unsigned long long)xcs.xcs_hits,
+		    (unsigned long long)xcs.xcs_misses,
+		    (unsigned long long)xcs.xcs_evictions, xcs.xcs_entries);
+	if ((entries == 0) != (xcs.xcs_bytes == 0))
+		errx(1, "%s: %zu bytes", what, xcs.xcs_bytes);
+}
+
+/* parse `f' through `xc' and check it against a plain parse */
+static struct xmlsd_document *
+get(struct xmlsd_cache *xc, struct file *f, const char *b)
+{
+	struct xmlsd_validate_failure xvf;
+	struct xmlsd_document	*xd;
+	char			*s;
+
+	memset(&xvf, 0xff, sizeof xvf);
+	if (xmlsd_cache_parse(xc, b, f->sz, &xd, &xvf) != XMLSD_ERR_SUCCES ||
+	    xd == NULL)
+		errx(1, "xmlsd_cache_parse");
+	if (strcmp(s = gen(xd), f->xml))
+		errx(1, "cached document differs");
+	free(s);
+	if (xvf.xvf_reason != f->xvf.xvf_reason ||
+	    xvf.xvf_velem != f->xvf.xvf_velem)
+		errx(1, "verdict %d, expected %d", xvf.xvf_reason,
+		    f->xvf.xvf_reason);
+	if (xvf.xvf_reason != XMLSD_VALIDATE_NO_ERROR &&
+	    (xvf.xvf_elem == NULL ||
+	    strcmp(xmlsd_elem_get_name(xvf.xvf_elem), "lastname")))
+		errx(1, "verdict not about the document");
+
+	return (xd);
+}
+
+static void
+messages(char **msgs, char **xml, int n, int seed)
+{
+	struct xmlsd_document	*xd;
+	int			 i;
+
+	for (i = 0; i < n; i++) {
+		if ((msgs[i] = malloc(MSG_MAX)) == NULL)
+			err(1, "malloc");
+		snprintf(msgs[i], MSG_MAX, "<status id='%d'><uptime>%d"
+		    "</uptime><load>0.%d</load></status>", i + seed, i * 17,
+		    i);
+		if (xml == NULL)
+			continue;
+		if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+		    xmlsd_parse_mem(msgs[i], strlen(msgs[i]), xd) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_parse_mem");
+		xml[i] = gen(xd);
+		xmlsd_doc_free(xd);
+	}
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker		*w = arg;
+	struct xmlsd_document	*xd;
+	char			*s;
+	int			 i, m;
+
+	for (i = 0; i < THREAD_LOOPS; i++) {
+		m = (i * 7 + w->seed) % THREAD_MSGS;
+		if (i % 5 == 0)
+			m = w->seed % 3;	/* a few hot ones */
+		if (xmlsd_cache_parse(w->xc, w->msgs[m], strlen(w->msgs[m]),
+		    &xd, NULL) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_cache_parse");
+		if (strcmp(s = gen(xd), w->xml[m]))
+			errx(1, "thread got the wrong document");
+		free(s);
+		xmlsd_cache_release(w->xc, xd);
+	}
+
+	return (NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd, *xd2, *auth, *preauth, *docs[MSGS];
+	struct xmlsd_validate_failure xvf;
+	struct xmlsd_cache_stats xcs;
+	struct xmlsd_cache	*xc;
+	struct worker		 w[THREADS];
+	struct file		 f[2];
+	pthread_t		 t[THREADS];
+	char			*msgs[MSGS], *xml[THREAD_MSGS], *copy, *p;
+	size_t			 one;
+	int			 i, flags;
+
+	if (argc != 3)
+		errx(1, "usage: cache auth.xml preauth.xml");
+	load(&f[0], argv[1]);
+	load(&f[1], argv[2]);
+	if (f[0].xvf.xvf_reason != XMLSD_VALIDATE_NO_ERROR ||
+	    f[1].xvf.xvf_reason != XMLSD_VALIDATE_UNRECOGNISED_ELEMENT)
+		errx(1, "unexpected validation of the examples");
+
+	for (flags = 0; flags <= XMLSD_PARSE_NATIVE; flags++) {
+		if (xmlsd_cache_alloc(&xc, 1024 * 1024, commands, flags) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_cache_alloc");
+
+		/* the same bytes give the same document, wherever they are */
+		auth = get(xc, &f[0], f[0].buf);
+		preauth = get(xc, &f[1], f[1].buf);
+		stats(xc, "first", 0, 2, 0, 2);
+		if ((copy = malloc(f[0].sz)) == NULL)
+			err(1, "malloc");
+		memcpy(copy, f[0].buf, f[0].sz);
+		if ((xd = get(xc, &f[0], copy)) != auth ||
+		    (xd2 = get(xc, &f[1], f[1].buf)) != preauth)
+			errx(1, "not shared");
+		stats(xc, "again", 2, 2, 0, 2);
+		xmlsd_cache_release(xc, xd);
+		xmlsd_cache_release(xc, xd2);
+
+		/* any other byte is another document */
+		for (p = copy + f[0].sz - 1; p > copy && *p != '1'; p--)
+			;
+		*p = '9';	/* in the last number */
+		if (xmlsd_cache_parse(xc, copy, f[0].sz, &xd, NULL) !=
+		    XMLSD_ERR_SUCCES || xd == auth)
+			errx(1, "changed input hit");
+		xmlsd_cache_release(xc, xd);
+		*p = '<';
+		if (xmlsd_cache_parse(xc, copy, f[0].sz, &xd, NULL) !=
+		    XMLSD_ERR_PARSER || xd != NULL)
+			errx(1, "broken input parsed");
+		stats(xc, "changed", 2, 4, 0, 3);
+		free(copy);
+		xmlsd_cache_release(xc, auth);
+		xmlsd_cache_release(xc, preauth);
+		xmlsd_cache_free(xc);
+
+		/* without validation the verdict is always good */
+		if (xmlsd_cache_alloc(&xc, 1024 * 1024, NULL, flags) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_cache_alloc");
+		for (i = 0; i < 2; i++) {
+			memset(&xvf, 0xff, sizeof xvf);
+			if (xmlsd_cache_parse(xc, f[1].buf, f[1].sz, &xd,
+			    &xvf) != XMLSD_ERR_SUCCES ||
+			    xvf.xvf_reason != XMLSD_VALIDATE_NO_ERROR)
+				errx(1, "verdict without validation");
+			xmlsd_cache_release(xc, xd);
+		}
+		stats(xc, "no validation", 1, 1, 0, 1);
+		xmlsd_cache_free(xc);
+	}
+
+	/* one entry's worth: the new one pushes out the old one */
+	if (xmlsd_cache_alloc(&xc, 1024 * 1024, commands, 0) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc");
+	xmlsd_cache_release(xc, get(xc, &f[1], f[1].buf));
+	xmlsd_cache_get_stats(xc, &xcs);
+	one = xcs.xcs_bytes;
+	xmlsd_cache_free(xc);
+
+	if (xmlsd_cache_alloc(&xc, one, commands, 0) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc");
+	auth = get(xc, &f[0], f[0].buf);
+	preauth = get(xc, &f[1], f[1].buf);
+	stats(xc, "evict", 0, 2, 1, 1);
+	free(gen(auth));	/* still in use, still there */
+	xd = get(xc, &f[0], f[0].buf);
+	if (xd == auth)
+		errx(1, "evicted document found");
+	stats(xc, "evict again", 0, 3, 2, 1);
+	xmlsd_cache_release(xc, auth);
+	xmlsd_cache_release(xc, preauth);
+	xmlsd_cache_release(xc, xd);
+	xmlsd_cache_get_stats(xc, &xcs);
+	if (xcs.xcs_bytes > one)
+		errx(1, "over the bound");
+	xmlsd_cache_free(xc);
+
+	/* nothing fits, every caller gets a document of its own */
+	if (xmlsd_cache_alloc(&xc, 0, NULL, 0) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc");
+	xd = get(xc, &f[0], f[0].buf);
+	xd2 = get(xc, &f[0], f[0].buf);
+	if (xd == xd2)
+		errx(1, "document shared without a cache");
+	stats(xc, "no room", 0, 2, 0, 0);
+	xmlsd_cache_release(xc, xd);
+	xmlsd_cache_release(xc, xd2);
+	xmlsd_cache_free(xc);
+
+	/* many entries */
+	if (xmlsd_cache_alloc(&xc, 64 * 1024 * 1024, NULL,
+	    XMLSD_PARSE_NATIVE) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc");
+	messages(msgs, NULL, MSGS, 0);
+	for (i = 0; i < MSGS * 2; i++) {
+		if (xmlsd_cache_parse(xc, msgs[i % MSGS],
+		    strlen(msgs[i % MSGS]), &xd, NULL) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_cache_parse");
+		if (i < MSGS)
+			docs[i] = xd;
+		else if (docs[i - MSGS] != xd)
+			errx(1, "message %d not found", i - MSGS);
+		xmlsd_cache_release(xc, xd);
+	}
+	stats(xc, "many", MSGS, MSGS, 0, MSGS);
+	xmlsd_cache_free(xc);
+	for (i = 0; i < MSGS; i++)
+		free(msgs[i]);
+
+	/* threads sharing a cache that holds about half the messages */
+	messages(msgs, xml, THREAD_MSGS, 0);
+	if (xmlsd_cache_alloc(&xc, 1024 * 1024, NULL, 0) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc");
+	xmlsd_cache_release(xc, get(xc, &f[0], f[0].buf));
+	xmlsd_cache_get_stats(xc, &xcs);
+	xmlsd_cache_free(xc);
+	if (xmlsd_cache_alloc(&xc, xcs.xcs_bytes * THREAD_MSGS / 2, NULL, 0) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc");
+	for (i = 0; i < THREADS; i++) {
+		w[i].xc = xc;
+		w[i].msgs = msgs;
+		w[i].xml = xml;
+		w[i].seed = i * 11;
+		if (pthread_create(&t[i], NULL, worker_main, &w[i]))
+			errx(1, "pthread_create");
+	}
+	for (i = 0; i < THREADS; i++)
+		if (pthread_join(t[i], NULL))
+			errx(1, "pthread_join");
+	xmlsd_cache_get_stats(xc, &xcs);
+	if (xcs.xcs_hits + xcs.xcs_misses != THREADS * THREAD_LOOPS ||
+	    xcs.xcs_hits == 0 || xcs.xcs_evictions == 0)
+		errx(1, "threads: %llu hits %llu misses %llu evictions",
+		    (unsigned long long)xcs.xcs_hits,
+		    (unsigned long long)xcs.xcs_misses,
+		    (unsigned long long)xcs.xcs_evictions);
+	xmlsd_cache_free(xc);
+	for (i = 0; i < THREAD_MSGS; i++) {
+		free(msgs[i]);
+		free(xml[i]);
+	}
+
+	/* arguments */
+	if (xmlsd_cache_alloc(NULL, 0, NULL, 0) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_cache_alloc(&xc, 0, NULL, 0x100) != XMLSD_ERR_INTEGRITY)
+		errx(1, "bad arguments accepted");
+	if (xmlsd_cache_alloc(&xc, 0, NULL, 0) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_cache_alloc");
+	if (xmlsd_cache_parse(NULL, "<a/>", 4, &xd, NULL) !=
+	    XMLSD_ERR_INTEGRITY ||
+	    xmlsd_cache_parse(xc, NULL, 4, &xd, NULL) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_cache_parse(xc, "<a/>", 0, &xd, NULL) !=
+	    XMLSD_ERR_INTEGRITY ||
+	    xmlsd_cache_parse(xc, "<a/>", 4, NULL, NULL) !=
+	    XMLSD_ERR_INTEGRITY)
+		errx(1, "bad arguments accepted");
+	xmlsd_cache_free(xc);
+	xmlsd_cache_release(NULL, NULL);
+	xmlsd_cache_get_stats(NULL, &xcs);
+	xmlsd_cache_free(NULL);
+
+	for (i = 0; i < 2; i++) {
+		free(f[i].buf);
+		free(f[i].xml);
+	}
+
+	return (0);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <err.h>
+#include <string.h>
+
+#define NCHILDREN	(20000)
+#define NNAMES		(37)
+
+/* compare the index against a plain walk of the children */
+static void
+check(struct xmlsd_element *xe)
+{
+	struct xmlsd_element		*xc, *xn;
+	char				 name[16];
+	size_t				 n;
+	int				 i;
+
+	for (i = 0; i <= NNAMES; i++) {
+		snprintf(name, sizeof name, "name%d", i);
+		n = 0;
+		xn = xmlsd_elem_find_child(xe, name);
+		XMLSD_ELEM_FOREACH_CHILDREN(xc, xe) {
+			if (strcmp(xmlsd_elem_get_name(xc), name))
+				continue;
+			if (xc != xn)
+				errx(1, "%s: %zu out of order", name, n);
+			xn = xmlsd_elem_find_child_next(xe, xn);
+			n++;
+		}
+		if (xn != NULL)
+			errx(1, "%s: too many", name);
+		if (xmlsd_elem_count_children(xe, name) != n)
+			errx(1, "%s: count %zu, want %zu", name,
+			    xmlsd_elem_count_children(xe, name), n);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document		*xd;
+	struct xmlsd_element		*root, *xc, *xn;
+	char				*s, name[16];
+	int				 i;
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if ((root = xmlsd_doc_add_elem(xd, NULL, "wide")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+
+	/* grow past the index threshold with a lookup after every add */
+	for (i = 0; i < NCHILDREN; i++) {
+		snprintf(name, sizeof name, "name%d", (i * 7) % NNAMES);
+		if (xmlsd_doc_add_elem(xd, root, name) == NULL)
+			errx(1, "xmlsd_doc_add_elem");
+		if (i < 64)
+			check(root);
+	}
+	check(root);
+
+	/* removal drops the index, it must come back correct */
+	for (i = 0, xc = xmlsd_elem_get_first_child(root); xc != NULL; i++) {
+		xn = xmlsd_elem_get_next_child(root, xc);
+		if (i % 3 == 0)
+			xmlsd_doc_remove_elem(xd, xc);
+		xc = xn;
+	}
+	check(root);
+	if (xmlsd_doc_add_elem(xd, root, "name0") == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	check(root);
+
+	/* and the same for parsed and frozen documents */
+	if ((s = xmlsd_generate(xd, malloc, NULL, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	xmlsd_doc_clear(xd);
+	if (xmlsd_parse_mem(s, strlen(s), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	free(s);
+	check(xmlsd_doc_get_root(xd));
+	if (xmlsd_doc_freeze(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_freeze");
+	check(xmlsd_doc_get_root(xd));
+
+	xmlsd_doc_free(xd);
+
+	printf("childindex: PASS\n");
+
+	return (0);
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <string.h>
+
+#define CHILDREN		(20)	/* enough for a child index */
+
+static int
+same_str(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a == b);
+	return (!strcmp(a, b));
+}
+
+/* `a' and `b' have the same names, values, attributes and children */
+static void
+same(struct xmlsd_element *a, struct xmlsd_element *b, int depth)
+{
+	struct xmlsd_attribute	*aa, *ba;
+	struct xmlsd_element	*ac, *bc;
+
+	if (!same_str(xmlsd_elem_get_name(a), xmlsd_elem_get_name(b)) ||
+	    !same_str(xmlsd_elem_get_value(a), xmlsd_elem_get_value(b)))
+		errx(1, "%s differs", xmlsd_elem_get_name(a));
+	if (xmlsd_elem_get_depth(b) != depth)
+		errx(1, "%s at depth %d, not %d", xmlsd_elem_get_name(b),
+		    xmlsd_elem_get_depth(b), depth);
+
+	for (aa = xmlsd_elem_get_first_attr(a),
+	    ba = xmlsd_elem_get_first_attr(b); aa != NULL && ba != NULL;
+	    aa = xmlsd_elem_get_next_attr(a, aa),
+	    ba = xmlsd_elem_get_next_attr(b, ba))
+		if (strcmp(xmlsd_attr_get_name(aa), xmlsd_attr_get_name(ba)) ||
+		    strcmp(xmlsd_attr_get_value(aa),
+		    xmlsd_attr_get_value(ba)))
+			errx(1, "attribute %s differs",
+			    xmlsd_attr_get_name(aa));
+	if (aa != NULL || ba != NULL)
+		errx(1, "%s has other attributes", xmlsd_elem_get_name(a));
+
+	for (ac = xmlsd_elem_get_first_child(a),
+	    bc = xmlsd_elem_get_first_child(b); ac != NULL && bc != NULL;
+	    ac = xmlsd_elem_get_next_child(a, ac),
+	    bc = xmlsd_elem_get_next_child(b, bc)) {
+		if (xmlsd_elem_get_parent(bc) != b)
+			errx(1, "%s has the wrong parent",
+			    xmlsd_elem_get_name(bc));
+		same(ac, bc, depth + 1);
+	}
+	if (ac != NULL || bc != NULL)
+		errx(1, "%s has other children", xmlsd_elem_get_name(a));
+}
+
+static char *
+gen(struct xmlsd_document *xd)
+{
+	char			*s;
+
+	if ((s = xmlsd_generate(xd, malloc, NULL, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	return (s);
+}
+
+/* a document with every kind of value */
+static void
+build(struct xmlsd_document *xd)
+{
+	struct xmlsd_element	*root, *xe;
+	int			 i;
+
+	if ((root = xmlsd_doc_add_elem(xd, NULL, "response")) == NULL ||
+	    xmlsd_elem_set_attr(root, "version", "1") ||
+	    xmlsd_elem_set_attr_uint64(root, "serial", 18446744073709551615ULL))
+		errx(1, "build root");
+	for (i = 0; i < CHILDREN; i++) {
+		if ((xe = xmlsd_doc_add_elem(xd, root,
+		    i % 2 ? "odd" : "even")) == NULL)
+			errx(1, "xmlsd_doc_add_elem");
+		switch (i % 4) {
+		case 0:
+			xmlsd_elem_set_value_int32(xe, -i);
+			break;
+		case 1:
+			xmlsd_elem_set_value_x64(xe, 0xfeedfacecafeULL + i);
+			break;
+		case 2:
+			xmlsd_elem_set_value_b64(xe, "\0binary\377", 8);
+			break;
+		case 3:
+			xmlsd_elem_set_value(xe, "a string value long enough "
+			    "not to fit inside the element");
+			break;
+		}
+		xmlsd_elem_set_attr_int64(xe, "n", i);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd, *copy, *dst;
+	struct xmlsd_element	*root, *xe, *nxe, *c;
+	struct stat		 st;
+	char			*b, *s, *t;
+	size_t			 n;
+	int			 fd, i, flags[] = { 0, XMLSD_DOC_F_RECYCLE,
+				    XMLSD_DOC_F_BORROW | XMLSD_DOC_F_FREEZE };
+
+	if (argc != 2)
+		errx(1, "usage: clone file.xml");
+	if ((fd = open(argv[1], O_RDONLY, 0)) == -1)
+		err(1, "open %s", argv[1]);
+	if (fstat(fd, &st) == -1)
+		err(1, "fstat");
+	if ((b = malloc(st.st_size)) == NULL)
+		err(1, "malloc");
+	if (read(fd, b, st.st_size) != st.st_size)
+		err(1, "read");
+	close(fd);
+
+	/* whole documents, the copy outlives the original */
+	for (i = 0; i < sizeof flags / sizeof flags[0]; i++) {
+		if (xmlsd_doc_alloc_flags(&xd, flags[i]) != XMLSD_ERR_SUCCES ||
+		    xmlsd_parse_mem(b, st.st_size, xd) != XMLSD_ERR_SUCCES)
+			errx(1, "parse %s", argv[1]);
+		if (xmlsd_doc_clone(&copy, xd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_clone");
+		same(xmlsd_doc_get_root(xd), xmlsd_doc_get_root(copy), 0);
+		s = gen(xd);
+		xmlsd_doc_free(xd);
+		memset(b, 'x', st.st_size);	/* no borrowing from it */
+		if (strcmp(s, t = gen(copy)))
+			errx(1, "copy generates something else");
+		free(t);
+
+		/* and may be changed without touching anything else */
+		xmlsd_doc_remove_elem(copy,
+		    xmlsd_elem_get_first_child(xmlsd_doc_get_root(copy)));
+		xmlsd_elem_set_attr(xmlsd_doc_get_root(copy), "extra", "1");
+		if (xmlsd_doc_add_elem(copy, xmlsd_doc_get_root(copy),
+		    "added") == NULL)
+			errx(1, "add to copy");
+		if (!strcmp(s, t = gen(copy)))
+			errx(1, "copy not changed");
+		free(t);
+		free(s);
+		xmlsd_doc_free(copy);
+
+		if ((fd = open(argv[1], O_RDONLY, 0)) == -1 ||
+		    read(fd, b, st.st_size) != st.st_size)
+			err(1, "read %s again", argv[1]);
+		close(fd);
+	}
+
+	/* empty documents */
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_clone(&copy, xd) != XMLSD_ERR_SUCCES ||
+	    !xmlsd_doc_is_empty(copy))
+		errx(1, "empty copy");
+	xmlsd_doc_free(copy);
+
+	/* subtrees of a built document into a response */
+	build(xd);
+	root = xmlsd_doc_get_root(xd);
+	if (xmlsd_doc_alloc(&dst) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if ((xe = xmlsd_elem_clone_into(dst, NULL, root)) == NULL ||
+	    xe != xmlsd_doc_get_root(dst))
+		errx(1, "clone root");
+	same(root, xe, 0);
+	if (xmlsd_elem_clone_into(dst, NULL, root) != NULL)
+		errx(1, "second root");
+	if (strcmp(s = gen(xd), t = gen(dst)))
+		errx(1, "generated copy differs");
+	free(s);
+	free(t);
+
+	/* a parent with a child index, finds see the new children */
+	if (xmlsd_elem_count_children(xe, "odd") != CHILDREN / 2)
+		errx(1, "count");
+	c = xmlsd_elem_get_first_child(root);
+	c = xmlsd_elem_get_next_child(root, c);
+	for (i = 0; i < 3; i++) {
+		if ((nxe = xmlsd_elem_clone_into(dst, xe, c)) == NULL ||
+		    xmlsd_elem_get_last_child(xe) != nxe)
+			errx(1, "clone child");
+		same(c, nxe, 1);
+	}
+	if (xmlsd_elem_count_children(xe, "odd") != CHILDREN / 2 + 3)
+		errx(1, "index not updated");
+	for (n = 0, c = xmlsd_elem_find_child(xe, "odd"); c != NULL;
+	    c = xmlsd_elem_find_child_next(xe, c))
+		n++;
+	if (n != CHILDREN / 2 + 3 ||
+	    xmlsd_doc_find_path(dst, "odd.response", &n) == NULL ||
+	    n != CHILDREN / 2 + 3)
+		errx(1, "new children not found");
+
+	/* into itself, below what is being copied */
+	if (xmlsd_doc_clone(&copy, dst) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_clone");
+	c = xmlsd_elem_get_last_child(xe);
+	if ((nxe = xmlsd_elem_clone_into(dst, c, xe)) == NULL ||
+	    xmlsd_elem_get_first_child(c) != nxe)
+		errx(1, "clone into itself");
+	same(xmlsd_doc_get_root(copy), nxe, 2);
+	xmlsd_doc_free(copy);
+	s = gen(dst);
+
+	if (xmlsd_doc_clone(NULL, xd) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_doc_clone(&copy, NULL) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_clone_into(NULL, NULL, root) != NULL ||
+	    xmlsd_elem_clone_into(dst, NULL, NULL) != NULL)
+		errx(1, "bad arguments accepted");
+
+	/* the parent must be in the tree of the document copied into */
+	c = xmlsd_elem_get_first_child(root);
+	if (xmlsd_elem_clone_into(dst, c, root) != NULL ||
+	    xmlsd_elem_detach(xd, c) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_clone_into(xd, c, root) != NULL ||
+	    xmlsd_elem_append(xd, root, c) != XMLSD_ERR_SUCCES)
+		errx(1, "copied under a parent of another tree");
+	if (strcmp(s, t = gen(dst)))
+		errx(1, "copied anyway");
+	free(t);
+	xmlsd_doc_free(xd);
+
+	/* the same again into a recycling document */
+	if (xmlsd_doc_alloc_flags(&xd, XMLSD_DOC_F_RECYCLE) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+	for (i = 0; i < 5; i++) {
+		xmlsd_doc_clear(xd);
+		if ((xe = xmlsd_elem_clone_into(xd, NULL,
+		    xmlsd_doc_get_root(dst))) == NULL)
+			errx(1, "clone into recycled");
+		same(xmlsd_doc_get_root(dst), xe, 0);
+		if (strcmp(s, t = gen(xd)))
+			errx(1, "recycled copy differs");
+		free(t);
+	}
+	free(s);
+	xmlsd_doc_free(dst);
+	xmlsd_doc_free(xd);
+
+	free(b);
+	return (0);
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <pthread.h>
+#include <err.h>
+#include <string.h>
+
+#define DEEP		(100000)	/* parse, walk, validate and free */
+#define DEEP_GEN	(2000)		/* output grows with depth squared */
+#define STACK_SIZE	(64 * 1024)
+#define VALID_DEEP	(500)		/* innermost path fits in 1024 bytes */
+
+struct xmlsd_v_attr		xa_none[] = {
+	{ NULL, 0 }
+};
+
+/* one entry per level, filled in by deep_list() */
+struct xmlsd_v_elem		xe_deep[VALID_DEEP + 1];
+
+struct xmlsd_v_elements		xel_deep[] = {
+	{ "a",	xe_deep },
+	{ NULL,	NULL }
+};
+
+/*
+ * Paths name the element first and the root last, so the path of every
+ * level is a tail of the one of the deepest.
+ */
+static void
+deep_list(void)
+{
+	static char			 path[2 * VALID_DEEP];
+	int				 i;
+
+	for (i = 0; i < 2 * VALID_DEEP - 1; i++)
+		path[i] = i % 2 ? '.' : 'a';
+	path[i] = '\0';
+
+	for (i = 0; i < VALID_DEEP; i++) {
+		xe_deep[i].element = "a";
+		xe_deep[i].path = i == 0 ? "" : &path[2 * (VALID_DEEP - i - 1)];
+		xe_deep[i].attr = xa_none;
+		/* all but the innermost have exactly one child */
+		xe_deep[i].min_occurs = xe_deep[i].max_occurs = i == 0 ? 0 : 1;
+	}
+}
+
+/* build `depth' nested elements, the innermost one has a value */
+static char *
+nested(int depth)
+{
+	char				*b, *p;
+	int				 i;
+
+	if ((b = malloc(depth * 7 + 2)) == NULL)
+		err(1, "malloc");
+	p = b;
+	for (i = 0; i < depth; i++) {
+		memcpy(p, "<a>", 3);
+		p += 3;
+	}
+	*p++ = 'x';
+	for (i = 0; i < depth; i++) {
+		memcpy(p, "</a>", 4);
+		p += 4;
+	}
+	*p = '\0';
+
+	return (b);
+}
+
+/* everything in here runs on a stack far smaller than the documents */
+void *
+thread_it(void *p)
+{
+	struct xmlsd_document		*xd;
+	struct xmlsd_element		*xe, *last;
+	struct xmlsd_walk		 xw;
+	struct xmlsd_validate_failure	 xvf;
+	size_t				 sz;
+	char				*b, *out;
+	int				 pre, post, depth, maxdepth;
+
+	if ((b = nested(DEEP)) == NULL)
+		errx(1, "nested");
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem(b, strlen(b), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	free(b);
+
+	pre = post = maxdepth = 0;
+	xmlsd_walk_init(&xw, xmlsd_doc_get_root(xd),
+	    XMLSD_WALK_PRE | XMLSD_WALK_POST);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		depth = xmlsd_elem_get_depth(xe);
+		if (xw.xw_post) {
+			if (depth != DEEP - ++post)
+				errx(1, "post order depth %d", depth);
+		} else {
+			if (depth != pre++)
+				errx(1, "pre order depth %d", depth);
+			if (depth > maxdepth)
+				maxdepth = depth;
+		}
+	}
+	if (pre != DEEP || post != DEEP || maxdepth != DEEP - 1)
+		errx(1, "walk: pre %d post %d depth %d", pre, post, maxdepth);
+
+	/* levels past the list are refused, that must not take us down */
+	if (xmlsd_validate_info(xd, xel_deep, &xvf) !=
+	    XMLSD_VALIDATE_UNRECOGNISED_ELEMENT ||
+	    xmlsd_elem_get_depth(xvf.xvf_elem) != VALID_DEEP)
+		errx(1, "xmlsd_validate of %d levels: %d", DEEP,
+		    xvf.xvf_reason);
+
+	xmlsd_doc_free(xd);
+
+	/* as deep as the list goes, which must pass */
+	if ((b = nested(VALID_DEEP)) == NULL)
+		errx(1, "nested");
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem(b, strlen(b), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	free(b);
+	if (xmlsd_validate_info(xd, xel_deep, &xvf) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_validate of %d levels: %d", VALID_DEEP,
+		    xvf.xvf_reason);
+	xmlsd_doc_free(xd);
+
+	/* generate a smaller one and make sure it round trips */
+	if ((b = nested(DEEP_GEN)) == NULL)
+		errx(1, "nested");
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem(b, strlen(b), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	free(b);
+	if ((out = xmlsd_generate(xd, malloc, &sz, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	xmlsd_doc_clear(xd);
+	if (xmlsd_parse_mem(out, strlen(out), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem generated");
+	free(out);
+
+	pre = 0;
+	last = NULL;
+	xmlsd_walk_init(&xw, xmlsd_doc_get_root(xd), XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		if ((depth = xmlsd_elem_get_depth(xe)) != pre++)
+			errx(1, "generated depth %d", depth);
+		last = xe;
+	}
+	if (pre != DEEP_GEN || last == NULL ||
+	    xmlsd_elem_get_value(last) == NULL ||
+	    strcmp(xmlsd_elem_get_value(last), "x"))
+		errx(1, "generated walk: %d", pre);
+
+	/* removing the top of the tree must not recurse either */
+	xmlsd_doc_remove_elem(xd, xmlsd_doc_get_root(xd));
+	if (!xmlsd_doc_is_empty(xd))
+		errx(1, "xmlsd_doc_remove_elem");
+	xmlsd_doc_free(xd);
+
+	return (NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pthread_attr_t			attr;
+	pthread_t			thread;
+
+	deep_list();
+	if (pthread_attr_init(&attr))
+		errx(1, "pthread_attr_init");
+	if (pthread_attr_setstacksize(&attr, STACK_SIZE))
+		errx(1, "pthread_attr_setstacksize");
+	if (pthread_create(&thread, &attr, thread_it, NULL))
+		errx(1, "pthread_create");
+	if (pthread_join(thread, NULL))
+		errx(1, "pthread_join");
+
+	fprintf(stderr, "deep: %d levels ok\n", DEEP);
+
+	return (0);
+}
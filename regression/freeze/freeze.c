@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <string.h>
+
+#define XMLSD_MEM_MAXSIZE	(10 * 1024 * 1024)
+#define ITERATIONS		(100)
+
+extern char			*__progname;
+
+/* modify a document the same way whether it is frozen or not */
+static void
+modify(struct xmlsd_document *xd)
+{
+	struct xmlsd_element		*root, *xe;
+
+	root = xmlsd_doc_get_root(xd);
+	if ((xe = xmlsd_doc_add_elem(xd, root, "added")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	if (xmlsd_elem_set_attr(xe, "new", "attribute") ||
+	    xmlsd_elem_set_value_x32(xe, 0xdeadbeef))
+		errx(1, "set added");
+	if (xmlsd_elem_set_attr(root, "changed", "yes"))
+		errx(1, "set root attribute");
+	if ((xe = xmlsd_elem_get_first_child(root)) != NULL &&
+	    xmlsd_elem_get_next_child(root, xe) != NULL)
+		xmlsd_doc_remove_elem(xd, xe);
+}
+
+static char *
+parse(char *b, size_t sz, struct xmlsd_document *xd, int mod)
+{
+	char				*s;
+
+	if (xmlsd_parse_mem(b, sz, xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse");
+	if (mod)
+		modify(xd);
+	if ((s = xmlsd_generate(xd, malloc, NULL, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+
+	return (s);
+}
+
+/*
+ * Make sure frozen documents generate exactly what the originals do,
+ * are laid out in document order and can still be modified.
+ */
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document		*xd, *fxd;
+	struct xmlsd_element		*xe;
+	struct xmlsd_walk		 xw;
+	int				f, i, mod;
+	char				*b, *want, *got, *last;
+	struct stat			sb;
+
+	if (argc != 2)
+		errx(1, "usage %s <filename>", __progname);
+	f = open(argv[1], O_RDONLY, 0);
+	if (f == -1)
+		err(1, "open");
+	if (fstat(f, &sb) == -1)
+		err(1, "stat");
+	if (sb.st_size > XMLSD_MEM_MAXSIZE)
+		errx(1, "file too big");
+	b = malloc(sb.st_size);
+	if (b == NULL)
+		err(1, "malloc");
+	if (read(f, b, sb.st_size) != sb.st_size)
+		err(1, "read");
+	close(f);
+
+	for (mod = 0; mod < 2; mod++) {
+		if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc");
+		want = parse(b, sb.st_size, xd, mod);
+		xmlsd_doc_free(xd);
+
+		/* explicitly */
+		if (xmlsd_doc_alloc(&fxd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc");
+		if (xmlsd_parse_mem(b, sb.st_size, fxd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_parse");
+		if (xmlsd_doc_freeze(fxd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_freeze");
+		last = NULL;
+		xmlsd_walk_init(&xw, xmlsd_doc_get_root(fxd), XMLSD_WALK_PRE);
+		while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+			if ((char *)xe <= last)
+				errx(1, "%s not in document order",
+				    xmlsd_elem_get_name(xe));
+			last = (char *)xe;
+		}
+		if (mod)
+			modify(fxd);
+		if ((got = xmlsd_generate(fxd, malloc, NULL, 0)) == NULL)
+			errx(1, "xmlsd_generate");
+		if (strcmp(want, got))
+			errx(1, "frozen differs:\n%s\n%s", want, got);
+		free(got);
+		xmlsd_doc_free(fxd);
+
+		/* after every parse of a recycling document */
+		if (xmlsd_doc_alloc_flags(&fxd,
+		    XMLSD_DOC_F_RECYCLE | XMLSD_DOC_F_FREEZE) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc_flags");
+		for (i = 0; i < ITERATIONS; i++) {
+			got = parse(b, sb.st_size, fxd, mod);
+			if (strcmp(want, got))
+				errx(1, "round %d differs:\n%s\n%s", i, want,
+				    got);
+			free(got);
+			xmlsd_doc_clear(fxd);
+		}
+		xmlsd_doc_free(fxd);
+		free(want);
+	}
+
+	printf("%s: PASS\n", argv[1]);
+
+	free(b);
+
+	return (0);
+}
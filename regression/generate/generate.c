@@ -17,6 +17,7 @@
 #include "../../xmlsd.h"
 
 #include <err.h>
+#include <stdarg.h>
 #include <string.h>
 
 /*
@@ -25,6 +26,34 @@
  * have no children or values into <foo ... /> instead of <foo ...></foo>
  */
 
+/* bulk construction */
+const char			*bulk_names[] = { "count", "kind" };
+const char			*bulk_values[] = { "3", "bulk" };
+const char			*bulk_col_name[] = { "a", "b", "c" };
+const char			*bulk_col_size[] = { "1", NULL, "3" };
+struct xmlsd_attr_column	 bulk_cols[] = {
+	{ "name", bulk_col_name },
+	{ "size", bulk_col_size },
+};
+
+/* typed setters must produce exactly what printf would have */
+static void
+check_typed(struct xmlsd_element *xe, const char *name, const char *fmt, ...)
+{
+	va_list				 ap;
+	char				 want[64];
+	const char			*got;
+
+	va_start(ap, fmt);
+	vsnprintf(want, sizeof want, fmt, ap);
+	va_end(ap);
+
+	got = name ? xmlsd_elem_get_attr(xe, name) : xmlsd_elem_get_value(xe);
+	if (got == NULL || strcmp(got, want))
+		errx(1, "typed %s: got %s, expected %s", name ? name : "value",
+		    got ? got : "NULL", want);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -70,6 +99,29 @@ main(int argc, char *argv[])
 	xe = xmlsd_doc_add_elem(xd, top_xe, "level1c");
 	xmlsd_elem_set_attr(xe, "l1c_attr", "l1c");
 	xmlsd_elem_set_value(xe, "something");
+	xe = xmlsd_doc_add_elem(xd, top_xe, "level1e");
+	xmlsd_elem_set_attr_int32(xe, "i32", INT32_MIN);
+	xmlsd_elem_set_attr_uint32(xe, "u32", UINT32_MAX);
+	xmlsd_elem_set_attr_int64(xe, "i64", INT64_MIN);
+	xmlsd_elem_set_attr_uint64(xe, "u64", UINT64_MAX);
+	xmlsd_elem_set_attr_x32(xe, "x32", 0);
+	xmlsd_elem_set_attr_x64(xe, "x64", 0xdeadbeefcafeULL);
+	xmlsd_elem_set_value_int64(xe, -42);
+	xmlsd_elem_set_attr_int64(xe, "unread", -1234567890123LL);
+	check_typed(xe, "i32", "%d", INT32_MIN);
+	check_typed(xe, "u32", "%u", UINT32_MAX);
+	check_typed(xe, "i64", "%" PRId64, INT64_MIN);
+	check_typed(xe, "u64", "%" PRIu64, UINT64_MAX);
+	check_typed(xe, "x32", "0x%x", 0);
+	check_typed(xe, "x64", "0x%" PRIx64, 0xdeadbeefcafeULL);
+	check_typed(xe, NULL, "%d", -42);
+	xe = xmlsd_doc_add_elem(xd, top_xe, "level1f");
+	xmlsd_doc_set_attrs(xd, xe, bulk_names, bulk_values, 2);
+	if (xmlsd_doc_add_elems(xd, xe, "entry", 3, bulk_cols, 2) == NULL)
+		errx(1, "xmlsd_doc_add_elems");
+	xe = xmlsd_doc_add_elem(xd, top_xe, "level1g");
+	xmlsd_elem_set_attr(xe, "escaped", "\"a\" & <b>");
+	xmlsd_elem_set_value(xe, "1 < 2 && \"3\" > 2");
 	xe1 = xmlsd_doc_add_elem(xd, top_xe, "level1d");
 	xmlsd_elem_set_attr(xe1, "l1d_attr", "l1d");
 	xe = xmlsd_doc_add_elem(xd, xe1, "level2");
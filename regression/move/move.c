@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <string.h>
+
+#define CHILDREN		(20)	/* enough for a child index */
+
+/* bytes handed out and not given back, each block starts with its size */
+static size_t		 live;
+
+static void *
+c_malloc(void *arg, size_t sz)
+{
+	size_t			*p;
+
+	if ((p = malloc(sizeof *p + sz)) == NULL)
+		return (NULL);
+	*p = sz;
+	live += sz;
+	return (p + 1);
+}
+
+static void *
+c_realloc(void *arg, void *ptr, size_t sz)
+{
+	size_t			*p;
+
+	if (ptr == NULL)
+		return (c_malloc(arg, sz));
+	p = (size_t *)ptr - 1;
+	live -= *p;
+	if ((p = realloc(p, sizeof *p + sz)) == NULL)
+		return (NULL);
+	*p = sz;
+	live += sz;
+	return (p + 1);
+}
+
+static void
+c_free(void *arg, void *ptr)
+{
+	size_t			*p;
+
+	if (ptr == NULL)
+		return;
+	p = (size_t *)ptr - 1;
+	live -= *p;
+	free(p);
+}
+
+static const char	*borrow = "<a><s>short</s>"
+			    "<l>a value long enough to be borrowed</l></a>";
+
+/* `a' and `b' have the same names, values, attributes and children */
+static void
+same(struct xmlsd_element *a, struct xmlsd_element *b, int depth)
+{
+	struct xmlsd_attribute	*aa, *ba;
+	struct xmlsd_element	*ac, *bc;
+	const char		*av, *bv;
+
+	av = xmlsd_elem_get_value(a);
+	bv = xmlsd_elem_get_value(b);
+	if (strcmp(xmlsd_elem_get_name(a), xmlsd_elem_get_name(b)) ||
+	    (av == NULL) != (bv == NULL) || (av != NULL && strcmp(av, bv)))
+		errx(1, "%s differs", xmlsd_elem_get_name(a));
+	if (xmlsd_elem_get_depth(b) != depth)
+		errx(1, "%s at depth %d, not %d", xmlsd_elem_get_name(b),
+		    xmlsd_elem_get_depth(b), depth);
+
+	for (aa = xmlsd_elem_get_first_attr(a),
+	    ba = xmlsd_elem_get_first_attr(b); aa != NULL && ba != NULL;
+	    aa = xmlsd_elem_get_next_attr(a, aa),
+	    ba = xmlsd_elem_get_next_attr(b, ba))
+		if (strcmp(xmlsd_attr_get_name(aa), xmlsd_attr_get_name(ba)) ||
+		    strcmp(xmlsd_attr_get_value(aa),
+		    xmlsd_attr_get_value(ba)))
+			errx(1, "attribute %s differs",
+			    xmlsd_attr_get_name(aa));
+	if (aa != NULL || ba != NULL)
+		errx(1, "%s has other attributes", xmlsd_elem_get_name(a));
+
+	for (ac = xmlsd_elem_get_first_child(a),
+	    bc = xmlsd_elem_get_first_child(b); ac != NULL && bc != NULL;
+	    ac = xmlsd_elem_get_next_child(a, ac),
+	    bc = xmlsd_elem_get_next_child(b, bc)) {
+		if (xmlsd_elem_get_parent(bc) != b)
+			errx(1, "%s has the wrong parent",
+			    xmlsd_elem_get_name(bc));
+		same(ac, bc, depth + 1);
+	}
+	if (ac != NULL || bc != NULL)
+		errx(1, "%s has other children", xmlsd_elem_get_name(a));
+}
+
+static struct xmlsd_document *
+parse(const char *name, int flags)
+{
+	struct xmlsd_document	*xd;
+	struct stat		 st;
+	char			*b;
+	int			 fd;
+
+	if ((fd = open(name, O_RDONLY, 0)) == -1)
+		err(1, "open %s", name);
+	if (fstat(fd, &st) == -1)
+		err(1, "fstat");
+	if ((b = malloc(st.st_size)) == NULL)
+		err(1, "malloc");
+	if (read(fd, b, st.st_size) != st.st_size)
+		err(1, "read %s", name);
+	close(fd);
+
+	if (xmlsd_doc_alloc_flags(&xd, flags) != XMLSD_ERR_SUCCES ||
+	    xmlsd_parse_mem(b, st.st_size, xd) != XMLSD_ERR_SUCCES)
+		errx(1, "parse %s", name);
+	free(b);
+
+	return (xd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd, *sub[2], *want[2], *other;
+	struct xmlsd_element	*root, *xe, *xc, *a, *b, *c;
+	size_t			 n;
+	char			 name[16];
+	struct xmlsd_allocator	 mm = { c_malloc, c_realloc, c_free, &mm };
+	struct xmlsd_allocator	 mm2 = { c_malloc, c_realloc, c_free, &mm2 };
+	int			 i, flags[] = { XMLSD_DOC_F_RECYCLE,
+				    XMLSD_DOC_F_FREEZE };
+
+	if (argc != 3)
+		errx(1, "usage: move auth.xml preauth.xml");
+
+	/* an aggregate reply out of two parsed documents */
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+	    (root = xmlsd_doc_add_elem(xd, NULL, "reply")) == NULL)
+		errx(1, "reply");
+	for (i = 0; i < 2; i++) {
+		sub[i] = parse(argv[i + 1], 0);
+		if (xmlsd_doc_clone(&want[i], sub[i]) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_clone");
+		xe = xmlsd_doc_get_root(sub[i]);
+		if (xmlsd_elem_append(xd, root, xe) != XMLSD_ERR_INTEGRITY)
+			errx(1, "attached element moved");
+		if (xmlsd_elem_detach(sub[i], xe) != XMLSD_ERR_SUCCES ||
+		    !xmlsd_doc_is_empty(sub[i]) ||
+		    xmlsd_elem_detach(sub[i], xe) != XMLSD_ERR_INTEGRITY)
+			errx(1, "detach root");
+		if (xmlsd_elem_append(xd, root, xe) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_elem_append");
+		xmlsd_doc_free(sub[i]);
+	}
+	if (strcmp(xmlsd_elem_get_name(xmlsd_elem_get_first_child(root)),
+	    "auth") ||
+	    strcmp(xmlsd_elem_get_name(xmlsd_elem_get_last_child(root)),
+	    "preauth"))
+		errx(1, "reply in the wrong order");
+	for (i = 0, xe = xmlsd_elem_get_first_child(root); i < 2;
+	    i++, xe = xmlsd_elem_get_next_child(root, xe)) {
+		same(xmlsd_doc_get_root(want[i]), xe, 1);
+		xmlsd_doc_free(want[i]);
+	}
+	if (xmlsd_doc_find_path(xd, "session_key.preauth.reply", &n) ==
+	    NULL || n != 1)
+		errx(1, "path index not updated");
+
+	/* within a document, deeper and shallower, with a child index */
+	a = xmlsd_elem_find_child(root, "auth");
+	b = xmlsd_elem_find_child(root, "preauth");
+	for (i = 0; i < CHILDREN; i++) {
+		snprintf(name, sizeof name, "c%d", i % 3);
+		if (xmlsd_doc_add_elem(xd, b, name) == NULL)
+			errx(1, "xmlsd_doc_add_elem");
+	}
+	if (xmlsd_elem_count_children(b, "c1") != 7)
+		errx(1, "count");
+	if (xmlsd_elem_detach(xd, a) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(xd, a, a) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_append(xd, xmlsd_elem_get_first_child(a), a) !=
+	    XMLSD_ERR_INTEGRITY)
+		errx(1, "moved into itself");
+	c = xmlsd_elem_find_child(b, "c1");
+	if (xmlsd_elem_insert_before(xd, c, a) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_get_parent(a) != b || xmlsd_elem_get_depth(a) != 2 ||
+	    xmlsd_elem_get_depth(xmlsd_elem_get_first_child(a)) != 3)
+		errx(1, "xmlsd_elem_insert_before");
+	if (xmlsd_elem_find_child(b, "auth") != a ||
+	    xmlsd_elem_count_children(b, "c1") != 7 ||
+	    xmlsd_elem_get_next_child(b, a) != c)
+		errx(1, "child index not updated");
+	if (xmlsd_doc_find_path(xd, "trans_token.auth.preauth.reply", &n) ==
+	    NULL || n != 1)
+		errx(1, "moved path not found");
+
+	/* the c1 children to the front, in order */
+	for (xc = xmlsd_elem_find_child(b, "c1"), xe = NULL; xc != NULL;
+	    xc = c, xe = xmlsd_elem_get_next_child(b, xe)) {
+		c = xmlsd_elem_find_child_next(b, xc);
+		if (xe == NULL)
+			xe = xmlsd_elem_get_first_child(b);
+		if (xmlsd_elem_detach(xd, xc) != XMLSD_ERR_SUCCES ||
+		    xmlsd_elem_insert_before(xd, xe, xc) != XMLSD_ERR_SUCCES)
+			errx(1, "move c1");
+		xe = xc;
+	}
+	for (xc = xmlsd_elem_find_child(b, "c1"), n = 0; xc != NULL;
+	    xc = xmlsd_elem_find_child_next(b, xc), n++) {
+		xe = n == 0 ? xmlsd_elem_get_first_child(b) :
+		    xmlsd_elem_get_next_child(b, xe);
+		if (xc != xe)
+			errx(1, "c1 out of order");
+	}
+	if (n != 7 || strcmp(xmlsd_elem_get_name(xmlsd_elem_get_next_child(b,
+	    xe)), "session_key"))
+		errx(1, "%zu c1 found", n);
+
+	/* back up a level, then the whole thing becomes the root */
+	if (xmlsd_elem_detach(xd, a) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(xd, root, a) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_get_depth(xmlsd_elem_get_first_child(a)) != 2)
+		errx(1, "move up");
+	if (xmlsd_elem_detach(xd, a) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(xd, NULL, a) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_insert_before(xd, root, a) != XMLSD_ERR_INTEGRITY)
+		errx(1, "second root");
+	if (xmlsd_elem_detach(xd, root) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(xd, NULL, a) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_get_depth(a) != 0 ||
+	    xmlsd_elem_get_depth(xmlsd_elem_get_first_child(a)) != 1 ||
+	    xmlsd_elem_get_parent(a) != NULL)
+		errx(1, "new root");
+	if (xmlsd_doc_find_path(xd, "session_key.auth", &n) == NULL ||
+	    n != 1)
+		errx(1, "path of the new root");
+
+	/* a detached subtree may be thrown away */
+	if (xmlsd_elem_detach(xd, root) != XMLSD_ERR_INTEGRITY)
+		errx(1, "detached twice");
+	xmlsd_doc_remove_elem(xd, root);
+	xmlsd_doc_free(xd);
+
+	/* out of document memory, which the new document keeps */
+	want[0] = parse(argv[1], 0);
+	for (i = 0; i < sizeof flags / sizeof flags[0]; i++) {
+		sub[0] = parse(argv[1], flags[i]);
+		if (xmlsd_doc_alloc(&other) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc");
+		xe = xmlsd_doc_get_root(sub[0]);
+		if (xmlsd_elem_detach(sub[0], xe) != XMLSD_ERR_SUCCES ||
+		    xmlsd_elem_append(other, NULL, xe) != XMLSD_ERR_SUCCES)
+			errx(1, "moved out of document memory");
+		/* the old document goes on with memory of its own */
+		xmlsd_doc_clear(sub[0]);
+		if (xmlsd_parse_mem(borrow, strlen(borrow), sub[0]) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "parse after a move");
+		same(xmlsd_doc_get_root(want[0]), xe, 0);
+		xmlsd_doc_free(sub[0]);
+		same(xmlsd_doc_get_root(want[0]), xe, 0);
+		xmlsd_doc_free(other);
+	}
+
+	/* between documents of one allocator, and back and forth */
+	for (i = 0; i < 2; i++)
+		if (xmlsd_doc_alloc_mm(&sub[i], i ? XMLSD_DOC_F_RECYCLE : 0,
+		    &mm) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_alloc_mm");
+	if (xmlsd_doc_alloc_mm(&other, 0, &mm2) != XMLSD_ERR_SUCCES ||
+	    (root = xmlsd_doc_add_elem(sub[1], NULL, "b")) == NULL ||
+	    xmlsd_doc_add_elem(other, NULL, "c") == NULL)
+		errx(1, "xmlsd_doc_alloc_mm");
+	if (xmlsd_parse_mem(borrow, strlen(borrow), sub[0]) != XMLSD_ERR_SUCCES)
+		errx(1, "parse");
+	xe = xmlsd_doc_get_root(sub[0]);
+	xc = xmlsd_elem_get_first_child(xe);
+	if (xmlsd_elem_detach(sub[0], xc) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(other, xmlsd_doc_get_root(other), xc) !=
+	    XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_append(sub[1], root, xc) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_detach(sub[0], xe) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(sub[1], root, xe) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_detach(sub[1], xc) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(sub[0], NULL, xc) != XMLSD_ERR_SUCCES)
+		errx(1, "moved between documents of one allocator");
+	xmlsd_doc_free(other);
+	xmlsd_doc_free(sub[0]);
+	if (strcmp(xmlsd_elem_get_value(xmlsd_elem_get_first_child(xe)),
+	    "a value long enough to be borrowed"))
+		errx(1, "moved value lost");
+	xmlsd_doc_clear(sub[1]);
+	xmlsd_doc_free(sub[1]);
+	if (live != 0)
+		errx(1, "%zu bytes not given back", live);
+	xmlsd_doc_free(want[0]);
+	/* short borrowed values are copies, long ones are not */
+	if (xmlsd_doc_alloc_flags(&sub[0], XMLSD_DOC_F_BORROW) !=
+	    XMLSD_ERR_SUCCES ||
+	    xmlsd_parse_mem(borrow, strlen(borrow), sub[0]) != XMLSD_ERR_SUCCES)
+		errx(1, "parse borrowed");
+	if (xmlsd_doc_alloc(&other) != XMLSD_ERR_SUCCES ||
+	    (root = xmlsd_doc_add_elem(other, NULL, "b")) == NULL)
+		errx(1, "xmlsd_doc_alloc");
+	xe = xmlsd_elem_get_first_child(xmlsd_doc_get_root(sub[0]));
+	xc = xmlsd_elem_get_next_child(xmlsd_doc_get_root(sub[0]), xe);
+	if (xmlsd_elem_detach(sub[0], xe) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(other, root, xe) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_detach(sub[0], xc) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(other, root, xc) != XMLSD_ERR_INTEGRITY)
+		errx(1, "moved borrowed values");
+	xmlsd_doc_remove_elem(sub[0], xc);
+	xmlsd_doc_free(sub[0]);
+	if (strcmp(xmlsd_elem_get_value(xe), "short"))
+		errx(1, "moved value lost");
+	xmlsd_doc_free(other);
+
+	/* only under elements in the tree of the document named */
+	if (xmlsd_doc_alloc(&other) != XMLSD_ERR_SUCCES ||
+	    (root = xmlsd_doc_add_elem(other, NULL, "b")) == NULL ||
+	    (xc = xmlsd_doc_add_elem(other, root, "c")) == NULL ||
+	    (xe = xmlsd_doc_add_elem(other, root, "e")) == NULL ||
+	    (c = xmlsd_doc_add_elem(other, xc, "d")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	sub[0] = parse(argv[1], 0);
+	a = xmlsd_doc_get_root(sub[0]);
+	b = xmlsd_elem_get_first_child(a);
+	if (xmlsd_elem_detach(other, xe) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_detach(other, xc) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(other, a, xe) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_append(other, b, xe) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_insert_before(other, b, xe) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_append(other, c, xe) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_insert_before(other, c, xe) != XMLSD_ERR_INTEGRITY)
+		errx(1, "moved under an element of another tree");
+	if (xmlsd_elem_detach(other, b) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_detach(other, c) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_get_first_child(a) != b ||
+	    xmlsd_elem_get_first_child(xc) != c)
+		errx(1, "detached from another tree");
+	if (xmlsd_doc_seal(sub[0]) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_append(other, a, xe) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_detach(other, b) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_get_first_child(a) != b)
+		errx(1, "moved under a sealed element");
+	if (xmlsd_elem_append(other, root, xe) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_insert_before(other, xe, xc) != XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_get_first_child(root) != xc ||
+	    xmlsd_elem_get_depth(c) != 2)
+		errx(1, "moved back");
+	xmlsd_doc_free(sub[0]);
+	xmlsd_doc_free(other);
+
+	if (xmlsd_elem_detach(NULL, NULL) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_append(NULL, NULL, NULL) != XMLSD_ERR_INTEGRITY ||
+	    xmlsd_elem_insert_before(NULL, NULL, NULL) !=
+	    XMLSD_ERR_INTEGRITY)
+		errx(1, "bad arguments accepted");
+
+	return (0);
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <string.h>
+
+#define XMLSD_MEM_MAXSIZE	(10 * 1024 * 1024)
+#define BENCH_ELEMS		(20000)
+#define BENCH_LOOPS		(200)
+
+/* documents both parsers must read the same way */
+const char *good[] = {
+	"<a>plain</a>",
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!-- comment -->\n"
+	    "<a x='1' y=\"a&amp;b\tc\r\nd\">\n  text &lt; more\r\n"
+	    "  second line\n  <b/>&#65;&#x42;&#9;x"
+	    "<![CDATA[raw <stuff> ]] & \n more]]></a>\n<?pi stuff?>\n",
+	"\xef\xbb\xbf<?xml version='1.0' encoding='utf-8'?><a>bom</a>",
+	"<a>\xc3\xa9t\xc3\xa9 &#233; &#x1F600;</a>",
+	"<a>  \n\t lead</a>",
+	"<a>x]y]]z</a>",
+	"<a>\n&#10;x&#10;\n</a>",
+	"<a>\r\r\n\rcr</a>",
+	"<a x='>' y='\"' z=\"'\" w='&#10;&#13;&#9;' v='a\n\tb'/>",
+	"<a><b>1</b>tail<c/></a >",
+	"<a:b xmlns:a='urn:x' a:c='d'><a:e/></a:b>",
+	"<a><![CDATA[]]><![CDATA[  lead]]>x</a>",
+	"<a>one<!-- x -->two<?p i?>three</a>",
+	"<r a0='0' a1='1' a2='2' a3='3' a4='4' a5='5' a6='6' a7='7' a8='8'"
+	    " a9='9'><c>1</c><c>2</c><c>3</c><c>4</c><c>5</c><c>6</c>"
+	    "<c>7</c><c>8</c><c>9</c></r>",
+	"<a>this value is long enough to be borrowed from the input</a>",
+	"<\xc3\xa9l_1:x-y.z \xc3\xa9='\xe2\x82\xac \xf0\x9f\x98\x80'>a long "
+	    "text with \xef\xbf\xbd and \xf4\x8f\xbf\xbd past the first 16 "
+	    "bytes</\xc3\xa9l_1:x-y.z>",
+	"<?xml version=\"1.0\" standalone='yes' ?><a\xc2\xb7" "b/>",
+	"<?xml version='1.1'?><a/>",
+	"<?xml  version = '1.0'\tencoding='UTF-8'\nstandalone='no'?><a/>",
+	NULL
+};
+
+/* documents both parsers must refuse */
+const char *bad[] = {
+	"<a></b>", "<a>&foo;</a>", "<a x='1' x='2'/>", "<a/><b/>",
+	"<a>]]></a>", "<a", "<a x='<'/>", "<a x=1/>", "text<a/>",
+	"<a>&#0;</a>", "<a>&#xD800;</a>", "<a><!-- -- --></a>", "<a>",
+	" <?xml version='1.0'?><a/>", "<a><?xml x?></a>", "<a>&#;</a>",
+	"<a x='1'y='2'/>", "<1a/>", "<a><![CDATA[x</a>", "<a>&amp</a>",
+	"", "  ", "<a#b/>", "<a(/>", "<a>\x01</a>", "<a>\xff\xfe</a>",
+	"<a x='\x01'/>", "<a\xff/>", "<a>\xc0\xaf</a>", "<a>\xed\xa0\x80</a>",
+	"<a>\xe2\x82</a>", "<a>\xef\xbf\xbe</a>", "<a x='y'\x80/>",
+	"<a>a text long enough for a full block \x1f</a>",
+	"<a x='a value long enough for a full block \xf5\x80\x80\x80'/>",
+	"<-a/>", "<a><![CDATA[\x02]]></a>",
+	"<r a0='0' a1='1' a2='2' a3='3' a4='4' a5='5' a6='6' a7='7' a8='8'"
+	    " a9='9' a10='10' a11='11' a5='x'/>",
+	"<?" "?><a/>", "<?xml?><a/>", "<?xml encoding='UTF-8'?><a/>",
+	"<?xml version='1.0'encoding='UTF-8'?><a/>", "<a><!-- \x01 --></a>",
+	"<\xc3\x97/>", "<a \xc3\x97='1'/>", "<\xc2\xb7" "a/>",
+	"<?xml version='1.0' standalone='yes' encoding='UTF-8'?><a/>",
+	"<a><?p\x01?></a>",
+	NULL
+};
+
+/* documents only expat reads */
+const char *unsupported[] = {
+	"<!DOCTYPE a><a/>",
+	"<?xml version='1.0' encoding='ISO-8859-1'?><a/>",
+	NULL
+};
+
+static void
+compare_elem(const char *what, struct xmlsd_element *xe,
+    struct xmlsd_element *ne)
+{
+	struct xmlsd_attribute	*xa, *na;
+	const char		*s, *n;
+	size_t			 slen, nlen;
+
+	if (strcmp(xmlsd_elem_get_name(xe), xmlsd_elem_get_name(ne)) ||
+	    xmlsd_elem_get_depth(xe) != xmlsd_elem_get_depth(ne))
+		errx(1, "%s: element %s differs", what,
+		    xmlsd_elem_get_name(xe));
+
+	s = xmlsd_elem_get_value_span(xe, &slen);
+	n = xmlsd_elem_get_value_span(ne, &nlen);
+	if ((s == NULL) != (n == NULL) || slen != nlen ||
+	    (s != NULL && memcmp(s, n, slen)))
+		errx(1, "%s: value of %s differs", what,
+		    xmlsd_elem_get_name(xe));
+
+	na = xmlsd_elem_get_first_attr(ne);
+	XMLSD_ELEM_FOREACH_ATTR(xa, xe) {
+		if (na == NULL ||
+		    strcmp(xmlsd_attr_get_name(xa), xmlsd_attr_get_name(na)))
+			errx(1, "%s: attributes of %s differ", what,
+			    xmlsd_elem_get_name(xe));
+		s = xmlsd_attr_get_value_span(xa, &slen);
+		n = xmlsd_attr_get_value_span(na, &nlen);
+		if (slen != nlen || memcmp(s, n, slen))
+			errx(1, "%s: attribute %s differs", what,
+			    xmlsd_attr_get_name(xa));
+		na = xmlsd_elem_get_next_attr(ne, na);
+	}
+	if (na != NULL)
+		errx(1, "%s: attributes of %s differ", what,
+		    xmlsd_elem_get_name(xe));
+}
+
+/* the two documents must be the same down to every value */
+static void
+compare(const char *what, struct xmlsd_document *xd,
+    struct xmlsd_document *nd)
+{
+	struct xmlsd_walk	 xw, nw;
+	struct xmlsd_element	*xe, *ne;
+	char			*xs, *ns;
+	size_t			 xsz, nsz;
+
+	xmlsd_walk_init(&xw, xmlsd_doc_get_root(xd), XMLSD_WALK_PRE);
+	xmlsd_walk_init(&nw, xmlsd_doc_get_root(nd), XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		if ((ne = xmlsd_walk_next(&nw)) == NULL)
+			errx(1, "%s: native document is short", what);
+		compare_elem(what, xe, ne);
+	}
+	if (xmlsd_walk_next(&nw) != NULL)
+		errx(1, "%s: native document is long", what);
+
+	if ((xs = xmlsd_generate(xd, malloc, &xsz, 0)) == NULL ||
+	    (ns = xmlsd_generate(nd, malloc, &nsz, 0)) == NULL)
+		errx(1, "%s: xmlsd_generate", what);
+	if (xsz != nsz || strcmp(xs, ns))
+		errx(1, "%s: generated documents differ", what);
+	free(xs);
+	free(ns);
+}
+
+/* parse `b' both ways into fresh documents with `flags' */
+static void
+check(const char *what, const char *b, size_t sz, int flags)
+{
+	struct xmlsd_document	*xd, *nd;
+	int			 xrv, nrv;
+
+	if (xmlsd_doc_alloc_flags(&xd, flags) != XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_alloc_flags(&nd, flags) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+	xrv = xmlsd_parse_mem_flags(b, sz, xd, 0);
+	nrv = xmlsd_parse_mem_flags(b, sz, nd, XMLSD_PARSE_NATIVE);
+	if (xrv != XMLSD_ERR_SUCCES || nrv != XMLSD_ERR_SUCCES)
+		errx(1, "%s: parse failed: expat %d native %d", what, xrv,
+		    nrv);
+	compare(what, xd, nd);
+
+	/* a recycled document must come out the same the second time */
+	if (flags & XMLSD_DOC_F_RECYCLE) {
+		xmlsd_doc_clear(nd);
+		if (xmlsd_parse_mem_flags(b, sz, nd, XMLSD_PARSE_NATIVE) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "%s: second parse failed", what);
+		compare(what, xd, nd);
+	}
+
+	xmlsd_doc_free(xd);
+	xmlsd_doc_free(nd);
+}
+
+static int
+parse(const char *b, int flags)
+{
+	struct xmlsd_document	*xd;
+	int			 rv;
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	rv = xmlsd_parse_mem_flags(b, strlen(b), xd, flags);
+	xmlsd_doc_free(xd);
+
+	return (rv);
+}
+
+static char *
+readfile(const char *name, size_t *sz)
+{
+	struct stat		 sb;
+	char			*b;
+	int			 f;
+
+	if ((f = open(name, O_RDONLY, 0)) == -1)
+		err(1, "%s", name);
+	if (fstat(f, &sb) == -1)
+		err(1, "stat");
+	if (sb.st_size > XMLSD_MEM_MAXSIZE)
+		errx(1, "%s: file too big", name);
+	if ((b = malloc(sb.st_size)) == NULL)
+		err(1, "malloc");
+	if (read(f, b, sb.st_size) != sb.st_size)
+		err(1, "read");
+	close(f);
+	*sz = sb.st_size;
+
+	return (b);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval		 now, d;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &d);
+	return (d.tv_sec + d.tv_usec / 1e6);
+}
+
+/* parse a large message over and over into a recycling document */
+static void
+bench(void)
+{
+	struct xmlsd_document	*xd;
+	struct xmlsd_element	*root, *xe;
+	struct timeval		 start;
+	char			*b;
+	size_t			 sz;
+	int			 i, flags;
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if ((root = xmlsd_doc_add_elem(xd, NULL, "root")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	for (i = 0; i < BENCH_ELEMS; i++) {
+		if ((xe = xmlsd_doc_add_elem(xd, root, "entry")) == NULL ||
+		    xmlsd_elem_set_attr_int32(xe, "id", i) ||
+		    xmlsd_elem_set_attr(xe, "name", "some name or other") ||
+		    xmlsd_elem_set_value(xe,
+		    "a line of text that is typical of what we send"))
+			errx(1, "xmlsd_doc_add_elem");
+	}
+	if ((b = xmlsd_generate(xd, malloc, &sz, 0)) == NULL)
+		errx(1, "xmlsd_generate");
+	sz = strlen(b);
+	xmlsd_doc_free(xd);
+
+	if (xmlsd_doc_alloc_flags(&xd, XMLSD_DOC_F_RECYCLE) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+	for (flags = 0; flags <= XMLSD_PARSE_NATIVE; flags++) {
+		gettimeofday(&start, NULL);
+		for (i = 0; i < BENCH_LOOPS; i++) {
+			xmlsd_doc_clear(xd);
+			if (xmlsd_parse_mem_flags(b, sz, xd, flags) !=
+			    XMLSD_ERR_SUCCES)
+				errx(1, "xmlsd_parse_mem_flags");
+		}
+		printf("%s %.3fs (%zu bytes x %d)\n",
+		    flags ? "native:" : "expat: ", elapsed(&start), sz,
+		    BENCH_LOOPS);
+	}
+	xmlsd_doc_free(xd);
+	free(b);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char			 what[32], *b;
+	size_t			 sz;
+	int			 i, c, bflag = 0, xrv, nrv;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bflag = 1;
+			break;
+		default:
+			errx(1, "usage: native [-b] [file ...]");
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	for (i = 0; good[i] != NULL; i++) {
+		snprintf(what, sizeof what, "good %d", i);
+		check(what, good[i], strlen(good[i]), 0);
+		check(what, good[i], strlen(good[i]), XMLSD_DOC_F_RECYCLE);
+		check(what, good[i], strlen(good[i]), XMLSD_DOC_F_BORROW);
+	}
+	for (i = 0; bad[i] != NULL; i++) {
+		xrv = parse(bad[i], 0);
+		nrv = parse(bad[i], XMLSD_PARSE_NATIVE);
+		if (xrv == XMLSD_ERR_SUCCES || xrv != nrv)
+			errx(1, "bad %d: expat %d native %d", i, xrv, nrv);
+	}
+	for (i = 0; unsupported[i] != NULL; i++)
+		if (parse(unsupported[i], 0) != XMLSD_ERR_SUCCES ||
+		    parse(unsupported[i], XMLSD_PARSE_NATIVE) !=
+		    XMLSD_ERR_PARSER)
+			errx(1, "unsupported %d", i);
+
+	/* a handler giving up stops the native parser just the same */
+	if ((b = malloc(8192 + 8)) == NULL)
+		err(1, "malloc");
+	memcpy(b, "<a>", 3);
+	memset(b + 3, 'x', 8192);
+	memcpy(b + 3 + 8192, "</a>", 5);
+	if (parse(b, 0) != XMLSD_ERR_OVERFLOW ||
+	    parse(b, XMLSD_PARSE_NATIVE) != XMLSD_ERR_OVERFLOW)
+		errx(1, "overflow");
+	free(b);
+
+	for (i = 0; i < argc; i++) {
+		b = readfile(argv[i], &sz);
+		check(argv[i], b, sz, 0);
+		check(argv[i], b, sz, XMLSD_DOC_F_RECYCLE | XMLSD_DOC_F_BORROW);
+		free(b);
+	}
+
+	if (bflag)
+		bench();
+
+	return (0);
+}
@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ENTRIES			(20000)	/* a couple of megabytes */
+#define ENTRY_MAX		(256)	/* longest formatted entry */
+#define BENCH_LOOPS		(20)
+#define RECYCLE_ROUNDS		(30)
+
+/* what goes around the entries */
+#define HEAD_PLAIN	"<root a='1' b=\"x&gt;y\">\n"
+#define HEAD_PROLOG	"\xef\xbb\xbf<?xml version='1.0' encoding='UTF-8'?>\n" \
+			"<!-- head --><?pi x?>\n" HEAD_PLAIN
+#define HEAD_DTD	"<!DOCTYPE root>\n" HEAD_PLAIN
+#define TAIL_PLAIN	"</root>\n"
+#define TAIL_TEXT	"text that belongs to the root itself\n</root >\n" \
+			"<!-- the end -->\n"
+#define TAIL_BAD	"</root>\n<junk/>\n"
+
+const char *entries[] = {
+	"  <entry id='%d' name=\"some name or other\">a line of text "
+	    "that is typical &amp; ordinary<sub>%d</sub></entry>\n",
+	"  <!-- a comment <entry/> -->\n",
+	"  <empty n='%d'/>\n",
+	"  loose text %d<held/>\n",
+	"  <![CDATA[ <not> an element %d ]]><after/>\n",
+	"  <?pi <entry> %d?>\n",
+	"  <a><b><c x='>'>%d<d/></c>deep</b></a>\n",
+	"\t<entry id='%d'>\r\n\t\tsplit\r\n\t\tlines</entry>\n",
+	NULL
+};
+
+static void
+compare_elem(const char *what, struct xmlsd_element *xe,
+    struct xmlsd_element *pe)
+{
+	struct xmlsd_attribute	*xa, *pa;
+	const char		*s, *p;
+	size_t			 slen, plen;
+
+	if (strcmp(xmlsd_elem_get_name(xe), xmlsd_elem_get_name(pe)) ||
+	    xmlsd_elem_get_depth(xe) != xmlsd_elem_get_depth(pe))
+		errx(1, "%s: element %s differs", what,
+		    xmlsd_elem_get_name(xe));
+
+	s = xmlsd_elem_get_value_span(xe, &slen);
+	p = xmlsd_elem_get_value_span(pe, &plen);
+	if ((s == NULL) != (p == NULL) || slen != plen ||
+	    (s != NULL && memcmp(s, p, slen)))
+		errx(1, "%s: value of %s differs", what,
+		    xmlsd_elem_get_name(xe));
+
+	pa = xmlsd_elem_get_first_attr(pe);
+	XMLSD_ELEM_FOREACH_ATTR(xa, xe) {
+		if (pa == NULL ||
+		    strcmp(xmlsd_attr_get_name(xa), xmlsd_attr_get_name(pa)))
+			errx(1, "%s: attributes of %s differ", what,
+			    xmlsd_elem_get_name(xe));
+		s = xmlsd_attr_get_value_span(xa, &slen);
+		p = xmlsd_attr_get_value_span(pa, &plen);
+		if (slen != plen || memcmp(s, p, slen))
+			errx(1, "%s: attribute %s differs", what,
+			    xmlsd_attr_get_name(xa));
+		pa = xmlsd_elem_get_next_attr(pe, pa);
+	}
+	if (pa != NULL)
+		errx(1, "%s: attributes of %s differ", what,
+		    xmlsd_elem_get_name(xe));
+}
+
+/* the two documents must be the same down to every value */
+static void
+compare(const char *what, struct xmlsd_document *xd,
+    struct xmlsd_document *pd)
+{
+	struct xmlsd_walk	 xw, pw;
+	struct xmlsd_element	*xe, *pe;
+	char			*xs, *ps;
+	size_t			 xsz, psz;
+
+	xmlsd_walk_init(&xw, xmlsd_doc_get_root(xd), XMLSD_WALK_PRE);
+	xmlsd_walk_init(&pw, xmlsd_doc_get_root(pd), XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		if ((pe = xmlsd_walk_next(&pw)) == NULL)
+			errx(1, "%s: parallel document is short", what);
+		compare_elem(what, xe, pe);
+	}
+	if (xmlsd_walk_next(&pw) != NULL)
+		errx(1, "%s: parallel document is long", what);
+
+	/* lookups must see the spliced elements */
+	if (xmlsd_elem_count_children(xmlsd_doc_get_root(xd), "entry") !=
+	    xmlsd_elem_count_children(xmlsd_doc_get_root(pd), "entry") ||
+	    xmlsd_elem_count_children(xmlsd_doc_get_root(xd), "held") !=
+	    xmlsd_elem_count_children(xmlsd_doc_get_root(pd), "held"))
+		errx(1, "%s: lookup differs", what);
+
+	if ((xs = xmlsd_generate(xd, malloc, &xsz, 0)) == NULL ||
+	    (ps = xmlsd_generate(pd, malloc, &psz, 0)) == NULL)
+		errx(1, "%s: xmlsd_generate", what);
+	if (xsz != psz || strcmp(xs, ps))
+		errx(1, "%s: generated documents differ", what);
+	free(xs);
+	free(ps);
+}
+
+/* a document of `n' entries, every `bad'th one broken if not 0 */
+static char *
+build(const char *head, const char *tail, int n, int bad, size_t *sz)
+{
+	char			*b;
+	size_t			 len, off;
+	int			 i, e;
+
+	len = strlen(head) + strlen(tail) + n * ENTRY_MAX + 1;
+	if ((b = malloc(len)) == NULL)
+		err(1, "malloc");
+	off = snprintf(b, len, "%s", head);
+	for (i = 0; i < n; i++) {
+		e = i % (sizeof entries / sizeof entries[0] - 1);
+		if (bad && i % bad == bad - 1)
+			off += snprintf(b + off, len - off, "<x></y>\n");
+		else
+			off += snprintf(b + off, len - off, entries[e], i, i);
+	}
+	*sz = off + snprintf(b + off, len - off, "%s", tail);
+
+	return (b);
+}
+
+/* parse `b' in one go and in parallel, both must come out the same */
+static void
+check(const char *what, const char *b, size_t sz, int flags, int pflags)
+{
+	struct xmlsd_document	*xd, *pd;
+	int			 nthreads[] = { 0, 2, 3, 16 };
+	int			 i, xrv, prv;
+	char			 w[64];
+
+	if (xmlsd_doc_alloc_flags(&xd, flags) != XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_alloc_flags(&pd, flags) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+	xrv = xmlsd_parse_mem_flags(b, sz, xd, pflags);
+
+	for (i = 0; i < sizeof nthreads / sizeof nthreads[0]; i++) {
+		snprintf(w, sizeof w, "%s flags %x/%x threads %d", what,
+		    flags, pflags, nthreads[i]);
+		xmlsd_doc_clear(pd);
+		prv = xmlsd_parse_mem_parallel(b, sz, pd, pflags,
+		    nthreads[i]);
+		if (prv != xrv)
+			errx(1, "%s: one parse %d, parallel %d", w, xrv, prv);
+		if (xrv == XMLSD_ERR_SUCCES)
+			compare(w, xd, pd);
+		else if (xmlsd_doc_is_empty(xd) != xmlsd_doc_is_empty(pd))
+			errx(1, "%s: failed parses differ", w);
+	}
+
+	xmlsd_doc_free(xd);
+	xmlsd_doc_free(pd);
+}
+
+/* bytes handed out and not given back, each block starts with its size */
+static size_t			 live;
+
+static void *
+c_malloc(void *arg, size_t sz)
+{
+	size_t			*p;
+
+	if ((p = malloc(sizeof *p + sz)) == NULL)
+		return (NULL);
+	*p = sz;
+	__atomic_add_fetch(&live, sz, __ATOMIC_RELAXED);
+	return (p + 1);
+}
+
+static void *
+c_realloc(void *arg, void *ptr, size_t sz)
+{
+	size_t			*p;
+
+	if (ptr == NULL)
+		return (c_malloc(arg, sz));
+	p = (size_t *)ptr - 1;
+	__atomic_sub_fetch(&live, *p, __ATOMIC_RELAXED);
+	if ((p = realloc(p, sizeof *p + sz)) == NULL)
+		return (NULL);
+	*p = sz;
+	__atomic_add_fetch(&live, sz, __ATOMIC_RELAXED);
+	return (p + 1);
+}
+
+static void
+c_free(void *arg, void *ptr)
+{
+	size_t			*p;
+
+	if (ptr == NULL)
+		return;
+	p = (size_t *)ptr - 1;
+	__atomic_sub_fetch(&live, *p, __ATOMIC_RELAXED);
+	free(p);
+}
+
+/* a recycling document parsed in parallel over and over must not grow */
+static void
+recycled(int pflags)
+{
+	struct xmlsd_allocator	 mm = { c_malloc, c_realloc, c_free };
+	struct xmlsd_document	*xd;
+	char			*b;
+	size_t			 sz, first = 0;
+	int			 i;
+
+	b = build(HEAD_PLAIN, TAIL_PLAIN, ENTRIES, 0, &sz);
+	if (xmlsd_doc_alloc_mm(&xd, XMLSD_DOC_F_RECYCLE, &mm) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_mm");
+	for (i = 0; i < RECYCLE_ROUNDS; i++) {
+		xmlsd_doc_clear(xd);
+		if (xmlsd_parse_mem_parallel(b, sz, xd, pflags, 4) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "recycled parse %d", i);
+		if (i == 0)
+			first = live;
+	}
+	if (live > first + first / 4)
+		errx(1, "recycled parses grew from %zu to %zu bytes", first,
+		    live);
+	xmlsd_doc_free(xd);
+	if (live != 0)
+		errx(1, "%zu bytes not given back", live);
+	free(b);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval		 now, d;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &d);
+	return (d.tv_sec + d.tv_usec / 1e6);
+}
+
+/* time parsing a large document serially and with some numbers of threads */
+static void
+bench(void)
+{
+	struct xmlsd_document	*xd;
+	struct timeval		 start;
+	const char		*name;
+	char			*b;
+	size_t			 sz;
+	int			 nthreads[] = { 2, 4, 8, 0 };
+	int			 i, j, flags, rv;
+
+	b = build(HEAD_PLAIN, TAIL_PLAIN, ENTRIES * 10, 0, &sz);
+	if (xmlsd_doc_alloc_flags(&xd, XMLSD_DOC_F_RECYCLE) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+	printf("%zu bytes x %d, %ld processors\n", sz, BENCH_LOOPS,
+	    sysconf(_SC_NPROCESSORS_ONLN));
+	for (flags = 0; flags <= XMLSD_PARSE_NATIVE; flags++) {
+		name = flags ? "native" : "expat ";
+		gettimeofday(&start, NULL);
+		for (i = 0; i < BENCH_LOOPS; i++) {
+			xmlsd_doc_clear(xd);
+			if (xmlsd_parse_mem_flags(b, sz, xd, flags) !=
+			    XMLSD_ERR_SUCCES)
+				errx(1, "xmlsd_parse_mem_flags");
+		}
+		printf("%s serial:      %.3fs\n", name, elapsed(&start));
+
+		for (j = 0; j < sizeof nthreads / sizeof nthreads[0]; j++) {
+			gettimeofday(&start, NULL);
+			for (i = 0; i < BENCH_LOOPS; i++) {
+				xmlsd_doc_clear(xd);
+				if ((rv = xmlsd_parse_mem_parallel(b, sz, xd,
+				    flags, nthreads[j])) != XMLSD_ERR_SUCCES)
+					errx(1, "xmlsd_parse_mem_parallel %d",
+					    rv);
+			}
+			if (nthreads[j] == 0)
+				printf("%s all threads: %.3fs\n", name,
+				    elapsed(&start));
+			else
+				printf("%s %d threads:   %.3fs\n", name,
+				    nthreads[j], elapsed(&start));
+		}
+	}
+	xmlsd_doc_free(xd);
+	free(b);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd;
+	const char		*small = "<a><b>x</b>y</a>";
+	char			*b;
+	size_t			 sz;
+	int			 c, pflags, bflag = 0;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bflag = 1;
+			break;
+		default:
+			errx(1, "usage: parallel [-b]");
+		}
+	}
+
+	for (pflags = 0; pflags <= XMLSD_PARSE_NATIVE; pflags++) {
+		b = build(HEAD_PROLOG, TAIL_PLAIN, ENTRIES, 0, &sz);
+		check("prolog", b, sz, 0, pflags);
+		check("prolog", b, sz, XMLSD_DOC_F_RECYCLE, pflags);
+		check("prolog", b, sz, XMLSD_DOC_F_BORROW, pflags);
+		check("prolog", b, sz, XMLSD_DOC_F_FREEZE, pflags);
+		check("prolog", b, sz, XMLSD_DOC_F_RECYCLE |
+		    XMLSD_DOC_F_BORROW | XMLSD_DOC_F_FREEZE, pflags);
+		free(b);
+
+		b = build(HEAD_PLAIN, TAIL_TEXT, ENTRIES, 0, &sz);
+		check("root text", b, sz, 0, pflags);
+		check("root text", b, sz, XMLSD_DOC_F_RECYCLE, pflags);
+		check("root text", b, sz, XMLSD_DOC_F_BORROW, pflags);
+		free(b);
+
+		/* these are parsed in one go or fail the same way */
+		b = build(HEAD_DTD, TAIL_PLAIN, ENTRIES, 0, &sz);
+		check("dtd", b, sz, 0, pflags);
+		free(b);
+		b = build(HEAD_PLAIN, TAIL_PLAIN, ENTRIES, ENTRIES - 10, &sz);
+		check("broken entry", b, sz, 0, pflags);
+		check("broken entry", b, sz, XMLSD_DOC_F_RECYCLE, pflags);
+		free(b);
+		b = build(HEAD_PLAIN, TAIL_BAD, ENTRIES, 0, &sz);
+		check("broken tail", b, sz, 0, pflags);
+		free(b);
+		b = build(HEAD_PLAIN, "", ENTRIES, 0, &sz);
+		check("no end", b, sz, 0, pflags);
+		free(b);
+		check("small", small, strlen(small), 0, pflags);
+		recycled(pflags);
+	}
+
+	/* arguments */
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem_parallel(small, strlen(small), xd, 0x100, 0) !=
+	    XMLSD_ERR_INTEGRITY ||
+	    xmlsd_parse_mem_parallel(small, strlen(small), xd, 0, -1) !=
+	    XMLSD_ERR_INTEGRITY ||
+	    xmlsd_parse_mem_parallel(NULL, 1, xd, 0, 0) !=
+	    XMLSD_ERR_INTEGRITY)
+		errx(1, "bad arguments accepted");
+	xmlsd_doc_free(xd);
+
+	if (bflag)
+		bench();
+
+	return (0);
+}
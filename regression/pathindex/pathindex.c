@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <err.h>
+#include <string.h>
+
+const char			*doc =
+    "<filesystem version=\"1\">"
+    "<dir name=\"foo\"/>"
+    "<dir name=\"bar\">"
+    "<file name=\"a\"/><file name=\"b\"/><file name=\"c\"/>"
+    "<dir name=\"nested\"><file name=\"n\"/></dir>"
+    "</dir>"
+    "<dir name=\"baz\">"
+    "<file name=\"d\"/><file name=\"e\"/><file name=\"f\"/>"
+    "</dir>"
+    "<file name=\"top\"/>"
+    "</filesystem>";
+
+/* expect the `name' attributes of the elements on `path' to be `want' */
+static void
+check(struct xmlsd_document *xd, const char *path, const char *want)
+{
+	struct xmlsd_element		**xe;
+	size_t				 i, n;
+	char				 got[256];
+
+	got[0] = '\0';
+	xe = xmlsd_doc_find_path(xd, path, &n);
+	if ((xe == NULL) != (n == 0))
+		errx(1, "%s: %zu elements", path, n);
+	for (i = 0; i < n; i++) {
+		if (xmlsd_elem_get_attr(xe[i], "name") != NULL)
+			strlcat(got, xmlsd_elem_get_attr(xe[i], "name"),
+			    sizeof got);
+		else
+			strlcat(got, "-", sizeof got);
+	}
+	if (strcmp(got, want))
+		errx(1, "%s: got \"%s\" want \"%s\"", path, got, want);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document		*xd;
+	struct xmlsd_element		*xe;
+	size_t				 n;
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem(doc, strlen(doc), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	if (xmlsd_doc_index_paths(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_index_paths");
+
+	check(xd, "filesystem", "-");
+	check(xd, "dir.filesystem", "foobarbaz");
+	check(xd, "file.dir.filesystem", "abcdef");
+	check(xd, "file.filesystem", "top");
+	check(xd, "file.dir.dir.filesystem", "n");
+	check(xd, "file.dir", "");
+	check(xd, "dir", "");
+	check(xd, "nope.filesystem", "");
+	check(xd, "", "");
+	check(xd, ".filesystem", "");
+	check(xd, "dir..filesystem", "");
+	check(xd, "filesystem.", "");
+
+	/* adding and removing elements must be seen */
+	xe = xmlsd_doc_find_path(xd, "dir.filesystem", &n)[0];
+	if ((xe = xmlsd_doc_add_elem(xd, xe, "file")) == NULL ||
+	    xmlsd_elem_set_attr(xe, "name", "new"))
+		errx(1, "xmlsd_doc_add_elem");
+	check(xd, "file.dir.filesystem", "newabcdef");
+	xmlsd_doc_remove_elem(xd, xmlsd_doc_find_path(xd,
+	    "dir.filesystem", &n)[1]);
+	check(xd, "file.dir.filesystem", "newdef");
+	check(xd, "file.dir.dir.filesystem", "");
+
+	/* and freezing */
+	if (xmlsd_doc_freeze(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_freeze");
+	check(xd, "file.dir.filesystem", "newdef");
+
+	xmlsd_doc_clear(xd);
+	check(xd, "filesystem", "");
+
+	xmlsd_doc_free(xd);
+
+	printf("pathindex: PASS\n");
+
+	return (0);
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <err.h>
+#include <string.h>
+
+#define DEEP		(200)
+
+const char			*doc =
+    "<filesystem n=\"fs\">"
+    "<dir n=\"foo\" name=\"usr\"/>"
+    "<dir n=\"etc\" name=\"etc\">"
+    "<file n=\"a\"/><file n=\"b\" mode=\"x\"/><file n=\"c\"/>"
+    "<dir n=\"nested\" name=\"etc\"><file n=\"n1\"/><file n=\"n2\"/></dir>"
+    "</dir>"
+    "<dir n=\"baz\" name=\"var\">"
+    "<file n=\"d\" mode=\"x\"/><file n=\"e\"/><link n=\"l\"/>"
+    "</dir>"
+    "<file n=\"top\"/>"
+    "</filesystem>";
+
+struct test {
+	const char			*query;
+	const char			*want;
+} tests[] = {
+	{ "/filesystem",			"fs" },
+	{ "/dir",				"" },
+	{ "/filesystem/dir",			"foo etc baz" },
+	{ "/filesystem/dir/file",		"a b c d e" },
+	{ "/filesystem/*/*",			"a b c nested d e l" },
+	{ "//file",				"a b c n1 n2 d e top" },
+	{ "//dir[@name='etc']/file",		"a b c n1 n2" },
+	{ "//dir[@name = \"etc\"]/file[2]",	"b n2" },
+	{ "//dir[@name!='etc']",		"foo baz" },
+	{ "//file[@mode]",			"b d" },
+	{ "//file[1]",				"a n1 d top" },
+	{ "//file[@mode][1]",			"b d" },
+	{ "//file[1][@mode]",			"d" },
+	{ "/filesystem/dir[2]",			"etc" },
+	{ "/filesystem/dir[4]",			"" },
+	{ "/filesystem//file",			"a b c n1 n2 d e top" },
+	{ "//dir//file",			"a b c n1 n2 d e" },
+	{ "/*",					"fs" },
+	{ "//*[@n='l']",			"l" },
+	{ NULL,					NULL }
+};
+
+/* nested matches of a descendant step, reported once in document order */
+const char			*nesteddoc =
+    "<a n=\"a1\"><b n=\"b1\"/>"
+    "<a n=\"a2\"><b n=\"b2\"/><a n=\"a3\"><b n=\"b3\"/></a></a>"
+    "<b n=\"b4\"/></a>";
+
+struct test nested[] = {
+	{ "//a//b",				"b1 b2 b3 b4" },
+	{ "//a/b",				"b1 b2 b3 b4" },
+	{ "//a//a//b",				"b2 b3" },
+	{ "//a//a",				"a2 a3" },
+	{ "//*//*/b",				"b2 b3" },
+	{ "//a//b[1]",				"b1 b2 b3" },
+	{ NULL,					NULL }
+};
+
+const char			*bad[] = {
+	"", "filesystem", "/", "//", "/a[", "/a[]", "/a[0]", "/a[@]",
+	"/a[@b=]", "/a[@b='c]", "/a[@b='c'", "/a]", "/a/", "/a b",
+	"/a[99999999999999999999]", NULL
+};
+
+static int
+collect(struct xmlsd_element *xe, void *arg)
+{
+	char				*buf = arg;
+
+	if (buf[0] != '\0')
+		strlcat(buf, " ", 256);
+	strlcat(buf, xmlsd_elem_get_attr(xe, "n"), 256);
+
+	return (0);
+}
+
+static int
+count(struct xmlsd_element *xe, void *arg)
+{
+	(*(int *)arg)++;
+
+	return (0);
+}
+
+static int
+stop(struct xmlsd_element *xe, void *arg)
+{
+	return (42);
+}
+
+static void
+run(struct xmlsd_document *xd, struct test *t)
+{
+	struct xmlsd_query		*q;
+	char				 got[256];
+	int				 i;
+
+	for (i = 0; t[i].query != NULL; i++) {
+		if (xmlsd_query_compile(t[i].query, &q) !=
+		    XMLSD_ERR_SUCCES)
+			errx(1, "%s: does not compile", t[i].query);
+		got[0] = '\0';
+		if (xmlsd_query_exec(q, xd, collect, got) != 0)
+			errx(1, "%s: xmlsd_query_exec", t[i].query);
+		if (strcmp(got, t[i].want))
+			errx(1, "%s: got \"%s\" want \"%s\"", t[i].query,
+			    got, t[i].want);
+		xmlsd_query_free(q);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document		*xd;
+	struct xmlsd_element		*xe;
+	struct xmlsd_query		*q;
+	int				 i, n;
+
+	for (i = 0; bad[i] != NULL; i++)
+		if (xmlsd_query_compile(bad[i], &q) != XMLSD_ERR_PARSER)
+			errx(1, "\"%s\" compiles", bad[i]);
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem(doc, strlen(doc), xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+
+	/* the same with and without the indexes */
+	run(xd, tests);
+	if (xmlsd_doc_index_paths(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_index_paths");
+	run(xd, tests);
+	if (xmlsd_doc_freeze(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_freeze");
+	run(xd, tests);
+
+	if (xmlsd_query_compile("//file", &q) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_query_compile");
+	if (xmlsd_query_exec(q, xd, stop, NULL) != 42)
+		errx(1, "callback did not stop the query");
+	xmlsd_query_free(q);
+	xmlsd_doc_clear(xd);
+
+	if (xmlsd_parse_mem(nesteddoc, strlen(nesteddoc), xd) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse_mem");
+	run(xd, nested);
+	if (xmlsd_doc_index_paths(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_index_paths");
+	run(xd, nested);
+	xmlsd_doc_clear(xd);
+
+	/* position counters for every level of a deep descendant step */
+	xe = NULL;
+	for (i = 0; i < DEEP; i++) {
+		if ((xe = xmlsd_doc_add_elem(xd, xe, "d")) == NULL ||
+		    xmlsd_doc_add_elem(xd, xe, "leaf") == NULL ||
+		    xmlsd_doc_add_elem(xd, xe, "leaf") == NULL)
+			errx(1, "xmlsd_doc_add_elem");
+	}
+	if (xmlsd_query_compile("//leaf[2]", &q) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_query_compile");
+	n = 0;
+	if (xmlsd_query_exec(q, xd, count, &n) != 0 || n != DEEP)
+		errx(1, "//leaf[2]: %d", n);
+	xmlsd_query_free(q);
+	if (xmlsd_query_compile("//d//leaf[2]", &q) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_query_compile");
+	n = 0;
+	if (xmlsd_query_exec(q, xd, count, &n) != 0 || n != DEEP)
+		errx(1, "//d//leaf[2]: %d", n);
+	xmlsd_query_free(q);
+
+	xmlsd_doc_free(xd);
+
+	printf("query: PASS\n");
+
+	return (0);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <pthread.h>
+#include <err.h>
+#include <stdio.h>
+
+#define BIG			(100000)	/* elements in the large tree */
+#define THREADS			(4)
+#define THREAD_DOCS		(1000)	/* more than the queue holds */
+
+/* a document of `n' elements, each with an attribute and a value */
+static struct xmlsd_document *
+make(int n, int flags)
+{
+	struct xmlsd_document	*xd;
+	struct xmlsd_element	*root, *xe;
+	int			 i;
+
+	if (xmlsd_doc_alloc_flags(&xd, flags) != XMLSD_ERR_SUCCES ||
+	    (root = xmlsd_doc_add_elem(xd, NULL, "root")) == NULL)
+		errx(1, "make");
+	for (i = 0; i < n; i++)
+		if ((xe = xmlsd_doc_add_elem(xd, root, "e")) == NULL ||
+		    xmlsd_elem_set_attr_int32(xe, "n", i) ||
+		    xmlsd_elem_set_value(xe, "a value long enough to be "
+		    "allocated on its own"))
+			errx(1, "make");
+
+	return (xd);
+}
+
+static void *
+worker(void *arg)
+{
+	int			 i;
+
+	for (i = 0; i < THREAD_DOCS; i++)
+		xmlsd_doc_free_async(make(i % 50, i % 2 ?
+		    XMLSD_DOC_F_RECYCLE : 0));
+
+	return (NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pthread_t		 t[THREADS];
+	int			 i;
+
+	/* nothing to wait for yet */
+	xmlsd_doc_free_flush();
+	xmlsd_doc_free_shutdown();
+	xmlsd_doc_free_async(NULL);
+
+	xmlsd_doc_free_async(make(BIG, 0));
+	xmlsd_doc_free_async(make(BIG, XMLSD_DOC_F_RECYCLE));
+	xmlsd_doc_free_flush();
+
+	/* more at once than fit in the queue, from several threads */
+	for (i = 0; i < THREADS; i++)
+		if (pthread_create(&t[i], NULL, worker, NULL))
+			errx(1, "pthread_create");
+	for (i = 0; i < THREADS; i++)
+		pthread_join(t[i], NULL);
+	xmlsd_doc_free_flush();
+
+	/* shut down with documents still queued, then start over */
+	for (i = 0; i < 100; i++)
+		xmlsd_doc_free_async(make(100, 0));
+	xmlsd_doc_free_shutdown();
+	xmlsd_doc_free_shutdown();
+	xmlsd_doc_free_async(make(BIG, 0));
+	xmlsd_doc_free_shutdown();
+
+	return (0);
+}
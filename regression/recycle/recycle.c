@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#define XMLSD_MEM_MAXSIZE	(10 * 1024 * 1024)
+#define ITERATIONS		(1000)
+#define STEADY_ROUNDS		(50)
+#define STEADY_ELEMS		(300)
+#define STEADY_ATTR		(20 * 1024)
+
+extern char			*__progname;
+
+/* bytes handed out and not given back, each block starts with its size */
+static size_t			 live;
+
+static void *
+c_malloc(void *arg, size_t sz)
+{
+	size_t				*p;
+
+	if ((p = malloc(sizeof *p + sz)) == NULL)
+		return (NULL);
+	*p = sz;
+	live += sz;
+	return (p + 1);
+}
+
+static void *
+c_realloc(void *arg, void *ptr, size_t sz)
+{
+	size_t				*p;
+
+	if (ptr == NULL)
+		return (c_malloc(arg, sz));
+	p = (size_t *)ptr - 1;
+	live -= *p;
+	if ((p = realloc(p, sizeof *p + sz)) == NULL)
+		return (NULL);
+	*p = sz;
+	live += sz;
+	return (p + 1);
+}
+
+static void
+c_free(void *arg, void *ptr)
+{
+	size_t				*p;
+
+	if (ptr == NULL)
+		return;
+	p = (size_t *)ptr - 1;
+	live -= *p;
+	free(p);
+}
+
+/*
+ * Parse `b' into a recycling document with `flags' round after round and
+ * make sure it holds on to the same memory from the second round on.
+ */
+static void
+steady(const char *what, const char *b, size_t sz, int flags)
+{
+	struct xmlsd_allocator		 mm = { c_malloc, c_realloc, c_free };
+	struct xmlsd_document		*xd;
+	size_t				 held = 0;
+	int				 i;
+
+	if (xmlsd_doc_alloc_mm(&xd, flags, &mm) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_mm");
+	for (i = 0; i < STEADY_ROUNDS; i++) {
+		if (xmlsd_parse_mem(b, sz, xd) != XMLSD_ERR_SUCCES)
+			errx(1, "%s: xmlsd_parse %d", what, i);
+		xmlsd_doc_clear(xd);
+		if (i == 1)
+			held = live;
+		else if (i > 1 && live != held)
+			errx(1, "%s: round %d holds %zu bytes, not %zu", what,
+			    i, live, held);
+	}
+	xmlsd_doc_free(xd);
+	if (live != 0)
+		errx(1, "%s: %zu bytes not given back", what, live);
+}
+
+/*
+ * Parse the same file over and over into a recycling document and make
+ * sure every round generates exactly what a fresh document does.
+ */
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document		*xd, *rxd;
+	int				f, i;
+	char				*b, *want, *got;
+	struct stat			sb;
+	size_t				n;
+
+	if (argc != 2)
+		errx(1, "usage %s <filename>", __progname);
+	f = open(argv[1], O_RDONLY, 0);
+	if (f == -1)
+		err(1, "open");
+	if (fstat(f, &sb) == -1)
+		err(1, "stat");
+	if (sb.st_size > XMLSD_MEM_MAXSIZE)
+		errx(1, "file too big");
+	b = malloc(sb.st_size);
+	if (b == NULL)
+		err(1, "malloc");
+	if (read(f, b, sb.st_size) != sb.st_size)
+		err(1, "read");
+	close(f);
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if (xmlsd_parse_mem(b, sb.st_size, xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_parse");
+	want = xmlsd_generate(xd, malloc, NULL, 0);
+	if (want == NULL)
+		errx(1, "xmlsd_generate");
+	xmlsd_doc_free(xd);
+
+	if (xmlsd_doc_alloc_flags(&rxd, XMLSD_DOC_F_RECYCLE) !=
+	    XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc_flags");
+	for (i = 0; i < ITERATIONS; i++) {
+		if (xmlsd_parse_mem(b, sb.st_size, rxd) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_parse %d", i);
+		got = xmlsd_generate(rxd, malloc, NULL, 0);
+		if (got == NULL)
+			errx(1, "xmlsd_generate %d", i);
+		if (strcmp(want, got))
+			errx(1, "round %d differs:\n%s\n%s", i, want, got);
+		free(got);
+		xmlsd_doc_clear(rxd);
+	}
+	xmlsd_doc_free(rxd);
+
+	/* frozen documents and large values come in allocations of their own */
+	if ((got = malloc(STEADY_ELEMS * 32 + STEADY_ATTR + 64)) == NULL)
+		err(1, "malloc");
+	n = snprintf(got, 32, "<root>");
+	for (i = 0; i < STEADY_ELEMS; i++)
+		n += snprintf(got + n, 32, "<e n=\"%d\">%d</e>", i, i);
+	n += snprintf(got + n, 32, "</root>");
+	steady("frozen", got, n, XMLSD_DOC_F_RECYCLE | XMLSD_DOC_F_FREEZE);
+	n = snprintf(got, 32, "<root a=\"");
+	memset(got + n, 'a', STEADY_ATTR);
+	n += STEADY_ATTR;
+	n += snprintf(got + n, 32, "\"/>");
+	steady("large attribute", got, n, XMLSD_DOC_F_RECYCLE);
+	free(got);
+
+	printf("%s: %d rounds PASS\n", argv[1], ITERATIONS);
+
+	free(want);
+	free(b);
+
+	return (0);
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <pthread.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ATTRS			(12)	/* enough for an attribute index */
+#define ITEMS			(10)	/* enough for a child index */
+#define THREADS			(4)
+#define THREAD_LOOPS		(2000)
+#define VERSIONS		(200)
+
+static const char	blob[] = "\0sealed\377";
+
+struct reader {
+	struct xmlsd_document	*xd;
+	struct xmlsd_doc_slot	*slot;
+	int			*stop;
+	int			 seen;
+};
+
+/* a document of version `gen' with a bit of everything to look up */
+static struct xmlsd_document *
+make(int gen)
+{
+	struct xmlsd_document	*xd;
+	struct xmlsd_element	*root, *xe;
+	char			 xml[2048];
+	size_t			 n;
+	int			 i;
+
+	n = snprintf(xml, sizeof xml, "<root gen=\"%d\"", gen);
+	for (i = 0; i < ATTRS; i++)
+		n += snprintf(xml + n, sizeof xml - n, " a%d=\"%d\"", i,
+		    gen * 100 + i);
+	n += snprintf(xml + n, sizeof xml - n, " on=\"true\">");
+	for (i = 0; i < ITEMS; i++)
+		n += snprintf(xml + n, sizeof xml - n,
+		    "<item>%d</item><hex>%x</hex>", gen + i, gen + i);
+	n += snprintf(xml + n, sizeof xml - n,
+	    "<name>a string long enough to be copied out</name></root>");
+
+	if (xmlsd_doc_alloc_flags(&xd, XMLSD_DOC_F_BORROW) !=
+	    XMLSD_ERR_SUCCES || xmlsd_parse_mem(xml, n, xd) != XMLSD_ERR_SUCCES)
+		errx(1, "parse version %d", gen);
+
+	/* values that are only formatted when read */
+	root = xmlsd_doc_get_root(xd);
+	if ((xe = xmlsd_doc_add_elem(xd, root, "blob")) == NULL ||
+	    xmlsd_elem_set_value_b64(xe, blob, sizeof blob - 1) ||
+	    (xe = xmlsd_doc_add_elem(xd, root, "num")) == NULL ||
+	    xmlsd_elem_set_value_int64(xe, -gen))
+		errx(1, "add to version %d", gen);
+
+	if (xmlsd_doc_seal(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_seal");
+	/* nothing may borrow from the input */
+	memset(xml, 'x', sizeof xml);
+
+	return (xd);
+}
+
+/* look everything up, returns the version of `xd' */
+static int
+check(struct xmlsd_document *xd)
+{
+	struct xmlsd_element	*root, *xe, **xep;
+	const char		*errstr;
+	char			 b[64], s[32];
+	size_t			 n, len;
+	int			 gen, i, on;
+
+	root = xmlsd_doc_get_root(xd);
+	gen = xmlsd_elem_get_attr_strtonum(root, "gen", 0, VERSIONS, &errstr);
+	if (errstr != NULL)
+		errx(1, "gen %s", errstr);
+	for (i = ATTRS - 1; i >= 0; i--) {
+		snprintf(s, sizeof s, "a%d", i);
+		if (xmlsd_elem_get_attr_strtonum(root, s, 0, 1000000,
+		    &errstr) != gen * 100 + i || errstr != NULL)
+			errx(1, "attribute %s", s);
+	}
+	if (xmlsd_elem_get_attr_boolean(root, "on", &on, 0) || !on)
+		errx(1, "boolean attribute");
+
+	for (i = 0, xe = xmlsd_elem_find_child(root, "item"); xe != NULL;
+	    xe = xmlsd_elem_find_child_next(root, xe), i++)
+		if (xmlsd_elem_get_value_strtonum(xe, 0, 1000000,
+		    &errstr) != gen + i || errstr != NULL)
+			errx(1, "item %d", i);
+	if (i != ITEMS || xmlsd_elem_count_children(root, "hex") != ITEMS)
+		errx(1, "children");
+	if ((xep = xmlsd_doc_find_path(xd, "hex.root", &n)) == NULL ||
+	    n != ITEMS)
+		errx(1, "xmlsd_doc_find_path");
+	for (i = 0; i < n; i++)
+		if (xmlsd_elem_get_value_hexnum(xep[i], 0, 1000000,
+		    &errstr) != gen + i || errstr != NULL)
+			errx(1, "hex %d", i);
+
+	len = sizeof b;
+	if (xmlsd_elem_get_value_b64(xmlsd_elem_find_child(root, "blob"),
+	    b, &len) != XMLSD_ERR_SUCCES || len != sizeof blob - 1 ||
+	    memcmp(b, blob, len) ||
+	    strcmp(xmlsd_elem_get_value(xmlsd_elem_find_child(root, "blob")),
+	    "AHNlYWxlZP8="))
+		errx(1, "blob");
+	snprintf(s, sizeof s, "%d", -gen);
+	if (strcmp(xmlsd_elem_get_value(xmlsd_elem_find_child(root, "num")),
+	    s) || strcmp(xmlsd_elem_get_value(xmlsd_elem_find_child(root,
+	    "name")), "a string long enough to be copied out"))
+		errx(1, "values");
+
+	return (gen);
+}
+
+static void *
+reader(void *arg)
+{
+	struct reader		*r = arg;
+	int			 i;
+
+	for (i = 0; i < THREAD_LOOPS; i++)
+		check(r->xd);
+
+	return (NULL);
+}
+
+static void *
+slot_reader(void *arg)
+{
+	struct reader		*r = arg;
+	struct xmlsd_document	*xd;
+	int			 gen;
+
+	while (!__atomic_load_n(r->stop, __ATOMIC_RELAXED)) {
+		if ((xd = xmlsd_doc_slot_get(r->slot)) == NULL)
+			errx(1, "empty slot");
+		if ((gen = check(xd)) < r->seen)
+			errx(1, "version %d after %d", gen, r->seen);
+		r->seen = gen;
+		xmlsd_doc_unref(xd);
+	}
+
+	return (NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd, *copy;
+	struct xmlsd_element	*root, *xe;
+	struct xmlsd_doc_slot	*slot;
+	struct reader		 r[THREADS];
+	pthread_t		 t[THREADS];
+	int			 i, stop = 0;
+
+	xd = make(1);
+	root = xmlsd_doc_get_root(xd);
+	xe = xmlsd_elem_get_first_child(root);
+	if (!xmlsd_doc_is_sealed(xd) || xmlsd_doc_seal(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "not sealed");
+	check(xd);
+
+	/* nothing may change */
+	if (xmlsd_doc_add_elem(xd, root, "x") != NULL ||
+	    xmlsd_elem_set_attr(root, "x", "1") == 0 ||
+	    xmlsd_elem_set_attr_int32(root, "a0", 1) == 0 ||
+	    xmlsd_elem_set_value(xe, "1") == 0 ||
+	    xmlsd_elem_set_value_x64(xe, 1) == 0 ||
+	    xmlsd_elem_set_value_b64(xe, "1", 1) == 0 ||
+	    xmlsd_elem_detach(xd, xe) == XMLSD_ERR_SUCCES ||
+	    xmlsd_elem_clone_into(xd, root, xe) != NULL ||
+	    xmlsd_doc_freeze(xd) == XMLSD_ERR_SUCCES ||
+	    xmlsd_parse_mem("<a/>", 4, xd) == XMLSD_ERR_SUCCES)
+		errx(1, "sealed document changed");
+	xmlsd_doc_remove_elem(xd, xe);
+	xmlsd_doc_clear(xd);
+	if (xmlsd_elem_get_first_child(root) != xe || check(xd) != 1)
+		errx(1, "sealed document emptied");
+
+	/* copies are not sealed */
+	if (xmlsd_doc_clone(&copy, xd) != XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_is_sealed(copy) ||
+	    xmlsd_elem_set_attr(xmlsd_doc_get_root(copy), "x", "1") ||
+	    xmlsd_doc_seal(copy) != XMLSD_ERR_SUCCES || check(copy) != 1)
+		errx(1, "copy");
+	xmlsd_doc_free(copy);
+
+	/* many readers at once */
+	for (i = 0; i < THREADS; i++) {
+		r[i].xd = xd;
+		if (pthread_create(&t[i], NULL, reader, &r[i]))
+			errx(1, "pthread_create");
+	}
+	for (i = 0; i < THREADS; i++)
+		pthread_join(t[i], NULL);
+
+	/* the last reference frees it */
+	xmlsd_doc_ref(xd);
+	xmlsd_doc_ref(xd);
+	xmlsd_doc_unref(xd);
+	xmlsd_doc_unref(xd);
+	check(xd);
+	xmlsd_doc_unref(xd);
+
+	/* new versions published while being read */
+	if (xmlsd_doc_slot_alloc(&slot) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_slot_alloc");
+	if (xmlsd_doc_slot_get(slot) != NULL)
+		errx(1, "slot not empty");
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_slot_set(slot, xd) != XMLSD_ERR_INTEGRITY)
+		errx(1, "unsealed document published");
+	xmlsd_doc_free(xd);
+	if (xmlsd_doc_slot_set(slot, make(0)) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_slot_set");
+	for (i = 0; i < THREADS; i++) {
+		r[i].slot = slot;
+		r[i].stop = &stop;
+		r[i].seen = 0;
+		if (pthread_create(&t[i], NULL, slot_reader, &r[i]))
+			errx(1, "pthread_create");
+	}
+	for (i = 1; i < VERSIONS; i++)
+		if (xmlsd_doc_slot_set(slot, make(i)) != XMLSD_ERR_SUCCES)
+			errx(1, "xmlsd_doc_slot_set");
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(t[i], NULL);
+
+	/* readers keep what they hold when the slot is emptied */
+	xd = xmlsd_doc_slot_get(slot);
+	if (xmlsd_doc_slot_set(slot, NULL) != XMLSD_ERR_SUCCES ||
+	    xmlsd_doc_slot_get(slot) != NULL || check(xd) != VERSIONS - 1)
+		errx(1, "emptied slot");
+	xmlsd_doc_unref(xd);
+	xmlsd_doc_slot_set(slot, make(1));
+	xmlsd_doc_slot_free(slot);
+
+	return (0);
+}
@@ -34,22 +34,26 @@ int				created;
 pthread_mutex_t			mtx;
 
 static void
-print_element(struct xmlsd_element *xe)
+print_element(struct xmlsd_element *top)
 {
-	struct xmlsd_element		*xc;
+	struct xmlsd_walk		 xw;
+	struct xmlsd_element		*xe;
 	struct xmlsd_attribute		*xa;
 
-	fprintf(stderr, "%d %s = %s (parent = %s)\n",
-	    xmlsd_elem_get_depth(xe),
-	    xmlsd_elem_get_name(xe),
-	    xmlsd_elem_get_value(xe) ? xmlsd_elem_get_value(xe) : "NOVAL",
-	    xmlsd_elem_get_parent(xe) ?
-	        xmlsd_elem_get_name(xmlsd_elem_get_parent(xe)) :"NOPARENT");
-	XMLSD_ELEM_FOREACH_ATTR(xa, xe)
-		fprintf(stderr, "\t%s = %s\n", xmlsd_attr_get_name(xa),
-		    xmlsd_attr_get_value(xa));
-	XMLSD_ELEM_FOREACH_CHILDREN(xc, xe)
-		print_element(xc);
+	xmlsd_walk_init(&xw, top, XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		fprintf(stderr, "%d %s = %s (parent = %s)\n",
+		    xmlsd_elem_get_depth(xe),
+		    xmlsd_elem_get_name(xe),
+		    xmlsd_elem_get_value(xe) ? xmlsd_elem_get_value(xe) :
+		    "NOVAL",
+		    xmlsd_elem_get_parent(xe) ?
+			xmlsd_elem_get_name(xmlsd_elem_get_parent(xe)) :
+			"NOPARENT");
+		XMLSD_ELEM_FOREACH_ATTR(xa, xe)
+			fprintf(stderr, "\t%s = %s\n", xmlsd_attr_get_name(xa),
+			    xmlsd_attr_get_value(xa));
+	}
 }
 
 void *
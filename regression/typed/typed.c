@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../../xmlsd.h"
+
+#include <sys/time.h>
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_LOOPS	(2000000)
+#define MANY		(40)	/* names, more than fit on the stack */
+
+const char *tests[] = {
+	"0", "1", "-1", "+1", "42", "007", " 12", "\t-3", "12 ", "",
+	" ", "-", "+", "x", "1x", "0x", "0x1f", "0X1F", "1f", "-0x10",
+	"ff", "FFFFFFFFFFFFFFFF", "10000000000000000", "0x0000000000000000001",
+	"9223372036854775807", "9223372036854775808",
+	"-9223372036854775808", "-9223372036854775809",
+	"00000000000000000000000000009", "99999999999999999999",
+	"18446744073709551615", "18446744073709551616",
+	"true", "false", "TRUE", "yes", "2", "01",
+	NULL
+};
+
+struct range {
+	long long		min, max;
+} ranges[] = {
+	{ LLONG_MIN, LLONG_MAX },
+	{ 0, 100 },
+	{ -5, 5 },
+	{ 10, 1 },
+};
+
+struct hrange {
+	unsigned long long	min, max;
+} hranges[] = {
+	{ 0, ULLONG_MAX },
+	{ 0, 0xff },
+	{ 0x10, 0x20 },
+	{ 10, 1 },
+};
+
+#define NRANGES		(sizeof ranges / sizeof ranges[0])
+
+/* what xmlsd_elem_get_attr_hexnum() used to do, without the inverted check */
+static unsigned long long
+ref_hexnum(const char *str, unsigned long long minval,
+    unsigned long long maxval, const char **errstr)
+{
+	char			*end;
+	unsigned long long	 val = 0;
+
+	*errstr = NULL;
+	if (minval > maxval) {
+		*errstr = "invalid";
+	} else {
+		errno = 0;
+		val = strtoull(str, &end, 16);
+		if (str == end || *end != '\0')
+			*errstr = "invalid";
+		else if (val < minval)
+			*errstr = "toosmall";
+		else if ((val == ULLONG_MAX && errno == ERANGE) ||
+		    val > maxval)
+			*errstr = "too large";
+	}
+	if (*errstr != NULL)
+		val = 0;
+	return (val);
+}
+
+static int
+ref_boolean(const char *s, int *b)
+{
+	if (!strcmp(s, "true") || !strcmp(s, "1"))
+		*b = 1;
+	else if (!strcmp(s, "false") || !strcmp(s, "0"))
+		*b = 0;
+	else
+		return (XMLSD_ERR_INTEGRITY);
+	return (0);
+}
+
+static int
+same(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a == b);
+	return (!strcmp(a, b));
+}
+
+/* every typed getter must agree with strtonum(3) and strtoull(3) */
+static void
+check(struct xmlsd_element *xe)
+{
+	const char		*names[] = { "v", "none", "v" }, *es[3];
+	const char		*s, *e1, *e2;
+	long long		 n1, n2, ns[3];
+	unsigned long long	 h1, h2;
+	size_t			 i;
+	int			 pass, b1, b2, r1, r2;
+
+	s = xmlsd_elem_get_attr(xe, "v");
+	if (xmlsd_attr_get_value_len(xmlsd_elem_find_attr(xe, "v")) !=
+	    strlen(s) || xmlsd_elem_get_value_len(xe) !=
+	    strlen(xmlsd_elem_get_value(xe)))
+		errx(1, "length of \"%s\"", s);
+
+	/* twice, the second time comes from the cache */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < NRANGES; i++) {
+			n1 = strtonum(s, ranges[i].min, ranges[i].max, &e1);
+			n2 = xmlsd_elem_get_attr_strtonum(xe, "v",
+			    ranges[i].min, ranges[i].max, &e2);
+			if (n1 != n2 || !same(e1, e2))
+				errx(1, "strtonum \"%s\": %lld %s != %lld %s",
+				    s, n1, e1, n2, e2);
+			n2 = xmlsd_elem_get_value_strtonum(xe,
+			    ranges[i].min, ranges[i].max, &e2);
+			if (n1 != n2 || !same(e1, e2))
+				errx(1, "value strtonum \"%s\"", s);
+			if (xmlsd_elem_get_attrs_strtonum(xe, names, ns, es, 3,
+			    ranges[i].min, ranges[i].max) != (e1 ? 0 : 2) ||
+			    ns[0] != n1 || !same(es[0], e1) || ns[2] != n1 ||
+			    !same(es[2], e1) || ns[1] != 0 ||
+			    !same(es[1], "attr not found"))
+				errx(1, "attrs strtonum \"%s\"", s);
+
+			h1 = ref_hexnum(s, hranges[i].min, hranges[i].max,
+			    &e1);
+			h2 = xmlsd_elem_get_attr_hexnum(xe, "v",
+			    hranges[i].min, hranges[i].max, &e2);
+			if (h1 != h2 || !same(e1, e2))
+				errx(1, "hexnum \"%s\": %llx %s != %llx %s",
+				    s, h1, e1, h2, e2);
+			h2 = xmlsd_elem_get_value_hexnum(xe,
+			    hranges[i].min, hranges[i].max, &e2);
+			if (h1 != h2 || !same(e1, e2))
+				errx(1, "value hexnum \"%s\"", s);
+		}
+
+		b1 = b2 = -1;
+		r1 = ref_boolean(s, &b1);
+		r2 = xmlsd_elem_get_attr_boolean(xe, "v", &b2, 0);
+		if (r1 != r2 || b1 != b2)
+			errx(1, "boolean \"%s\"", s);
+		b2 = -1;
+		r2 = xmlsd_elem_get_value_boolean(xe, &b2, 0);
+		if (r1 != r2 || b1 != b2)
+			errx(1, "value boolean \"%s\"", s);
+	}
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval		 now, d;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &d);
+	return (d.tv_sec + d.tv_usec / 1e6);
+}
+
+/* the old getters parsed the string on every call */
+static void
+bench(struct xmlsd_element *xe)
+{
+	struct timeval		 start;
+	const char		*errstr;
+	long long		 sum = 0;
+	int			 i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_LOOPS; i++)
+		sum += strtonum(xmlsd_elem_get_attr(xe, "v"), 0, LLONG_MAX,
+		    &errstr);
+	printf("strtonum:      %.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_LOOPS; i++)
+		sum -= xmlsd_elem_get_attr_strtonum(xe, "v", 0, LLONG_MAX,
+		    &errstr);
+	printf("attr_strtonum: %.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_LOOPS; i++)
+		sum += ref_hexnum(xmlsd_elem_get_attr(xe, "v"), 0,
+		    ULLONG_MAX, &errstr);
+	printf("strtoull:      %.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_LOOPS; i++)
+		sum -= xmlsd_elem_get_attr_hexnum(xe, "v", 0, ULLONG_MAX,
+		    &errstr);
+	printf("attr_hexnum:   %.3fs\n", elapsed(&start));
+
+	if (sum != 0)
+		errx(1, "bench: results differ");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct xmlsd_document	*xd;
+	struct xmlsd_element	*root, *xe;
+	const char		*errstr, *many[MANY], *errs[MANY];
+	long long		 nums[MANY];
+	int			 i, j, c, bflag = 0;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bflag = 1;
+			break;
+		default:
+			errx(1, "usage: typed [-b]");
+		}
+	}
+
+	if (xmlsd_doc_alloc(&xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_alloc");
+	if ((root = xmlsd_doc_add_elem(xd, NULL, "root")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	for (i = 0; tests[i] != NULL; i++) {
+		if ((xe = xmlsd_doc_add_elem(xd, root, "t")) == NULL)
+			errx(1, "xmlsd_doc_add_elem");
+		if (xmlsd_elem_set_attr(xe, "v", tests[i]) ||
+		    xmlsd_elem_set_value(xe, tests[i]))
+			errx(1, "xmlsd_elem_set_attr");
+		check(xe);
+	}
+
+	/* native numbers decode without going through their digits */
+	if ((xe = xmlsd_doc_add_elem(xd, root, "n")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	if (xmlsd_elem_set_attr_uint64(xe, "v", ULLONG_MAX) ||
+	    xmlsd_elem_set_value_uint64(xe, ULLONG_MAX) ||
+	    xmlsd_elem_set_attr_int64(xe, "i", LLONG_MIN) ||
+	    xmlsd_elem_set_attr_x32(xe, "h", 0xdead))
+		errx(1, "xmlsd_elem_set_attr_uint64");
+	xmlsd_elem_get_attr_strtonum(xe, "v", 0, LLONG_MAX, &errstr);
+	if (errstr == NULL || strcmp(errstr, "too large"))
+		errx(1, "uint64 strtonum");
+	if (xmlsd_elem_get_attr_strtonum(xe, "i", LLONG_MIN, 0, &errstr) !=
+	    LLONG_MIN || errstr != NULL)
+		errx(1, "int64 strtonum");
+	if (xmlsd_elem_get_attr_hexnum(xe, "h", 0, 0xffff, &errstr) !=
+	    0xdead || errstr != NULL)
+		errx(1, "x32 hexnum");
+	xmlsd_elem_get_attr_strtonum(xe, "h", 0, LLONG_MAX, &errstr);
+	if (errstr == NULL || strcmp(errstr, "invalid"))
+		errx(1, "x32 strtonum");
+	/* more names than are matched in one pass */
+	for (j = 0; j < MANY; j++)
+		many[j] = j % 2 ? "i" : "v";
+	if (xmlsd_elem_get_attrs_strtonum(xe, many, nums, errs, MANY,
+	    LLONG_MIN, 0) != MANY / 2)
+		errx(1, "attrs strtonum");
+	for (j = 0; j < MANY; j++)
+		if (j % 2 ? nums[j] != LLONG_MIN || errs[j] != NULL :
+		    errs[j] == NULL || strcmp(errs[j], "too large"))
+			errx(1, "attrs strtonum %d", j);
+	check(xe);
+
+	/* a new value must not see what the old one decoded to */
+	if ((xe = xmlsd_doc_add_elem(xd, root, "s")) == NULL)
+		errx(1, "xmlsd_doc_add_elem");
+	if (xmlsd_elem_set_value(xe, "-17") ||
+	    xmlsd_elem_get_value_strtonum(xe, -100, 0, &errstr) != -17 ||
+	    xmlsd_elem_set_value(xe, "17") ||
+	    xmlsd_elem_get_value_strtonum(xe, 0, 100, &errstr) != 17 ||
+	    errstr != NULL)
+		errx(1, "stale value");
+	if (xmlsd_elem_set_attr(xe, "v", "17") ||
+	    xmlsd_elem_set_value(xe, "17"))
+		errx(1, "xmlsd_elem_set_attr");
+
+	/* decoded values survive freezing */
+	if (xmlsd_doc_freeze(xd) != XMLSD_ERR_SUCCES)
+		errx(1, "xmlsd_doc_freeze");
+	XMLSD_ELEM_FOREACH_CHILDREN(xe, xmlsd_doc_get_root(xd))
+		check(xe);
+
+	if (bflag) {
+		xe = xmlsd_doc_add_elem(xd, xmlsd_doc_get_root(xd), "bench");
+		if (xe == NULL || xmlsd_elem_set_attr(xe, "v", "1234567890"))
+			errx(1, "bench element");
+		bench(xe);
+	}
+
+	xmlsd_doc_free(xd);
+
+	fprintf(stderr, "typed: %d values ok\n", i);
+
+	return (0);
+}
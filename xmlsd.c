@@ -21,6 +21,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <err.h>
 #include <string.h>
 #include <poll.h>
@@ -38,31 +39,51 @@ static const char *vertag = XMLSD_VERSION;
 
 struct xmlsd_context {
 	XML_Parser			xml_parser;
+	struct xmlsd_native		*native;	/* instead of expat */
+	struct xmlsd_parse_cache	*cache;
+	const struct xmlsd_allocator	*mm_prev;	/* of this thread */
 	XML_Char			*value;
 	int				value_at;
 	int				tot_size;
 	int				depth;
 	int				saved_rv;
 
+	/* XMLSD_DOC_F_BORROW, values may point into src */
+	const char			*src;
+	size_t				src_len;
+	size_t				src_skip;	/* fed before src */
+	size_t				value_off;
+	int				value_borrow;
+	int				part;
+
 	struct xmlsd_document		*xml_el;
 	struct xmlsd_element		*xml_last;
 };
 
 #define XMLSD_ABORT(_ctx, _rv)	do {			\
 	(_ctx)->saved_rv = _rv;				\
-	XML_StopParser((_ctx)->xml_parser, XML_FALSE);	\
+	if ((_ctx)->native != NULL)			\
+		(_ctx)->native->stop = 1;		\
+	else						\
+		XML_StopParser((_ctx)->xml_parser, XML_FALSE); \
 	return;						\
 } while (0)
 
 
 static enum xmlsd_validate_reason
 		xmlsd_calc_path(struct xmlsd_element *, char *, size_t);
+static size_t	xmlsd_byte_index(struct xmlsd_context *);
 static void	xmlsd_chardata(void *, const XML_Char *, int);
+static const char *
+		xmlsd_borrow_attr(struct xmlsd_context *, const char **,
+		    const char *, const char *, size_t *);
+static int	xmlsd_borrow_span(struct xmlsd_context *, size_t,
+		    const char *, size_t);
 static void	xmlsd_end(void *, const char *);
 static int	xmlsd_occurrences(struct xmlsd_element *, const char *);
-static void	xmlsd_parse_done(struct xmlsd_context *);
+static int	xmlsd_parse_done(struct xmlsd_context *, int);
 static int	xmlsd_parse_setup(struct xmlsd_context *,
-		    struct xmlsd_document *);
+		    struct xmlsd_document *, int, struct xmlsd_parse_cache *);
 static void	xmlsd_start(void *, const char *, const char **);
 
 const char *
@@ -79,12 +100,74 @@ xmlsd_version(int *major, int *minor, int *patch)
 	*patch = XMLSD_VERSION_PATCH;
 }
 
+/* input offset of the event being handled */
+static size_t
+xmlsd_byte_index(struct xmlsd_context *ctx)
+{
+	if (ctx->native != NULL)
+		return (ctx->native->at);
+	return (XML_GetCurrentByteIndex(ctx->xml_parser) - ctx->src_skip);
+}
+
+/*
+ * Return 1 if the `len' characters at offset `off' of the input are the
+ * same as `s', in which case they can be borrowed instead of copied.
+ */
+static int
+xmlsd_borrow_span(struct xmlsd_context *ctx, size_t off, const char *s,
+    size_t len)
+{
+	if (off > ctx->src_len || len > ctx->src_len - off)
+		return (0);
+	return (!memcmp(ctx->src + off, s, len));
+}
+
+/*
+ * Find attribute `name' = `value' in the raw start tag at `*pp' and move
+ * `*pp' past it.  Returns the value in the input if expat did not have to
+ * change it, in which case the length is returned in `len'.  Sets `*pp'
+ * to NULL once the tag no longer matches what expat reported.
+ */
+static const char *
+xmlsd_borrow_attr(struct xmlsd_context *ctx, const char **pp,
+    const char *name, const char *value, size_t *len)
+{
+	const char		*p = *pp, *end = ctx->src + ctx->src_len, *q;
+	size_t			 nlen = strlen(name);
+
+	*pp = NULL;
+	while (p < end && isspace((unsigned char)*p))
+		p++;
+	if ((size_t)(end - p) < nlen || memcmp(p, name, nlen))
+		return (NULL);
+	for (p += nlen; p < end && isspace((unsigned char)*p); p++)
+		;
+	if (p == end || *p++ != '=')
+		return (NULL);
+	while (p < end && isspace((unsigned char)*p))
+		p++;
+	if (p == end || (*p != '"' && *p != '\''))
+		return (NULL);
+	if ((q = memchr(p + 1, *p, end - p - 1)) == NULL)
+		return (NULL);
+	*pp = q + 1;
+
+	/* entities and white space are replaced, those values differ */
+	p++;
+	*len = q - p;
+	if (strncmp(p, value, *len) || value[*len] != '\0')
+		return (NULL);
+	return (p);
+}
+
 static void
 xmlsd_chardata(void *data, const XML_Char *s, int len)
 {
 	int			newlen;
 	XML_Char		*newvalue;
 	struct	xmlsd_context	*ctx = data;
+	const XML_Char		*start = s;
+	size_t			off;
 
 	if (ctx == NULL)
 		errx(1, "xmlsd_chardata: no context");
@@ -93,7 +176,7 @@ xmlsd_chardata(void *data, const XML_Char *s, int len)
 	if (iscntrl(s[0]) && len == 1)
 		return;
 
-	if (ctx->value == NULL) {
+	if (ctx->value_at == 0) {
 		/* eat all blanks in front because expat isn't smart */
 		while (len > 0 && isblank(s[0])) {
 			s += 1;
@@ -101,11 +184,27 @@ xmlsd_chardata(void *data, const XML_Char *s, int len)
 		}
 		if (len == 0)
 			return;
+		ctx->value_borrow = ctx->src != NULL;
+		ctx->value_off = xmlsd_byte_index(ctx) +
+		    (s - start);
+
+		/* the buffer is kept for the whole parse */
+		if (ctx->value == NULL) {
+			ctx->value = xmlsd_mm_malloc(ctx->cache->mm,
+			    XMLSD_PAGE_SIZE);
+			if (ctx->value == NULL)
+				XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
+			bzero(ctx->value, XMLSD_PAGE_SIZE);
+			ctx->tot_size = XMLSD_PAGE_SIZE;
+		}
+	}
 
-		ctx->value = calloc(1, XMLSD_PAGE_SIZE);
-		if (ctx->value == NULL)
-			XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
-		ctx->tot_size += XMLSD_PAGE_SIZE;
+	/* keep borrowing as long as the pieces are the input in order */
+	if (ctx->value_borrow) {
+		off = xmlsd_byte_index(ctx) + (s - start);
+		if (off != ctx->value_off + ctx->value_at ||
+		    !xmlsd_borrow_span(ctx, off, s, len))
+			ctx->value_borrow = 0;
 	}
 
 	/* check for overflow (DO NOT FORGET NUL!) */
@@ -119,9 +218,9 @@ xmlsd_chardata(void *data, const XML_Char *s, int len)
 			return;
 		}
 
-		newvalue = realloc(ctx->value, newlen);
+		newvalue = xmlsd_mm_realloc(ctx->cache->mm, ctx->value, newlen);
 		if (newvalue == NULL) {
-			free(ctx->value);
+			xmlsd_mm_free(ctx->cache->mm, ctx->value);
 			ctx->value = NULL;
 			ctx->value_at = 0;
 			ctx->tot_size = 0;
@@ -144,45 +243,49 @@ xmlsd_start(void *data, const char *el, const char **attr)
 	struct xmlsd_context	*ctx = data;
 	struct xmlsd_element	*xe;
 	struct xmlsd_attribute	*xa;
+	const char		*p = NULL, *v;
+	size_t			 len;
 
 	if (ctx == NULL)
 		errx(1, "xmlsd_start: no context");
 
-	xe = calloc(1, sizeof *xe);
+	xe = xmlsd_doc_elem_alloc(ctx->xml_el, el);
 	if (xe == NULL)
 		XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
 
 	if (ctx->xml_last != NULL) {
-		TAILQ_INSERT_TAIL(&ctx->xml_last->children, xe, entry);
+		xmlsd_elem_add_child(ctx->xml_last, xe);
 	} else { /* top level */
 		/* XXX verify this is the first and only */
 		ctx->xml_el->root = xe;
 	}
-	xe->name = strdup(el);
-	if (xe->name == NULL)
-		XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
-	TAILQ_INIT(&xe->children);
 	xe->parent = ctx->xml_last;
 	ctx->xml_last = xe;
-	TAILQ_INIT(&xe->attr_list);
+
+	/* the attributes follow the element name in the input */
+	if (ctx->src != NULL && attr[0] != NULL) {
+		len = xmlsd_byte_index(ctx);
+		if (xmlsd_borrow_span(ctx, len, "<", 1) &&
+		    xmlsd_borrow_span(ctx, len + 1, el, xe->namelen))
+			p = ctx->src + len + 1 + xe->namelen;
+	}
 
 	for (i = 0; attr[i]; i += 2) {
 		/*fprintf(stderr, "%s -> %s = %s\n", el, attr[i], attr[i + 1]);*/
-		xa = calloc(1, sizeof *xa);
+		v = NULL;
+		if (p != NULL)
+			v = xmlsd_borrow_attr(ctx, &p, attr[i], attr[i + 1],
+			    &len);
+		if (v != NULL && len >= XMLSD_NUMBUF_LEN) {
+			xa = xmlsd_doc_attr_alloc(ctx->xml_el, attr[i], "");
+			if (xa != NULL)
+				xmlsd_value_borrow(&xa->value, v, len);
+		} else
+			xa = xmlsd_doc_attr_alloc(ctx->xml_el, attr[i],
+			    attr[i + 1]);
 		if (xa == NULL)
 			XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
-		xa->name = strdup(attr[i]);
-		if (xa->name == NULL) {
-			free(xa);
-			XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
-		}
-		xa->value = strdup(attr[i + 1]);
-		if (xa->value == NULL) {
-			free(xa->name);
-			free(xa);
-			XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
-		}
-		TAILQ_INSERT_TAIL(&xe->attr_list, xa, entry);
+		xmlsd_elem_add_attr(xe, xa);
 	}
 
 	ctx->depth++;
@@ -203,26 +306,28 @@ xmlsd_end(void *data, const char *el)
 		XMLSD_ABORT(ctx, XMLSD_ERR_INTEGRITY);
 	if (strcmp(xe->name, el))
 		XMLSD_ABORT(ctx, XMLSD_ERR_INTEGRITY);
-	if (ctx->value) {
-		if (ctx->value_at > 1) {
-			/* eat all blanks in back because expat isn't smart */
-			while (isblank(ctx->value[--ctx->value_at])) {
-				ctx->value[ctx->value_at] = '\0';
-				if (ctx->value_at == 0)
-					break;
-			}
-		}
+	if (ctx->value_at != 0) {
+		/*
+		 * eat all blanks in back because expat isn't smart, a value of
+		 * a single character is kept as it is
+		 */
+		if (ctx->value_at > 1)
+			while (ctx->value_at > 0 &&
+			    isblank(ctx->value[ctx->value_at - 1]))
+				ctx->value_at--;
+		ctx->value[ctx->value_at] = '\0';
 		/* save off value */
-		if (xe->value)
+		if (xe->value.type != XMLSD_VALUE_NONE)
 			XMLSD_ABORT(ctx, XMLSD_ERR_INTEGRITY);
-		xe->value = strdup(ctx->value);
-		if (xe->value == NULL)
+		if (ctx->value_borrow && ctx->value_at >= XMLSD_NUMBUF_LEN)
+			xmlsd_value_borrow(&xe->value,
+			    ctx->src + ctx->value_off, ctx->value_at);
+		else if (xmlsd_doc_value_set(ctx->xml_el, &xe->value,
+		    ctx->value, ctx->value_at) != 0)
 			XMLSD_ABORT(ctx, XMLSD_ERR_RESOURCE);
 
-		free(ctx->value);
-		ctx->value = NULL;
 		ctx->value_at = 0;
-		ctx->tot_size = 0;
+		ctx->value_borrow = 0;
 	}
 
 	/* go up a level */
@@ -230,25 +335,67 @@ xmlsd_end(void *data, const char *el)
 	ctx->xml_last = xe->parent;
 }
 
+/*
+ * Prepare `ctx' for parsing into `xd' with expat, or with the built in
+ * tokenizer if `native' is set.  The parser is taken from `pc', or from
+ * the document if it is NULL.
+ */
 static int
-xmlsd_parse_setup(struct xmlsd_context *ctx, struct xmlsd_document *xd)
+xmlsd_parse_setup(struct xmlsd_context *ctx, struct xmlsd_document *xd,
+    int native, struct xmlsd_parse_cache *pc)
 {
-	XML_Parser		xml;
+	XML_Parser			 xml;
 
-	if (ctx == NULL || (xd && !xmlsd_doc_is_empty(xd)))
+	if (ctx == NULL || xd == NULL || !xmlsd_doc_is_empty(xd) || xd->sealed)
 		return (XMLSD_ERR_INTEGRITY);
 
+	xmlsd_doc_changed(xd);
 	bzero(ctx, sizeof *ctx);
 	ctx->depth = -1;
 	ctx->saved_rv = XMLSD_ERR_UNKNOWN;
 
-	xml = XML_ParserCreate(NULL);
+	/* pick up whatever a previous parse left behind */
+	if (pc == NULL)
+		pc = &xd->parse_cache;
+	ctx->cache = pc;
+	ctx->value = pc->value;
+	ctx->tot_size = pc->tot_size;
+	pc->value = NULL;
+	pc->tot_size = 0;
+	ctx->xml_el = xd;
+	ctx->xml_last = NULL;
+
+	if (native) {
+		ctx->native = &pc->native;
+		ctx->native->mm = pc->mm;
+		ctx->native->data = ctx;
+		ctx->native->start = xmlsd_start;
+		ctx->native->end = xmlsd_end;
+		ctx->native->chardata = xmlsd_chardata;
+		return (XMLSD_ERR_SUCCES);
+	}
+
+	/* expat allocates from the cache's allocator until the parse is done */
+	if (pc->mm != NULL)
+		ctx->mm_prev = xmlsd_mm_enter(pc->mm);
+	if ((xml = pc->xml_parser) != NULL) {
+		pc->xml_parser = NULL;
+		if (XML_ParserReset(xml, NULL) != XML_TRUE) {
+			XML_ParserFree(xml);
+			xml = NULL;
+		}
+	}
 	if (xml == NULL)
+		xml = pc->mm != NULL ? xmlsd_mm_parser_create() :
+		    XML_ParserCreate(NULL);
+	if (xml == NULL) {
+		if (pc->mm != NULL)
+			xmlsd_mm_leave(ctx->mm_prev);
+		pc->value = ctx->value;
+		pc->tot_size = ctx->tot_size;
 		return (XMLSD_ERR_RESOURCE);
-
+	}
 	ctx->xml_parser = xml;
-	ctx->xml_el = xd;
-	ctx->xml_last = NULL;
 
 	XML_SetUserData(xml, ctx);
 	XML_SetElementHandler(xml, xmlsd_start, xmlsd_end);
@@ -257,10 +404,45 @@ xmlsd_parse_setup(struct xmlsd_context *ctx, struct xmlsd_document *xd)
 	return (XMLSD_ERR_SUCCES);
 }
 
-static void
-xmlsd_parse_done(struct xmlsd_context *ctx)
+static int
+xmlsd_parse_done(struct xmlsd_context *ctx, int rv)
+{
+	struct xmlsd_document		*xd = ctx->xml_el;
+	struct xmlsd_parse_cache	*pc = ctx->cache;
+
+	/* a cache that isn't the document's is always kept */
+	if ((xd->flags & XMLSD_DOC_F_RECYCLE) || pc != &xd->parse_cache) {
+		if (ctx->xml_parser != NULL)
+			pc->xml_parser = ctx->xml_parser;
+		pc->value = ctx->value;
+		pc->tot_size = ctx->tot_size;
+	} else {
+		if (ctx->xml_parser != NULL)
+			XML_ParserFree(ctx->xml_parser);
+		xmlsd_mm_free(pc->mm, ctx->value);
+		xmlsd_native_free(&pc->native);
+	}
+	if (ctx->xml_parser != NULL && pc->mm != NULL)
+		xmlsd_mm_leave(ctx->mm_prev);
+
+	if (rv == XMLSD_ERR_SUCCES && ctx->part == XMLSD_PART_DOC &&
+	    (xd->flags & XMLSD_DOC_F_FREEZE))
+		rv = xmlsd_doc_freeze(xd);
+
+	return (rv);
+}
+
+void
+xmlsd_parse_cache_free(struct xmlsd_parse_cache *pc)
 {
-	XML_ParserFree(ctx->xml_parser);
+	const struct xmlsd_allocator *mm = pc->mm;
+
+	if (pc->xml_parser != NULL)
+		XML_ParserFree(pc->xml_parser);
+	xmlsd_mm_free(mm, pc->value);
+	xmlsd_native_free(&pc->native);
+	bzero(pc, sizeof *pc);
+	pc->mm = mm;
 }
 
 int
@@ -278,7 +460,7 @@ xmlsd_parse_fileds(int f, struct xmlsd_document *xd)
 	if (f <= 0 || xd == NULL)
 		return (XMLSD_ERR_INTEGRITY);
 
-	if ((irv = xmlsd_parse_setup(&ctx, xd)) != XMLSD_ERR_SUCCES)
+	if ((irv = xmlsd_parse_setup(&ctx, xd, 0, NULL)) != XMLSD_ERR_SUCCES)
 		return (irv);
 
 	xml = ctx.xml_parser;
@@ -310,6 +492,8 @@ xmlsd_parse_fileds(int f, struct xmlsd_document *xd)
 			status = XML_GetErrorCode(xml);
 			if (status == XML_ERROR_ABORTED)
 				rv = ctx.saved_rv;
+			else if (status == XML_ERROR_NO_MEMORY)
+				rv = XMLSD_ERR_RESOURCE;
 			else
 				rv = XMLSD_ERR_PARSER;
 			goto done;
@@ -318,8 +502,7 @@ xmlsd_parse_fileds(int f, struct xmlsd_document *xd)
 
 	rv = XMLSD_ERR_SUCCES;
 done:
-	xmlsd_parse_done(&ctx);
-	return (rv);
+	return (xmlsd_parse_done(&ctx, rv));
 }
 
 int
@@ -334,7 +517,7 @@ xmlsd_parse_file(FILE *f, struct xmlsd_document *xd)
 	if (f == NULL || xd == NULL)
 		return (XMLSD_ERR_INTEGRITY);
 
-	if ((irv = xmlsd_parse_setup(&ctx, xd)) != XMLSD_ERR_SUCCES)
+	if ((irv = xmlsd_parse_setup(&ctx, xd, 0, NULL)) != XMLSD_ERR_SUCCES)
 		return (irv);
 
 	xml = ctx.xml_parser;
@@ -349,6 +532,8 @@ xmlsd_parse_file(FILE *f, struct xmlsd_document *xd)
 			status = XML_GetErrorCode(xml);
 			if (status == XML_ERROR_ABORTED)
 				rv = ctx.saved_rv;
+			else if (status == XML_ERROR_NO_MEMORY)
+				rv = XMLSD_ERR_RESOURCE;
 			else
 				rv = XMLSD_ERR_PARSER;
 			goto done;
@@ -357,28 +542,100 @@ xmlsd_parse_file(FILE *f, struct xmlsd_document *xd)
 
 	rv = XMLSD_ERR_SUCCES;
 done:
-	xmlsd_parse_done(&ctx);
-	return (rv);
+	return (xmlsd_parse_done(&ctx, rv));
 }
 
 int
 xmlsd_parse_mem(const char *b, size_t sz, struct xmlsd_document *xd)
 {
+	return (xmlsd_parse_mem_flags(b, sz, xd, 0));
+}
+
+/*
+ * Parse like xmlsd_parse_mem() does.  With XMLSD_PARSE_NATIVE in `flags'
+ * the built in tokenizer is used instead of expat.
+ */
+int
+xmlsd_parse_mem_flags(const char *b, size_t sz, struct xmlsd_document *xd,
+    int flags)
+{
+	if (b == NULL || sz <= 0 || xd == NULL ||
+	    (flags & ~XMLSD_PARSE_NATIVE))
+		return (XMLSD_ERR_INTEGRITY);
+
+	return (xmlsd_parse_part(b, sz, xd, flags, XMLSD_PART_DOC, NULL));
+}
+
+/*
+ * Parse `b' into the empty document `xd'.  `part' says what `b' holds:
+ * XMLSD_PART_DOC is a whole document.  XMLSD_PART_HEAD is everything up to
+ * and including the start tag of the root, which is closed right after.
+ * XMLSD_PART_CONTENT is what lies between a start and an end tag, it
+ * becomes the children of an element made up for the purpose.  Only whole
+ * documents are frozen.  The parser comes from and goes back to `pc'
+ * unless it is NULL, then the document's own is used.
+ */
+int
+xmlsd_parse_part(const char *b, size_t sz, struct xmlsd_document *xd,
+    int flags, int part, struct xmlsd_parse_cache *pc)
+{
+	static const char	 open[] = "<xmlsd>", close[] = "</xmlsd>";
 	int			irv, status, rv = XMLSD_ERR_UNKNOWN;
 	struct xmlsd_context	ctx;
+	struct xmlsd_element	*root;
 	XML_Parser		xml;
 
-	if (b == NULL || sz <= 0 || xd == NULL)
-		return (XMLSD_ERR_INTEGRITY);
-
-	if ((irv = xmlsd_parse_setup(&ctx, xd)) != XMLSD_ERR_SUCCES)
+	irv = xmlsd_parse_setup(&ctx, xd, flags & XMLSD_PARSE_NATIVE, pc);
+	if (irv != XMLSD_ERR_SUCCES)
 		return (irv);
+	ctx.part = part;
+	if (xd->flags & XMLSD_DOC_F_BORROW) {
+		ctx.src = b;
+		ctx.src_len = sz;
+	}
 
+	if (ctx.native != NULL) {
+		ctx.native->part = part;
+		rv = xmlsd_native_parse(ctx.native, b, sz);
+		if (ctx.native->stop)
+			rv = ctx.saved_rv;
+		goto done;
+	}
+
+	/* expat is fed the missing tags around the input */
 	xml = ctx.xml_parser;
-	if (XML_Parse(xml, b, sz, 1) != XML_STATUS_OK) {
+	switch (part) {
+	case XMLSD_PART_HEAD:
+		if ((status = XML_Parse(xml, b, sz, 0)) != XML_STATUS_OK)
+			break;
+		if ((root = ctx.xml_last) == NULL) {
+			rv = XMLSD_ERR_PARSER;
+			goto done;
+		}
+		if ((status = XML_Parse(xml, "</", 2, 0)) != XML_STATUS_OK ||
+		    (status = XML_Parse(xml, root->name, root->namelen, 0)) !=
+		    XML_STATUS_OK)
+			break;
+		status = XML_Parse(xml, ">", 1, 1);
+		break;
+	case XMLSD_PART_CONTENT:
+		ctx.src_skip = sizeof open - 1;
+		if ((status = XML_Parse(xml, open, sizeof open - 1, 0)) !=
+		    XML_STATUS_OK ||
+		    (status = XML_Parse(xml, b, sz, 0)) != XML_STATUS_OK)
+			break;
+		status = XML_Parse(xml, close, sizeof close - 1, 1);
+		break;
+	default:
+		status = XML_Parse(xml, b, sz, 1);
+		break;
+	}
+	if (status != XML_STATUS_OK) {
 		status = XML_GetErrorCode(xml);
 		if (status == XML_ERROR_ABORTED)
 			rv = ctx.saved_rv;
+		else if (status == XML_ERROR_NO_MEMORY)
+			rv = XMLSD_ERR_RESOURCE;
 		else
 			rv = XMLSD_ERR_PARSER;
 		goto done;
@@ -386,8 +643,7 @@ xmlsd_parse_mem(const char *b, size_t sz, struct xmlsd_document *xd)
 
 	rv = XMLSD_ERR_SUCCES;
 done:
-	xmlsd_parse_done(&ctx);
-	return (rv);
+	return (xmlsd_parse_done(&ctx, rv));
 }
 
 static enum xmlsd_validate_reason
@@ -498,34 +754,27 @@ done:
 static int
 xmlsd_occurrences(struct xmlsd_element *parent, const char *name)
 {
-	struct xmlsd_element	*xi;
-	int			 occur;
+	size_t			 occur;
 
 	/* We don't handle root nodes, only children of it */
 	if (parent == NULL)
 		return (0);
 
-	occur = 0;
-	XMLSD_ELEM_FOREACH_CHILDREN(xi, parent) {
-		if (!strcmp(xi->name, name))
-			occur++;
-	}
+	occur = xmlsd_elem_count_children(parent, name);
 
-	return occur;
+	return (occur > INT_MAX ? INT_MAX : occur);
 }
 
 /*
- * Validate an element and its children.
+ * Validate a single element, its children are not looked at.
  *
  * `cmd' is the actual validation element that applies to this element.
  * `xc' is the list of elements for the whole document.
  */
 static int
-xmlsd_validate_element(struct xmlsd_document *xd, struct xmlsd_element *xe,
-    struct xmlsd_v_elem *cmd, struct xmlsd_v_elem *xc, struct
-    xmlsd_validate_failure *xvf)
+xmlsd_validate_one(struct xmlsd_element *xe, struct xmlsd_v_elem *cmd,
+    struct xmlsd_v_elem *xc, struct xmlsd_validate_failure *xvf)
 {
-	struct xmlsd_element	*xi;
 	char			*dot;
 	char			 xe_path[1024];
 	int			 i, rv = 1, occur, reason;
@@ -576,22 +825,46 @@ xmlsd_validate_element(struct xmlsd_document *xd, struct xmlsd_element *xe,
 			goto done;
 		}
 	}
-	XMLSD_ELEM_FOREACH_CHILDREN(xi, xe) {
-		for (cmd = NULL, i = 0; xc[i].element != NULL; i++)
-			if (!strcmp(xc[i].element, xi->name) &&
-			    !xmlsd_check_path(xi, xc[i].path))
-				cmd = &xc[i];
-		if (cmd == NULL) {
-			rv = xvf->xvf_reason =
-			    XMLSD_VALIDATE_UNRECOGNISED_ELEMENT;
-			xvf->xvf_elem = xi;
-			xvf->xvf_velem = xc; /* all validate structs */
-			goto done;
+	xvf->xvf_reason = rv = 0;
+done:
+	return (rv);
+}
+
+/*
+ * Validate an element and its children.
+ *
+ * `cmd' is the validation element that applies to `top'.
+ * `xc' is the list of elements for the whole document.
+ *
+ * The tree is walked in document order so the first failure reported is
+ * the same one a depth first recursion would find.
+ */
+static int
+xmlsd_validate_element(struct xmlsd_document *xd, struct xmlsd_element *top,
+    struct xmlsd_v_elem *cmd, struct xmlsd_v_elem *xc, struct
+    xmlsd_validate_failure *xvf)
+{
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xi;
+	int			 i, rv = 0;
+
+	xmlsd_walk_init(&xw, top, XMLSD_WALK_PRE);
+	while ((xi = xmlsd_walk_next(&xw)) != NULL) {
+		if (xi != top) {
+			for (cmd = NULL, i = 0; xc[i].element != NULL; i++)
+				if (!strcmp(xc[i].element, xi->name) &&
+				    !xmlsd_check_path(xi, xc[i].path))
+					cmd = &xc[i];
+			if (cmd == NULL) {
+				rv = xvf->xvf_reason =
+				    XMLSD_VALIDATE_UNRECOGNISED_ELEMENT;
+				xvf->xvf_elem = xi;
+				xvf->xvf_velem = xc; /* all validate structs */
+				goto done;
+			}
 		}
-		if ((rv = xmlsd_validate_element(xd, xi, cmd, xc, xvf)) != 0){
-			/* errorset by caller */
+		if ((rv = xmlsd_validate_one(xi, cmd, xc, xvf)) != 0)
 			goto done;
-		}
 	}
 	xvf->xvf_reason = rv = 0;
 done:
@@ -629,7 +902,7 @@ xmlsd_validate_info(struct xmlsd_document *xd, struct xmlsd_v_elements *els,
 	}
 
 
-	/* this will recurse over the whole tree */
+	/* this will walk the whole tree */
 	rv = xmlsd_validate_element(xd, xe, cmd, cmd, xvf);
 
 done:
@@ -26,6 +26,7 @@
 #include <inttypes.h>
 
 #include <sys/queue.h>
+#include <sys/uio.h>
 
 /* versioning */
 #define XMLSD_STRINGIFY(x)	#x
@@ -112,6 +113,9 @@ struct xmlsd_v_elements_validation {
 struct xmlsd_attribute;
 const char		*xmlsd_attr_get_name(struct xmlsd_attribute *);
 const char		*xmlsd_attr_get_value(struct xmlsd_attribute *);
+size_t			 xmlsd_attr_get_value_len(struct xmlsd_attribute *);
+const char		*xmlsd_attr_get_value_span(struct xmlsd_attribute *,
+			    size_t *);
 
 /*
  * XML element inteface definition
@@ -120,11 +124,16 @@ struct xmlsd_element;
 /* element get and iteration interface */
 const char		*xmlsd_elem_get_name(struct xmlsd_element *);
 const char		*xmlsd_elem_get_value(struct xmlsd_element *);
+size_t			 xmlsd_elem_get_value_len(struct xmlsd_element *);
+const char		*xmlsd_elem_get_value_span(struct xmlsd_element *,
+			    size_t *);
 long long 		 xmlsd_elem_get_value_strtonum(struct xmlsd_element *,
 			     long long, long long, const char **);
 unsigned long long 	 xmlsd_elem_get_value_hexnum(struct xmlsd_element *,
 			     unsigned long long, unsigned long long,
 			     const char **);
+int			 xmlsd_elem_get_value_b64(struct xmlsd_element *, void *,
+			     size_t *);
 int			 xmlsd_elem_get_value_boolean(struct xmlsd_element *,
 			     int *, int);
 int			 xmlsd_elem_get_depth(struct xmlsd_element *);
@@ -142,6 +151,10 @@ struct xmlsd_attribute	*xmlsd_elem_get_previous_attr(struct xmlsd_element *,
 	    (attr) != NULL; (attr) = xmlsd_elem_get_next_attr(elem, attr))
 struct xmlsd_element	*xmlsd_elem_find_child(struct xmlsd_element *,
 			     const char *);
+struct xmlsd_element	*xmlsd_elem_find_child_next(struct xmlsd_element *,
+			     struct xmlsd_element *);
+size_t			 xmlsd_elem_count_children(struct xmlsd_element *,
+			     const char *);
 struct xmlsd_element	*xmlsd_elem_get_first_child(struct xmlsd_element *);
 struct xmlsd_element	*xmlsd_elem_get_next_child(struct xmlsd_element *,
 			     struct xmlsd_element *);
@@ -151,6 +164,19 @@ struct xmlsd_element	*xmlsd_elem_get_previous_child(struct xmlsd_element *,
 #define XMLSD_ELEM_FOREACH_CHILDREN(child, elem)			\
 	for ((child) = xmlsd_elem_get_first_child(elem);		\
 	    (child) != NULL; (child) = xmlsd_elem_get_next_child(elem, child))
+/* non-recursive pre/post-order walk of an element and its descendants */
+struct xmlsd_walk {
+	struct xmlsd_element	*xw_top;
+	struct xmlsd_element	*xw_cur;
+	int			 xw_flags;
+#define XMLSD_WALK_PRE		0x0001	/* return elements on the way down */
+#define XMLSD_WALK_POST		0x0002	/* return elements on the way up */
+	int			 xw_post;	/* xw_cur returned on the way up */
+};
+void			 xmlsd_walk_init(struct xmlsd_walk *,
+			     struct xmlsd_element *, int);
+struct xmlsd_element	*xmlsd_walk_next(struct xmlsd_walk *);
+void			 xmlsd_walk_skip(struct xmlsd_walk *);
 /* attribute getting  interface */
 const char		*xmlsd_elem_get_attr(struct xmlsd_element *,
 			     const char *);
@@ -162,6 +188,18 @@ unsigned long long 	 xmlsd_elem_get_attr_hexnum(struct xmlsd_element *,
 /* XXX real bool? */
 int			 xmlsd_elem_get_attr_boolean(struct xmlsd_element *,
 			     const char *, int *, int);
+/* many attributes at once */
+struct xmlsd_attr_set;
+size_t			 xmlsd_elem_get_attrs(struct xmlsd_element *,
+			     const char **, const char **, size_t);
+size_t			 xmlsd_elem_get_attrs_strtonum(struct xmlsd_element *,
+			     const char **, long long *, const char **, size_t,
+			     long long, long long);
+int			 xmlsd_attr_set_alloc(struct xmlsd_attr_set **,
+			     const char **, size_t);
+size_t			 xmlsd_elem_get_attr_set(struct xmlsd_element *,
+			     struct xmlsd_attr_set *, const char **);
+void			 xmlsd_attr_set_free(struct xmlsd_attr_set *);
 /* element setting interface */
 int			 xmlsd_elem_set_attr(struct xmlsd_element *, const char *, const char *);
 int			 xmlsd_elem_set_attr_int32(struct xmlsd_element *, const char *, int32_t);
@@ -177,6 +215,8 @@ int			 xmlsd_elem_set_value_int64(struct xmlsd_element *, int64_t);
 int			 xmlsd_elem_set_value_uint64(struct xmlsd_element *, uint64_t);
 int			 xmlsd_elem_set_value_x32(struct xmlsd_element *, uint32_t);
 int			 xmlsd_elem_set_value_x64(struct xmlsd_element *, uint64_t);
+int			 xmlsd_elem_set_value_b64(struct xmlsd_element *,
+			     const void *, size_t);
 void			 xmlsd_elem_free(struct xmlsd_element *);
 
 
@@ -184,10 +224,35 @@ void			 xmlsd_elem_free(struct xmlsd_element *);
 
 /* XML document parsing and creation */
 struct xmlsd_document;
+#define XMLSD_DOC_F_RECYCLE	0x0001	/* keep memory across clear */
+#define XMLSD_DOC_F_FREEZE	0x0002	/* freeze after every parse */
+#define XMLSD_DOC_F_BORROW	0x0004	/* point values into parsed memory */
+struct xmlsd_allocator {
+	void			*(*xal_malloc)(void *, size_t);
+	void			*(*xal_realloc)(void *, void *, size_t);
+	void			 (*xal_free)(void *, void *);
+	void			*xal_arg;	/* passed to all three */
+};
 int			 xmlsd_doc_alloc(struct xmlsd_document **);
+int			 xmlsd_doc_alloc_flags(struct xmlsd_document **, int);
+int			 xmlsd_doc_alloc_mm(struct xmlsd_document **, int,
+			     const struct xmlsd_allocator *);
 void			 xmlsd_doc_clear(struct xmlsd_document *);
 void			 xmlsd_doc_free(struct xmlsd_document *);
+void			 xmlsd_doc_free_async(struct xmlsd_document *);
+void			 xmlsd_doc_free_flush(void);
+void			 xmlsd_doc_free_shutdown(void);
 int			 xmlsd_doc_is_empty(struct xmlsd_document *);
+int			 xmlsd_doc_freeze(struct xmlsd_document *);
+int			 xmlsd_doc_clone(struct xmlsd_document **,
+			     struct xmlsd_document *);
+int			 xmlsd_doc_seal(struct xmlsd_document *);
+int			 xmlsd_doc_is_sealed(struct xmlsd_document *);
+void			 xmlsd_doc_ref(struct xmlsd_document *);
+void			 xmlsd_doc_unref(struct xmlsd_document *);
+int			 xmlsd_doc_index_paths(struct xmlsd_document *);
+struct xmlsd_element	**xmlsd_doc_find_path(struct xmlsd_document *,
+			     const char *, size_t *);
 struct xmlsd_element	*xmlsd_doc_get_root(struct xmlsd_document *);
 #define	xmlsd_doc_get_first_elem(doc) xmlsd_doc_get_root(doc)
  
@@ -195,15 +260,96 @@ int			 xmlsd_parse_fileds(int, struct xmlsd_document *);
 int			 xmlsd_parse_file(FILE *, struct xmlsd_document  *);
 int			 xmlsd_parse_mem(const char *, size_t,
 			    struct xmlsd_document *);
+#define XMLSD_PARSE_NATIVE	0x0001	/* built in tokenizer, no DTDs */
+int			 xmlsd_parse_mem_flags(const char *, size_t,
+			    struct xmlsd_document *, int);
+int			 xmlsd_parse_mem_parallel(const char *, size_t,
+			    struct xmlsd_document *, int, int);
+
+/* parsing many documents at once */
+struct xmlsd_pool;
+int			 xmlsd_pool_alloc(struct xmlsd_pool **, int, int);
+int			 xmlsd_pool_alloc_mm(struct xmlsd_pool **, int, int,
+			    const struct xmlsd_allocator *);
+void			 xmlsd_pool_free(struct xmlsd_pool *);
+int			 xmlsd_parse_batch(const struct iovec *, size_t,
+			    struct xmlsd_document **, int *,
+			    struct xmlsd_pool *);
+
+/* documents parsed before, shared */
+struct xmlsd_cache;
+struct xmlsd_cache_stats {
+	uint64_t		 xcs_hits;
+	uint64_t		 xcs_misses;
+	uint64_t		 xcs_evictions;
+	size_t			 xcs_bytes;	/* counted against the bound */
+	size_t			 xcs_entries;
+};
+int			 xmlsd_cache_alloc(struct xmlsd_cache **, size_t,
+			    struct xmlsd_v_elements *, int);
+int			 xmlsd_cache_alloc_mm(struct xmlsd_cache **, size_t,
+			    struct xmlsd_v_elements *, int,
+			    const struct xmlsd_allocator *);
+void			 xmlsd_cache_free(struct xmlsd_cache *);
+int			 xmlsd_cache_parse(struct xmlsd_cache *, const char *,
+			    size_t, struct xmlsd_document **,
+			    struct xmlsd_validate_failure *);
+void			 xmlsd_cache_release(struct xmlsd_cache *,
+			    struct xmlsd_document *);
+void			 xmlsd_cache_get_stats(struct xmlsd_cache *,
+			    struct xmlsd_cache_stats *);
+
+/* the current version of a sealed document, replaced while it is read */
+struct xmlsd_doc_slot;
+int			 xmlsd_doc_slot_alloc(struct xmlsd_doc_slot **);
+void			 xmlsd_doc_slot_free(struct xmlsd_doc_slot *);
+struct xmlsd_document	*xmlsd_doc_slot_get(struct xmlsd_doc_slot *);
+int			 xmlsd_doc_slot_set(struct xmlsd_doc_slot *,
+			    struct xmlsd_document *);
+
+/* queries */
+struct xmlsd_query;
+int			 xmlsd_query_compile(const char *,
+			     struct xmlsd_query **);
+int			 xmlsd_query_exec(struct xmlsd_query *,
+			     struct xmlsd_document *,
+			     int (*)(struct xmlsd_element *, void *), void *);
+void			 xmlsd_query_free(struct xmlsd_query *);
 
 #define XMLSD_GEN_ADD_HEADER	1
 char *xmlsd_generate(struct xmlsd_document *xl, void *(*alloc_fn)(size_t),
     size_t *, int);
+void			*xmlsd_doc_save_binary(struct xmlsd_document *,
+			    void *(*)(size_t), size_t *);
+int			 xmlsd_doc_load_binary(struct xmlsd_document *,
+			    const void *, size_t);
 struct xmlsd_element	*xmlsd_doc_add_elem(struct xmlsd_document *,
 			     struct xmlsd_element *, const char *);
+struct xmlsd_element	*xmlsd_elem_clone_into(struct xmlsd_document *,
+			     struct xmlsd_element *, struct xmlsd_element *);
+
+/* bulk construction, one allocation per call */
+struct xmlsd_attr_column {
+	const char		*name;
+	const char		**values; /* one per element, NULL to omit */
+};
+struct xmlsd_element	*xmlsd_doc_add_elems(struct xmlsd_document *,
+			     struct xmlsd_element *, const char *, size_t,
+			     struct xmlsd_attr_column *, size_t);
+int			 xmlsd_doc_set_attrs(struct xmlsd_document *,
+			     struct xmlsd_element *, const char **,
+			     const char **, size_t);
 void			 xmlsd_doc_remove_elem(struct xmlsd_document *,
 			     struct xmlsd_element *);
 
+/* moving subtrees without copying */
+int			 xmlsd_elem_detach(struct xmlsd_document *,
+			     struct xmlsd_element *);
+int			 xmlsd_elem_append(struct xmlsd_document *,
+			     struct xmlsd_element *, struct xmlsd_element *);
+int			 xmlsd_elem_insert_before(struct xmlsd_document *,
+			     struct xmlsd_element *, struct xmlsd_element *);
+
 /* validation */
 int			 xmlsd_validate(struct xmlsd_document *,
 			    struct xmlsd_v_elements *);
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Memory from a caller supplied allocator, or the system one if there is
+ * none.  Expat's memory functions carry no argument, so the allocator of
+ * the parse under way is kept per thread while it runs and every block
+ * handed to expat starts with the allocator it came from.  Expat may then
+ * free its parser from any thread, as xmlsd_doc_free() does.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <expat.h>
+
+#define XMLSD_MM_HDR		(16)	/* allocator in front of expat's */
+
+static pthread_once_t		 xmlsd_mm_once = PTHREAD_ONCE_INIT;
+static pthread_key_t		 xmlsd_mm_key;
+static int			 xmlsd_mm_key_ok;
+
+void *
+xmlsd_mm_malloc(const struct xmlsd_allocator *mm, size_t sz)
+{
+	if (mm == NULL)
+		return (malloc(sz));
+	return (mm->xal_malloc(mm->xal_arg, sz));
+}
+
+/* zeroed memory for `n' objects of `sz' bytes, like calloc(3) */
+void *
+xmlsd_mm_calloc(const struct xmlsd_allocator *mm, size_t n, size_t sz)
+{
+	void			*p;
+
+	if (mm == NULL)
+		return (calloc(n, sz));
+	if (sz != 0 && n > SIZE_MAX / sz)
+		return (NULL);
+	if ((p = mm->xal_malloc(mm->xal_arg, n * sz)) != NULL)
+		memset(p, 0, n * sz);
+	return (p);
+}
+
+void *
+xmlsd_mm_realloc(const struct xmlsd_allocator *mm, void *p, size_t sz)
+{
+	if (mm == NULL)
+		return (realloc(p, sz));
+	return (mm->xal_realloc(mm->xal_arg, p, sz));
+}
+
+void
+xmlsd_mm_free(const struct xmlsd_allocator *mm, void *p)
+{
+	if (p == NULL)
+		return;
+	if (mm == NULL)
+		free(p);
+	else
+		mm->xal_free(mm->xal_arg, p);
+}
+
+static void
+xmlsd_mm_init(void)
+{
+	xmlsd_mm_key_ok = pthread_key_create(&xmlsd_mm_key, NULL) == 0;
+}
+
+static void *
+xmlsd_mm_expat_malloc(size_t sz)
+{
+	const struct xmlsd_allocator *mm;
+	char			*p;
+
+	if (sz > SIZE_MAX - XMLSD_MM_HDR)
+		return (NULL);
+	mm = pthread_getspecific(xmlsd_mm_key);
+	if ((p = xmlsd_mm_malloc(mm, XMLSD_MM_HDR + sz)) == NULL)
+		return (NULL);
+	*(const struct xmlsd_allocator **)p = mm;
+
+	return (p + XMLSD_MM_HDR);
+}
+
+static void *
+xmlsd_mm_expat_realloc(void *ptr, size_t sz)
+{
+	const struct xmlsd_allocator *mm;
+	char			*p;
+
+	if (ptr == NULL)
+		return (xmlsd_mm_expat_malloc(sz));
+	if (sz > SIZE_MAX - XMLSD_MM_HDR)
+		return (NULL);
+	p = (char *)ptr - XMLSD_MM_HDR;
+	mm = *(const struct xmlsd_allocator **)p;
+	if ((p = xmlsd_mm_realloc(mm, p, XMLSD_MM_HDR + sz)) == NULL)
+		return (NULL);
+
+	return (p + XMLSD_MM_HDR);
+}
+
+static void
+xmlsd_mm_expat_free(void *ptr)
+{
+	char			*p;
+
+	if (ptr == NULL)
+		return;
+	p = (char *)ptr - XMLSD_MM_HDR;
+	xmlsd_mm_free(*(const struct xmlsd_allocator **)p, p);
+}
+
+static const XML_Memory_Handling_Suite xmlsd_mm_expat = {
+	xmlsd_mm_expat_malloc,
+	xmlsd_mm_expat_realloc,
+	xmlsd_mm_expat_free
+};
+
+/*
+ * Make `mm' the allocator of expat parsers made by xmlsd_mm_parser_create()
+ * on this thread until xmlsd_mm_leave() is called with what is returned.
+ */
+const struct xmlsd_allocator *
+xmlsd_mm_enter(const struct xmlsd_allocator *mm)
+{
+	const struct xmlsd_allocator *prev;
+
+	pthread_once(&xmlsd_mm_once, xmlsd_mm_init);
+	if (!xmlsd_mm_key_ok)
+		return (NULL);
+	prev = pthread_getspecific(xmlsd_mm_key);
+	pthread_setspecific(xmlsd_mm_key, mm);
+
+	return (prev);
+}
+
+void
+xmlsd_mm_leave(const struct xmlsd_allocator *prev)
+{
+	if (xmlsd_mm_key_ok)
+		pthread_setspecific(xmlsd_mm_key, prev);
+}
+
+/*
+ * Create an expat parser that allocates from the allocator entered on
+ * this thread.  Returns NULL on failure.
+ */
+struct XML_ParserStruct *
+xmlsd_mm_parser_create(void)
+{
+	pthread_once(&xmlsd_mm_once, xmlsd_mm_init);
+	if (!xmlsd_mm_key_ok)
+		return (NULL);
+
+	return (XML_ParserCreate_MM(NULL, &xmlsd_mm_expat, NULL));
+}
@@ -17,6 +17,8 @@
 #include "xmlsd.h"
 #include "xmlsd_internal.h"
 
+#include <string.h>
+
 const char		*
 xmlsd_attr_get_name(struct xmlsd_attribute *xa)
 {
@@ -26,5 +28,54 @@ xmlsd_attr_get_name(struct xmlsd_attribute *xa)
 const char		*
 xmlsd_attr_get_value(struct xmlsd_attribute *xa)
 {
-	return (xa->value);
+	return (xmlsd_value_get(&xa->value));
+}
+
+size_t
+xmlsd_attr_get_value_len(struct xmlsd_attribute *xa)
+{
+	return (xmlsd_value_len(&xa->value));
+}
+
+/*
+ * Return the value of `xa' and its length in `len' without copying it out
+ * of the parsed memory of an XMLSD_DOC_F_BORROW document.  The value may
+ * not be NUL terminated.
+ */
+const char *
+xmlsd_attr_get_value_span(struct xmlsd_attribute *xa, size_t *len)
+{
+	return (xmlsd_value_span(&xa->value, len));
+}
+
+/*
+ * Allocate a new attribute called `name' with no value from `mm'.
+ * The attribute is not linked to any element.  The name never changes so
+ * it lives in the same allocation, right behind the attribute.
+ */
+struct xmlsd_attribute *
+xmlsd_attr_alloc(const struct xmlsd_allocator *mm, const char *name)
+{
+	struct xmlsd_attribute	*xa;
+	size_t			 len = strlen(name);
+
+	if ((xa = xmlsd_mm_malloc(mm, sizeof *xa + len + 1)) == NULL)
+		return (NULL);
+	bzero(xa, sizeof *xa);
+	xa->value.mm = mm;
+	xa->name = memcpy(xa + 1, name, len + 1);
+	xa->namelen = len;
+
+	return (xa);
+}
+
+void
+xmlsd_attr_free(struct xmlsd_attribute *xa)
+{
+	xmlsd_value_clear(&xa->value);
+
+	/* bulk allocated attributes go away with their document */
+	if (xa->flags & XMLSD_ATTR_F_CHUNK)
+		return;
+	xmlsd_mm_free(xa->value.mm, xa);
 }
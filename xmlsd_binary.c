@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Binary snapshots of documents.  A snapshot is a header, the elements in
+ * document order, their attributes in the same order and a table of NUL
+ * terminated strings.  Everything refers to everything else by index or
+ * offset so a snapshot can be stored and mapped anywhere.  Numbers are in
+ * the byte order of the machine that wrote the snapshot, other machines
+ * refuse it.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <string.h>
+
+#define XMLSD_BIN_MAGIC		"xmlsdbin"
+#define XMLSD_BIN_VERSION	(1)
+#define XMLSD_BIN_ORDER		(0x01020304)
+#define XMLSD_BIN_MAX		(0xffffffffU)	/* most of anything */
+
+struct xmlsd_bin_header {
+	char				magic[8];
+	uint32_t			version;
+	uint32_t			order;
+	uint32_t			nelems;
+	uint32_t			nattrs;
+	uint32_t			strsz;
+	uint32_t			pad;
+};
+
+/* an element or an attribute */
+struct xmlsd_bin_node {
+	uint32_t			parent;	/* element, + 1 for elements */
+	uint32_t			name;	/* string offset */
+	uint32_t			namelen;
+	uint32_t			type;	/* XMLSD_VALUE_* */
+	uint64_t			value;	/* string offset or number */
+	uint32_t			len;
+	uint32_t			pad;
+};
+
+/* add the `len' bytes at `s' to the strings at `tab', return the offset */
+static uint32_t
+xmlsd_bin_string(char *tab, size_t *off, const char *s, size_t len)
+{
+	size_t			 at = *off;
+
+	memcpy(tab + at, s, len);
+	tab[at + len] = '\0';
+	*off += len + 1;
+
+	return (at);
+}
+
+/* bytes of the string table used by `v' */
+static size_t
+xmlsd_bin_value_size(struct xmlsd_value *v)
+{
+	if (v->type == XMLSD_VALUE_B64)
+		return (xmlsd_b64_enclen(v->num.bin->len) + 1);
+	return (v->type == XMLSD_VALUE_STRING ? v->len + 1 : 0);
+}
+
+static void
+xmlsd_bin_value(struct xmlsd_bin_node *bn, struct xmlsd_value *v,
+    char *tab, size_t *off)
+{
+	const char		*s;
+	size_t			 len;
+
+	bn->type = v->type;
+	switch (v->type) {
+	case XMLSD_VALUE_NONE:
+		break;
+	case XMLSD_VALUE_B64:
+		/* binary data is kept as its text */
+		bn->type = XMLSD_VALUE_STRING;
+		bn->value = *off;
+		len = xmlsd_b64_encode(tab + *off, v->num.bin->data,
+		    v->num.bin->len);
+		tab[*off + len] = '\0';
+		bn->len = len;
+		*off += len + 1;
+		break;
+	case XMLSD_VALUE_STRING:
+		s = xmlsd_value_span(v, &len);
+		bn->value = xmlsd_bin_string(tab, off, s, len);
+		bn->len = len;
+		break;
+	default:
+		bn->value = v->num.u;
+		break;
+	}
+}
+
+/*
+ * Return a binary snapshot of `xd' in memory obtained from `alloc_fn',
+ * its size is returned in `sz'.  Returns NULL if `xd' is too large or
+ * memory runs out.
+ */
+void *
+xmlsd_doc_save_binary(struct xmlsd_document *xd, void *(*alloc_fn)(size_t),
+    size_t *sz)
+{
+	struct xmlsd_bin_header	 bh;
+	struct xmlsd_bin_node	*bn, *ba;
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xe;
+	struct xmlsd_attribute	*xa;
+	size_t			 nelems = 0, nattrs = 0, strsz = 0, off = 0;
+	size_t			 cur = 0, total;
+	char			*buf, *tab;
+
+	if (xd == NULL || alloc_fn == NULL || sz == NULL)
+		return (NULL);
+
+	xmlsd_walk_init(&xw, xd->root, XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		nelems++;
+		strsz += xe->namelen + 1 + xmlsd_bin_value_size(&xe->value);
+		TAILQ_FOREACH(xa, &xe->attr_list, entry) {
+			nattrs++;
+			strsz += xa->namelen + 1 +
+			    xmlsd_bin_value_size(&xa->value);
+		}
+	}
+	if (nelems + nattrs > XMLSD_BIN_MAX || strsz > XMLSD_BIN_MAX)
+		return (NULL);
+
+	total = sizeof bh + (nelems + nattrs) * sizeof *bn + strsz;
+	if ((buf = alloc_fn(total)) == NULL)
+		return (NULL);
+	memset(buf, 0, total);
+
+	memset(&bh, 0, sizeof bh);
+	memcpy(bh.magic, XMLSD_BIN_MAGIC, sizeof bh.magic);
+	bh.version = XMLSD_BIN_VERSION;
+	bh.order = XMLSD_BIN_ORDER;
+	bh.nelems = nelems;
+	bh.nattrs = nattrs;
+	bh.strsz = strsz;
+	memcpy(buf, &bh, sizeof bh);
+
+	bn = (struct xmlsd_bin_node *)(buf + sizeof bh);
+	ba = bn + nelems;
+	tab = (char *)(ba + nattrs);
+
+	/* the parent of each element is the one whose subtree we are in */
+	xmlsd_walk_init(&xw, xd->root, XMLSD_WALK_PRE | XMLSD_WALK_POST);
+	nelems = 0;
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		if (xw.xw_post) {
+			cur = bn[cur].parent - 1;
+			continue;
+		}
+		bn[nelems].parent = nelems == 0 ? 0 : cur + 1;
+		bn[nelems].name = xmlsd_bin_string(tab, &off, xe->name,
+		    xe->namelen);
+		bn[nelems].namelen = xe->namelen;
+		xmlsd_bin_value(&bn[nelems], &xe->value, tab, &off);
+
+		TAILQ_FOREACH(xa, &xe->attr_list, entry) {
+			ba->parent = nelems;
+			ba->name = xmlsd_bin_string(tab, &off, xa->name,
+			    xa->namelen);
+			ba->namelen = xa->namelen;
+			xmlsd_bin_value(ba, &xa->value, tab, &off);
+			ba++;
+		}
+		cur = nelems++;
+	}
+
+	*sz = total;
+	return (buf);
+}
+
+/* the string of `len' bytes at `off' in the `strsz' bytes at `tab' */
+static char *
+xmlsd_bin_check(const char *tab, uint32_t strsz, uint64_t off, uint32_t len)
+{
+	if (off >= strsz || len >= strsz - off || tab[off + len] != '\0')
+		return (NULL);
+	return ((char *)tab + off);
+}
+
+/* set up `xa' or `xe' from `bn', strings are taken from `tab' */
+static int
+xmlsd_bin_node(struct xmlsd_bin_node *bn, const char *tab, uint32_t strsz,
+    char **name, size_t *namelen, struct xmlsd_value *v)
+{
+	if (bn->namelen == 0 ||
+	    (*name = xmlsd_bin_check(tab, strsz, bn->name, bn->namelen)) ==
+	    NULL || memchr(*name, '\0', bn->namelen) != NULL)
+		return (1);
+	*namelen = bn->namelen;
+
+	memset(v, 0, sizeof *v);
+	switch (bn->type) {
+	case XMLSD_VALUE_NONE:
+		break;
+	case XMLSD_VALUE_STRING:
+		/* strings are terminated so they need not be borrowed */
+		if ((v->str = xmlsd_bin_check(tab, strsz, bn->value,
+		    bn->len)) == NULL)
+			return (1);
+		v->len = bn->len;
+		break;
+	case XMLSD_VALUE_INT:
+	case XMLSD_VALUE_UINT:
+	case XMLSD_VALUE_HEX:
+		v->num.u = bn->value;
+		break;
+	default:
+		return (1);
+	}
+	v->type = bn->type;
+
+	return (0);
+}
+
+/*
+ * Load the binary snapshot of `sz' bytes at `buf' into the empty document
+ * `xd'.  All nodes are placed in a single block of document memory.  With
+ * XMLSD_DOC_F_BORROW names and values point into `buf', which must then
+ * outlive the document but may be read only, e.g. a mapped file.
+ * Otherwise the strings are copied into the block as well.
+ *
+ * Returns XMLSD_ERR_PARSER if `buf' is not a valid snapshot.
+ */
+int
+xmlsd_doc_load_binary(struct xmlsd_document *xd, const void *buf, size_t sz)
+{
+	struct xmlsd_bin_header	 bh;
+	struct xmlsd_bin_node	 bn;
+	struct xmlsd_element	*elems, *xe, *parent;
+	struct xmlsd_attribute	*attrs, *xa;
+	const char		*nodes, *tab;
+	size_t			 i, nsz, total;
+	char			*p;
+
+	if (xd == NULL || buf == NULL || !xmlsd_doc_is_empty(xd) ||
+	    xd->sealed)
+		return (XMLSD_ERR_INTEGRITY);
+
+	/* the snapshot may sit anywhere so nothing is read in place */
+	if (sz < sizeof bh)
+		return (XMLSD_ERR_PARSER);
+	memcpy(&bh, buf, sizeof bh);
+	if (memcmp(bh.magic, XMLSD_BIN_MAGIC, sizeof bh.magic) ||
+	    bh.version != XMLSD_BIN_VERSION || bh.order != XMLSD_BIN_ORDER)
+		return (XMLSD_ERR_PARSER);
+	nsz = ((size_t)bh.nelems + bh.nattrs) * sizeof bn;
+	if (sz - sizeof bh < nsz || sz - sizeof bh - nsz != bh.strsz ||
+	    (bh.nelems == 0 && bh.nattrs != 0))
+		return (XMLSD_ERR_PARSER);
+	nodes = (const char *)buf + sizeof bh;
+	tab = nodes + nsz;
+	if (bh.nelems == 0)
+		return (XMLSD_ERR_SUCCES);
+
+	total = bh.nelems * sizeof *xe + bh.nattrs * sizeof *xa;
+	if (!(xd->flags & XMLSD_DOC_F_BORROW))
+		total += bh.strsz;
+	if ((p = xmlsd_doc_chunk_alloc(xd, total)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	elems = (struct xmlsd_element *)p;
+	attrs = (struct xmlsd_attribute *)(elems + bh.nelems);
+	if (!(xd->flags & XMLSD_DOC_F_BORROW))
+		tab = memcpy(attrs + bh.nattrs, tab, bh.strsz);
+
+	for (i = 0; i < bh.nelems; i++) {
+		memcpy(&bn, nodes + i * sizeof bn, sizeof bn);
+		/* parents come first, only the first element has none */
+		if ((i == 0) != (bn.parent == 0) || bn.parent > i)
+			return (XMLSD_ERR_PARSER);
+
+		xe = &elems[i];
+		memset(xe, 0, sizeof *xe);
+		TAILQ_INIT(&xe->attr_list);
+		TAILQ_INIT(&xe->children);
+		xe->flags = XMLSD_ELEM_F_CHUNK;
+		if (xmlsd_bin_node(&bn, tab, bh.strsz, &xe->name,
+		    &xe->namelen, &xe->value))
+			return (XMLSD_ERR_PARSER);
+		xe->value.mm = xd->mm;
+		if (i != 0) {
+			parent = &elems[bn.parent - 1];
+			xe->parent = parent;
+			xe->depth = parent->depth + 1;
+			xmlsd_elem_add_child(parent, xe);
+		}
+	}
+
+	for (i = 0; i < bh.nattrs; i++) {
+		memcpy(&bn, nodes + (bh.nelems + i) * sizeof bn, sizeof bn);
+		if (bn.parent >= bh.nelems)
+			return (XMLSD_ERR_PARSER);
+
+		xa = &attrs[i];
+		memset(xa, 0, sizeof *xa);
+		xa->flags = XMLSD_ATTR_F_CHUNK;
+		if (xmlsd_bin_node(&bn, tab, bh.strsz, &xa->name,
+		    &xa->namelen, &xa->value))
+			return (XMLSD_ERR_PARSER);
+		xa->value.mm = xd->mm;
+		xmlsd_elem_add_attr(&elems[bn.parent], xa);
+	}
+
+	xd->root = elems;
+	xmlsd_doc_changed(xd);
+
+	return (XMLSD_ERR_SUCCES);
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Documents parsed before, found by the bytes they were parsed from.
+ * Every entry keeps a copy of its input, which is compared in full on a
+ * hit, the sealed document and the verdict of validating it.  Entries are
+ * shared by reference and the least recently used ones that push the
+ * cache over its bound are dropped, those still referenced are freed by
+ * their last release.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XMLSD_CACHE_BUCKETS	(64)	/* initial hash table size */
+
+struct xmlsd_cache_entry {
+	TAILQ_ENTRY(xmlsd_cache_entry)	 lru;
+	struct xmlsd_cache_entry	*next;	/* in the same bucket */
+	uint64_t			 hash;
+	size_t				 size;	/* counted against the bound */
+	int				 refs;
+	int				 gone;	/* no longer in the cache */
+	struct xmlsd_document		*xd;
+	struct xmlsd_validate_failure	 xvf;
+	size_t				 len;
+	char				 data[];	/* the input */
+};
+TAILQ_HEAD(xmlsd_cache_lru, xmlsd_cache_entry);
+
+struct xmlsd_cache {
+	pthread_mutex_t			 mtx;
+	struct xmlsd_cache_entry	**table;
+	size_t				 mask;
+	struct xmlsd_cache_lru		 lru;	/* most recently used first */
+	struct xmlsd_v_elements		*els;
+	int				 flags;
+	size_t				 max;
+	struct xmlsd_cache_stats	 stats;
+	struct xmlsd_allocator		 xal;
+	const struct xmlsd_allocator	*mm;	/* &xal or NULL for malloc */
+};
+
+/* word at a time hash of the input, the whole of it is compared on a hit */
+static uint64_t
+xmlsd_cache_hash(const char *b, size_t sz)
+{
+	uint64_t		 h = 0xcbf29ce484222325ULL ^ sz, w;
+	size_t			 i;
+
+	for (i = 0; i + sizeof w <= sz; i += sizeof w) {
+		memcpy(&w, b + i, sizeof w);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 32;
+	}
+	if (i < sz) {
+		w = 0;
+		memcpy(&w, b + i, sz - i);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return (h);
+}
+
+static struct xmlsd_cache_entry *
+xmlsd_cache_find(struct xmlsd_cache *xc, uint64_t h, const char *b, size_t sz)
+{
+	struct xmlsd_cache_entry *ce;
+
+	for (ce = xc->table[h & xc->mask]; ce != NULL; ce = ce->next)
+		if (ce->hash == h && ce->len == sz && !memcmp(ce->data, b, sz))
+			return (ce);
+
+	return (NULL);
+}
+
+/* double the hash table, it is left as it was if there is no memory */
+static void
+xmlsd_cache_grow(struct xmlsd_cache *xc)
+{
+	struct xmlsd_cache_entry **table, *ce, *next;
+	size_t			 i, mask = xc->mask * 2 + 1;
+
+	if ((table = xmlsd_mm_calloc(xc->mm, mask + 1, sizeof *table)) ==
+	    NULL)
+		return;
+	for (i = 0; i <= xc->mask; i++)
+		for (ce = xc->table[i]; ce != NULL; ce = next) {
+			next = ce->next;
+			ce->next = table[ce->hash & mask];
+			table[ce->hash & mask] = ce;
+		}
+	xmlsd_mm_free(xc->mm, xc->table);
+	xc->table = table;
+	xc->mask = mask;
+}
+
+static void
+xmlsd_cache_entry_free(struct xmlsd_cache *xc, struct xmlsd_cache_entry *ce)
+{
+	xmlsd_doc_free(ce->xd);
+	xmlsd_mm_free(xc->mm, ce);
+}
+
+/* take `ce' out of the cache, it is freed now or by its last release */
+static void
+xmlsd_cache_remove(struct xmlsd_cache *xc, struct xmlsd_cache_entry *ce)
+{
+	struct xmlsd_cache_entry **cep;
+
+	for (cep = &xc->table[ce->hash & xc->mask]; *cep != ce;
+	    cep = &(*cep)->next)
+		;
+	*cep = ce->next;
+	TAILQ_REMOVE(&xc->lru, ce, lru);
+	xc->stats.xcs_bytes -= ce->size;
+	xc->stats.xcs_entries--;
+
+	if (ce->refs == 0)
+		xmlsd_cache_entry_free(xc, ce);
+	else
+		ce->gone = 1;
+}
+
+/*
+ * Allocate a cache in `xcp' holding up to `max' bytes of documents and
+ * their input.  Documents are parsed with `flags' of
+ * xmlsd_parse_mem_flags() and validated against `els' unless it is NULL.
+ */
+int
+xmlsd_cache_alloc(struct xmlsd_cache **xcp, size_t max,
+    struct xmlsd_v_elements *els, int flags)
+{
+	return (xmlsd_cache_alloc_mm(xcp, max, els, flags, NULL));
+}
+
+/*
+ * Like xmlsd_cache_alloc() for a cache that takes its memory from `mm', as
+ * do the documents in it.
+ */
+int
+xmlsd_cache_alloc_mm(struct xmlsd_cache **xcp, size_t max,
+    struct xmlsd_v_elements *els, int flags, const struct xmlsd_allocator *mm)
+{
+	struct xmlsd_cache	*xc;
+
+	if (xcp == NULL || (flags & ~XMLSD_PARSE_NATIVE))
+		return (XMLSD_ERR_INTEGRITY);
+	if (mm != NULL && (mm->xal_malloc == NULL ||
+	    mm->xal_realloc == NULL || mm->xal_free == NULL))
+		return (XMLSD_ERR_INTEGRITY);
+
+	if ((xc = xmlsd_mm_calloc(mm, 1, sizeof *xc)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	if (mm != NULL) {
+		xc->xal = *mm;
+		xc->mm = &xc->xal;
+	}
+	if ((xc->table = xmlsd_mm_calloc(mm, XMLSD_CACHE_BUCKETS,
+	    sizeof *xc->table)) == NULL) {
+		xmlsd_mm_free(mm, xc);
+		return (XMLSD_ERR_RESOURCE);
+	}
+	xc->mask = XMLSD_CACHE_BUCKETS - 1;
+	TAILQ_INIT(&xc->lru);
+	xc->els = els;
+	xc->flags = flags;
+	xc->max = max;
+	pthread_mutex_init(&xc->mtx, NULL);
+
+	*xcp = xc;
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Free `xc' and its documents.  Every document it handed out must have
+ * been released.
+ */
+void
+xmlsd_cache_free(struct xmlsd_cache *xc)
+{
+	struct xmlsd_cache_entry *ce;
+	struct xmlsd_allocator	 xal;
+
+	if (xc == NULL)
+		return;
+
+	while ((ce = TAILQ_FIRST(&xc->lru)) != NULL) {
+		TAILQ_REMOVE(&xc->lru, ce, lru);
+		xmlsd_cache_entry_free(xc, ce);
+	}
+	pthread_mutex_destroy(&xc->mtx);
+	xmlsd_mm_free(xc->mm, xc->table);
+	if (xc->mm == NULL)
+		free(xc);
+	else {
+		xal = xc->xal;
+		xmlsd_mm_free(&xal, xc);
+	}
+}
+
+/*
+ * Return in `xdp' the document parsed from the `sz' bytes at `b', taken
+ * from `xc' if the same bytes were parsed before.  If `xvf' isn't NULL
+ * the result of validating the document is stored in it, with
+ * XMLSD_VALIDATE_NO_ERROR if it is valid or the cache does not validate.
+ *
+ * The document is shared and sealed so that it cannot be modified, any
+ * number of threads may read it at once.  It is handed back
+ * with xmlsd_cache_release().  Documents that fail to parse are not
+ * cached, the parse error is returned and `xdp' is set to NULL.
+ */
+int
+xmlsd_cache_parse(struct xmlsd_cache *xc, const char *b, size_t sz,
+    struct xmlsd_document **xdp, struct xmlsd_validate_failure *xvf)
+{
+	struct xmlsd_cache_entry *ce, *old;
+	struct xmlsd_document	*xd;
+	uint64_t		 h;
+	int			 rv;
+
+	if (xc == NULL || b == NULL || sz == 0 || xdp == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	*xdp = NULL;
+
+	h = xmlsd_cache_hash(b, sz);
+	pthread_mutex_lock(&xc->mtx);
+	if ((ce = xmlsd_cache_find(xc, h, b, sz)) != NULL) {
+		ce->refs++;
+		TAILQ_REMOVE(&xc->lru, ce, lru);
+		TAILQ_INSERT_HEAD(&xc->lru, ce, lru);
+		xc->stats.xcs_hits++;
+		pthread_mutex_unlock(&xc->mtx);
+		goto done;
+	}
+	xc->stats.xcs_misses++;
+	pthread_mutex_unlock(&xc->mtx);
+
+	/* parse without holding the lock, others may hit meanwhile */
+	if (sz > SIZE_MAX - sizeof *ce ||
+	    (ce = xmlsd_mm_malloc(xc->mm, sizeof *ce + sz)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	bzero(ce, sizeof *ce);
+	if ((rv = xmlsd_doc_alloc_mm(&xd, XMLSD_DOC_F_FREEZE, xc->mm)) !=
+	    XMLSD_ERR_SUCCES) {
+		xmlsd_mm_free(xc->mm, ce);
+		return (rv);
+	}
+	if ((rv = xmlsd_parse_mem_flags(b, sz, xd, xc->flags)) !=
+	    XMLSD_ERR_SUCCES) {
+		xmlsd_doc_free(xd);
+		xmlsd_mm_free(xc->mm, ce);
+		return (rv);
+	}
+	if (xc->els != NULL)
+		xmlsd_validate_info(xd, xc->els, &ce->xvf);
+	if ((rv = xmlsd_doc_seal(xd)) != XMLSD_ERR_SUCCES) {
+		xmlsd_doc_free(xd);
+		xmlsd_mm_free(xc->mm, ce);
+		return (rv);
+	}
+	ce->xd = xd;
+	xd->cache_entry = ce;
+	ce->hash = h;
+	ce->refs = 1;
+	ce->len = sz;
+	memcpy(ce->data, b, sz);
+	ce->size = sizeof *ce + sz + xmlsd_doc_mem_size(xd);
+
+	pthread_mutex_lock(&xc->mtx);
+	if ((old = xmlsd_cache_find(xc, h, b, sz)) != NULL) {
+		/* parsed by someone else at the same time */
+		old->refs++;
+		TAILQ_REMOVE(&xc->lru, old, lru);
+		TAILQ_INSERT_HEAD(&xc->lru, old, lru);
+		pthread_mutex_unlock(&xc->mtx);
+		xmlsd_cache_entry_free(xc, ce);
+		ce = old;
+		goto done;
+	}
+	if (ce->size > xc->max) {
+		/* would never fit, belongs to the caller alone */
+		ce->gone = 1;
+		pthread_mutex_unlock(&xc->mtx);
+		goto done;
+	}
+	while (xc->stats.xcs_bytes + ce->size > xc->max) {
+		xmlsd_cache_remove(xc, TAILQ_LAST(&xc->lru, xmlsd_cache_lru));
+		xc->stats.xcs_evictions++;
+	}
+	if (xc->stats.xcs_entries > xc->mask)
+		xmlsd_cache_grow(xc);
+	ce->next = xc->table[h & xc->mask];
+	xc->table[h & xc->mask] = ce;
+	TAILQ_INSERT_HEAD(&xc->lru, ce, lru);
+	xc->stats.xcs_bytes += ce->size;
+	xc->stats.xcs_entries++;
+	pthread_mutex_unlock(&xc->mtx);
+
+done:
+	if (xvf != NULL)
+		*xvf = ce->xvf;
+	*xdp = ce->xd;
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Hand back a document returned by xmlsd_cache_parse().
+ */
+void
+xmlsd_cache_release(struct xmlsd_cache *xc, struct xmlsd_document *xd)
+{
+	struct xmlsd_cache_entry *ce;
+	int			 last;
+
+	if (xc == NULL || xd == NULL || (ce = xd->cache_entry) == NULL)
+		return;
+
+	pthread_mutex_lock(&xc->mtx);
+	last = --ce->refs == 0 && ce->gone;
+	pthread_mutex_unlock(&xc->mtx);
+
+	if (last)
+		xmlsd_cache_entry_free(xc, ce);
+}
+
+/*
+ * Copy the counters of `xc' into `xcs'.
+ */
+void
+xmlsd_cache_get_stats(struct xmlsd_cache *xc, struct xmlsd_cache_stats *xcs)
+{
+	if (xc == NULL || xcs == NULL)
+		return;
+
+	pthread_mutex_lock(&xc->mtx);
+	*xcs = xc->stats;
+	pthread_mutex_unlock(&xc->mtx);
+}
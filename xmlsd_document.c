@@ -17,6 +17,7 @@
 #include "xmlsd.h"
 #include "xmlsd_internal.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -27,34 +28,162 @@
  */
 int
 xmlsd_doc_alloc(struct xmlsd_document **xdp)
+{
+	return (xmlsd_doc_alloc_flags(xdp, 0));
+}
+
+/*
+ * Allocate a new xmlsd_document with `flags' into `xdp'.
+ *
+ * With XMLSD_DOC_F_RECYCLE the document allocates its nodes and strings
+ * from chunks that survive xmlsd_doc_clear(), along with the parser
+ * state, so that a cleared document can be parsed into again without
+ * going back to the system allocator.
+ *
+ * With XMLSD_DOC_F_FREEZE every successful parse is followed by
+ * xmlsd_doc_freeze().
+ */
+int
+xmlsd_doc_alloc_flags(struct xmlsd_document **xdp, int flags)
+{
+	return (xmlsd_doc_alloc_mm(xdp, flags, NULL));
+}
+
+/*
+ * Allocate a new xmlsd_document with `flags' into `xdp' that takes its
+ * memory from `mm', or from malloc(3) if it is NULL.
+ *
+ * The document itself, its chunks and the memory of its parser, expat's
+ * included, come from `mm'.  Elements, attributes and strings are
+ * allocated from chunks as with XMLSD_DOC_F_RECYCLE, which are given back
+ * when the document is cleared unless it recycles.  Indexes built by
+ * lookups and values set on elements later come from `mm' as well.
+ */
+int
+xmlsd_doc_alloc_mm(struct xmlsd_document **xdp, int flags,
+    const struct xmlsd_allocator *mm)
 {
 	struct xmlsd_document *xd;
 
-	xd = calloc(1, sizeof(*xd));
+	if (flags & ~(XMLSD_DOC_F_RECYCLE | XMLSD_DOC_F_FREEZE |
+	    XMLSD_DOC_F_BORROW))
+		return (XMLSD_ERR_INTEGRITY);
+	if (mm != NULL && (mm->xal_malloc == NULL ||
+	    mm->xal_realloc == NULL || mm->xal_free == NULL))
+		return (XMLSD_ERR_INTEGRITY);
+
+	xd = xmlsd_mm_malloc(mm, sizeof(*xd));
 	if (xd == NULL)
 		return (XMLSD_ERR_RESOURCE);
+	bzero(xd, sizeof(*xd));
 
 	xd->root = NULL;
+	xd->flags = flags;
+	SLIST_INIT(&xd->chunks);
+	SLIST_INIT(&xd->big);
+	SLIST_INIT(&xd->shares);
+	if (mm != NULL) {
+		xd->xal = *mm;
+		xd->mm = &xd->xal;
+		xd->parse_cache.mm = xd->mm;
+	}
 	*xdp = xd;
 	return (XMLSD_ERR_SUCCES);
 }
 
+/* let go of the chunks of other documents that `xd' was using */
+static void
+xmlsd_doc_drop_shares(struct xmlsd_document *xd)
+{
+	struct xmlsd_share_ref *sr;
+	struct xmlsd_chunk_share *cs;
+	struct xmlsd_chunk *xc;
+	struct xmlsd_allocator xal;
+
+	while ((sr = SLIST_FIRST(&xd->shares)) != NULL) {
+		SLIST_REMOVE_HEAD(&xd->shares, link);
+		cs = sr->cs;
+		xmlsd_mm_free(xd->mm, sr);
+		if (__atomic_sub_fetch(&cs->refs, 1, __ATOMIC_ACQ_REL) != 0)
+			continue;
+		while ((xc = SLIST_FIRST(&cs->chunks)) != NULL) {
+			SLIST_REMOVE_HEAD(&cs->chunks, link);
+			xmlsd_mm_free(cs->mm, xc);
+		}
+		if (cs->mm == NULL)
+			free(cs);
+		else {
+			xal = cs->xal;
+			xmlsd_mm_free(&xal, cs);
+		}
+	}
+}
+
+static void
+xmlsd_doc_free_chunks(struct xmlsd_document *xd)
+{
+	struct xmlsd_chunk *xc;
+
+	while ((xc = SLIST_FIRST(&xd->chunks)) != NULL) {
+		SLIST_REMOVE_HEAD(&xd->chunks, link);
+		xmlsd_mm_free(xd->mm, xc);
+	}
+	while ((xc = SLIST_FIRST(&xd->big)) != NULL) {
+		SLIST_REMOVE_HEAD(&xd->big, link);
+		xmlsd_mm_free(xd->mm, xc);
+	}
+	xd->chunk_cur = NULL;
+	xmlsd_doc_drop_shares(xd);
+}
+
+/*
+ * Keep the large chunks of a recycling document that were handed out
+ * since the last clear and free the rest, so that what it holds follows
+ * the largest of the documents parsed into it lately.
+ */
+static void
+xmlsd_doc_recycle_big(struct xmlsd_document *xd)
+{
+	struct xmlsd_chunk *xc, *next;
+
+	for (xc = SLIST_FIRST(&xd->big); xc != NULL; xc = next) {
+		next = SLIST_NEXT(xc, link);
+		if (xc->used != 0)
+			xc->used = 0;
+		else {
+			SLIST_REMOVE(&xd->big, xc, xmlsd_chunk, link);
+			xmlsd_mm_free(xd->mm, xc);
+		}
+	}
+}
+
 /*
  * Empty out and free all entries in `xd' but leave the document itself
- * allocated.
+ * allocated.  Recycling documents keep their chunks for reuse.
  */
 void
 xmlsd_doc_clear(struct xmlsd_document *xd)
 {
 	struct xmlsd_element *xe;
+	struct xmlsd_chunk *xc;
 
-	if (xd == NULL)
+	if (xd == NULL || xd->sealed)
 		return;
 
 	/* Recursively empty tree */
 	while ((xe = xmlsd_doc_get_first_elem(xd)) != NULL) {
 		xmlsd_doc_remove_elem(xd, xe);
 	}
+
+	/* Nothing can point into the chunks anymore */
+	if (xd->flags & XMLSD_DOC_F_RECYCLE) {
+		SLIST_FOREACH(xc, &xd->chunks, link)
+			xc->used = 0;
+		xd->chunk_cur = SLIST_FIRST(&xd->chunks);
+		xmlsd_doc_recycle_big(xd);
+		xmlsd_doc_drop_shares(xd);
+	} else
+		xmlsd_doc_free_chunks(xd);
 }
 
 /*
@@ -63,10 +192,201 @@ xmlsd_doc_clear(struct xmlsd_document *xd)
 void
 xmlsd_doc_free(struct xmlsd_document *xd)
 {
+	struct xmlsd_allocator xal;
+
 	if (xd == NULL)
 		return;
+	xd->sealed = 0;
 	xmlsd_doc_clear(xd);
-	free (xd);
+	xmlsd_doc_free_chunks(xd);
+	xmlsd_parse_cache_free(&xd->parse_cache);
+	xmlsd_doc_changed(xd);
+	if (xd->mm == NULL)
+		free (xd);
+	else {
+		/* the allocator goes with the document */
+		xal = xd->xal;
+		xmlsd_mm_free(&xal, xd);
+	}
+}
+
+/*
+ * Allocate `sz' bytes of memory owned by `xd'.
+ *
+ * The memory is only released when the document is cleared or freed,
+ * never individually.  Recycling documents and those with an allocator
+ * hand out small allocations from XMLSD_CHUNK_SIZE chunks, everything else
+ * gets a chunk of its own.  Those of recycling documents are reused for
+ * allocations they are large enough for after a clear.
+ * Returns NULL on allocation failure.
+ */
+void *
+xmlsd_doc_chunk_alloc(struct xmlsd_document *xd, size_t sz)
+{
+	struct xmlsd_chunk *xc, *fit;
+	char *p;
+
+	if (sz > SIZE_MAX - XMLSD_ALIGN(sizeof *xc) - 8)
+		return (NULL);
+	sz = XMLSD_ALIGN(sz);
+
+	if (!XMLSD_DOC_CHUNKED(xd)) {
+		xc = xmlsd_mm_malloc(xd->mm, XMLSD_ALIGN(sizeof *xc) + sz);
+		if (xc == NULL)
+			return (NULL);
+		xc->size = xc->used = sz;
+		SLIST_INSERT_HEAD(&xd->chunks, xc, link);
+		return ((char *)xc + XMLSD_ALIGN(sizeof *xc));
+	}
+	if (sz > XMLSD_CHUNK_SIZE / 4) {
+		/* the smallest free one that fits */
+		fit = NULL;
+		SLIST_FOREACH(xc, &xd->big, link)
+			if (xc->used == 0 && xc->size >= sz &&
+			    (fit == NULL || xc->size < fit->size))
+				fit = xc;
+		if ((xc = fit) == NULL) {
+			xc = xmlsd_mm_malloc(xd->mm,
+			    XMLSD_ALIGN(sizeof *xc) + sz);
+			if (xc == NULL)
+				return (NULL);
+			xc->size = sz;
+			SLIST_INSERT_HEAD(&xd->big, xc, link);
+		}
+		xc->used = sz;
+		return ((char *)xc + XMLSD_ALIGN(sizeof *xc));
+	}
+
+	/* chunks past the current one are unused since the last clear */
+	while ((xc = xd->chunk_cur) != NULL && xc->size - xc->used < sz) {
+		if (SLIST_NEXT(xc, link) == NULL)
+			break;
+		xd->chunk_cur = SLIST_NEXT(xc, link);
+	}
+	if (xc == NULL || xc->size - xc->used < sz) {
+		xc = xmlsd_mm_malloc(xd->mm,
+		    XMLSD_ALIGN(sizeof *xc) + XMLSD_CHUNK_SIZE);
+		if (xc == NULL)
+			return (NULL);
+		xc->size = XMLSD_CHUNK_SIZE;
+		xc->used = 0;
+		if (xd->chunk_cur != NULL)
+			SLIST_INSERT_AFTER(xd->chunk_cur, xc, link);
+		else
+			SLIST_INSERT_HEAD(&xd->chunks, xc, link);
+		xd->chunk_cur = xc;
+	}
+
+	p = (char *)xc + XMLSD_ALIGN(sizeof *xc) + xc->used;
+	xc->used += sz;
+	return (p);
+}
+
+/*
+ * Bytes of memory held by the chunks of `xd', which is all of it once
+ * the document is frozen.
+ */
+size_t
+xmlsd_doc_mem_size(struct xmlsd_document *xd)
+{
+	struct xmlsd_chunk *xc;
+	size_t sz = sizeof *xd;
+
+	SLIST_FOREACH(xc, &xd->chunks, link)
+		sz += XMLSD_ALIGN(sizeof *xc) + xc->size;
+	SLIST_FOREACH(xc, &xd->big, link)
+		sz += XMLSD_ALIGN(sizeof *xc) + xc->size;
+
+	return (sz);
+}
+
+/*
+ * Allocate a new unlinked element called `name' for `xd'.  The name is
+ * stored right behind the element either way.
+ */
+struct xmlsd_element *
+xmlsd_doc_elem_alloc(struct xmlsd_document *xd, const char *name)
+{
+	struct xmlsd_element *xe;
+	size_t len;
+
+	len = strlen(name);
+	if (XMLSD_DOC_CHUNKED(xd)) {
+		xe = xmlsd_doc_chunk_alloc(xd, sizeof *xe + len + 1);
+		if (xe == NULL)
+			return (NULL);
+		memset(xe, 0, sizeof *xe);
+		xe->flags = XMLSD_ELEM_F_CHUNK;
+	} else {
+		if ((xe = xmlsd_mm_calloc(xd->mm, 1, sizeof *xe + len + 1)) ==
+		    NULL)
+			return (NULL);
+	}
+	xe->value.mm = xd->mm;
+	xe->name = memcpy(xe + 1, name, len + 1);
+	xe->namelen = len;
+	TAILQ_INIT(&xe->attr_list);
+	TAILQ_INIT(&xe->children);
+
+	return (xe);
+}
+
+/*
+ * Allocate a new unlinked attribute `name' = `value' for `xd'.
+ */
+struct xmlsd_attribute *
+xmlsd_doc_attr_alloc(struct xmlsd_document *xd, const char *name,
+    const char *value)
+{
+	struct xmlsd_attribute *xa;
+	size_t nlen, vlen;
+
+	if (!XMLSD_DOC_CHUNKED(xd)) {
+		if ((xa = xmlsd_attr_alloc(xd->mm, name)) == NULL)
+			return (NULL);
+		if (xmlsd_value_set(&xa->value, value) != 0) {
+			xmlsd_attr_free(xa);
+			return (NULL);
+		}
+		return (xa);
+	}
+
+	nlen = strlen(name) + 1;
+	vlen = strlen(value) + 1;
+	if ((xa = xmlsd_doc_chunk_alloc(xd, sizeof *xa + nlen + vlen)) == NULL)
+		return (NULL);
+	memset(xa, 0, sizeof *xa);
+	xa->name = memcpy(xa + 1, name, nlen);
+	xa->namelen = nlen - 1;
+	xa->value.str = memcpy(xa->name + nlen, value, vlen);
+	xa->value.len = vlen - 1;
+	xa->value.type = XMLSD_VALUE_STRING;
+	xa->value.mm = xd->mm;
+	xa->flags = XMLSD_ATTR_F_CHUNK;
+
+	return (xa);
+}
+
+/*
+ * Set `v' to a copy of the `len' characters of `s' using the storage policy
+ * of `xd'.
+ */
+int
+xmlsd_doc_value_set(struct xmlsd_document *xd, struct xmlsd_value *v,
+    const char *s, size_t len)
+{
+	if (!XMLSD_DOC_CHUNKED(xd) || len < sizeof v->numbuf)
+		return (xmlsd_value_set_len(v, s, len));
+
+	xmlsd_value_clear(v);
+	if ((v->str = xmlsd_doc_chunk_alloc(xd, len + 1)) == NULL)
+		return (1);
+	memcpy(v->str, s, len);
+	v->str[len] = '\0';
+	v->len = len;
+	v->type = XMLSD_VALUE_STRING;
+
+	return (0);
 }
 
 /*
@@ -79,63 +399,468 @@ xmlsd_doc_add_elem(struct xmlsd_document *xd, struct xmlsd_element *xe,
 {
 	struct xmlsd_element *nxe = NULL;
 
-	if (xd == NULL || name == NULL || (strlen(name) == 0))
+	if (xd == NULL || name == NULL || (strlen(name) == 0) || xd->sealed)
 		goto fail;
 
-	/* XXX xmlsd_elem_alloc(parent, name)? */
-        nxe = calloc(1, sizeof *nxe);
-        if (nxe == NULL)
+	nxe = xmlsd_doc_elem_alloc(xd, name);
+	if (nxe == NULL)
 		goto fail;
 
-	nxe->name = strdup(name);
-	if (nxe->name == NULL)
-		goto fail;
-
-        TAILQ_INIT(&nxe->attr_list);
-	TAILQ_INIT(&nxe->children);
 	nxe->depth = xe ? xe->depth + 1 : 0;
 	nxe->parent = xe;
 
 	if (xe)
-		TAILQ_INSERT_TAIL(&xe->children, nxe, entry);
+		xmlsd_elem_add_child(xe, nxe);
 	else {
 		if (xd->root != NULL)
 			goto fail;
 		xd->root = nxe;
 	}
+	xmlsd_doc_changed(xd);
 
 	return nxe;
 
 fail:
-	if (nxe) {
-		if (nxe->name)
-			free(nxe->name);
-		if (nxe)
-			free(nxe);
-	}
+	if (nxe)
+		xmlsd_elem_free(nxe);
 	return NULL;
 }
 
 /*
- * Remove elem and its children from xd.
+ * Add `n' elements called `name' to the end of the children of `xe'.
+ *
+ * Attribute `cols[j].name' of the i-th new element is set to
+ * `cols[j].values[i]', or omitted if that value is NULL.  All elements,
+ * attributes and strings are carved out of a single allocation owned by
+ * `xd' which is only released when the document is cleared or freed.
+ *
+ * Returns the first new element, the others follow it, or NULL on failure.
+ */
+struct xmlsd_element *
+xmlsd_doc_add_elems(struct xmlsd_document *xd, struct xmlsd_element *xe,
+    const char *name, size_t n, struct xmlsd_attr_column *cols, size_t ncols)
+{
+	struct xmlsd_element	*nxe;
+	struct xmlsd_attribute	*xa;
+	const char		*v;
+	char			*p, *xname, *aname;
+	size_t			 i, j, len, alen, sz, nattrs = 0;
+
+	if (xd == NULL || xe == NULL || name == NULL || (strlen(name) == 0) ||
+	    n == 0 || (ncols != 0 && cols == NULL) || xd->sealed)
+		return (NULL);
+
+	/* size everything up front */
+	sz = strlen(name) + 1;
+	for (j = 0; j < ncols; j++) {
+		if (cols[j].name == NULL || (strlen(cols[j].name) == 0) ||
+		    cols[j].values == NULL)
+			return (NULL);
+		sz += strlen(cols[j].name) + 1;
+		for (i = 0; i < n; i++) {
+			if (cols[j].values[i] == NULL)
+				continue;
+			sz += strlen(cols[j].values[i]) + 1;
+			nattrs++;
+		}
+	}
+	if (n > SIZE_MAX / 2 / sizeof *nxe ||
+	    nattrs > SIZE_MAX / 2 / sizeof *xa)
+		return (NULL);
+	sz += n * sizeof *nxe + nattrs * sizeof *xa;
+
+	if ((nxe = xmlsd_doc_chunk_alloc(xd, sz)) == NULL)
+		return (NULL);
+	memset(nxe, 0, n * sizeof *nxe + nattrs * sizeof *xa);
+	xa = (struct xmlsd_attribute *)(nxe + n);
+	p = (char *)(xa + nattrs);
+
+	len = strlen(name) + 1;
+	xname = memcpy(p, name, len);
+	p += len;
+	xmlsd_doc_changed(xd);
+	for (i = 0; i < n; i++) {
+		nxe[i].name = xname;
+		nxe[i].namelen = len - 1;
+		nxe[i].flags = XMLSD_ELEM_F_CHUNK;
+		nxe[i].value.mm = xd->mm;
+		TAILQ_INIT(&nxe[i].attr_list);
+		TAILQ_INIT(&nxe[i].children);
+		nxe[i].depth = xe->depth + 1;
+		nxe[i].parent = xe;
+		xmlsd_elem_add_child(xe, &nxe[i]);
+	}
+
+	/* column by column, which keeps attribute order per element */
+	for (j = 0; j < ncols; j++) {
+		alen = strlen(cols[j].name);
+		aname = memcpy(p, cols[j].name, alen + 1);
+		p += alen + 1;
+		for (i = 0; i < n; i++) {
+			if ((v = cols[j].values[i]) == NULL)
+				continue;
+			len = strlen(v) + 1;
+			xa->name = aname;
+			xa->namelen = alen;
+			xa->flags = XMLSD_ATTR_F_CHUNK;
+			xa->value.str = memcpy(p, v, len);
+			xa->value.len = len - 1;
+			xa->value.type = XMLSD_VALUE_STRING;
+			xa->value.mm = xd->mm;
+			p += len;
+			TAILQ_INSERT_TAIL(&nxe[i].attr_list, xa, entry);
+			xa++;
+		}
+	}
+
+	return (nxe);
+}
+
+/*
+ * Add the `n' attributes `names[i]' = `values[i]' to `xe' which belongs to
+ * `xd'.  Like xmlsd_doc_add_elems() this uses a single allocation owned by
+ * the document.
+ *
+ * Returns 0 on success or 1 on failure, in which case no attribute was set.
+ */
+int
+xmlsd_doc_set_attrs(struct xmlsd_document *xd, struct xmlsd_element *xe,
+    const char **names, const char **values, size_t n)
+{
+	struct xmlsd_attribute	*xa;
+	char			*p;
+	size_t			 i, len, sz = 0;
+
+	if (xd == NULL || xe == NULL || names == NULL || values == NULL ||
+	    xd->sealed)
+		return 1;
+
+	for (i = 0; i < n; i++) {
+		if (names[i] == NULL || (strlen(names[i]) == 0) ||
+		    values[i] == NULL)
+			return 1;
+		sz += strlen(names[i]) + strlen(values[i]) + 2;
+	}
+	if (n == 0)
+		return 0;
+	if (n > SIZE_MAX / 2 / sizeof *xa)
+		return 1;
+	sz += n * sizeof *xa;
+
+	if ((xa = xmlsd_doc_chunk_alloc(xd, sz)) == NULL)
+		return 1;
+	memset(xa, 0, n * sizeof *xa);
+	p = (char *)(xa + n);
+
+	for (i = 0; i < n; i++, xa++) {
+		len = strlen(names[i]) + 1;
+		xa->name = memcpy(p, names[i], len);
+		xa->namelen = len - 1;
+		p += len;
+		len = strlen(values[i]) + 1;
+		xa->value.str = memcpy(p, values[i], len);
+		xa->value.len = len - 1;
+		xa->value.type = XMLSD_VALUE_STRING;
+		xa->value.mm = xd->mm;
+		p += len;
+		xa->flags = XMLSD_ATTR_F_CHUNK;
+		xmlsd_elem_add_attr(xe, xa);
+	}
+
+	return 0;
+}
+
+/*
+ * Remove elem and its children from xd.  Elements detached from xd are
+ * freed as well.
  */
 void
 xmlsd_doc_remove_elem(struct xmlsd_document *xd, struct xmlsd_element *xe)
 {
-	struct xmlsd_element	*xc;
+	struct xmlsd_element	*xc, *xp;
 
-	if (xe == NULL || xd == NULL || xd->root == NULL)
+	if (xe == NULL || xd == NULL || xd->sealed)
 		return;
+	if (xe->detached != NULL) {
+		if (xe->detached != xd)
+			return;
+	} else if (xd->root == NULL)
+		return;
+	xmlsd_doc_changed(xd);
 
-	while ((xc = xmlsd_elem_get_first_child(xe)) != NULL)
-		xmlsd_doc_remove_elem(xd, xc);
-	if (xe->parent)
+	if (xe->parent) {
+		xmlsd_elem_drop_child_index(xe->parent);
 		TAILQ_REMOVE(&xe->parent->children, xe, entry);
-	else {
+	} else if (xe->detached == NULL) {
 		xd->root = NULL;
 	}
+
+	/* free bottom up, without recursing however deep the tree is */
+	xc = xe;
+	for (;;) {
+		while ((xp = xmlsd_elem_get_first_child(xc)) != NULL)
+			xc = xp;
+		if (xc == xe)
+			break;
+		xp = xc->parent;
+		TAILQ_REMOVE(&xp->children, xc, entry);
+		xmlsd_elem_free(xc);
+		xc = xp;
+	}
 	xmlsd_elem_free(xe);
 }
+
+/* `xe' is in the tree of `xd', not detached from it, and may be changed */
+static int
+xmlsd_doc_holds(struct xmlsd_document *xd, struct xmlsd_element *xe)
+{
+	if (xe->flags & XMLSD_ELEM_F_SEALED)
+		return (0);
+	while (xe->parent != NULL)
+		xe = xe->parent;
+
+	return (xe == xd->root);
+}
+
+/*
+ * Take `xe' and its descendants out of the tree of `xd' without freeing
+ * or copying anything.  The subtree still belongs to `xd' and must be
+ * put back with xmlsd_elem_append() or xmlsd_elem_insert_before(), or
+ * freed with xmlsd_doc_remove_elem(), before `xd' is cleared or freed.
+ */
+int
+xmlsd_elem_detach(struct xmlsd_document *xd, struct xmlsd_element *xe)
+{
+	if (xd == NULL || xe == NULL || xe->detached != NULL || xd->sealed ||
+	    !xmlsd_doc_holds(xd, xe))
+		return (XMLSD_ERR_INTEGRITY);
+
+	if (xe->parent) {
+		xmlsd_elem_drop_child_index(xe->parent);
+		TAILQ_REMOVE(&xe->parent->children, xe, entry);
+		xe->parent = NULL;
+	} else
+		xd->root = NULL;
+	xe->detached = xd;
+	xmlsd_doc_changed(xd);
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/* `a' and `b' are the same allocator, or both malloc(3) */
+static int
+xmlsd_mm_same(const struct xmlsd_allocator *a, const struct xmlsd_allocator *b)
+{
+	if (a == NULL || b == NULL)
+		return (a == b);
+	return (a->xal_malloc == b->xal_malloc &&
+	    a->xal_realloc == b->xal_realloc && a->xal_free == b->xal_free &&
+	    a->xal_arg == b->xal_arg);
+}
+
+/* where the memory of `top' comes from besides allocations of its own */
+#define XMLSD_MEM_CHUNK		(0x1)	/* chunks of its document */
+#define XMLSD_MEM_INPUT		(0x2)	/* values borrowed from the input */
+
+static int
+xmlsd_value_memory(struct xmlsd_value *v)
+{
+	if (v->type != XMLSD_VALUE_STRING || v->str == v->numbuf ||
+	    (v->flags & XMLSD_VALUE_F_ALLOC))
+		return (0);
+	return (v->flags & XMLSD_VALUE_F_BORROW ? XMLSD_MEM_INPUT :
+	    XMLSD_MEM_CHUNK);
+}
+
+static int
+xmlsd_elem_memory(struct xmlsd_element *top)
+{
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xe;
+	struct xmlsd_attribute	*xa;
+	int			 mem = 0;
+
+	xmlsd_walk_init(&xw, top, XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		if (xe->flags & XMLSD_ELEM_F_CHUNK)
+			mem |= XMLSD_MEM_CHUNK;
+		mem |= xmlsd_value_memory(&xe->value);
+		TAILQ_FOREACH(xa, &xe->attr_list, entry) {
+			if (xa->flags & XMLSD_ATTR_F_CHUNK)
+				mem |= XMLSD_MEM_CHUNK;
+			mem |= xmlsd_value_memory(&xa->value);
+		}
+	}
+
+	return (mem);
+}
+
+/* `xd' holds a reference to `cs' */
+static int
+xmlsd_doc_has_share(struct xmlsd_document *xd, struct xmlsd_chunk_share *cs)
+{
+	struct xmlsd_share_ref	*sr;
+
+	SLIST_FOREACH(sr, &xd->shares, link)
+		if (sr->cs == cs)
+			return (1);
+	return (0);
+}
+
+static int
+xmlsd_doc_add_share(struct xmlsd_document *xd, struct xmlsd_chunk_share *cs)
+{
+	struct xmlsd_share_ref	*sr;
+
+	if ((sr = xmlsd_mm_malloc(xd->mm, sizeof *sr)) == NULL)
+		return (1);
+	sr->cs = cs;
+	__atomic_add_fetch(&cs->refs, 1, __ATOMIC_RELAXED);
+	SLIST_INSERT_HEAD(&xd->shares, sr, link);
+
+	return (0);
+}
+
+/*
+ * Let `to' use the chunks of `from', and those `from' uses of others, for
+ * as long as it needs them.  The chunks of `from' become a share of both
+ * and it starts on new ones.
+ */
+static int
+xmlsd_doc_share_chunks(struct xmlsd_document *to, struct xmlsd_document *from)
+{
+	struct xmlsd_chunk_share *cs;
+	struct xmlsd_share_ref	*sr;
+	struct xmlsd_chunk	*xc;
+
+	if (!SLIST_EMPTY(&from->chunks) || !SLIST_EMPTY(&from->big)) {
+		if ((cs = xmlsd_mm_malloc(from->mm, sizeof *cs)) == NULL)
+			return (1);
+		bzero(cs, sizeof *cs);
+		SLIST_INIT(&cs->chunks);
+		if (from->mm != NULL) {
+			cs->xal = *from->mm;
+			cs->mm = &cs->xal;
+		}
+		if (xmlsd_doc_add_share(from, cs)) {
+			xmlsd_mm_free(from->mm, cs);
+			return (1);
+		}
+		while ((xc = SLIST_FIRST(&from->chunks)) != NULL) {
+			SLIST_REMOVE_HEAD(&from->chunks, link);
+			SLIST_INSERT_HEAD(&cs->chunks, xc, link);
+		}
+		while ((xc = SLIST_FIRST(&from->big)) != NULL) {
+			SLIST_REMOVE_HEAD(&from->big, link);
+			SLIST_INSERT_HEAD(&cs->chunks, xc, link);
+		}
+		from->chunk_cur = NULL;
+	}
+
+	SLIST_FOREACH(sr, &from->shares, link)
+		if (!xmlsd_doc_has_share(to, sr->cs) &&
+		    xmlsd_doc_add_share(to, sr->cs))
+			return (1);
+
+	return (0);
+}
+
+/*
+ * Make the detached `xe' part of `xd' under `parent', in place.  `parent'
+ * must be in the tree of `xd'.  A subtree moves to another document with
+ * the same allocator, which then keeps the memory of the old one the
+ * subtree lives in until it is cleared or freed itself.  Values borrowed
+ * from the input of the old document can't move.
+ */
+static int
+xmlsd_elem_attach(struct xmlsd_document *xd, struct xmlsd_element *parent,
+    struct xmlsd_element *xe)
+{
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xp;
+	struct xmlsd_attribute	*xa;
+	int			 delta, mem, moved;
+
+	if (xd == NULL || xe == NULL || xe->detached == NULL || xd->sealed)
+		return (XMLSD_ERR_INTEGRITY);
+	if (parent != NULL && !xmlsd_doc_holds(xd, parent))
+		return (XMLSD_ERR_INTEGRITY);
+	if ((moved = xe->detached != xd)) {
+		if (!xmlsd_mm_same(xe->detached->mm, xd->mm))
+			return (XMLSD_ERR_INTEGRITY);
+		mem = xmlsd_elem_memory(xe);
+		if (mem & XMLSD_MEM_INPUT)
+			return (XMLSD_ERR_INTEGRITY);
+		if ((mem & XMLSD_MEM_CHUNK) &&
+		    xmlsd_doc_share_chunks(xd, xe->detached))
+			return (XMLSD_ERR_RESOURCE);
+	}
+
+	xe->parent = parent;
+	xe->detached = NULL;
+	delta = (parent ? parent->depth + 1 : 0) - xe->depth;
+	if (delta != 0 || moved) {
+		/* the allocator of the old document goes away with it */
+		xmlsd_walk_init(&xw, xe, XMLSD_WALK_PRE);
+		while ((xp = xmlsd_walk_next(&xw)) != NULL) {
+			xp->depth += delta;
+			if (!moved)
+				continue;
+			xp->value.mm = xd->mm;
+			TAILQ_FOREACH(xa, &xp->attr_list, entry)
+				xa->value.mm = xd->mm;
+		}
+	}
+	xmlsd_doc_changed(xd);
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Move the detached `xe' to the end of the children of `parent' in `xd',
+ * or make it the root of `xd' if `parent' is NULL and `xd' is empty.
+ */
+int
+xmlsd_elem_append(struct xmlsd_document *xd, struct xmlsd_element *parent,
+    struct xmlsd_element *xe)
+{
+	int			 rv;
+
+	if (parent == NULL && (xd == NULL || xd->root != NULL))
+		return (XMLSD_ERR_INTEGRITY);
+	if ((rv = xmlsd_elem_attach(xd, parent, xe)) != XMLSD_ERR_SUCCES)
+		return (rv);
+
+	if (parent)
+		xmlsd_elem_add_child(parent, xe);
+	else
+		xd->root = xe;
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Move the detached `xe' in front of `sibling' in `xd'.
+ */
+int
+xmlsd_elem_insert_before(struct xmlsd_document *xd,
+    struct xmlsd_element *sibling, struct xmlsd_element *xe)
+{
+	int			 rv;
+
+	if (sibling == NULL || sibling->parent == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	if ((rv = xmlsd_elem_attach(xd, sibling->parent, xe)) !=
+	    XMLSD_ERR_SUCCES)
+		return (rv);
+
+	/* the index keeps children of a name in order, start over */
+	xmlsd_elem_drop_child_index(sibling->parent);
+	TAILQ_INSERT_BEFORE(sibling, xe, entry);
+
+	return (XMLSD_ERR_SUCCES);
+}
+
 /*
  * Return boolean whether or not xd is an empty document.
  */
@@ -153,3 +878,529 @@ xmlsd_doc_get_root(struct xmlsd_document *xd)
 {
 	return (xd->root);
 }
+
+/* bytes needed to store a copy of `v' */
+static size_t
+xmlsd_value_flat_size(struct xmlsd_value *v)
+{
+	if (v->type == XMLSD_VALUE_B64)
+		return (xmlsd_b64_enclen(v->num.bin->len) + 1);
+	return (v->type == XMLSD_VALUE_STRING ? v->len + 1 : 0);
+}
+
+/* copy `src' into `dst', string storage is taken from `p' */
+static char *
+xmlsd_value_flatten(struct xmlsd_value *dst, struct xmlsd_value *src, char *p)
+{
+	size_t len;
+
+	memset(dst, 0, sizeof *dst);
+	dst->type = src->type;
+	dst->num = src->num;	/* numbers are formatted on demand */
+	if (src->type == XMLSD_VALUE_B64) {
+		/* binary data is kept as its text */
+		dst->type = XMLSD_VALUE_STRING;
+		dst->num.u = 0;
+		len = xmlsd_b64_encode(p, src->num.bin->data,
+		    src->num.bin->len);
+		p[len] = '\0';
+		dst->str = p;
+		dst->len = len;
+		p += len + 1;
+	} else if (src->type == XMLSD_VALUE_STRING) {
+		/* borrowed strings are not terminated */
+		dst->str = memcpy(p, src->str, src->len);
+		dst->str[src->len] = '\0';
+		dst->len = src->len;
+		p += src->len + 1;
+		/* strings keep whatever they were decoded as */
+		dst->flags = src->flags &
+		    (XMLSD_VALUE_F_KIND | XMLSD_VALUE_F_STATUS);
+	}
+
+	return (p);
+}
+
+/*
+ * Return the number of bytes xmlsd_elem_flatten() needs for `top' and all
+ * of its descendants.
+ */
+size_t
+xmlsd_elem_flat_size(struct xmlsd_element *top)
+{
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xe;
+	struct xmlsd_attribute	*xa;
+	size_t			 sz, total = 0;
+
+	xmlsd_walk_init(&xw, top, XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		sz = sizeof *xe + xe->namelen + 1 +
+		    xmlsd_value_flat_size(&xe->value);
+		TAILQ_FOREACH(xa, &xe->attr_list, entry)
+			sz += sizeof *xa + xa->namelen + 1 +
+			    xmlsd_value_flat_size(&xa->value);
+		total += XMLSD_ALIGN(sz);
+	}
+
+	return (total);
+}
+
+/*
+ * Copy `top' and all of its descendants into `buf' as children of
+ * `parent', which may be NULL, for a document allocating from `mm'.  The
+ * elements are laid out in document order, each directly followed by its
+ * attributes and then its strings, so walking the copy touches memory
+ * front to back.
+ *
+ * `buf' must hold xmlsd_elem_flat_size() bytes and be suitably aligned.
+ * The copy is not linked into `parent', its top element is returned.
+ */
+struct xmlsd_element *
+xmlsd_elem_flatten(struct xmlsd_element *top, struct xmlsd_element *parent,
+    void *buf, const struct xmlsd_allocator *mm)
+{
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xe, *nxe, *cur = parent, *ntop = NULL;
+	struct xmlsd_attribute	*xa, *nxa, *na;
+	char			*p = buf, *s;
+	size_t			 len, nattrs;
+
+	xmlsd_walk_init(&xw, top, XMLSD_WALK_PRE | XMLSD_WALK_POST);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		if (xw.xw_post) {
+			cur = cur->parent;
+			continue;
+		}
+
+		nattrs = 0;
+		TAILQ_FOREACH(xa, &xe->attr_list, entry)
+			nattrs++;
+
+		nxe = (struct xmlsd_element *)p;
+		na = (struct xmlsd_attribute *)(nxe + 1);
+		s = (char *)(na + nattrs);
+
+		memset(nxe, 0, sizeof *nxe);
+		TAILQ_INIT(&nxe->attr_list);
+		TAILQ_INIT(&nxe->children);
+		nxe->flags = XMLSD_ELEM_F_CHUNK;
+		nxe->parent = cur;
+		nxe->depth = cur ? cur->depth + 1 : 0;
+		len = xe->namelen + 1;
+		nxe->name = memcpy(s, xe->name, len);
+		nxe->namelen = xe->namelen;
+		s = xmlsd_value_flatten(&nxe->value, &xe->value, s + len);
+		nxe->value.mm = mm;
+
+		nxa = na;
+		TAILQ_FOREACH(xa, &xe->attr_list, entry) {
+			memset(nxa, 0, sizeof *nxa);
+			nxa->flags = XMLSD_ATTR_F_CHUNK;
+			len = xa->namelen + 1;
+			nxa->name = memcpy(s, xa->name, len);
+			nxa->namelen = xa->namelen;
+			s = xmlsd_value_flatten(&nxa->value, &xa->value,
+			    s + len);
+			nxa->value.mm = mm;
+			TAILQ_INSERT_TAIL(&nxe->attr_list, nxa, entry);
+			nxa++;
+		}
+
+		if (ntop == NULL)
+			ntop = nxe;
+		else
+			xmlsd_elem_add_child(cur, nxe);
+		cur = nxe;
+		p += XMLSD_ALIGN(s - p);
+	}
+
+	return (ntop);
+}
+
+/*
+ * Lay the tree of `xd' out again in one contiguous block, in document
+ * order.  The old nodes are released.
+ *
+ * The result is an ordinary document, all accessors keep working and it
+ * may still be modified, but anything added later lives outside the
+ * block.  Element and attribute pointers obtained before freezing are
+ * no longer valid afterwards.
+ *
+ * Returns an error code, on failure the document is left as it was.
+ */
+int
+xmlsd_doc_freeze(struct xmlsd_document *xd)
+{
+	struct xmlsd_element	*root;
+	void			*buf;
+
+	if (xd == NULL || xd->sealed)
+		return (XMLSD_ERR_INTEGRITY);
+	if (xd->root == NULL)
+		return (XMLSD_ERR_SUCCES);
+
+	buf = xmlsd_doc_chunk_alloc(xd, xmlsd_elem_flat_size(xd->root));
+	if (buf == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	root = xmlsd_elem_flatten(xd->root, NULL, buf, xd->mm);
+
+	xmlsd_doc_remove_elem(xd, xd->root);
+	xd->root = root;
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Copy `src' and all of its descendants into `xd' as the last child of
+ * `parent', or as the root if `parent' is NULL and `xd' is empty.
+ * `parent' must be in the tree of `xd'.  The copy is made with a single
+ * allocation owned by `xd', taken from its chunks if it recycles memory.
+ * `src' may belong to any document, including `xd'.
+ *
+ * Returns the copy of `src' or NULL on failure.
+ */
+struct xmlsd_element *
+xmlsd_elem_clone_into(struct xmlsd_document *xd, struct xmlsd_element *parent,
+    struct xmlsd_element *src)
+{
+	struct xmlsd_element	*nxe;
+	void			*buf;
+
+	if (xd == NULL || src == NULL || xd->sealed ||
+	    (parent == NULL && xd->root != NULL) ||
+	    (parent != NULL && !xmlsd_doc_holds(xd, parent)))
+		return (NULL);
+
+	buf = xmlsd_doc_chunk_alloc(xd, xmlsd_elem_flat_size(src));
+	if (buf == NULL)
+		return (NULL);
+	nxe = xmlsd_elem_flatten(src, parent, buf, xd->mm);
+
+	if (parent)
+		xmlsd_elem_add_child(parent, nxe);
+	else
+		xd->root = nxe;
+	xmlsd_doc_changed(xd);
+
+	return (nxe);
+}
+
+/*
+ * Allocate a copy of `src' into `xdp', with the same flags and allocator.
+ * The tree is copied with a single allocation, laid out like a frozen
+ * document.
+ */
+int
+xmlsd_doc_clone(struct xmlsd_document **xdp, struct xmlsd_document *src)
+{
+	struct xmlsd_document	*xd;
+	int			 rv;
+
+	if (xdp == NULL || src == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+
+	if ((rv = xmlsd_doc_alloc_mm(&xd, src->flags, src->mm)) !=
+	    XMLSD_ERR_SUCCES)
+		return (rv);
+	if (src->root != NULL &&
+	    xmlsd_elem_clone_into(xd, NULL, src->root) == NULL) {
+		xmlsd_doc_free(xd);
+		return (XMLSD_ERR_RESOURCE);
+	}
+
+	*xdp = xd;
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Make `xd' read only so that any number of threads may read it at once
+ * without locking.  Everything lookups would otherwise build on first use
+ * is built now: the path index, the child and attribute indexes and the
+ * text of every value.  Calls that would modify a sealed document fail
+ * and clearing it does nothing, it can only be freed.
+ *
+ * Returns an error code, on failure the document is not sealed.
+ */
+int
+xmlsd_doc_seal(struct xmlsd_document *xd)
+{
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xe;
+
+	if (xd == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	if (xd->sealed)
+		return (XMLSD_ERR_SUCCES);
+
+	xmlsd_walk_init(&xw, xd->root, XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL)
+		if (xmlsd_elem_seal(xe))
+			return (XMLSD_ERR_RESOURCE);
+	if (xmlsd_doc_index_paths(xd) != XMLSD_ERR_SUCCES)
+		return (XMLSD_ERR_RESOURCE);
+
+	xmlsd_walk_init(&xw, xd->root, XMLSD_WALK_PRE);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL)
+		xe->flags |= XMLSD_ELEM_F_SEALED;
+	xmlsd_parse_cache_free(&xd->parse_cache);
+	xd->sealed = 1;
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Return whether `xd' is sealed.
+ */
+int
+xmlsd_doc_is_sealed(struct xmlsd_document *xd)
+{
+	return (xd->sealed);
+}
+
+/*
+ * Take another reference to `xd'.  A document starts out with one
+ * reference, held by whoever allocated it.
+ */
+void
+xmlsd_doc_ref(struct xmlsd_document *xd)
+{
+	__atomic_add_fetch(&xd->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drop a reference to `xd', the last one frees it.
+ */
+void
+xmlsd_doc_unref(struct xmlsd_document *xd)
+{
+	if (xd == NULL)
+		return;
+	if (__atomic_sub_fetch(&xd->refs, 1, __ATOMIC_ACQ_REL) < 0)
+		xmlsd_doc_free(xd);
+}
+
+static void
+xmlsd_path_index_free(const struct xmlsd_allocator *mm,
+    struct xmlsd_path_index *pi)
+{
+	if (pi == NULL)
+		return;
+	xmlsd_mm_free(mm, pi->nodes);
+	xmlsd_mm_free(mm, pi->table);
+	xmlsd_mm_free(mm, pi->elems);
+	xmlsd_mm_free(mm, pi);
+}
+
+/*
+ * The tree of `xd' has changed shape, forget everything derived from it.
+ */
+void
+xmlsd_doc_changed(struct xmlsd_document *xd)
+{
+	xmlsd_path_index_free(xd->mm, xd->path_index);
+	xd->path_index = NULL;
+}
+
+static uint32_t
+xmlsd_path_hash(size_t parent, const char *name, size_t len)
+{
+	uint32_t		 h = 2166136261U ^ (uint32_t)parent;
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+
+	return (h);
+}
+
+/* return the table slot of path `name' below `parent' */
+static size_t *
+xmlsd_path_slot(struct xmlsd_path_index *pi, size_t parent, const char *name,
+    size_t len)
+{
+	struct xmlsd_path_node	*pn;
+	size_t			 i;
+
+	for (i = xmlsd_path_hash(parent, name, len) & pi->mask;
+	    pi->table[i] != 0; i = (i + 1) & pi->mask) {
+		pn = &pi->nodes[pi->table[i] - 1];
+		if (pn->parent == parent && pn->namelen == len &&
+		    !memcmp(pn->name, name, len))
+			break;
+	}
+
+	return (&pi->table[i]);
+}
+
+/*
+ * Find or add the node for path `name' below `parent', growing `pi' with
+ * memory from `mm'.  Returns XMLSD_PATH_NONE on allocation failure.
+ */
+static size_t
+xmlsd_path_node_get(const struct xmlsd_allocator *mm,
+    struct xmlsd_path_index *pi, size_t parent, const char *name, size_t len)
+{
+	struct xmlsd_path_node	*pn;
+	size_t			*slot, *table, i, size;
+
+	slot = xmlsd_path_slot(pi, parent, name, len);
+	if (*slot != 0)
+		return (*slot - 1);
+
+	if (pi->nnodes == pi->nodes_size) {
+		size = pi->nodes_size ? pi->nodes_size * 2 : 16;
+		if (size > SIZE_MAX / 2 / sizeof *pn)
+			return (XMLSD_PATH_NONE);
+		if ((pn = xmlsd_mm_realloc(mm, pi->nodes,
+		    size * sizeof *pn)) == NULL)
+			return (XMLSD_PATH_NONE);
+		pi->nodes = pn;
+		pi->nodes_size = size;
+	}
+	if ((pi->nnodes + 1) * 2 > pi->mask + 1) {
+		size = (pi->mask + 1) * 2;
+		if ((table = xmlsd_mm_calloc(mm, size, sizeof *table)) ==
+		    NULL)
+			return (XMLSD_PATH_NONE);
+		xmlsd_mm_free(mm, pi->table);
+		pi->table = table;
+		pi->mask = size - 1;
+		for (i = 0; i < pi->nnodes; i++) {
+			pn = &pi->nodes[i];
+			*xmlsd_path_slot(pi, pn->parent, pn->name,
+			    pn->namelen) = i + 1;
+		}
+		slot = xmlsd_path_slot(pi, parent, name, len);
+	}
+
+	pn = &pi->nodes[pi->nnodes];
+	pn->parent = parent;
+	pn->name = name;
+	pn->namelen = len;
+	pn->count = pn->off = 0;
+	*slot = ++pi->nnodes;
+
+	return (pi->nnodes - 1);
+}
+
+/*
+ * Index every element of `xd' by its dotted path, as used in struct
+ * xmlsd_v_elem, for xmlsd_doc_find_path().  The index is dropped
+ * whenever elements are added or removed and only needs to be rebuilt
+ * if it is wanted again.
+ *
+ * Returns an error code.
+ */
+int
+xmlsd_doc_index_paths(struct xmlsd_document *xd)
+{
+	struct xmlsd_path_index	*pi;
+	struct xmlsd_walk	 xw;
+	struct xmlsd_element	*xe;
+	size_t			 n, cur, nelems = 0;
+	int			 pass;
+
+	if (xd == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	if (xd->path_index != NULL)
+		return (XMLSD_ERR_SUCCES);
+
+	if ((pi = xmlsd_mm_calloc(xd->mm, 1, sizeof *pi)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	pi->mask = 15;
+	if ((pi->table = xmlsd_mm_calloc(xd->mm, pi->mask + 1,
+	    sizeof *pi->table)) == NULL)
+		goto fail;
+
+	/* count the elements per path, then drop them into place */
+	for (pass = 0; pass < 2; pass++) {
+		cur = XMLSD_PATH_NONE;
+		xmlsd_walk_init(&xw, xd->root, XMLSD_WALK_PRE |
+		    XMLSD_WALK_POST);
+		while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+			if (xw.xw_post) {
+				cur = pi->nodes[cur].parent;
+				continue;
+			}
+			if (pass == 0) {
+				n = xmlsd_path_node_get(xd->mm, pi, cur,
+				    xe->name, xe->namelen);
+				if (n == XMLSD_PATH_NONE)
+					goto fail;
+				pi->nodes[n].count++;
+				nelems++;
+			} else {
+				n = *xmlsd_path_slot(pi, cur, xe->name,
+				    xe->namelen) - 1;
+				pi->elems[pi->nodes[n].off++] = xe;
+			}
+			cur = n;
+		}
+
+		if (pass == 0) {
+			pi->elems = xmlsd_mm_calloc(xd->mm,
+			    nelems ? nelems : 1, sizeof *pi->elems);
+			if (pi->elems == NULL)
+				goto fail;
+		}
+		for (n = 0, cur = 0; n < pi->nnodes; n++) {
+			/* first pass sets offsets, second restores them */
+			if (pass == 1)
+				pi->nodes[n].off -= pi->nodes[n].count;
+			else {
+				pi->nodes[n].off = cur;
+				cur += pi->nodes[n].count;
+			}
+		}
+	}
+
+	xd->path_index = pi;
+	return (XMLSD_ERR_SUCCES);
+fail:
+	xmlsd_path_index_free(xd->mm, pi);
+	return (XMLSD_ERR_RESOURCE);
+}
+
+/*
+ * Return all elements of `xd' on the dotted path `path', innermost name
+ * first as in struct xmlsd_v_elem, e.g. "file.dir.filesystem" for all
+ * file elements in dir elements below the filesystem root.  The elements
+ * are in document order and their number is stored in `nelems'.
+ *
+ * The paths are indexed first if needed.  The array belongs to `xd' and
+ * is valid until elements are added or removed.  Returns NULL if there
+ * are no such elements or the index could not be built.
+ */
+struct xmlsd_element **
+xmlsd_doc_find_path(struct xmlsd_document *xd, const char *path,
+    size_t *nelems)
+{
+	struct xmlsd_path_index	*pi;
+	struct xmlsd_path_node	*pn;
+	const char		*end, *dot;
+	size_t			 cur = XMLSD_PATH_NONE, slot;
+
+	*nelems = 0;
+	if (path == NULL || xmlsd_doc_index_paths(xd) != XMLSD_ERR_SUCCES)
+		return (NULL);
+	pi = xd->path_index;
+
+	/* the outermost name is last */
+	end = path + strlen(path);
+	do {
+		for (dot = end; dot > path && dot[-1] != '.'; dot--)
+			;
+		if (dot == end)
+			return (NULL);
+		if ((slot = *xmlsd_path_slot(pi, cur, dot, end - dot)) == 0)
+			return (NULL);
+		cur = slot - 1;
+		end = dot - 1;
+	} while (dot > path);
+
+	pn = &pi->nodes[cur];
+	*nelems = pn->count;
+	return (&pi->elems[pn->off]);
+}
@@ -21,6 +21,127 @@
 
 #include <string.h>
 
+/*
+ * FNV-1a, good enough for the short names found in documents.
+ */
+uint32_t
+xmlsd_hash(const char *s)
+{
+	uint32_t		 h = 2166136261U;
+
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+
+	return (h);
+}
+
+/* insert `xa' unless an attribute by that name is in the index already */
+static void
+xmlsd_attr_index_insert(struct xmlsd_attr_index *ai, struct xmlsd_attribute *xa)
+{
+	struct xmlsd_attribute	*xi;
+	size_t			 i;
+
+	for (i = xmlsd_hash(xa->name) & ai->mask;
+	    (xi = ai->slot[i]) != NULL; i = (i + 1) & ai->mask)
+		if (xi->namelen == xa->namelen &&
+		    !memcmp(xi->name, xa->name, xa->namelen))
+			return;
+	ai->slot[i] = xa;
+	ai->count++;
+}
+
+/*
+ * Build the attribute index of `xe', at most half full.  The first
+ * attribute of a given name wins, just like a walk of attr_list.
+ */
+static struct xmlsd_attr_index *
+xmlsd_attr_index_build(struct xmlsd_element *xe)
+{
+	struct xmlsd_attr_index	*ai;
+	struct xmlsd_attribute	*xa;
+	size_t			 n = 0, size = 16;
+
+	TAILQ_FOREACH(xa, &xe->attr_list, entry)
+		n++;
+	while (size < n * 2)
+		size *= 2;
+
+	ai = xmlsd_mm_calloc(xe->value.mm, 1,
+	    sizeof *ai + size * sizeof ai->slot[0]);
+	if (ai == NULL)
+		return (NULL);
+	ai->mask = size - 1;
+	TAILQ_FOREACH(xa, &xe->attr_list, entry)
+		xmlsd_attr_index_insert(ai, xa);
+
+	return (xe->attr_index = ai);
+}
+
+/*
+ * Find the first attribute called `name' in `xe'.
+ *
+ * Small elements are simply searched, the index is built the first time
+ * a search gets past XMLSD_ATTR_INDEX_MIN attributes.  Names of another
+ * length are passed over without looking at them.
+ */
+static struct xmlsd_attribute *
+xmlsd_elem_lookup_attr(struct xmlsd_element *xe, const char *name)
+{
+	struct xmlsd_attr_index	*ai;
+	struct xmlsd_attribute	*xa;
+	size_t			 i, n = 0, len = strlen(name);
+
+	if ((ai = xe->attr_index) == NULL) {
+		TAILQ_FOREACH(xa, &xe->attr_list, entry) {
+			if (xa->namelen == len && !memcmp(xa->name, name, len))
+				return (xa);
+			if (++n == XMLSD_ATTR_INDEX_MIN)
+				break;
+		}
+		if (xa == NULL)
+			return (NULL);
+		/* fall back to searching if we are out of memory */
+		if ((ai = xmlsd_attr_index_build(xe)) == NULL) {
+			while ((xa = TAILQ_NEXT(xa, entry)) != NULL)
+				if (xa->namelen == len &&
+				    !memcmp(xa->name, name, len))
+					break;
+			return (xa);
+		}
+	}
+
+	for (i = xmlsd_hash(name) & ai->mask;
+	    (xa = ai->slot[i]) != NULL; i = (i + 1) & ai->mask)
+		if (xa->namelen == len && !memcmp(xa->name, name, len))
+			break;
+
+	return (xa);
+}
+
+/*
+ * Append `xa' to the attributes of `xe', keeping the index up to date.
+ */
+void
+xmlsd_elem_add_attr(struct xmlsd_element *xe, struct xmlsd_attribute *xa)
+{
+	struct xmlsd_attr_index	*ai = xe->attr_index;
+
+	TAILQ_INSERT_TAIL(&xe->attr_list, xa, entry);
+	if (ai == NULL)
+		return;
+
+	/* too full, build a bigger one on the next lookup */
+	if ((ai->count + 1) * 2 > ai->mask + 1) {
+		xmlsd_mm_free(xe->value.mm, ai);
+		xe->attr_index = NULL;
+		return;
+	}
+	xmlsd_attr_index_insert(ai, xa);
+}
+
 const char *
 xmlsd_elem_get_name(struct xmlsd_element *xe)
 {
@@ -42,14 +163,10 @@ xmlsd_elem_get_parent(struct xmlsd_element *xe)
 struct xmlsd_attribute	*
 xmlsd_elem_find_attr(struct xmlsd_element *xe, const char *findme)
 {
-	struct xmlsd_attribute	*xa;
-
-	TAILQ_FOREACH(xa, &xe->attr_list, entry) {
-		if (!strcmp(xe->name, findme)) 
-			break;
-	}
+	if (xe == NULL || findme == NULL)
+		return (NULL);
 
-	return (xa);
+	return (xmlsd_elem_lookup_attr(xe, findme));
 }
 
 struct xmlsd_attribute	*
@@ -77,21 +194,224 @@ xmlsd_elem_get_previous_attr(struct xmlsd_element *xe,
 	return (TAILQ_PREV(xa, xmlsd_attribute_list, entry));
 }
 
+/* find the bucket for `name' of `len', or the empty slot it would go in */
+static struct xmlsd_child_bucket *
+xmlsd_child_index_slot(struct xmlsd_child_index *ci, const char *name,
+    size_t len)
+{
+	struct xmlsd_child_bucket *cb;
+	size_t			 i;
+
+	for (i = xmlsd_hash(name) & ci->mask;; i = (i + 1) & ci->mask) {
+		cb = &ci->slot[i];
+		if (cb->name == NULL || (cb->namelen == len &&
+		    !memcmp(cb->name, name, len)))
+			return (cb);
+	}
+}
+
+/*
+ * Add `xc' to the end of the list of its name in the child index of `xe',
+ * growing the index if it gets more than half full.  Returns 1 if the index
+ * could not be grown, in which case it has been dropped.
+ */
+static int
+xmlsd_child_index_append(struct xmlsd_element *xe, struct xmlsd_element *xc)
+{
+	struct xmlsd_child_index *ci = xe->child_index, *nci;
+	struct xmlsd_child_bucket *cb, *ncb;
+	size_t			 i, size;
+
+	xc->name_next = NULL;
+	cb = xmlsd_child_index_slot(ci, xc->name, xc->namelen);
+	if (cb->name != NULL) {
+		cb->last->name_next = xc;
+		cb->last = xc;
+		cb->count++;
+		return (0);
+	}
+
+	if ((ci->nnames + 1) * 2 > ci->mask + 1) {
+		size = (ci->mask + 1) * 2;
+		nci = xmlsd_mm_calloc(xe->value.mm, 1,
+		    sizeof *nci + size * sizeof nci->slot[0]);
+		if (nci == NULL) {
+			xmlsd_elem_drop_child_index(xe);
+			return (1);
+		}
+		nci->mask = size - 1;
+		nci->nnames = ci->nnames;
+		for (i = 0; i <= ci->mask; i++) {
+			if (ci->slot[i].name == NULL)
+				continue;
+			ncb = xmlsd_child_index_slot(nci, ci->slot[i].name,
+			    ci->slot[i].namelen);
+			*ncb = ci->slot[i];
+		}
+		xmlsd_mm_free(xe->value.mm, ci);
+		xe->child_index = ci = nci;
+		cb = xmlsd_child_index_slot(ci, xc->name, xc->namelen);
+	}
+
+	cb->name = xc->name;
+	cb->namelen = xc->namelen;
+	cb->first = cb->last = xc;
+	cb->count = 1;
+	ci->nnames++;
+
+	return (0);
+}
+
+/*
+ * Return the child index of `xe', building it if `xe' has enough children
+ * to make it worthwhile.  Returns NULL if there is no index.
+ */
+static struct xmlsd_child_index *
+xmlsd_elem_child_index(struct xmlsd_element *xe)
+{
+	struct xmlsd_element	*xc;
+	size_t			 n = 0;
+
+	if (xe->child_index != NULL)
+		return (xe->child_index);
+
+	TAILQ_FOREACH(xc, &xe->children, entry)
+		if (++n == XMLSD_CHILD_INDEX_MIN)
+			break;
+	if (xc == NULL)
+		return (NULL);
+
+	xe->child_index = xmlsd_mm_calloc(xe->value.mm, 1,
+	    sizeof *xe->child_index + 16 * sizeof xe->child_index->slot[0]);
+	if (xe->child_index == NULL)
+		return (NULL);
+	xe->child_index->mask = 15;
+	TAILQ_FOREACH(xc, &xe->children, entry)
+		if (xmlsd_child_index_append(xe, xc))
+			return (NULL);
+
+	return (xe->child_index);
+}
+
+/*
+ * Free the child index of `xe', it is rebuilt when needed.
+ */
+void
+xmlsd_elem_drop_child_index(struct xmlsd_element *xe)
+{
+	xmlsd_mm_free(xe->value.mm, xe->child_index);
+	xe->child_index = NULL;
+}
+
+/*
+ * Build everything lookups in `xe' would build on demand and make its
+ * values read only, so that it can be read by several threads at once.
+ * The caller marks it sealed once every element of the document is.
+ *
+ * Returns 0 on success, 1 on allocation failure.
+ */
+int
+xmlsd_elem_seal(struct xmlsd_element *xe)
+{
+	struct xmlsd_attribute	*xa;
+	struct xmlsd_element	*xc;
+	size_t			 n = 0;
+
+	TAILQ_FOREACH(xa, &xe->attr_list, entry) {
+		if (xmlsd_value_seal(&xa->value))
+			return (1);
+		n++;
+	}
+	if (n >= XMLSD_ATTR_INDEX_MIN && xe->attr_index == NULL &&
+	    xmlsd_attr_index_build(xe) == NULL)
+		return (1);
+	n = 0;
+	TAILQ_FOREACH(xc, &xe->children, entry)
+		if (++n == XMLSD_CHILD_INDEX_MIN)
+			break;
+	if (xc != NULL && xmlsd_elem_child_index(xe) == NULL)
+		return (1);
+	if (xmlsd_value_seal(&xe->value))
+		return (1);
+
+	return (0);
+}
+
+/*
+ * Append `xc' to the children of `xe', keeping the index up to date.
+ */
+void
+xmlsd_elem_add_child(struct xmlsd_element *xe, struct xmlsd_element *xc)
+{
+	TAILQ_INSERT_TAIL(&xe->children, xc, entry);
+	if (xe->child_index != NULL)
+		xmlsd_child_index_append(xe, xc);
+}
+
 struct xmlsd_element	*
 xmlsd_elem_find_child(struct xmlsd_element *xe, const char *findme)
 {
+	struct xmlsd_child_index *ci;
 	struct xmlsd_element	*xc;
+	size_t			 len;
 
 	if (xe == NULL || findme == NULL)
 		return (NULL);
+	len = strlen(findme);
+	if ((ci = xmlsd_elem_child_index(xe)) != NULL)
+		return (xmlsd_child_index_slot(ci, findme, len)->first);
 	TAILQ_FOREACH(xc, &xe->children, entry) {
-		if (!strcmp(xc->name, findme))
+		if (xc->namelen == len && !memcmp(xc->name, findme, len))
 			break;
 	}
 
 	return (xc);
 }
 
+/*
+ * Return the next child of `xe' after `prev' with the same name as `prev'.
+ */
+struct xmlsd_element	*
+xmlsd_elem_find_child_next(struct xmlsd_element *xe,
+    struct xmlsd_element *prev)
+{
+	struct xmlsd_element	*xc;
+
+	if (xe == NULL || prev == NULL || prev->parent != xe)
+		return (NULL);
+	if (xmlsd_elem_child_index(xe) != NULL)
+		return (prev->name_next);
+	for (xc = TAILQ_NEXT(prev, entry); xc != NULL;
+	    xc = TAILQ_NEXT(xc, entry))
+		if (xc->namelen == prev->namelen &&
+		    !memcmp(xc->name, prev->name, prev->namelen))
+			break;
+
+	return (xc);
+}
+
+/*
+ * Return the number of children of `xe' called `findme'.
+ */
+size_t
+xmlsd_elem_count_children(struct xmlsd_element *xe, const char *findme)
+{
+	struct xmlsd_child_index *ci;
+	struct xmlsd_element	*xc;
+	size_t			 len, n = 0;
+
+	if (xe == NULL || findme == NULL)
+		return (0);
+	len = strlen(findme);
+	if ((ci = xmlsd_elem_child_index(xe)) != NULL)
+		return (xmlsd_child_index_slot(ci, findme, len)->count);
+	TAILQ_FOREACH(xc, &xe->children, entry)
+		if (xc->namelen == len && !memcmp(xc->name, findme, len))
+			n++;
+
+	return (n);
+}
+
 struct xmlsd_element	*
 xmlsd_elem_get_first_child(struct xmlsd_element *xe)
 {
@@ -125,55 +445,43 @@ xmlsd_elem_get_attr(struct xmlsd_element *xe, const char *findme)
 	if (xe == NULL || findme == NULL)
 		return (NULL);
 
-	TAILQ_FOREACH(xa, &xe->attr_list, entry) {
-		if (!strcmp(xa->name, findme))
-			return (xa->value);
-	}
-	return (NULL);
+	if ((xa = xmlsd_elem_lookup_attr(xe, findme)) == NULL)
+		return (NULL);
+	return (xmlsd_value_get(&xa->value));
 }
 
+/*
+ * The typed getters decode a string the first time it is asked for and
+ * keep the result in the value, asking again costs a compare.
+ */
 long long
 xmlsd_elem_get_attr_strtonum(struct xmlsd_element *xe, const char *attr,
     long long minval, long long maxval, const char **errstr)
 {
-	const char	*str;
+	struct xmlsd_attribute	*xa;
 
-	if ((str = xmlsd_elem_get_attr(xe, attr)) == NULL) {
+	if (xe == NULL || attr == NULL ||
+	    (xa = xmlsd_elem_lookup_attr(xe, attr)) == NULL) {
 	    *errstr = "attr not found";
 	    return (0);
 	}
 
-	return (strtonum(str, minval, maxval, errstr));
+	return (xmlsd_value_strtonum(&xa->value, minval, maxval, errstr));
 }
 
 unsigned long long
 xmlsd_elem_get_attr_hexnum(struct xmlsd_element *xe, const char *attr,
     unsigned long long minval, unsigned long long maxval, const char **errstr)
 {
-	const char		*str;
-	char			*end;
-	unsigned long long	 val = 0;
+	struct xmlsd_attribute	*xa;
 
-	*errstr = NULL;
-	if ((str = xmlsd_elem_get_attr(xe, attr)) == NULL) {
+	if (xe == NULL || attr == NULL ||
+	    (xa = xmlsd_elem_lookup_attr(xe, attr)) == NULL) {
 	    *errstr = "attr not found";
 	    return (0);
 	}
-	if (minval > maxval) {
-		*errstr = "invalid";
-	} else {
-		val = strtoull(str, &end, 16);
-		if (str == end || *end != '\0')
-			*errstr = "invalid";
-		else if (val < minval)
-			*errstr = "toosmall";
-		else if ((val == ULLONG_MAX && errno == ERANGE) ||
-		    val < maxval)
-			*errstr = "too large";
-	}
-	if (*errstr != NULL)
-		val = 0;
-	return (val);
+
+	return (xmlsd_value_hexnum(&xa->value, minval, maxval, errstr));
 }
 
 /*
@@ -185,8 +493,7 @@ int
 xmlsd_elem_get_attr_boolean(struct xmlsd_element *elem, const char *name,
     int *ret_b, int def)
 {
-	const char	*attr;
-	int		 rv = 0;
+	struct xmlsd_attribute	*xa;
 
 	if (elem == NULL)
 		return (XMLSD_ERR_INTEGRITY);
@@ -195,241 +502,392 @@ xmlsd_elem_get_attr_boolean(struct xmlsd_element *elem, const char *name,
 	if (ret_b == NULL)
 		return (XMLSD_ERR_INTEGRITY);
 
-	if ((attr = xmlsd_elem_get_attr(elem, name)) == NULL) {
+	if ((xa = xmlsd_elem_lookup_attr(elem, name)) == NULL) {
 		*ret_b = def;
 		return (0);
 	}
 
-	if (!strcmp(attr, "true") || !strcmp(attr, "1"))
-		*ret_b = 1;
-	else if (!strcmp(attr, "false") || !strcmp(attr, "0"))
-		*ret_b = 0;
-	else
-		rv = XMLSD_ERR_INTEGRITY;
-
-	return (rv);
+	return (xmlsd_value_boolean(&xa->value, ret_b));
 }
 
-int
-xmlsd_elem_set_attr_int32(struct xmlsd_element *xe, const char *name,
-    int32_t ival)
+/* find the table slot of `name' in `as' */
+static size_t *
+xmlsd_attr_set_slot(struct xmlsd_attr_set *as, const char *name)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL || name == NULL || (strlen(name) == 0))
-		return 1;
+	size_t			 i;
 
-	if (asprintf(&buf, "%d", ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
-
-	rv = xmlsd_elem_set_attr(xe, name, buf);
+	for (i = xmlsd_hash(name) & as->mask; as->table[i] != 0;
+	    i = (i + 1) & as->mask)
+		if (!strcmp(as->names[as->table[i] - 1], name))
+			break;
 
-	free(buf);
+	return (&as->table[i]);
+}
 
-	return rv;
+/*
+ * Set up `as' for `names' with the storage in `table', which must have
+ * room for at least 2 * `n' entries rounded up to a power of two, and
+ * `alias' which must have room for `n'.
+ */
+static void
+xmlsd_attr_set_init(struct xmlsd_attr_set *as, const char **names, size_t n,
+    size_t *table, size_t *alias)
+{
+	size_t			*slot, i, size = 2;
+
+	while (size < n * 2)
+		size *= 2;
+	memset(table, 0, size * sizeof *table);
+	as->names = names;
+	as->n = n;
+	as->nunique = 0;
+	as->mask = size - 1;
+	as->table = table;
+	as->alias = alias;
+
+	for (i = 0; i < n; i++) {
+		slot = xmlsd_attr_set_slot(as, names[i]);
+		if (*slot == 0) {
+			*slot = i + 1;
+			as->nunique++;
+		}
+		alias[i] = *slot - 1;
+	}
 }
 
+/*
+ * Compile the `n' attribute names in `names' into a set for
+ * xmlsd_elem_get_attr_set() that can be used on any number of elements.
+ * The names are copied.
+ *
+ * Returns an error code.
+ */
 int
-xmlsd_elem_set_attr_uint32(struct xmlsd_element *xe, const char *name,
-    uint32_t ival)
+xmlsd_attr_set_alloc(struct xmlsd_attr_set **asp, const char **names,
+    size_t n)
 {
-	char *buf;
-	int rv;
+	struct xmlsd_attr_set	*as;
+	const char		**nnames;
+	size_t			*table, i, len, size = 2;
+	char			*p;
 
-	if (xe == NULL || name == NULL || (strlen(name) == 0))
-		return 1;
+	if (asp == NULL || (names == NULL && n != 0))
+		return (XMLSD_ERR_INTEGRITY);
+	if (n > SIZE_MAX / 8 / sizeof *table)
+		return (XMLSD_ERR_RESOURCE);
 
-	if (asprintf(&buf, "%u", ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
+	for (i = 0, len = 0; i < n; i++) {
+		if (names[i] == NULL)
+			return (XMLSD_ERR_INTEGRITY);
+		len += strlen(names[i]) + 1;
+	}
+	while (size < n * 2)
+		size *= 2;
+
+	as = malloc(sizeof *as + (size + n) * sizeof *table +
+	    n * sizeof *nnames + len);
+	if (as == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	table = (size_t *)(as + 1);
+	nnames = (const char **)(table + size + n);
+	p = (char *)(nnames + n);
+	for (i = 0; i < n; i++) {
+		len = strlen(names[i]) + 1;
+		nnames[i] = memcpy(p, names[i], len);
+		p += len;
+	}
+	xmlsd_attr_set_init(as, nnames, n, table, table + size);
+
+	*asp = as;
+	return (XMLSD_ERR_SUCCES);
+}
 
-	rv = xmlsd_elem_set_attr(xe, name, buf);
+void
+xmlsd_attr_set_free(struct xmlsd_attr_set *as)
+{
+	free(as);
+}
+
+/*
+ * Find the attribute of `xe' for every name of `as' with a single pass
+ * over the attributes of `xe', into `xap[i]' for the i-th name or, if
+ * `xap' is NULL, its value into `out[i]'.
+ */
+static size_t
+xmlsd_attr_set_match(struct xmlsd_element *xe, struct xmlsd_attr_set *as,
+    const char **out, struct xmlsd_attribute **xap)
+{
+	struct xmlsd_attribute	*xa;
+	size_t			 i, slot, found = 0;
+
+	for (i = 0; i < as->n; i++)
+		if (xap != NULL)
+			xap[i] = NULL;
+		else
+			out[i] = NULL;
+	if (xe == NULL || as->n == 0)
+		return (0);
+
+	TAILQ_FOREACH(xa, &xe->attr_list, entry) {
+		if ((slot = *xmlsd_attr_set_slot(as, xa->name)) == 0)
+			continue;
+		if (xap != NULL) {
+			if (xap[slot - 1] != NULL)
+				continue;
+			xap[slot - 1] = xa;
+		} else {
+			if (out[slot - 1] != NULL)
+				continue;
+			out[slot - 1] = xmlsd_value_get(&xa->value);
+		}
+		if (++found == as->nunique)
+			break;
+	}
 
-	free(buf);
+	/* names asked for more than once */
+	for (i = 0, found = 0; i < as->n; i++) {
+		if (xap != NULL) {
+			xap[i] = xap[as->alias[i]];
+			found += xap[i] != NULL;
+		} else {
+			out[i] = out[as->alias[i]];
+			found += out[i] != NULL;
+		}
+	}
 
-	return rv;
+	return (found);
 }
 
-int
-xmlsd_elem_set_attr_int64(struct xmlsd_element *xe, const char *name,
-    int64_t ival)
+/*
+ * Look up every attribute of set `as' in `xe' with a single pass over the
+ * attributes of `xe'.  The value of the i-th name is stored in `out[i]',
+ * NULL if `xe' does not have it.  If an attribute occurs more than once
+ * the first one is used, like xmlsd_elem_get_attr() does.
+ *
+ * Returns the number of names found.
+ */
+size_t
+xmlsd_elem_get_attr_set(struct xmlsd_element *xe, struct xmlsd_attr_set *as,
+    const char **out)
 {
-	char *buf;
-	int rv;
+	return (xmlsd_attr_set_match(xe, as, out, NULL));
+}
 
-	if (xe == NULL || name == NULL || (strlen(name) == 0))
-		return 1;
+/*
+ * Look up the `n' attributes in `names' in `xe' at once, see
+ * xmlsd_elem_get_attr_set().  Up to XMLSD_ATTR_SET_STACK names are
+ * matched in a single pass over the attributes without allocating, more
+ * are looked up one by one.
+ *
+ * Returns the number of names found.
+ */
+size_t
+xmlsd_elem_get_attrs(struct xmlsd_element *xe, const char **names,
+    const char **out, size_t n)
+{
+	struct xmlsd_attr_set	 as;
+	size_t			 table[XMLSD_ATTR_SET_STACK * 2];
+	size_t			 alias[XMLSD_ATTR_SET_STACK];
+	size_t			 i, found = 0;
+
+	if (n <= XMLSD_ATTR_SET_STACK) {
+		xmlsd_attr_set_init(&as, names, n, table, alias);
+		return (xmlsd_elem_get_attr_set(xe, &as, out));
+	}
 
-	if (asprintf(&buf, "%" PRId64, ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
+	for (i = 0; i < n; i++)
+		if ((out[i] = xmlsd_elem_get_attr(xe, names[i])) != NULL)
+			found++;
 
-	rv = xmlsd_elem_set_attr(xe, name, buf);
+	return (found);
+}
 
-	free(buf);
+/*
+ * Typed version of xmlsd_elem_get_attrs(), every attribute in `names' is
+ * converted like xmlsd_elem_get_attr_strtonum() does, and kept decoded the
+ * same way, into `out' with the error, if any, in `errstr'.
+ *
+ * Returns the number of attributes that were converted successfully.
+ */
+size_t
+xmlsd_elem_get_attrs_strtonum(struct xmlsd_element *xe, const char **names,
+    long long *out, const char **errstr, size_t n, long long minval,
+    long long maxval)
+{
+	struct xmlsd_attr_set	 as;
+	struct xmlsd_attribute	*xa[XMLSD_ATTR_SET_STACK], *a;
+	size_t			 table[XMLSD_ATTR_SET_STACK * 2];
+	size_t			 alias[XMLSD_ATTR_SET_STACK];
+	size_t			 i, found = 0;
+
+	/* as xmlsd_elem_get_attrs(), but keep the attributes */
+	if (n <= XMLSD_ATTR_SET_STACK) {
+		xmlsd_attr_set_init(&as, names, n, table, alias);
+		xmlsd_attr_set_match(xe, &as, NULL, xa);
+	}
+	for (i = 0; i < n; i++) {
+		if (n <= XMLSD_ATTR_SET_STACK)
+			a = xa[i];
+		else
+			a = xe ? xmlsd_elem_lookup_attr(xe, names[i]) : NULL;
+		if (a == NULL) {
+			out[i] = 0;
+			errstr[i] = "attr not found";
+			continue;
+		}
+		out[i] = xmlsd_value_strtonum(&a->value, minval, maxval,
+		    &errstr[i]);
+		if (errstr[i] == NULL)
+			found++;
+	}
 
-	return rv;
+	return (found);
 }
 
-int
-xmlsd_elem_set_attr_uint64(struct xmlsd_element *xe, const char *name,
-    uint64_t ival)
+static int
+xmlsd_elem_set_attr_num(struct xmlsd_element *xe, const char *name, int type,
+    uint64_t num)
 {
-	char *buf;
-	int rv;
+	struct xmlsd_attribute *xa;
 
-	if (xe == NULL || name == NULL || (strlen(name) == 0))
+	if (xe == NULL || name == NULL || (strlen(name) == 0) ||
+	    (xe->flags & XMLSD_ELEM_F_SEALED))
 		return 1;
 
-	if (asprintf(&buf, "%" PRIu64, ival) == -1)
-		return 1;
-	if (buf == NULL)
+	if ((xa = xmlsd_attr_alloc(xe->value.mm, name)) == NULL)
 		return 1;
+	xmlsd_value_set_num(&xa->value, type, num);
 
-	rv = xmlsd_elem_set_attr(xe, name, buf);
+	xmlsd_elem_add_attr(xe, xa);
 
-	free(buf);
+	return 0;
+}
 
-	return rv;
+int
+xmlsd_elem_set_attr_int32(struct xmlsd_element *xe, const char *name,
+    int32_t ival)
+{
+	return (xmlsd_elem_set_attr_num(xe, name, XMLSD_VALUE_INT,
+	    (int64_t)ival));
 }
 
 int
-xmlsd_elem_set_attr_x32(struct xmlsd_element *xe, const char *name,
+xmlsd_elem_set_attr_uint32(struct xmlsd_element *xe, const char *name,
     uint32_t ival)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL || name == NULL || (strlen(name) == 0))
-		return 1;
-
-	if (asprintf(&buf, "0x%x", ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
+	return (xmlsd_elem_set_attr_num(xe, name, XMLSD_VALUE_UINT, ival));
+}
 
-	rv = xmlsd_elem_set_attr(xe, name, buf);
+int
+xmlsd_elem_set_attr_int64(struct xmlsd_element *xe, const char *name,
+    int64_t ival)
+{
+	return (xmlsd_elem_set_attr_num(xe, name, XMLSD_VALUE_INT, ival));
+}
 
-	free(buf);
+int
+xmlsd_elem_set_attr_uint64(struct xmlsd_element *xe, const char *name,
+    uint64_t ival)
+{
+	return (xmlsd_elem_set_attr_num(xe, name, XMLSD_VALUE_UINT, ival));
+}
 
-	return rv;
+int
+xmlsd_elem_set_attr_x32(struct xmlsd_element *xe, const char *name,
+    uint32_t ival)
+{
+	return (xmlsd_elem_set_attr_num(xe, name, XMLSD_VALUE_HEX, ival));
 }
 
 int
 xmlsd_elem_set_attr_x64(struct xmlsd_element *xe, const char *name,
     uint64_t ival)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL || name == NULL || (strlen(name) == 0))
-		return 1;
-
-	if (asprintf(&buf, "0x%" PRIx64, ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
-
-	rv = xmlsd_elem_set_attr(xe, name, buf);
-
-	free(buf);
-
-	return rv;
+	return (xmlsd_elem_set_attr_num(xe, name, XMLSD_VALUE_HEX, ival));
 }
 
 int
 xmlsd_elem_set_attr(struct xmlsd_element *xe, const char *name,
     const char *value)
 {
-	struct xmlsd_attribute *xa = NULL;
+	struct xmlsd_attribute *xa;
 
-	if (xe == NULL || name == NULL || (strlen(name) == 0) || value == NULL)
-		goto fail;
+	if (xe == NULL || name == NULL || (strlen(name) == 0) ||
+	    value == NULL || (xe->flags & XMLSD_ELEM_F_SEALED))
+		return 1;
 
-        xa = calloc(1, sizeof *xa);
+	if ((xa = xmlsd_attr_alloc(xe->value.mm, name)) == NULL)
+		return 1;
+	if (xmlsd_value_set(&xa->value, value) != 0) {
+		xmlsd_attr_free(xa);
+		return 1;
+	}
 
-        if (xa == NULL)
-		goto fail;
+	xmlsd_elem_add_attr(xe, xa);
 
-	xa->name = strdup(name);
-        if (xa->name == NULL)
-		goto fail;
+	return 0;
+}
 
-	xa->value = strdup(value);
-        if (xa->value == NULL)
-		goto fail;
+const char *
+xmlsd_elem_get_value(struct xmlsd_element *xe)
+{
+	if (xe == NULL)
+		return (NULL);
 
-	TAILQ_INSERT_TAIL(&xe->attr_list, xa, entry);
+	return (xmlsd_value_get(&xe->value));
+}
 
-	return 0;
+/*
+ * Return the length of the value of `xe' as xmlsd_elem_get_value() would
+ * return it, or 0 if it has none.
+ */
+size_t
+xmlsd_elem_get_value_len(struct xmlsd_element *xe)
+{
+	if (xe == NULL)
+		return (0);
 
-fail:
-	if (xa) {
-		if (xa->name)
-			free(xa->name);
-		if (xa->value)
-			free(xa->value);
-		free(xa);
-	}
-	return 1;
+	return (xmlsd_value_len(&xe->value));
 }
 
+/*
+ * Return the value of `xe' and its length in `len' without copying it out
+ * of the parsed memory of an XMLSD_DOC_F_BORROW document.  The value may
+ * not be NUL terminated.  Returns NULL if `xe' has no value.
+ */
 const char *
-xmlsd_elem_get_value(struct xmlsd_element *xe)
+xmlsd_elem_get_value_span(struct xmlsd_element *xe, size_t *len)
 {
-	if (xe == NULL)
+	if (xe == NULL) {
+		*len = 0;
 		return (NULL);
+	}
 
-	return (xe->value);
+	return (xmlsd_value_span(&xe->value, len));
 }
 
 long long
 xmlsd_elem_get_value_strtonum(struct xmlsd_element *xe, long long minval,
     long long maxval, const char **errstr)
 {
-	const char	*str;
-
-	if ((str = xmlsd_elem_get_value(xe)) == NULL) {
+	if (xe == NULL || xe->value.type == XMLSD_VALUE_NONE) {
 	    *errstr = "no value found";
 	    return (0);
 	}
 
-	return (strtonum(str, minval, maxval, errstr));
+	return (xmlsd_value_strtonum(&xe->value, minval, maxval, errstr));
 }
 
 unsigned long long
 xmlsd_elem_get_value_hexnum(struct xmlsd_element *xe,
     unsigned long long minval, unsigned long long maxval, const char **errstr)
 {
-	const char		*str;
-	char			*end;
-	unsigned long long	 val = 0;
-
-	*errstr = NULL;
-	if ((str = xmlsd_elem_get_value(xe)) == NULL) {
+	if (xe == NULL || xe->value.type == XMLSD_VALUE_NONE) {
 	    *errstr = "no value found";
 	    return (0);
 	}
-	if (minval > maxval) {
-		*errstr = "invalid";
-	} else {
-		val = strtoull(str, &end, 16);
-		if (str == end || *end != '\0')
-			*errstr = "invalid";
-		else if (val < minval)
-			*errstr = "toosmall";
-		else if ((val == ULLONG_MAX && errno == ERANGE) ||
-		    val < maxval)
-			*errstr = "too large";
-	}
-	if (*errstr != NULL)
-		val = 0;
-	return (val);
+
+	return (xmlsd_value_hexnum(&xe->value, minval, maxval, errstr));
 }
 
 /*
@@ -440,169 +898,102 @@ xmlsd_elem_get_value_hexnum(struct xmlsd_element *xe,
 int
 xmlsd_elem_get_value_boolean(struct xmlsd_element *elem, int *ret_b, int def)
 {
-	const char	*value;
-	int		 rv = 0;
-
 	if (elem == NULL)
 		return (XMLSD_ERR_INTEGRITY);
 	if (ret_b == NULL)
 		return (XMLSD_ERR_INTEGRITY);
 
-	if ((value = xmlsd_elem_get_value(elem)) == NULL) {
+	if (elem->value.type == XMLSD_VALUE_NONE) {
 		*ret_b = def;
 		return (0);
 	}
 
-	if (!strcmp(value, "true") || !strcmp(value, "1"))
-		*ret_b = 1;
-	else if (!strcmp(value, "false") || !strcmp(value, "0"))
-		*ret_b = 0;
-	else
-		rv = XMLSD_ERR_INTEGRITY;
-
-	return (rv);
+	return (xmlsd_value_boolean(&elem->value, ret_b));
 }
 
+/*
+ * Decode the base64 value of `xe' into `out', which has room for `*outlen'
+ * bytes.  The data is decoded straight from the stored text, or copied if
+ * it was set with xmlsd_elem_set_value_b64().  With `out' NULL only the
+ * decoded size is returned in `*outlen'.
+ */
 int
-xmlsd_elem_set_value_int32(struct xmlsd_element *xe, int32_t ival)
+xmlsd_elem_get_value_b64(struct xmlsd_element *xe, void *out, size_t *outlen)
 {
-	char *buf;
-	int rv;
+	if (xe == NULL || outlen == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	if (xe->value.type == XMLSD_VALUE_NONE)
+		return (XMLSD_ERR_INTEGRITY);
 
-	if (xe == NULL)
-		return 1;
+	return (xmlsd_value_get_b64(&xe->value, out, outlen));
+}
 
-	if (asprintf(&buf, "%d", ival) == -1)
-		return 1;
-	if (buf == NULL)
+static int
+xmlsd_elem_set_value_num(struct xmlsd_element *xe, int type, uint64_t num)
+{
+	if (xe == NULL || (xe->flags & XMLSD_ELEM_F_SEALED))
 		return 1;
 
-	rv = xmlsd_elem_set_value(xe, buf);
+	xmlsd_value_set_num(&xe->value, type, num);
 
-	free(buf);
+	return 0;
+}
 
-	return rv;
+int
+xmlsd_elem_set_value_int32(struct xmlsd_element *xe, int32_t ival)
+{
+	return (xmlsd_elem_set_value_num(xe, XMLSD_VALUE_INT, (int64_t)ival));
 }
 
 int
 xmlsd_elem_set_value_uint32(struct xmlsd_element *xe, uint32_t ival)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL)
-		return 1;
-
-	if (asprintf(&buf, "%u", ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
-
-	rv = xmlsd_elem_set_value(xe, buf);
-
-	free(buf);
-
-	return rv;
+	return (xmlsd_elem_set_value_num(xe, XMLSD_VALUE_UINT, ival));
 }
 
 int
 xmlsd_elem_set_value_int64(struct xmlsd_element *xe, int64_t ival)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL)
-		return 1;
-
-	if (asprintf(&buf, "%" PRId64, ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
-
-	rv = xmlsd_elem_set_value(xe, buf);
-
-	free(buf);
-
-	return rv;
+	return (xmlsd_elem_set_value_num(xe, XMLSD_VALUE_INT, ival));
 }
 
 int
 xmlsd_elem_set_value_uint64(struct xmlsd_element *xe, uint64_t ival)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL)
-		return 1;
-
-	if (asprintf(&buf, "%" PRIu64, ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
-
-	rv = xmlsd_elem_set_value(xe, buf);
-
-	free(buf);
-
-	return rv;
+	return (xmlsd_elem_set_value_num(xe, XMLSD_VALUE_UINT, ival));
 }
 
 int
 xmlsd_elem_set_value_x32(struct xmlsd_element *xe, uint32_t ival)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL)
-		return 1;
-
-	if (asprintf(&buf, "0x%x", ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
-
-	rv = xmlsd_elem_set_value(xe, buf);
-
-	free(buf);
-
-	return rv;
+	return (xmlsd_elem_set_value_num(xe, XMLSD_VALUE_HEX, ival));
 }
 
 int
 xmlsd_elem_set_value_x64(struct xmlsd_element *xe, uint64_t ival)
 {
-	char *buf;
-	int rv;
-
-	if (xe == NULL)
-		return 1;
-
-	if (asprintf(&buf, "0x%" PRIx64, ival) == -1)
-		return 1;
-	if (buf == NULL)
-		return 1;
-
-	rv = xmlsd_elem_set_value(xe, buf);
-
-	free(buf);
-
-	return rv;
+	return (xmlsd_elem_set_value_num(xe, XMLSD_VALUE_HEX, ival));
 }
 
 int
 xmlsd_elem_set_value(struct xmlsd_element *xe, const char *value)
 {
-	if (xe == NULL || value == NULL)
+	if (xe == NULL || value == NULL || (xe->flags & XMLSD_ELEM_F_SEALED))
 		return 1;
 
-	if (xe->value)
-		free(xe->value);
+	return (xmlsd_value_set(&xe->value, value));
+}
 
-	xe->value = strdup(value);
-	if (xe->value == NULL)
+/* the data is kept as is and only base64 encoded when generated */
+int
+xmlsd_elem_set_value_b64(struct xmlsd_element *xe, const void *data,
+    size_t len)
+{
+	if (xe == NULL || (data == NULL && len != 0) ||
+	    (xe->flags & XMLSD_ELEM_F_SEALED))
 		return 1;
 
-	return 0;
+	return (xmlsd_value_set_b64(&xe->value, data, len));
 }
 
 void
@@ -614,21 +1005,78 @@ xmlsd_elem_free(struct xmlsd_element *xe)
 		return;
 
 	/* free attributes */
+	xmlsd_mm_free(xe->value.mm, xe->attr_index);
+	xmlsd_mm_free(xe->value.mm, xe->child_index);
 	while ((xa = TAILQ_FIRST(&xe->attr_list))) {
 		TAILQ_REMOVE(&xe->attr_list, xa, entry);
-		if (xa->name)
-			free(xa->name);
-		if (xa->value)
-			free(xa->value);
-		free(xa);
+		xmlsd_attr_free(xa);
 	}
 
 	/* free element */
-	if (xe->name)
-		free(xe->name);
-	if (xe->value)
-		free(xe->value);
+	xmlsd_value_clear(&xe->value);
+	if (xe->flags & XMLSD_ELEM_F_CHUNK)
+		return;
+	xmlsd_mm_free(xe->value.mm, xe);
+}
+
+/*
+ * Set up `xw' to walk `xe' and all of its descendants.  `flags' selects
+ * whether elements are returned before their children (XMLSD_WALK_PRE),
+ * after them (XMLSD_WALK_POST) or both.
+ */
+void
+xmlsd_walk_init(struct xmlsd_walk *xw, struct xmlsd_element *xe, int flags)
+{
+	xw->xw_top = xe;
+	xw->xw_cur = NULL;
+	xw->xw_flags = flags;
+	xw->xw_post = 0;
+}
 
-	free(xe);
+/*
+ * Return the next element of the walk or NULL when it is done.  The walk
+ * only follows parent and sibling links so it uses no stack no matter how
+ * deep the tree is.  xw_post tells whether the element is returned on the
+ * way up.  The tree must not be modified during the walk.
+ */
+struct xmlsd_element *
+xmlsd_walk_next(struct xmlsd_walk *xw)
+{
+	struct xmlsd_element	*xe = xw->xw_cur, *next;
+
+	do {
+		if (xe == NULL) {
+			/* first call or done */
+			if ((xe = xw->xw_top) == NULL)
+				return (NULL);
+			xw->xw_post = 0;
+		} else if (xw->xw_post == 0) {
+			if ((next = TAILQ_FIRST(&xe->children)) != NULL)
+				xe = next;
+			else
+				xw->xw_post = 1;
+		} else if (xe == xw->xw_top) {
+			xw->xw_top = xw->xw_cur = NULL;
+			return (NULL);
+		} else if ((next = TAILQ_NEXT(xe, entry)) != NULL) {
+			xe = next;
+			xw->xw_post = 0;
+		} else
+			xe = xe->parent;
+	} while (!(xw->xw_flags &
+	    (xw->xw_post ? XMLSD_WALK_POST : XMLSD_WALK_PRE)));
+
+	xw->xw_cur = xe;
+	return (xe);
 }
 
+/*
+ * Do not descend into the children of the element that was just returned
+ * on the way down.  It is not returned on the way up either.
+ */
+void
+xmlsd_walk_skip(struct xmlsd_walk *xw)
+{
+	if (xw->xw_cur != NULL)
+		xw->xw_post = 1;
+}
@@ -21,112 +21,144 @@
 
 #define NL "\r\n"
 
+/* append `len' bytes of `s' to `buf' unless only counting */
+static char *
+put(char *buf, const char *s, size_t len, int dry_run)
+{
+	if (dry_run != 0)
+		memcpy(buf, s, len);
+	return (buf + len);
+}
+
+/* indent by `n' spaces */
+static char *
+put_indent(char *buf, int n, int dry_run)
+{
+	if (dry_run != 0)
+		memset(buf, ' ', n);
+	return (buf + n);
+}
+
 /*
  * encode characters that are invalid in xml attributes and values and return
- * a pointer to the end of the string (the NUL terminated part).
+ * a pointer to the end of the encoded data.  Runs of characters that need
+ * no encoding are copied in one go.
  *
  * if dry_run is set don't actually change teh data, just calculate the length.
  */
 static char *
-encode_data(char *buf, const char *data, int dry_run)
+encode_data(char *buf, const char *data, size_t len, int dry_run)
 {
-	while (*data != '\0') {
-		if (*data == '&') {
-			if (dry_run != 0) {
-				buf[0] = '&';
-				buf[1] = 'a';
-				buf[2] = 'm';
-				buf[3] = 'p';
-				buf[4] = ';';
-			}
-			buf += 5;	/* &amp; */
-		} else if (*data == '<') {
-			if (dry_run != 0) {
-				buf[0] = '&';
-				buf[1] = 'l';
-				buf[2] = 't';
-				buf[3] = ';';
-			}
-
-			buf += 4;	/* &lt; */
-		} else if (*data == '>') {
-			if (dry_run != 0) {
-				buf[0] = '&';
-				buf[1] = 'g';
-				buf[2] = 't';
-				buf[3] = ';';
-			}
-			buf += 4;	/* &gt; */
-		} else if (*data == '"') {
-			if (dry_run != 0) {
-				buf[0] = '&';
-				buf[1] = 'q';
-				buf[2] = 'u';
-				buf[3] = 'o';
-				buf[4] = 't';
-				buf[5] = ';';
-			}
-			buf += 6;
-		} else {
-			/* no encoding, just copy */
-			if (dry_run != 0)
-				*buf = *data;
-			buf++;
+	const char		*end = data + len, *run;
+
+	while (data < end) {
+		for (run = data; data < end; data++)
+			if (*data == '&' || *data == '<' || *data == '>' ||
+			    *data == '"')
+				break;
+		buf = put(buf, run, data - run, dry_run);
+		if (data == end)
+			break;
+
+		switch (*data++) {
+		case '&':
+			buf = put(buf, "&amp;", 5, dry_run);
+			break;
+		case '<':
+			buf = put(buf, "&lt;", 4, dry_run);
+			break;
+		case '>':
+			buf = put(buf, "&gt;", 4, dry_run);
+			break;
+		default:
+			buf = put(buf, "&quot;", 6, dry_run);
+			break;
 		}
-		data++;
-	}
-	/*
-	 * Don't forget to NUL terminate, strictly not needed due to context
-	 * as this will never be the last thing to touch the buffer.
-	 */
-	if (dry_run != 0) {
-		*buf = '\0';
 	}
 
 	return (buf);
 }
 
+/*
+ * encode a value that may be stored as a native number or binary data, in
+ * which case the digits are written straight into the buffer as they never
+ * need encoding.
+ */
+static char *
+encode_value(char *buf, struct xmlsd_value *v, int dry_run)
+{
+	char			tmp[XMLSD_NUMBUF_LEN];
+
+	if (v->str != NULL)
+		return (encode_data(buf, v->str, v->len, dry_run));
+	if (v->type == XMLSD_VALUE_B64) {
+		if (dry_run)
+			return (buf + xmlsd_b64_encode(buf, v->num.bin->data,
+			    v->num.bin->len));
+		return (buf + xmlsd_b64_enclen(v->num.bin->len));
+	}
+
+	return (buf + xmlsd_fmt_num(dry_run ? buf : tmp, v->type, v->num.u));
+}
+
+/*
+ * Generate `top' and all its children.  The tree is walked iteratively so
+ * that deep documents do not eat the stack.  Every name and value knows
+ * its length so the output is put together with plain copies.
+ *
+ * The output is NUL terminated if `bufsz' leaves room for it.
+ */
 size_t
-xmlsd_generate_elem(struct xmlsd_element *xe, char *buf, size_t bufsz,
+xmlsd_generate_elem(struct xmlsd_element *top, char *buf, size_t bufsz,
     int dry_run)
 {
+	struct xmlsd_walk	 xw;
 	struct xmlsd_attribute	*xa;
-	struct xmlsd_element	*xc;
+	struct xmlsd_element	*xe;
 	char			*obuf = buf;
 
-	obuf += snprintf(obuf, buf ? bufsz - (obuf-buf) : 0,
-	    "%*s<%s", xe->depth * 2, "", xe->name);
-	XMLSD_ELEM_FOREACH_ATTR(xa, xe) {
-		obuf += snprintf(obuf, dry_run ? bufsz - (obuf-buf) : 0,
-		    " %s=\"", xa->name);
-		obuf = encode_data(obuf, xa->value, dry_run);
-		/* it would likely be more efficient to inline this */
-		obuf += snprintf(obuf, dry_run ? bufsz - (obuf-buf) : 0,
-		    "\"");
-	}
+	xmlsd_walk_init(&xw, top, XMLSD_WALK_PRE | XMLSD_WALK_POST);
+	while ((xe = xmlsd_walk_next(&xw)) != NULL) {
+		if (xw.xw_post) {
+			/* close our tag, only elements with children get here */
+			obuf = put_indent(obuf, xe->depth * 2, dry_run);
+			obuf = put(obuf, "</", 2, dry_run);
+			obuf = put(obuf, xe->name, xe->namelen, dry_run);
+			obuf = put(obuf, ">" NL, 3, dry_run);
+			continue;
+		}
+
+		obuf = put_indent(obuf, xe->depth * 2, dry_run);
+		obuf = put(obuf, "<", 1, dry_run);
+		obuf = put(obuf, xe->name, xe->namelen, dry_run);
+		XMLSD_ELEM_FOREACH_ATTR(xa, xe) {
+			obuf = put(obuf, " ", 1, dry_run);
+			obuf = put(obuf, xa->name, xa->namelen, dry_run);
+			obuf = put(obuf, "=\"", 2, dry_run);
+			obuf = encode_value(obuf, &xa->value, dry_run);
+			obuf = put(obuf, "\"", 1, dry_run);
+		}
 
-	/* should have only one of children or value */
-	if (xmlsd_elem_get_first_child(xe) == NULL && xe->value == NULL) {
-		obuf += snprintf(obuf, dry_run ? bufsz - (obuf-buf) : 0,
-		    "/>" NL);
-	} else if (xe->value != NULL) {
-		obuf += snprintf(obuf, dry_run ? bufsz - (obuf-buf)
-			    : 0, ">");
-		obuf = encode_data(obuf, xe->value, dry_run);
-		obuf += snprintf(obuf, dry_run ? bufsz - (obuf-buf)
-			    : 0, "</%s>" NL, xe->name);
-	} else {
-		obuf += snprintf(obuf, dry_run ? bufsz - (obuf-buf) : 0,
-		    ">" NL);
-		/* print all children */
-		XMLSD_ELEM_FOREACH_CHILDREN(xc, xe) {
-			obuf += xmlsd_generate_elem(xc, obuf,
-			    dry_run ? bufsz - (obuf - buf) : 0, dry_run);
+		/* should have only one of children or value */
+		if (xmlsd_elem_get_first_child(xe) == NULL &&
+		    xe->value.type == XMLSD_VALUE_NONE) {
+			obuf = put(obuf, "/>" NL, 4, dry_run);
+			xmlsd_walk_skip(&xw);
+		} else if (xe->value.type != XMLSD_VALUE_NONE) {
+			obuf = put(obuf, ">", 1, dry_run);
+			obuf = encode_value(obuf, &xe->value, dry_run);
+			obuf = put(obuf, "</", 2, dry_run);
+			obuf = put(obuf, xe->name, xe->namelen, dry_run);
+			obuf = put(obuf, ">" NL, 3, dry_run);
+			xmlsd_walk_skip(&xw);
+		} else {
+			/* children follow */
+			obuf = put(obuf, ">" NL, 3, dry_run);
 		}
-		/* close our tag */
-		obuf += snprintf(obuf, dry_run ? bufsz - (obuf-buf) : 0,
-		    "%*s</%s>" NL, xe->depth * 2, "", xe->name);
 	}
+	if (dry_run != 0 && (size_t)(obuf - buf) < bufsz)
+		*obuf = '\0';
+
 	return (obuf-buf);
 }
 
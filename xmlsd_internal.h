@@ -1,21 +1,310 @@
+/*
+ * value storage, either a string or a native number or binary data that is
+ * formatted on demand
+ */
+#define XMLSD_NUMBUF_LEN	(24)	/* "-9223372036854775808" + NUL */
+
+struct xmlsd_bin {
+	size_t				 len;
+	uint8_t				 data[];
+};
+
+struct xmlsd_value {
+	char				*str;
+	size_t				 len;	/* of str, if set */
+	int				 type;
+#define XMLSD_VALUE_NONE		(0)
+#define XMLSD_VALUE_STRING		(1)
+#define XMLSD_VALUE_INT			(2)
+#define XMLSD_VALUE_UINT		(3)
+#define XMLSD_VALUE_HEX			(4)
+#define XMLSD_VALUE_B64			(5)	/* num.bin, base64 as text */
+	int				 flags;
+#define XMLSD_VALUE_F_ALLOC		(0x0001) /* str must be freed */
+#define XMLSD_VALUE_F_BORROW		(0x0002) /* str in the input, no NUL */
+/* what a string value was last decoded as, the result is kept in num */
+#define XMLSD_VALUE_F_DEC		(0x0010)
+#define XMLSD_VALUE_F_HEX		(0x0020)
+#define XMLSD_VALUE_F_BOOL		(0x0030)
+#define XMLSD_VALUE_F_KIND		(0x00f0)
+#define XMLSD_VALUE_F_INVALID		(0x0100)
+#define XMLSD_VALUE_F_UNDER		(0x0200)
+#define XMLSD_VALUE_F_OVER		(0x0400)
+#define XMLSD_VALUE_F_STATUS		(0x0700)
+#define XMLSD_VALUE_F_SEALED		(0x0800) /* read only, nothing kept */
+	union {
+		int64_t			 i;
+		uint64_t		 u;
+		struct xmlsd_bin	*bin;
+	}				 num;
+	char				 numbuf[XMLSD_NUMBUF_LEN]; /* or short str */
+	const struct xmlsd_allocator	*mm;	/* of str and bin, kept */
+};
+
 struct xmlsd_attribute {
 	TAILQ_ENTRY(xmlsd_attribute)	entry;
 	char				*name;
-	char				*value;
+	size_t				namelen;
+	struct xmlsd_value		value;
+	int				flags;
+#define XMLSD_ATTR_F_CHUNK		(0x0001) /* attr and name in doc chunk */
 };
 TAILQ_HEAD(xmlsd_attribute_list, xmlsd_attribute);
 
+/* open addressed name lookup, built once an element has enough attributes */
+#define XMLSD_ATTR_INDEX_MIN		(8)
+
+struct xmlsd_attr_index {
+	size_t				 mask;
+	size_t				 count;
+	struct xmlsd_attribute		*slot[];
+};
+
+/* children by name, built once an element has enough children */
+#define XMLSD_CHILD_INDEX_MIN		(8)
+
+struct xmlsd_child_bucket {
+	const char			*name;
+	size_t				 namelen;
+	struct xmlsd_element		*first;
+	struct xmlsd_element		*last;
+	size_t				 count;
+};
+
+struct xmlsd_child_index {
+	size_t				 mask;
+	size_t				 nnames;
+	struct xmlsd_child_bucket	 slot[];
+};
+
+/* names looked up together by xmlsd_elem_get_attr_set() */
+#define XMLSD_ATTR_SET_STACK		(32)	/* names that need no malloc */
+
+struct xmlsd_attr_set {
+	const char			**names;
+	size_t				 n;
+	size_t				 nunique;
+	size_t				 mask;
+	size_t				*table;	/* name + 1, 0 is empty */
+	size_t				*alias;	/* first slot of the same name */
+};
+
 TAILQ_HEAD(xmlsd_element_list, xmlsd_element);
 struct xmlsd_element {
 	TAILQ_ENTRY(xmlsd_element)	 entry;
 	struct xmlsd_attribute_list	 attr_list;
+	struct xmlsd_attr_index		*attr_index;
 	struct xmlsd_element_list	 children;
+	struct xmlsd_child_index	*child_index;
+	struct xmlsd_element		*name_next; /* valid with parent index */
 	struct xmlsd_element		*parent;
+	struct xmlsd_document		*detached; /* taken out of */
 	char				*name;
-	char				*value;
+	size_t				 namelen;
+	struct xmlsd_value		 value;
 	int				 depth;
+	int				 flags;
+#define XMLSD_ELEM_F_CHUNK		(0x0001) /* elem and name in doc chunk */
+#define XMLSD_ELEM_F_SEALED		(0x0002) /* document is read only */
+};
+
+/* memory owned by a document, released only when it is cleared or freed */
+#define XMLSD_ALIGN(x)			(((x) + 7) & ~(size_t)7)
+#define XMLSD_CHUNK_SIZE		(64 * 1024)
+
+struct xmlsd_chunk {
+	SLIST_ENTRY(xmlsd_chunk)	 link;
+	size_t				 size;
+	size_t				 used;
+};
+SLIST_HEAD(xmlsd_chunk_list, xmlsd_chunk);
+
+/*
+ * Chunks of a document that elements moved to other documents still live
+ * in.  Each document holding a reference lets go of it when it is cleared
+ * or freed, the last one frees the chunks.
+ */
+struct xmlsd_chunk_share {
+	struct xmlsd_chunk_list		 chunks;
+	int				 refs;	/* atomic */
+	struct xmlsd_allocator		 xal;
+	const struct xmlsd_allocator	*mm;	/* &xal or NULL for malloc */
+};
+
+struct xmlsd_share_ref {
+	SLIST_ENTRY(xmlsd_share_ref)	 link;
+	struct xmlsd_chunk_share	*cs;
+};
+SLIST_HEAD(xmlsd_share_list, xmlsd_share_ref);
+
+/*
+ * Built in tokenizer for UTF-8 documents without a DTD.  It calls the same
+ * handlers with the same pieces of text expat would.
+ */
+struct xmlsd_native_open {
+	const char			*name;	/* in the input */
+	size_t				 len;
+};
+
+struct xmlsd_native {
+	void				*data;
+	void				(*start)(void *, const char *,
+					    const char **);
+	void				(*end)(void *, const char *);
+	void				(*chardata)(void *, const char *, int);
+	size_t				 at;	/* input offset of the event */
+	int				 stop;	/* set by handlers to abort */
+	int				 part;	/* XMLSD_PART_* */
+
+	/* scratch space, kept by recycling documents */
+	char				*buf;	/* names and attribute values */
+	size_t				 bufsz;
+	size_t				*off;	/* attribute offsets in buf */
+	const char			**attr;
+	size_t				 attrsz;
+	struct xmlsd_native_open	*open;	/* elements not yet closed */
+	size_t				 opensz;
+	size_t				*seen;	/* attribute + 1, 0 is empty */
+	size_t				 seensz;
+	const struct xmlsd_allocator	*mm;	/* of the scratch space */
+};
+
+/* parser state that recycling documents keep between parses */
+struct XML_ParserStruct;
+struct xmlsd_parse_cache {
+	struct XML_ParserStruct		*xml_parser;
+	char				*value;
+	int				 tot_size;
+	struct xmlsd_native		 native;
+	const struct xmlsd_allocator	*mm;	/* NULL for malloc */
+};
+
+/*
+ * Every distinct dotted path in a document, with the elements on it.
+ * Nodes refer to their parent path by index, the elements of node n are
+ * elems[nodes[n].off] up to nodes[n].off + nodes[n].count.
+ */
+#define XMLSD_PATH_NONE			((size_t)-1)
+
+struct xmlsd_path_node {
+	size_t				 parent;
+	const char			*name;
+	size_t				 namelen;
+	size_t				 count;
+	size_t				 off;
+};
+
+struct xmlsd_path_index {
+	struct xmlsd_path_node		*nodes;
+	size_t				 nnodes;
+	size_t				 nodes_size;
+	size_t				*table;	/* node + 1, 0 is empty */
+	size_t				 mask;
+	struct xmlsd_element		**elems;
 };
 
 struct xmlsd_document {
 	struct xmlsd_element		*root;
+	int				 flags;
+	struct xmlsd_chunk_list		 chunks;
+	struct xmlsd_chunk		*chunk_cur;
+	struct xmlsd_chunk_list		 big;	/* one allocation each */
+	struct xmlsd_share_list		 shares; /* chunks of others in use */
+	struct xmlsd_parse_cache	 parse_cache;
+	struct xmlsd_path_index		*path_index;
+	struct xmlsd_cache_entry	*cache_entry; /* shared by a cache */
+	int				 refs;	/* past the first, atomic */
+	int				 sealed;
+	struct xmlsd_allocator		 xal;
+	const struct xmlsd_allocator	*mm;	/* &xal or NULL for malloc */
 };
+
+/* elements, attributes and strings are allocated from chunks */
+#define XMLSD_DOC_CHUNKED(xd)		\
+	(((xd)->flags & XMLSD_DOC_F_RECYCLE) || (xd)->mm != NULL)
+
+/* xmlsd.c */
+#define XMLSD_PART_DOC			(0)	/* the whole document */
+#define XMLSD_PART_HEAD			(1)	/* up to the root start tag */
+#define XMLSD_PART_CONTENT		(2)	/* children of an element */
+void			 xmlsd_parse_cache_free(struct xmlsd_parse_cache *);
+int			 xmlsd_parse_part(const char *, size_t,
+			    struct xmlsd_document *, int, int,
+			    struct xmlsd_parse_cache *);
+
+/* xmlsd_alloc.c */
+void			*xmlsd_mm_malloc(const struct xmlsd_allocator *,
+			    size_t);
+void			*xmlsd_mm_calloc(const struct xmlsd_allocator *,
+			    size_t, size_t);
+void			*xmlsd_mm_realloc(const struct xmlsd_allocator *,
+			    void *, size_t);
+void			 xmlsd_mm_free(const struct xmlsd_allocator *, void *);
+const struct xmlsd_allocator *xmlsd_mm_enter(const struct xmlsd_allocator *);
+void			 xmlsd_mm_leave(const struct xmlsd_allocator *);
+struct XML_ParserStruct	*xmlsd_mm_parser_create(void);
+
+/* xmlsd_native.c */
+int			 xmlsd_native_parse(struct xmlsd_native *, const char *,
+			    size_t);
+void			 xmlsd_native_free(struct xmlsd_native *);
+const char		*xmlsd_native_find(const char *, const char *,
+			    const char *);
+
+/* xmlsd_document.c */
+void			*xmlsd_doc_chunk_alloc(struct xmlsd_document *, size_t);
+struct xmlsd_element	*xmlsd_doc_elem_alloc(struct xmlsd_document *,
+			     const char *);
+struct xmlsd_attribute	*xmlsd_doc_attr_alloc(struct xmlsd_document *,
+			     const char *, const char *);
+int			 xmlsd_doc_value_set(struct xmlsd_document *,
+			     struct xmlsd_value *, const char *, size_t);
+void			 xmlsd_doc_changed(struct xmlsd_document *);
+size_t			 xmlsd_doc_mem_size(struct xmlsd_document *);
+size_t			 xmlsd_elem_flat_size(struct xmlsd_element *);
+struct xmlsd_element	*xmlsd_elem_flatten(struct xmlsd_element *,
+			     struct xmlsd_element *, void *,
+			     const struct xmlsd_allocator *);
+
+/* xmlsd_element.c */
+uint32_t		 xmlsd_hash(const char *);
+void			 xmlsd_elem_add_attr(struct xmlsd_element *,
+			     struct xmlsd_attribute *);
+void			 xmlsd_elem_add_child(struct xmlsd_element *,
+			     struct xmlsd_element *);
+void			 xmlsd_elem_drop_child_index(struct xmlsd_element *);
+int			 xmlsd_elem_seal(struct xmlsd_element *);
+
+/* xmlsd_attribute.c */
+struct xmlsd_attribute	*xmlsd_attr_alloc(const struct xmlsd_allocator *,
+			     const char *);
+void			 xmlsd_attr_free(struct xmlsd_attribute *);
+
+/* xmlsd_value.c */
+size_t			 xmlsd_fmt_num(char *, int, uint64_t);
+const char		*xmlsd_value_get(struct xmlsd_value *);
+int			 xmlsd_value_set(struct xmlsd_value *, const char *);
+int			 xmlsd_value_set_len(struct xmlsd_value *, const char *,
+			     size_t);
+size_t			 xmlsd_value_len(struct xmlsd_value *);
+int			 xmlsd_value_seal(struct xmlsd_value *);
+void			 xmlsd_value_borrow(struct xmlsd_value *, const char *,
+			    size_t);
+const char		*xmlsd_value_span(struct xmlsd_value *, size_t *);
+void			 xmlsd_value_set_num(struct xmlsd_value *, int,
+			     uint64_t);
+void			 xmlsd_value_clear(struct xmlsd_value *);
+long long		 xmlsd_value_strtonum(struct xmlsd_value *, long long,
+			     long long, const char **);
+unsigned long long	 xmlsd_value_hexnum(struct xmlsd_value *,
+			     unsigned long long, unsigned long long,
+			     const char **);
+int			 xmlsd_value_boolean(struct xmlsd_value *, int *);
+int			 xmlsd_value_set_b64(struct xmlsd_value *, const void *,
+			     size_t);
+int			 xmlsd_value_get_b64(struct xmlsd_value *, void *,
+			     size_t *);
+size_t			 xmlsd_b64_enclen(size_t);
+size_t			 xmlsd_b64_encode(char *, const void *, size_t);
+int			 xmlsd_b64_decode(const char *, size_t, void *, size_t,
+			     size_t *);
@@ -0,0 +1,887 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A tokenizer for the documents we exchange: UTF-8, no DTD, no external
+ * entities.  It hands the handlers in xmlsd.c the same events expat does,
+ * down to how text is cut up: every line break and every character or
+ * entity reference is a piece of its own.  Anything it does not handle
+ * is a parse error rather than a different document.
+ *
+ * Names, text and attribute values must be valid UTF-8 made of characters
+ * xml allows; names may use any character outside of ASCII.  Comments and
+ * processing instructions are skipped without looking at what they hold.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* what ends a run of characters, by context */
+#define XMLSD_C_TEXT		(0x01)	/* < & ] CR LF */
+#define XMLSD_C_CDATA		(0x02)	/* ] CR LF */
+#define XMLSD_C_ATTR		(0x04)	/* < & TAB CR LF and quotes */
+#define XMLSD_C_NAME		(0x08)	/* white space and markup */
+#define XMLSD_C_SPACE		(0x10)
+#define XMLSD_C_CHECK		(0x20)	/* also controls and non-ASCII */
+
+#define XMLSD_NATIVE_DUP_MIN	(8)	/* attributes worth hashing */
+
+#define XMLSD_C_ALL_SPACE	(XMLSD_C_ATTR | XMLSD_C_NAME | XMLSD_C_SPACE)
+
+static const unsigned char xmlsd_cc[256] = {
+	['\t'] = XMLSD_C_ALL_SPACE,
+	['\n'] = XMLSD_C_ALL_SPACE | XMLSD_C_TEXT | XMLSD_C_CDATA,
+	['\r'] = XMLSD_C_ALL_SPACE | XMLSD_C_TEXT | XMLSD_C_CDATA,
+	[' '] = XMLSD_C_NAME | XMLSD_C_SPACE,
+	['"'] = XMLSD_C_ATTR | XMLSD_C_NAME,
+	['\''] = XMLSD_C_ATTR | XMLSD_C_NAME,
+	['&'] = XMLSD_C_TEXT | XMLSD_C_ATTR | XMLSD_C_NAME,
+	['/'] = XMLSD_C_NAME,
+	['<'] = XMLSD_C_TEXT | XMLSD_C_ATTR | XMLSD_C_NAME,
+	['='] = XMLSD_C_NAME,
+	['>'] = XMLSD_C_NAME,
+	[']'] = XMLSD_C_TEXT | XMLSD_C_CDATA,
+};
+
+static const char *xmlsd_no_attr[] = { NULL };
+
+#define XMLSD_N_CALL(_xn, _call)	do {				\
+	(_xn)->_call;							\
+	if ((_xn)->stop)						\
+		return (XMLSD_ERR_UNKNOWN);				\
+} while (0)
+
+/*
+ * Return the first character in [p, end) of class `cls', or `end'.  With
+ * XMLSD_C_CHECK in `cls' bytes below 0x20 and above 0x7f stop the scan as
+ * well, for the caller to check.  Text and attribute values are scanned
+ * 16 bytes at a time where SSE2 is available, names and white space are
+ * short and go byte by byte.
+ */
+static inline const char *
+xmlsd_scan(const char *p, const char *end, int cls)
+{
+	unsigned char		 c;
+#if defined(__SSE2__)
+	__m128i			 v, m;
+	const char		*set;
+	unsigned int		 bits;
+	int			 i, n;
+
+	switch (cls & ~XMLSD_C_CHECK) {
+	case XMLSD_C_TEXT:
+		set = "<&]\r\n";
+		break;
+	case XMLSD_C_CDATA:
+		set = "]\r\n";
+		break;
+	case XMLSD_C_ATTR:
+		set = "<&\t\r\n\"'";
+		break;
+	default:
+		set = "";
+		break;
+	}
+	n = strlen(set);
+	while (n != 0 && end - p >= 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		/* signed, so this takes the bytes above 0x7f too */
+		if (cls & XMLSD_C_CHECK)
+			m = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+		else
+			m = _mm_setzero_si128();
+		for (i = 0; i < n; i++)
+			m = _mm_or_si128(m,
+			    _mm_cmpeq_epi8(v, _mm_set1_epi8(set[i])));
+		if ((bits = _mm_movemask_epi8(m)) != 0)
+			return (p + __builtin_ctz(bits));
+		p += 16;
+	}
+#endif
+	for (; p < end; p++) {
+		c = *p;
+		if (xmlsd_cc[c] & cls)
+			break;
+		if ((cls & XMLSD_C_CHECK) && (c < 0x20 || c > 0x7f))
+			break;
+	}
+
+	return (p);
+}
+
+/*
+ * Return the length of the character at `p', a control character or the
+ * first byte of a multibyte one, or 0 if xml does not allow it there or it
+ * is not valid UTF-8.
+ */
+static size_t
+xmlsd_native_char(const char *p, const char *end)
+{
+	const unsigned char	*u = (const unsigned char *)p;
+	unsigned char		 lo = 0x80, hi = 0xbf;
+	size_t			 len, i;
+
+	if (*u < 0x80)
+		return (*u == '\t' || *u == '\r' || *u == '\n');
+	if (*u >= 0xc2 && *u <= 0xdf)
+		len = 2;
+	else if (*u >= 0xe0 && *u <= 0xef) {
+		len = 3;
+		if (*u == 0xe0)
+			lo = 0xa0;	/* overlong */
+		else if (*u == 0xed)
+			hi = 0x9f;	/* surrogates */
+	} else if (*u >= 0xf0 && *u <= 0xf4) {
+		len = 4;
+		if (*u == 0xf0)
+			lo = 0x90;	/* overlong */
+		else if (*u == 0xf4)
+			hi = 0x8f;	/* past U+10FFFF */
+	} else
+		return (0);
+	if ((size_t)(end - p) < len || u[1] < lo || u[1] > hi)
+		return (0);
+	for (i = 2; i < len; i++)
+		if (u[i] < 0x80 || u[i] > 0xbf)
+			return (0);
+	/* U+FFFE and U+FFFF */
+	if (u[0] == 0xef && u[1] == 0xbf && u[2] >= 0xbe)
+		return (0);
+
+	return (len);
+}
+
+/* all of [p, end) are characters xml allows */
+static int
+xmlsd_native_chars(const char *p, const char *end)
+{
+	size_t			 len;
+
+	while ((p = xmlsd_scan(p, end, XMLSD_C_CHECK)) != end) {
+		if ((unsigned char)*p == 0x7f)
+			len = 1;
+		else if ((len = xmlsd_native_char(p, end)) == 0)
+			return (0);
+		p += len;
+	}
+
+	return (1);
+}
+
+/*
+ * The non-ASCII character `c' may start a name, or with `first' 0 be part
+ * of one, per the NameStartChar and NameChar productions.
+ */
+static int
+xmlsd_name_char(unsigned int c, int first)
+{
+	if ((c >= 0xc0 && c <= 0xd6) || (c >= 0xd8 && c <= 0xf6) ||
+	    (c >= 0xf8 && c <= 0x2ff) || (c >= 0x370 && c <= 0x37d) ||
+	    (c >= 0x37f && c <= 0x1fff) || (c >= 0x200c && c <= 0x200d) ||
+	    (c >= 0x2070 && c <= 0x218f) || (c >= 0x2c00 && c <= 0x2fef) ||
+	    (c >= 0x3001 && c <= 0xd7ff) || (c >= 0xf900 && c <= 0xfdcf) ||
+	    (c >= 0xfdf0 && c <= 0xfffd) || (c >= 0x10000 && c <= 0xeffff))
+		return (1);
+	if (first)
+		return (0);
+	return (c == 0xb7 || (c >= 0x300 && c <= 0x36f) ||
+	    (c >= 0x203f && c <= 0x2040));
+}
+
+static const char *
+xmlsd_skip_space(const char *p, const char *end)
+{
+	while (p < end && (xmlsd_cc[(unsigned char)*p] & XMLSD_C_SPACE))
+		p++;
+	return (p);
+}
+
+/*
+ * Return the end of the name at `p', or `p' if there is none.  The name
+ * ends at the first character that cannot be part of it, which the caller
+ * then finds is not what it expects.
+ */
+static const char *
+xmlsd_scan_name(const char *p, const char *end)
+{
+	const char		*s = p;
+	unsigned char		 c;
+	unsigned int		 cp;
+	size_t			 len, i;
+
+	while (p < end) {
+		c = *p;
+		if (c > 0x7f) {
+			if ((len = xmlsd_native_char(p, end)) == 0)
+				break;
+			cp = c & (0x7f >> len);
+			for (i = 1; i < len; i++)
+				cp = cp << 6 | (p[i] & 0x3f);
+			if (!xmlsd_name_char(cp, p == s))
+				break;
+			p += len;
+		} else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		    c == '_' || c == ':')
+			p++;
+		else if (p != s && ((c >= '0' && c <= '9') || c == '-' ||
+		    c == '.'))
+			p++;
+		else
+			break;
+	}
+
+	return (p);
+}
+
+/* make room for `len' more bytes at `used' in the scratch buffer */
+static int
+xmlsd_native_grow(struct xmlsd_native *xn, size_t used, size_t len)
+{
+	char			*nb;
+	size_t			 sz;
+
+	if (used + len <= xn->bufsz)
+		return (0);
+	for (sz = xn->bufsz ? xn->bufsz : 256; sz < used + len; sz *= 2)
+		;
+	if ((nb = xmlsd_mm_realloc(xn->mm, xn->buf, sz)) == NULL)
+		return (1);
+	xn->buf = nb;
+	xn->bufsz = sz;
+
+	return (0);
+}
+
+/* copy `len' bytes to `*used' in the scratch buffer */
+static int
+xmlsd_native_put(struct xmlsd_native *xn, size_t *used, const char *s,
+    size_t len)
+{
+	if (xmlsd_native_grow(xn, *used, len))
+		return (1);
+	memcpy(xn->buf + *used, s, len);
+	*used += len;
+
+	return (0);
+}
+
+/*
+ * Decode the reference at `*pp', which points at the '&', into `out' and
+ * return its length or 0 if it is not a known entity or a valid character.
+ */
+static size_t
+xmlsd_native_ref(const char **pp, const char *end, char out[4])
+{
+	const char		*p = *pp + 1, *e;
+	unsigned long		 c = 0;
+	int			 d, hex = 0;
+
+	if ((e = memchr(p, ';', end - p)) == NULL)
+		return (0);
+	*pp = e + 1;
+
+	if (*p != '#') {
+		static const struct {
+			const char	*name;
+			char		 c;
+		} ent[] = {
+			{ "lt", '<' }, { "gt", '>' }, { "amp", '&' },
+			{ "quot", '"' }, { "apos", '\'' }, { NULL, 0 }
+		};
+
+		for (d = 0; ent[d].name != NULL; d++)
+			if (strlen(ent[d].name) == (size_t)(e - p) &&
+			    !memcmp(ent[d].name, p, e - p)) {
+				out[0] = ent[d].c;
+				return (1);
+			}
+		return (0);
+	}
+
+	if (++p < e && *p == 'x') {
+		hex = 1;
+		p++;
+	}
+	if (p == e)
+		return (0);
+	for (; p < e; p++) {
+		if (*p >= '0' && *p <= '9')
+			d = *p - '0';
+		else if (hex && *p >= 'a' && *p <= 'f')
+			d = *p - 'a' + 10;
+		else if (hex && *p >= 'A' && *p <= 'F')
+			d = *p - 'A' + 10;
+		else
+			return (0);
+		c = c * (hex ? 16 : 10) + d;
+		if (c > 0x10ffff)
+			return (0);
+	}
+
+	/* the characters xml allows */
+	if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+		return (0);
+	if ((c >= 0xd800 && c <= 0xdfff) || c == 0xfffe || c == 0xffff)
+		return (0);
+
+	if (c < 0x80) {
+		out[0] = c;
+		return (1);
+	}
+	if (c < 0x800) {
+		out[0] = 0xc0 | c >> 6;
+		out[1] = 0x80 | (c & 0x3f);
+		return (2);
+	}
+	if (c < 0x10000) {
+		out[0] = 0xe0 | c >> 12;
+		out[1] = 0x80 | (c >> 6 & 0x3f);
+		out[2] = 0x80 | (c & 0x3f);
+		return (3);
+	}
+	out[0] = 0xf0 | c >> 18;
+	out[1] = 0x80 | (c >> 12 & 0x3f);
+	out[2] = 0x80 | (c >> 6 & 0x3f);
+	out[3] = 0x80 | (c & 0x3f);
+	return (4);
+}
+
+/*
+ * Hand the text at `*pp' up to the next markup to the chardata handler.
+ * In a CDATA section `cdata' is set and the text runs up to the "]]>".
+ */
+static int
+xmlsd_native_text(struct xmlsd_native *xn, const char *b, const char **pp,
+    const char *end, int cdata)
+{
+	const char		*s = *pp, *q = *pp, *r;
+	char			 ref[4];
+	size_t			 len;
+	int			 cls = cdata ? XMLSD_C_CDATA : XMLSD_C_TEXT;
+
+	for (;;) {
+		q = xmlsd_scan(q, end, cls | XMLSD_C_CHECK);
+		if (q < end && !(xmlsd_cc[(unsigned char)*q] & cls)) {
+			if ((len = xmlsd_native_char(q, end)) == 0)
+				return (XMLSD_ERR_PARSER);
+			q += len;
+			continue;
+		}
+		if (q < end && *q == ']') {
+			if (end - q < 3 || q[1] != ']' || q[2] != '>') {
+				q++;
+				continue;
+			}
+			if (!cdata)
+				return (XMLSD_ERR_PARSER);
+		}
+		if (q > s) {
+			xn->at = s - b;
+			XMLSD_N_CALL(xn, chardata(xn->data, s, q - s));
+		}
+		if (q == end) {
+			*pp = q;
+			return (cdata ? XMLSD_ERR_PARSER : XMLSD_ERR_SUCCES);
+		}
+
+		r = q;
+		switch (*q) {
+		case '<':
+			*pp = q;
+			return (XMLSD_ERR_SUCCES);
+		case ']':
+			*pp = q + 3;
+			return (XMLSD_ERR_SUCCES);
+		case '\r':
+		case '\n':
+			/* a line break of either kind is a single LF */
+			if (*q++ == '\r' && q < end && *q == '\n')
+				q++;
+			xn->at = r - b;
+			XMLSD_N_CALL(xn, chardata(xn->data, "\n", 1));
+			break;
+		case '&':
+			if ((len = xmlsd_native_ref(&q, end, ref)) == 0)
+				return (XMLSD_ERR_PARSER);
+			xn->at = r - b;
+			XMLSD_N_CALL(xn, chardata(xn->data, ref, len));
+			break;
+		}
+		s = q;
+	}
+}
+
+/*
+ * Decode the attribute value at `*pp', which points at the opening quote,
+ * to `*used' in the scratch buffer.  White space characters become spaces
+ * like in any attribute of type CDATA.
+ */
+static int
+xmlsd_native_attr_value(struct xmlsd_native *xn, const char **pp,
+    const char *end, size_t *used)
+{
+	const char		*p = *pp + 1, *q;
+	char			 quote = **pp, ref[4];
+	size_t			 len;
+
+	for (;;) {
+		for (q = p;; q += len) {
+			q = xmlsd_scan(q, end, XMLSD_C_ATTR | XMLSD_C_CHECK);
+			if (q == end || (xmlsd_cc[(unsigned char)*q] &
+			    XMLSD_C_ATTR))
+				break;
+			if ((len = xmlsd_native_char(q, end)) == 0)
+				return (XMLSD_ERR_PARSER);
+		}
+		if (xmlsd_native_put(xn, used, p, q - p))
+			return (XMLSD_ERR_RESOURCE);
+		if (q == end || *q == '<')
+			return (XMLSD_ERR_PARSER);
+		p = q + 1;
+		if (*q == quote)
+			break;
+		switch (*q) {
+		case '"':
+		case '\'':
+			if (xmlsd_native_put(xn, used, q, 1))
+				return (XMLSD_ERR_RESOURCE);
+			break;
+		case '&':
+			p = q;
+			if ((len = xmlsd_native_ref(&p, end, ref)) == 0)
+				return (XMLSD_ERR_PARSER);
+			if (xmlsd_native_put(xn, used, ref, len))
+				return (XMLSD_ERR_RESOURCE);
+			break;
+		case '\r':
+			if (p < end && *p == '\n')
+				p++;
+			/* FALLTHROUGH */
+		default:
+			if (xmlsd_native_put(xn, used, " ", 1))
+				return (XMLSD_ERR_RESOURCE);
+			break;
+		}
+	}
+	*pp = p;
+
+	return (xmlsd_native_put(xn, used, "", 1) ? XMLSD_ERR_RESOURCE :
+	    XMLSD_ERR_SUCCES);
+}
+
+/* remember that element `name' is open at `*depth' */
+static int
+xmlsd_native_push(struct xmlsd_native *xn, size_t *depth, const char *name,
+    size_t len)
+{
+	struct xmlsd_native_open *no;
+	size_t			 sz;
+
+	if (*depth == xn->opensz) {
+		sz = xn->opensz ? xn->opensz * 2 : 32;
+		if ((no = xmlsd_mm_realloc(xn->mm, xn->open,
+		    sz * sizeof *no)) == NULL)
+			return (1);
+		xn->open = no;
+		xn->opensz = sz;
+	}
+	xn->open[*depth].name = name;
+	xn->open[*depth].len = len;
+	(*depth)++;
+
+	return (0);
+}
+
+/*
+ * Return 1 if a name is given twice in the `n' attributes of `attr', 0 if
+ * not or -1 if there is no memory.  A few are compared pairwise, more go
+ * through a hash table kept in the scratch space.
+ */
+static int
+xmlsd_native_dup(struct xmlsd_native *xn, const char **attr, size_t n)
+{
+	size_t			*ns, i, j, size = 2;
+
+	if (n < XMLSD_NATIVE_DUP_MIN) {
+		for (i = 0; i < n; i++)
+			for (j = i + 1; j < n; j++)
+				if (!strcmp(attr[2 * i], attr[2 * j]))
+					return (1);
+		return (0);
+	}
+
+	while (size < n * 2)
+		size *= 2;
+	if (size > xn->seensz) {
+		if ((ns = xmlsd_mm_realloc(xn->mm, xn->seen,
+		    size * sizeof *ns)) == NULL)
+			return (-1);
+		xn->seen = ns;
+		xn->seensz = size;
+	}
+	memset(xn->seen, 0, size * sizeof *xn->seen);
+	for (i = 0; i < n; i++) {
+		for (j = xmlsd_hash(attr[2 * i]) & (size - 1); xn->seen[j] != 0;
+		    j = (j + 1) & (size - 1))
+			if (!strcmp(attr[2 * (xn->seen[j] - 1)], attr[2 * i]))
+				return (1);
+		xn->seen[j] = i + 1;
+	}
+
+	return (0);
+}
+
+/* parse the start tag at `*pp' and report it */
+static int
+xmlsd_native_start(struct xmlsd_native *xn, const char *b, const char **pp,
+    const char *end, size_t *depth)
+{
+	const char		*p = *pp + 1, *name, *q;
+	size_t			 used = 0, n = 0, nlen, i, sz;
+	size_t			*noff;
+	const char		**nattr;
+	int			 rv, space;
+
+	name = p;
+	if ((p = xmlsd_scan_name(p, end)) == name)
+		return (XMLSD_ERR_PARSER);
+	nlen = p - name;
+	if (xmlsd_native_put(xn, &used, name, nlen) ||
+	    xmlsd_native_put(xn, &used, "", 1))
+		return (XMLSD_ERR_RESOURCE);
+
+	for (;;) {
+		q = p;
+		p = xmlsd_skip_space(p, end);
+		space = p != q;
+		if (p == end)
+			return (XMLSD_ERR_PARSER);
+		if (*p == '>' || (*p == '/' && end - p > 1 && p[1] == '>'))
+			break;
+		if (!space)
+			return (XMLSD_ERR_PARSER);
+
+		/* name = "value", names and values alternate in off */
+		if (2 * n + 2 > xn->attrsz) {
+			sz = xn->attrsz ? xn->attrsz * 2 : 16;
+			if ((noff = xmlsd_mm_realloc(xn->mm, xn->off,
+			    sz * sizeof *noff)) == NULL)
+				return (XMLSD_ERR_RESOURCE);
+			xn->off = noff;
+			if ((nattr = xmlsd_mm_realloc(xn->mm, xn->attr,
+			    (sz + 1) * sizeof *nattr)) == NULL)
+				return (XMLSD_ERR_RESOURCE);
+			xn->attr = nattr;
+			xn->attrsz = sz;
+		}
+		xn->off[2 * n] = used;
+		q = p;
+		if ((p = xmlsd_scan_name(p, end)) == q)
+			return (XMLSD_ERR_PARSER);
+		if (xmlsd_native_put(xn, &used, q, p - q) ||
+		    xmlsd_native_put(xn, &used, "", 1))
+			return (XMLSD_ERR_RESOURCE);
+		p = xmlsd_skip_space(p, end);
+		if (p == end || *p++ != '=')
+			return (XMLSD_ERR_PARSER);
+		p = xmlsd_skip_space(p, end);
+		if (p == end || (*p != '"' && *p != '\''))
+			return (XMLSD_ERR_PARSER);
+		xn->off[2 * n + 1] = used;
+		if ((rv = xmlsd_native_attr_value(xn, &p, end, &used)) != 0)
+			return (rv);
+		n++;
+	}
+
+	/* the scratch buffer has stopped moving, hand out pointers */
+	for (i = 0; i < 2 * n; i++)
+		xn->attr[i] = xn->buf + xn->off[i];
+	if (xn->attr == NULL)
+		nattr = xmlsd_no_attr;
+	else {
+		xn->attr[2 * n] = NULL;
+		nattr = xn->attr;
+	}
+	if ((rv = xmlsd_native_dup(xn, nattr, n)) != 0)
+		return (rv > 0 ? XMLSD_ERR_PARSER : XMLSD_ERR_RESOURCE);
+
+	xn->at = *pp - b;
+	XMLSD_N_CALL(xn, start(xn->data, xn->buf, nattr));
+	if (*p == '/') {
+		XMLSD_N_CALL(xn, end(xn->data, xn->buf));
+		*pp = p + 2;
+		return (XMLSD_ERR_SUCCES);
+	}
+
+	if (xmlsd_native_push(xn, depth, name, nlen))
+		return (XMLSD_ERR_RESOURCE);
+	*pp = p + 1;
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/* parse the end tag at `*pp', which must close the innermost element */
+static int
+xmlsd_native_end(struct xmlsd_native *xn, const char *b, const char **pp,
+    const char *end, size_t *depth)
+{
+	struct xmlsd_native_open *no;
+	const char		*p = *pp + 2, *name = p;
+	size_t			 used = 0;
+
+	if (*depth == 0)
+		return (XMLSD_ERR_PARSER);
+	no = &xn->open[*depth - 1];
+	if ((p = xmlsd_scan_name(p, end)) == name || p - name != no->len ||
+	    memcmp(name, no->name, no->len))
+		return (XMLSD_ERR_PARSER);
+	p = xmlsd_skip_space(p, end);
+	if (p == end || *p != '>')
+		return (XMLSD_ERR_PARSER);
+	if (xmlsd_native_put(xn, &used, name, no->len) ||
+	    xmlsd_native_put(xn, &used, "", 1))
+		return (XMLSD_ERR_RESOURCE);
+
+	(*depth)--;
+	xn->at = *pp - b;
+	XMLSD_N_CALL(xn, end(xn->data, xn->buf));
+	*pp = p + 1;
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/* return the end of the string `s' in [p, end), or NULL */
+const char *
+xmlsd_native_find(const char *p, const char *end, const char *s)
+{
+	size_t			 len = strlen(s);
+
+	while ((p = memchr(p, s[0], end - p)) != NULL) {
+		if ((size_t)(end - p) < len)
+			return (NULL);
+		if (!memcmp(p, s, len))
+			return (p + len);
+		p++;
+	}
+
+	return (NULL);
+}
+
+/*
+ * Check the pseudo-attributes of the xml declaration in [p, end), after
+ * `<?xml'.  The version comes first and is required, the encoding must be
+ * UTF-8 and standalone yes or no.
+ */
+static int
+xmlsd_native_decl(const char *p, const char *end)
+{
+	static const char	*names[] = { "version", "encoding",
+				    "standalone" };
+	const char		*q, *v;
+	size_t			 i, n = 0, len, nnames;
+
+	nnames = sizeof names / sizeof names[0];
+
+	for (;;) {
+		q = xmlsd_skip_space(p, end);
+		if (q == end)
+			break;
+		if (q == p)
+			return (XMLSD_ERR_PARSER);
+		p = xmlsd_scan_name(q, end);
+		len = p - q;
+		for (i = n; i < nnames; i++)
+			if (strlen(names[i]) == len &&
+			    !memcmp(q, names[i], len))
+				break;
+		if (i == nnames || (n == 0 && i != 0))
+			return (XMLSD_ERR_PARSER);
+		n = i + 1;
+
+		p = xmlsd_skip_space(p, end);
+		if (p == end || *p++ != '=')
+			return (XMLSD_ERR_PARSER);
+		p = xmlsd_skip_space(p, end);
+		if (p == end || (*p != '"' && *p != '\''))
+			return (XMLSD_ERR_PARSER);
+		v = p + 1;
+		if ((p = memchr(v, *p, end - v)) == NULL)
+			return (XMLSD_ERR_PARSER);
+		len = p++ - v;
+
+		switch (i) {
+		case 0:
+			/* what expat takes for a version number */
+			for (i = 0; i < len; i++)
+				if (!isalnum((unsigned char)v[i]) &&
+				    strchr("_.:-", v[i]) == NULL)
+					return (XMLSD_ERR_PARSER);
+			break;
+		case 1:
+			if (len != 5 || strncasecmp(v, "UTF-8", 5))
+				return (XMLSD_ERR_PARSER);
+			break;
+		default:
+			if ((len != 3 || strncmp(v, "yes", 3)) &&
+			    (len != 2 || strncmp(v, "no", 2)))
+				return (XMLSD_ERR_PARSER);
+			break;
+		}
+	}
+
+	return (n == 0 ? XMLSD_ERR_PARSER : XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Skip the comment, processing instruction or CDATA section at `*pp'.
+ * Only the xml declaration at the very start may say which encoding the
+ * document is in, and that must be UTF-8.
+ */
+static int
+xmlsd_native_misc(struct xmlsd_native *xn, const char *b, const char **pp,
+    const char *end, int first)
+{
+	const char		*p = *pp, *q, *e;
+	size_t			 len;
+
+	if (end - p >= 4 && !memcmp(p, "<!--", 4)) {
+		if ((q = xmlsd_native_find(p + 4, end, "--")) == NULL ||
+		    q == end || *q != '>' || !xmlsd_native_chars(p + 4, q - 2))
+			return (XMLSD_ERR_PARSER);
+		*pp = q + 1;
+		return (XMLSD_ERR_SUCCES);
+	}
+	if (end - p >= 9 && !memcmp(p, "<![CDATA[", 9)) {
+		*pp = p + 9;
+		return (xmlsd_native_text(xn, b, pp, end, 1));
+	}
+	if (end - p < 2 || p[1] != '?')
+		return (XMLSD_ERR_PARSER);	/* DOCTYPE and friends */
+
+	if ((e = xmlsd_native_find(p + 2, end, "?>")) == NULL)
+		return (XMLSD_ERR_PARSER);
+	q = xmlsd_scan_name(p + 2, e - 2);
+	len = q - (p + 2);
+	/* a target, then white space or the end */
+	if (len == 0 || (q != e - 2 && !(xmlsd_cc[(unsigned char)*q] &
+	    XMLSD_C_SPACE)) || !xmlsd_native_chars(q, e - 2))
+		return (XMLSD_ERR_PARSER);
+	if (len == 3 && !strncasecmp(p + 2, "xml", 3)) {
+		if (!first || strncmp(p + 2, "xml", 3) ||
+		    xmlsd_native_decl(q, e - 2))
+			return (XMLSD_ERR_PARSER);
+	}
+	*pp = e;
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Parse the `sz' bytes at `b' and call the handlers of `xn'.  Returns
+ * XMLSD_ERR_SUCCES, XMLSD_ERR_PARSER if the document is malformed or uses
+ * something this tokenizer does not support, or XMLSD_ERR_RESOURCE.  If a
+ * handler set `stop' the return value is meaningless.
+ */
+int
+xmlsd_native_parse(struct xmlsd_native *xn, const char *b, size_t sz)
+{
+	const char		*p = b, *end = b + sz;
+	size_t			 depth = 0, used = 0;
+	int			 rv, root = 0;
+
+	xn->stop = 0;
+
+	if (xn->part == XMLSD_PART_CONTENT) {
+		/* an element no end tag in the input can match */
+		if (xmlsd_native_push(xn, &depth, "", 0))
+			return (XMLSD_ERR_RESOURCE);
+		root = 1;
+		xn->at = 0;
+		XMLSD_N_CALL(xn, start(xn->data, "xmlsd", xmlsd_no_attr));
+	} else if (sz >= 3 && !memcmp(p, "\xef\xbb\xbf", 3))
+		p += 3;		/* byte order mark */
+
+	while (p < end) {
+		if (depth == 0) {
+			/* outside of the root only markup is allowed */
+			p = xmlsd_skip_space(p, end);
+			if (p == end)
+				break;
+			if (*p != '<')
+				return (XMLSD_ERR_PARSER);
+		} else if (*p != '<') {
+			if ((rv = xmlsd_native_text(xn, b, &p, end, 0)) != 0)
+				return (rv);
+			continue;
+		}
+
+		if (end - p < 2)
+			return (XMLSD_ERR_PARSER);
+		if (p[1] == '/')
+			rv = xmlsd_native_end(xn, b, &p, end, &depth);
+		else if (p[1] == '!' || p[1] == '?') {
+			/* no CDATA outside of the root */
+			if (depth == 0 && end - p > 2 && p[2] == '[')
+				return (XMLSD_ERR_PARSER);
+			rv = xmlsd_native_misc(xn, b, &p, end,
+			    xn->part != XMLSD_PART_CONTENT &&
+			    (p == b || (p == b + 3 && b[0] == '\xef')));
+		} else if (depth == 0 && root++)
+			rv = XMLSD_ERR_PARSER;
+		else
+			rv = xmlsd_native_start(xn, b, &p, end, &depth);
+		if (rv != XMLSD_ERR_SUCCES)
+			return (rv);
+	}
+
+	/* close what the caller left out */
+	if (depth == 1 && xn->part == XMLSD_PART_CONTENT) {
+		xn->at = sz;
+		XMLSD_N_CALL(xn, end(xn->data, "xmlsd"));
+		depth = 0;
+	} else if (depth == 1 && xn->part == XMLSD_PART_HEAD) {
+		if (xmlsd_native_put(xn, &used, xn->open[0].name,
+		    xn->open[0].len) || xmlsd_native_put(xn, &used, "", 1))
+			return (XMLSD_ERR_RESOURCE);
+		xn->at = sz;
+		XMLSD_N_CALL(xn, end(xn->data, xn->buf));
+		depth = 0;
+	}
+	if (depth != 0 || !root)
+		return (XMLSD_ERR_PARSER);
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+void
+xmlsd_native_free(struct xmlsd_native *xn)
+{
+	xmlsd_mm_free(xn->mm, xn->buf);
+	xmlsd_mm_free(xn->mm, xn->off);
+	xmlsd_mm_free(xn->mm, xn->attr);
+	xmlsd_mm_free(xn->mm, xn->open);
+	xmlsd_mm_free(xn->mm, xn->seen);
+	bzero(xn, sizeof *xn);
+}
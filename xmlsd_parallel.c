@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Parsing one large document on several threads.  A quick scan finds
+ * places between children of the root where the document can be cut,
+ * the pieces are parsed into documents of their own at the same time and
+ * their elements are then moved under the root in order.
+ *
+ * A cut is only made where nothing but white space follows the previous
+ * end tag, there the parser holds no pending text and the pieces come out
+ * exactly as one parse would.  Documents the scan does not understand,
+ * such as those with a DTD, are parsed in one go.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define XMLSD_PARALLEL_MIN	(256 * 1024)	/* smallest piece */
+#define XMLSD_PARALLEL_SERIAL	(2 * XMLSD_PARALLEL_MIN) /* smaller is serial */
+#define XMLSD_PARALLEL_MAX	(256)		/* most pieces */
+
+struct xmlsd_parallel_job {
+	pthread_t			 thread;
+	const char			*b;
+	size_t				 sz;
+	struct xmlsd_document		*xd;
+	int				 flags;
+	int				 started;
+	int				 rv;
+};
+
+static const char *
+xmlsd_parallel_space(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+	    *p == '\n'))
+		p++;
+	return (p);
+}
+
+/* return the '>' ending the tag at `p', skipping quoted values */
+static const char *
+xmlsd_parallel_tag(const char *p, const char *end)
+{
+	for (; p < end; p++) {
+		switch (*p) {
+		case '>':
+			return (p);
+		case '<':
+			return (NULL);
+		case '"':
+		case '\'':
+			if ((p = memchr(p + 1, *p, end - p - 1)) == NULL)
+				return (NULL);
+			break;
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Skip the comment or processing instruction at `p'.  Returns NULL for
+ * anything else and for an xml declaration that is not for UTF-8.
+ */
+static const char *
+xmlsd_parallel_misc(const char *p, const char *end)
+{
+	const char		*e, *q;
+
+	if (end - p >= 4 && !memcmp(p, "<!--", 4))
+		return (xmlsd_native_find(p + 4, end, "-->"));
+	if (end - p < 2 || p[1] != '?' ||
+	    (e = xmlsd_native_find(p + 2, end, "?>")) == NULL)
+		return (NULL);
+	if (e - p > 5 && !strncmp(p, "<?xml", 5) &&
+	    (q = xmlsd_native_find(p, e, "encoding")) != NULL) {
+		q = xmlsd_parallel_space(q, e);
+		if (q == e || *q++ != '=')
+			return (NULL);
+		q = xmlsd_parallel_space(q, e);
+		if (e - q < 7 || strncasecmp(q + 1, "UTF-8", 5) || q[6] != *q)
+			return (NULL);
+	}
+
+	return (e);
+}
+
+/*
+ * Find up to `*n' - 1 places in `b' to cut at, roughly evenly spaced.
+ * bounds[0] is set to the end of the root start tag and bounds[*n] to the
+ * start of the root end tag, `*n' is set to the number of pieces between
+ * them.  Returns 1 if the document can't be cut.
+ */
+static int
+xmlsd_parallel_scan(const char *b, size_t sz, size_t *bounds, size_t *n)
+{
+	const char		*p = b, *end = b + sz, *q, *e, *name;
+	size_t			 k = 1, depth = 1, namelen;
+	int			 dirty = 0;
+
+	if (sz >= 3 && !memcmp(p, "\xef\xbb\xbf", 3))
+		p += 3;
+
+	/* prolog, no DTD */
+	for (;;) {
+		p = xmlsd_parallel_space(p, end);
+		if (end - p < 2 || *p != '<')
+			return (1);
+		if (p[1] != '?' && p[1] != '!')
+			break;
+		if ((p = xmlsd_parallel_misc(p, end)) == NULL)
+			return (1);
+	}
+
+	/* the root must have content to cut */
+	name = p + 1;
+	if ((e = xmlsd_parallel_tag(name, end)) == NULL || e[-1] == '/')
+		return (1);
+	for (q = name; q < e && *q != '/' &&
+	    xmlsd_parallel_space(q, e) == q; q++)
+		;
+	namelen = q - name;
+	bounds[0] = e + 1 - b;
+	p = e + 1;
+
+	while (depth > 0) {
+		if ((q = memchr(p, '<', end - p)) == NULL)
+			return (1);
+		/* text right in the root is held until the next end tag */
+		if (depth == 1 && !dirty)
+			dirty = xmlsd_parallel_space(p, q) != q;
+		p = q;
+
+		if (end - p >= 9 && !memcmp(p, "<![CDATA[", 9)) {
+			if ((p = xmlsd_native_find(p + 9, end, "]]>")) ==
+			    NULL)
+				return (1);
+			if (depth == 1)
+				dirty = 1;
+			continue;
+		}
+		if (end - p >= 2 && (p[1] == '!' || p[1] == '?')) {
+			if ((p = xmlsd_parallel_misc(p, end)) == NULL)
+				return (1);
+			continue;
+		}
+		if ((e = xmlsd_parallel_tag(p + 1, end)) == NULL)
+			return (1);
+
+		if (p[1] == '/') {
+			if (--depth == 1)
+				dirty = 0;
+		} else {
+			if (depth == 1 && !dirty && k < *n &&
+			    (size_t)(p - b) >= sz / *n * k)
+				bounds[k++] = p - b;
+			if (e[-1] != '/')
+				depth++;
+			else if (depth == 1)
+				dirty = 0;
+		}
+		if (depth == 0) {
+			/* the root end tag */
+			if ((size_t)(e - p) < 2 + namelen ||
+			    memcmp(p + 2, name, namelen) ||
+			    xmlsd_parallel_space(p + 2 + namelen, e) != e)
+				return (1);
+			bounds[k] = p - b;
+		}
+		p = e + 1;
+	}
+	*n = k;
+
+	/* epilog */
+	for (;;) {
+		p = xmlsd_parallel_space(p, end);
+		if (p == end)
+			break;
+		if ((p = xmlsd_parallel_misc(p, end)) == NULL)
+			return (1);
+	}
+
+	return (0);
+}
+
+static void *
+xmlsd_parallel_run(void *arg)
+{
+	struct xmlsd_parallel_job *job = arg;
+
+	job->rv = xmlsd_parse_part(job->b, job->sz, job->xd, job->flags,
+	    XMLSD_PART_CONTENT, NULL);
+	return (NULL);
+}
+
+/*
+ * Move the children of the made up element of `from' under `to' and hand
+ * the memory of `from' to `xd'.
+ */
+static int
+xmlsd_parallel_splice(struct xmlsd_document *xd, struct xmlsd_element *to,
+    struct xmlsd_document *from, int last)
+{
+	struct xmlsd_element	*top = from->root, *xe;
+	struct xmlsd_chunk	*xc;
+	const char		*s;
+	size_t			 len;
+
+	/* text after the last child belongs to the root */
+	if (top->value.type != XMLSD_VALUE_NONE) {
+		if (!last || to->value.type != XMLSD_VALUE_NONE)
+			return (1);
+		s = xmlsd_value_span(&top->value, &len);
+		if (top->value.flags & XMLSD_VALUE_F_BORROW)
+			xmlsd_value_borrow(&to->value, s, len);
+		else if (xmlsd_doc_value_set(xd, &to->value, s, len))
+			return (1);
+	}
+
+	while ((xe = TAILQ_FIRST(&top->children)) != NULL) {
+		TAILQ_REMOVE(&top->children, xe, entry);
+		xe->parent = to;
+		xmlsd_elem_add_child(to, xe);
+	}
+	while ((xc = SLIST_FIRST(&from->chunks)) != NULL) {
+		SLIST_REMOVE_HEAD(&from->chunks, link);
+		SLIST_INSERT_HEAD(&xd->chunks, xc, link);
+	}
+	while ((xc = SLIST_FIRST(&from->big)) != NULL) {
+		SLIST_REMOVE_HEAD(&from->big, link);
+		SLIST_INSERT_HEAD(&xd->big, xc, link);
+	}
+	from->chunk_cur = NULL;
+
+	return (0);
+}
+
+/*
+ * Take the chunks of the recycling document `xd' that hold nothing out into
+ * `spare', but for one to parse the root into.  Returns how many there are.
+ */
+static size_t
+xmlsd_parallel_spare(struct xmlsd_document *xd, struct xmlsd_chunk_list *spare)
+{
+	struct xmlsd_chunk_list	 kept;
+	struct xmlsd_chunk	*xc;
+	size_t			 n = 0;
+	int			 own = 0;
+
+	SLIST_INIT(spare);
+	if (!(xd->flags & XMLSD_DOC_F_RECYCLE))
+		return (0);
+	SLIST_INIT(&kept);
+	while ((xc = SLIST_FIRST(&xd->chunks)) != NULL) {
+		SLIST_REMOVE_HEAD(&xd->chunks, link);
+		if (xc->used == 0 && own) {
+			SLIST_INSERT_HEAD(spare, xc, link);
+			n++;
+		} else {
+			own |= xc->used == 0;
+			SLIST_INSERT_HEAD(&kept, xc, link);
+		}
+	}
+	xd->chunks = kept;
+	xd->chunk_cur = SLIST_FIRST(&xd->chunks);
+
+	return (n);
+}
+
+/* move up to `n' chunks from `spare' to `xd', which is still empty */
+static void
+xmlsd_parallel_lend(struct xmlsd_chunk_list *spare, struct xmlsd_document *xd,
+    size_t n)
+{
+	struct xmlsd_chunk	*xc;
+
+	while (n-- > 0 && (xc = SLIST_FIRST(spare)) != NULL) {
+		SLIST_REMOVE_HEAD(spare, link);
+		SLIST_INSERT_HEAD(&xd->chunks, xc, link);
+	}
+	xd->chunk_cur = SLIST_FIRST(&xd->chunks);
+}
+
+/*
+ * Parse the `sz' bytes at `b' into `xd' using up to `nthreads' threads,
+ * or one per processor if `nthreads' is 0.  `flags' are those of
+ * xmlsd_parse_mem_flags().  The result is the same as that of
+ * xmlsd_parse_mem_flags(), documents under XMLSD_PARALLEL_SERIAL bytes or
+ * that can't be cut, and all of them if `nthreads' is 0 on a single
+ * processor, are parsed by the calling thread alone.
+ *
+ * A recycling document lends the chunks it is not using to the pieces,
+ * they come back with the rest of each piece.
+ */
+int
+xmlsd_parse_mem_parallel(const char *b, size_t sz, struct xmlsd_document *xd,
+    int flags, int nthreads)
+{
+	struct xmlsd_parallel_job *jobs = NULL;
+	struct xmlsd_element	*root;
+	struct xmlsd_chunk_list	 spare;
+	struct xmlsd_chunk	*xc;
+	size_t			*bounds = NULL, n, i, nspare;
+	long			 ncpu;
+	int			 rv;
+
+	if (b == NULL || sz == 0 || xd == NULL ||
+	    (flags & ~XMLSD_PARSE_NATIVE) || nthreads < 0)
+		return (XMLSD_ERR_INTEGRITY);
+
+	/* threads cost more than they save on small documents or one cpu */
+	if (sz < XMLSD_PARALLEL_SERIAL)
+		goto serial;
+	if (nthreads == 0)
+		nthreads = (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ?
+		    ncpu : 1;
+	n = sz / XMLSD_PARALLEL_MIN;
+	if (n > (size_t)nthreads)
+		n = nthreads;
+	if (n > XMLSD_PARALLEL_MAX)
+		n = XMLSD_PARALLEL_MAX;
+	if (n < 2 || !xmlsd_doc_is_empty(xd) || xd->sealed)
+		goto serial;
+
+	if ((bounds = xmlsd_mm_calloc(xd->mm, n + 1, sizeof *bounds)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	if (xmlsd_parallel_scan(b, sz, bounds, &n) || n < 2)
+		goto serial;
+	if ((jobs = xmlsd_mm_calloc(xd->mm, n, sizeof *jobs)) == NULL) {
+		xmlsd_mm_free(xd->mm, bounds);
+		return (XMLSD_ERR_RESOURCE);
+	}
+
+	nspare = xmlsd_parallel_spare(xd, &spare);
+	for (i = 0; i < n; i++) {
+		jobs[i].b = b + bounds[i];
+		jobs[i].sz = bounds[i + 1] - bounds[i];
+		jobs[i].flags = flags;
+		jobs[i].rv = XMLSD_ERR_RESOURCE;
+		if (xmlsd_doc_alloc_mm(&jobs[i].xd, xd->flags &
+		    (XMLSD_DOC_F_RECYCLE | XMLSD_DOC_F_BORROW), xd->mm) !=
+		    XMLSD_ERR_SUCCES) {
+			jobs[i].xd = NULL;
+			continue;
+		}
+		/* what is parsed ends up in `xd', with its allocator */
+		jobs[i].xd->mm = xd->mm;
+		xmlsd_parallel_lend(&spare, jobs[i].xd,
+		    (nspare + n - 1 - i) / n);
+		if (i == 0)
+			continue;
+		if (pthread_create(&jobs[i].thread, NULL, xmlsd_parallel_run,
+		    &jobs[i]) != 0)
+			xmlsd_parallel_run(&jobs[i]);
+		else
+			jobs[i].started = 1;
+	}
+	/* shares of pieces that could not be set up */
+	if (!SLIST_EMPTY(&spare)) {
+		while ((xc = SLIST_FIRST(&spare)) != NULL) {
+			SLIST_REMOVE_HEAD(&spare, link);
+			SLIST_INSERT_HEAD(&xd->chunks, xc, link);
+		}
+		xd->chunk_cur = SLIST_FIRST(&xd->chunks);
+	}
+
+	/* the root and the first piece are ours */
+	rv = xmlsd_parse_part(b, bounds[0], xd, flags, XMLSD_PART_HEAD,
+	    NULL);
+	if (jobs[0].xd != NULL)
+		xmlsd_parallel_run(&jobs[0]);
+
+	for (i = 0; i < n; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		root = xmlsd_doc_get_root(xd);
+		if (rv == XMLSD_ERR_SUCCES && (rv = jobs[i].rv) ==
+		    XMLSD_ERR_SUCCES && xmlsd_parallel_splice(xd, root,
+		    jobs[i].xd, i == n - 1))
+			rv = XMLSD_ERR_RESOURCE;
+		xmlsd_doc_free(jobs[i].xd);
+	}
+	xmlsd_mm_free(xd->mm, jobs);
+	xmlsd_mm_free(xd->mm, bounds);
+	xmlsd_doc_changed(xd);
+
+	if (rv == XMLSD_ERR_SUCCES) {
+		if (xd->flags & XMLSD_DOC_F_FREEZE)
+			rv = xmlsd_doc_freeze(xd);
+		return (rv);
+	}
+
+	/* let a single parse say what is wrong */
+	xmlsd_doc_clear(xd);
+	return (xmlsd_parse_mem_flags(b, sz, xd, flags));
+
+serial:
+	xmlsd_mm_free(xd->mm, bounds);
+	return (xmlsd_parse_mem_flags(b, sz, xd, flags));
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Parsing batches of documents on a set of threads that live as long as
+ * the pool.  Every thread keeps its own parser between documents, the
+ * thread calling xmlsd_parse_batch() works along with them.  Documents are
+ * handed out a few at a time from a shared cursor so that a thread stuck
+ * on a large one does not hold up the rest.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XMLSD_POOL_MAX		(256)	/* most threads */
+#define XMLSD_POOL_GRAIN	(64)	/* most documents handed out at once */
+
+struct xmlsd_batch {
+	const struct iovec		*bufs;
+	size_t				 n;
+	struct xmlsd_document		**docs;
+	int				*errors;
+	size_t				 next;	/* first not handed out */
+	size_t				 grain;
+};
+
+struct xmlsd_pool_thread {
+	pthread_t			 thread;
+	struct xmlsd_pool		*pool;
+	struct xmlsd_parse_cache	 cache;
+	int				 started;
+};
+
+struct xmlsd_pool {
+	pthread_mutex_t			 mtx;
+	pthread_cond_t			 work;	/* new batch or quit */
+	pthread_cond_t			 idle;	/* batch done */
+	struct xmlsd_batch		*batch;
+	unsigned int			 gen;	/* batches posted */
+	int				 running;
+	int				 quit;
+	int				 flags;
+	int				 nthreads;
+	struct xmlsd_pool_thread	*threads; /* [0] is the caller */
+	struct xmlsd_allocator		 xal;
+	const struct xmlsd_allocator	*mm;	/* &xal or NULL for malloc */
+};
+
+/* parse documents of `xb' until there are none left, `pool' may be NULL */
+static void
+xmlsd_pool_run(struct xmlsd_pool *pool, struct xmlsd_batch *xb,
+    struct xmlsd_parse_cache *pc)
+{
+	struct xmlsd_document	*xd;
+	size_t			 i, end;
+	int			 rv;
+
+	for (;;) {
+		if (pool != NULL)
+			pthread_mutex_lock(&pool->mtx);
+		i = xb->next;
+		end = xb->n - i < xb->grain ? xb->n : i + xb->grain;
+		xb->next = end;
+		if (pool != NULL)
+			pthread_mutex_unlock(&pool->mtx);
+		if (i == end)
+			break;
+
+		for (; i < end; i++) {
+			rv = XMLSD_ERR_SUCCES;
+			if ((xd = xb->docs[i]) == NULL) {
+				if ((rv = xmlsd_doc_alloc_mm(&xd, 0,
+				    pool ? pool->mm : NULL)) ==
+				    XMLSD_ERR_SUCCES)
+					xb->docs[i] = xd;
+			}
+			if (rv == XMLSD_ERR_SUCCES) {
+				if (xb->bufs[i].iov_base == NULL ||
+				    xb->bufs[i].iov_len == 0)
+					rv = XMLSD_ERR_INTEGRITY;
+				else
+					rv = xmlsd_parse_part(
+					    xb->bufs[i].iov_base,
+					    xb->bufs[i].iov_len, xd,
+					    pool ? pool->flags : 0,
+					    XMLSD_PART_DOC, pc);
+			}
+			xb->errors[i] = rv;
+		}
+	}
+}
+
+static void *
+xmlsd_pool_main(void *arg)
+{
+	struct xmlsd_pool_thread *pt = arg;
+	struct xmlsd_pool	*pool = pt->pool;
+	struct xmlsd_batch	*xb;
+	unsigned int		 seen = 0;
+
+	pthread_mutex_lock(&pool->mtx);
+	for (;;) {
+		while (!pool->quit &&
+		    (pool->batch == NULL || pool->gen == seen))
+			pthread_cond_wait(&pool->work, &pool->mtx);
+		if (pool->quit)
+			break;
+		seen = pool->gen;
+		xb = pool->batch;
+		pool->running++;
+		pthread_mutex_unlock(&pool->mtx);
+
+		xmlsd_pool_run(pool, xb, &pt->cache);
+
+		pthread_mutex_lock(&pool->mtx);
+		if (--pool->running == 0)
+			pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->mtx);
+
+	return (NULL);
+}
+
+/*
+ * Allocate a pool of `nthreads' threads, counting the one calling
+ * xmlsd_parse_batch(), or one per processor if `nthreads' is 0.  `flags'
+ * are those of xmlsd_parse_mem_flags() and apply to every document.
+ */
+int
+xmlsd_pool_alloc(struct xmlsd_pool **poolp, int nthreads, int flags)
+{
+	return (xmlsd_pool_alloc_mm(poolp, nthreads, flags, NULL));
+}
+
+/*
+ * Like xmlsd_pool_alloc() for a pool that takes its memory from `mm', as
+ * do the parsers of its threads and the documents it allocates.
+ */
+int
+xmlsd_pool_alloc_mm(struct xmlsd_pool **poolp, int nthreads, int flags,
+    const struct xmlsd_allocator *mm)
+{
+	struct xmlsd_pool	*pool;
+	long			 ncpu;
+	int			 i;
+
+	if (poolp == NULL || nthreads < 0 || (flags & ~XMLSD_PARSE_NATIVE))
+		return (XMLSD_ERR_INTEGRITY);
+	if (mm != NULL && (mm->xal_malloc == NULL ||
+	    mm->xal_realloc == NULL || mm->xal_free == NULL))
+		return (XMLSD_ERR_INTEGRITY);
+
+	if (nthreads == 0)
+		nthreads = (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ?
+		    ncpu : 1;
+	if (nthreads > XMLSD_POOL_MAX)
+		nthreads = XMLSD_POOL_MAX;
+
+	if ((pool = xmlsd_mm_calloc(mm, 1, sizeof *pool)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	if (mm != NULL) {
+		pool->xal = *mm;
+		pool->mm = &pool->xal;
+	}
+	if ((pool->threads = xmlsd_mm_calloc(mm, nthreads,
+	    sizeof *pool->threads)) == NULL) {
+		xmlsd_mm_free(mm, pool);
+		return (XMLSD_ERR_RESOURCE);
+	}
+	for (i = 0; i < nthreads; i++)
+		pool->threads[i].cache.mm = pool->mm;
+	pool->flags = flags;
+	pool->nthreads = nthreads;
+	pthread_mutex_init(&pool->mtx, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	for (i = 1; i < nthreads; i++) {
+		pool->threads[i].pool = pool;
+		if (pthread_create(&pool->threads[i].thread, NULL,
+		    xmlsd_pool_main, &pool->threads[i]) != 0) {
+			xmlsd_pool_free(pool);
+			return (XMLSD_ERR_RESOURCE);
+		}
+		pool->threads[i].started = 1;
+	}
+
+	*poolp = pool;
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Stop the threads of `pool' and free it.  It must not be in use.
+ */
+void
+xmlsd_pool_free(struct xmlsd_pool *pool)
+{
+	struct xmlsd_allocator	 xal;
+	int			 i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->mtx);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mtx);
+
+	for (i = 0; i < pool->nthreads; i++) {
+		if (pool->threads[i].started)
+			pthread_join(pool->threads[i].thread, NULL);
+		xmlsd_parse_cache_free(&pool->threads[i].cache);
+	}
+
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mtx);
+	xmlsd_mm_free(pool->mm, pool->threads);
+	if (pool->mm == NULL)
+		free(pool);
+	else {
+		xal = pool->xal;
+		xmlsd_mm_free(&xal, pool);
+	}
+}
+
+/*
+ * Parse the `n' documents in `bufs' into `docs'.  Entries of `docs' that
+ * are NULL are filled in with newly allocated documents, the others must
+ * be empty.  The result of each parse is stored in `errors' if it isn't
+ * NULL.  Without a `pool' the documents are parsed by the calling thread.
+ *
+ * Returns the error of the first document that failed or 0 if they were
+ * all parsed.  Batches given to the same pool at once run one after the
+ * other.
+ */
+int
+xmlsd_parse_batch(const struct iovec *bufs, size_t n,
+    struct xmlsd_document **docs, int *errors, struct xmlsd_pool *pool)
+{
+	struct xmlsd_parse_cache cache;
+	struct xmlsd_batch	 xb;
+	size_t			 i;
+	int			*rvs = errors, rv = XMLSD_ERR_SUCCES;
+
+	if ((bufs == NULL || docs == NULL) && n > 0)
+		return (XMLSD_ERR_INTEGRITY);
+	if (n == 0)
+		return (XMLSD_ERR_SUCCES);
+	if (rvs == NULL && (rvs = calloc(n, sizeof *rvs)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+
+	bzero(&xb, sizeof xb);
+	xb.bufs = bufs;
+	xb.n = n;
+	xb.docs = docs;
+	xb.errors = rvs;
+
+	if (pool == NULL) {
+		bzero(&cache, sizeof cache);
+		xb.grain = n;
+		xmlsd_pool_run(NULL, &xb, &cache);
+		xmlsd_parse_cache_free(&cache);
+	} else {
+		/* small grains for few documents, fewer trips to the lock */
+		xb.grain = n / ((size_t)pool->nthreads * 8);
+		if (xb.grain < 1)
+			xb.grain = 1;
+		if (xb.grain > XMLSD_POOL_GRAIN)
+			xb.grain = XMLSD_POOL_GRAIN;
+
+		pthread_mutex_lock(&pool->mtx);
+		while (pool->batch != NULL)
+			pthread_cond_wait(&pool->idle, &pool->mtx);
+		pool->batch = &xb;
+		pool->gen++;
+		pthread_cond_broadcast(&pool->work);
+		pthread_mutex_unlock(&pool->mtx);
+
+		xmlsd_pool_run(pool, &xb, &pool->threads[0].cache);
+
+		pthread_mutex_lock(&pool->mtx);
+		while (pool->running > 0)
+			pthread_cond_wait(&pool->idle, &pool->mtx);
+		pool->batch = NULL;
+		pthread_cond_broadcast(&pool->idle);
+		pthread_mutex_unlock(&pool->mtx);
+	}
+
+	for (i = 0; i < n; i++)
+		if (rvs[i] != XMLSD_ERR_SUCCES) {
+			rv = rvs[i];
+			break;
+		}
+	if (rvs != errors)
+		free(rvs);
+
+	return (rv);
+}
@@ -0,0 +1,598 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A small subset of XPath.  A query is a list of steps, each introduced by
+ * `/' for children or `//' for descendants of the elements selected so
+ * far, starting at the document.  A step is an element name or `*',
+ * followed by any number of predicates:
+ *
+ *	[@name]			has attribute name
+ *	[@name='value']		attribute name is value
+ *	[@name!='value']	attribute name is missing or not value
+ *	[n]			n-th of the elements of the same parent that
+ *				made it through the predicates before it
+ *
+ * e.g. //dir[@name='etc']/file or /filesystem/dir[2].
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+
+struct xmlsd_query_pred {
+	int				 type;
+#define XMLSD_QPRED_ATTR		(0)
+#define XMLSD_QPRED_ATTR_EQ		(1)
+#define XMLSD_QPRED_ATTR_NE		(2)
+#define XMLSD_QPRED_POS			(3)
+	char				*name;
+	char				*value;
+	size_t				 valuelen;
+	size_t				 pos;
+	size_t				 slot;	/* counter of a POS predicate */
+};
+
+struct xmlsd_query_step {
+	int				 axis;
+#define XMLSD_QAXIS_CHILD		(0)
+#define XMLSD_QAXIS_DESC		(1)
+	char				*name;	/* NULL matches any */
+	size_t				 namelen;
+	struct xmlsd_query_pred		*preds;
+	size_t				 npreds;
+	size_t				 npos;
+};
+
+struct xmlsd_query {
+	struct xmlsd_query_step		*steps;
+	size_t				 nsteps;
+	/* leading plain child steps, as a path for xmlsd_doc_find_path() */
+	size_t				 nprefix;
+	char				*prefix;
+	/* first descendant step with steps after it, or nsteps */
+	size_t				 gather;
+};
+
+/* position counters live on a stack that only grows with the tree depth */
+#define XMLSD_QUERY_STACK		(64)
+
+struct xmlsd_query_ctx {
+	struct xmlsd_query		*q;
+	struct xmlsd_document		*xd;
+	int				(*fn)(struct xmlsd_element *, void *);
+	void				*arg;
+	size_t				*pos;
+	size_t				 npos;
+	size_t				 top;
+	size_t				 stack[XMLSD_QUERY_STACK];
+	/* results below the current element of step gather, by address */
+	struct xmlsd_element		**set;
+	size_t				 setsize, nset;
+	/* per step, the element whose descendants it walked last */
+	struct xmlsd_element		**last;
+};
+
+static int	xmlsd_query_step(struct xmlsd_query_ctx *, size_t,
+		    struct xmlsd_element *);
+
+#define XMLSD_QNAME_CHAR(c)						\
+	((c) != '\0' && (c) != '/' && (c) != '[' && (c) != ']' &&	\
+	(c) != '=' && (c) != '!' && (c) != '@' && (c) != '\'' &&	\
+	(c) != '"' && !isspace((unsigned char)(c)))
+
+static void
+xmlsd_query_skip_space(const char **s)
+{
+	while (isspace((unsigned char)**s))
+		(*s)++;
+}
+
+/* copy the name at `*s', NULL if there is none or no memory */
+static char *
+xmlsd_query_name(const char **s)
+{
+	const char		*p = *s;
+
+	while (XMLSD_QNAME_CHAR(**s))
+		(*s)++;
+	if (*s == p)
+		return (NULL);
+	return (strndup(p, *s - p));
+}
+
+/* copy the quoted string at `*s' */
+static char *
+xmlsd_query_quoted(const char **s)
+{
+	const char		*p;
+	char			 q = **s;
+
+	if (q != '\'' && q != '"')
+		return (NULL);
+	p = ++(*s);
+	while (**s != q)
+		if (*(*s)++ == '\0')
+			return (NULL);
+	return (strndup(p, (*s)++ - p));
+}
+
+/* parse a predicate, `*s' is just past the `[' */
+static int
+xmlsd_query_pred(const char **s, struct xmlsd_query_step *qs)
+{
+	struct xmlsd_query_pred	*qp;
+	const char		*errstr;
+	char			 num[16];
+	size_t			 n;
+
+	qp = realloc(qs->preds, (qs->npreds + 1) * sizeof *qp);
+	if (qp == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	qs->preds = qp;
+	qp = &qs->preds[qs->npreds++];
+	memset(qp, 0, sizeof *qp);
+
+	xmlsd_query_skip_space(s);
+	if (**s == '@') {
+		(*s)++;
+		if ((qp->name = xmlsd_query_name(s)) == NULL)
+			return (XMLSD_ERR_PARSER);
+		xmlsd_query_skip_space(s);
+		qp->type = XMLSD_QPRED_ATTR;
+		if (**s == '=' || (**s == '!' && (*s)[1] == '=')) {
+			qp->type = **s == '=' ? XMLSD_QPRED_ATTR_EQ :
+			    XMLSD_QPRED_ATTR_NE;
+			*s += qp->type == XMLSD_QPRED_ATTR_EQ ? 1 : 2;
+			xmlsd_query_skip_space(s);
+			if ((qp->value = xmlsd_query_quoted(s)) == NULL)
+				return (XMLSD_ERR_PARSER);
+			qp->valuelen = strlen(qp->value);
+		}
+	} else {
+		for (n = 0; isdigit((unsigned char)**s); (*s)++) {
+			if (n == sizeof num - 1)
+				return (XMLSD_ERR_PARSER);
+			num[n++] = **s;
+		}
+		num[n] = '\0';
+		qp->pos = strtonum(num, 1, LLONG_MAX, &errstr);
+		if (errstr != NULL)
+			return (XMLSD_ERR_PARSER);
+		qp->type = XMLSD_QPRED_POS;
+		qp->slot = qs->npos++;
+	}
+
+	xmlsd_query_skip_space(s);
+	if (*(*s)++ != ']')
+		return (XMLSD_ERR_PARSER);
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+void
+xmlsd_query_free(struct xmlsd_query *q)
+{
+	size_t			 i, j;
+
+	if (q == NULL)
+		return;
+	for (i = 0; i < q->nsteps; i++) {
+		for (j = 0; j < q->steps[i].npreds; j++) {
+			free(q->steps[i].preds[j].name);
+			free(q->steps[i].preds[j].value);
+		}
+		free(q->steps[i].preds);
+		free(q->steps[i].name);
+	}
+	free(q->steps);
+	free(q->prefix);
+	free(q);
+}
+
+/*
+ * Compile the query `s' into `qp', see the top of this file for what is
+ * understood.  The result may be run any number of times and needs to be
+ * released with xmlsd_query_free().
+ *
+ * Returns an error code, XMLSD_ERR_PARSER if `s' is not a valid query.
+ */
+int
+xmlsd_query_compile(const char *s, struct xmlsd_query **qp)
+{
+	struct xmlsd_query	*q;
+	struct xmlsd_query_step	*qs;
+	size_t			 i, len;
+	int			 rv;
+
+	if (s == NULL || qp == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	if ((q = calloc(1, sizeof *q)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+
+	rv = XMLSD_ERR_PARSER;
+	xmlsd_query_skip_space(&s);
+	if (*s != '/')
+		goto fail;
+	while (*s == '/') {
+		qs = realloc(q->steps, (q->nsteps + 1) * sizeof *qs);
+		if (qs == NULL) {
+			rv = XMLSD_ERR_RESOURCE;
+			goto fail;
+		}
+		q->steps = qs;
+		qs = &q->steps[q->nsteps++];
+		memset(qs, 0, sizeof *qs);
+
+		if (*++s == '/') {
+			qs->axis = XMLSD_QAXIS_DESC;
+			s++;
+		}
+		if (*s == '*')
+			s++;
+		else if ((qs->name = xmlsd_query_name(&s)) == NULL)
+			goto fail;
+		else
+			qs->namelen = strlen(qs->name);
+		xmlsd_query_skip_space(&s);
+		while (*s == '[') {
+			s++;
+			rv = xmlsd_query_pred(&s, qs);
+			if (rv != XMLSD_ERR_SUCCES)
+				goto fail;
+			rv = XMLSD_ERR_PARSER;
+			xmlsd_query_skip_space(&s);
+		}
+	}
+	if (*s != '\0')
+		goto fail;
+
+	/* leading steps that a path index can answer directly */
+	for (len = 0; q->nprefix < q->nsteps; q->nprefix++) {
+		qs = &q->steps[q->nprefix];
+		if (qs->axis != XMLSD_QAXIS_CHILD || qs->name == NULL ||
+		    qs->npreds != 0)
+			break;
+		len += strlen(qs->name) + 1;
+	}
+	for (q->gather = 0; q->gather + 1 < q->nsteps; q->gather++)
+		if (q->steps[q->gather].axis == XMLSD_QAXIS_DESC)
+			break;
+	if (q->gather + 1 == q->nsteps)
+		q->gather = q->nsteps;
+	if (q->nprefix != 0) {
+		if ((q->prefix = malloc(len)) == NULL) {
+			rv = XMLSD_ERR_RESOURCE;
+			goto fail;
+		}
+		q->prefix[0] = '\0';
+		for (i = q->nprefix; i-- > 0;) {
+			strlcat(q->prefix, q->steps[i].name, len);
+			if (i != 0)
+				strlcat(q->prefix, ".", len);
+		}
+	}
+
+	*qp = q;
+	return (XMLSD_ERR_SUCCES);
+fail:
+	xmlsd_query_free(q);
+	return (rv);
+}
+
+/*
+ * Make sure there is room for `n' counters at `base' and clear them.
+ */
+static int
+xmlsd_query_counters(struct xmlsd_query_ctx *ctx, size_t base, size_t n)
+{
+	size_t			*pos, size;
+
+	if (base + n > ctx->npos) {
+		if (base + n > SIZE_MAX / 2 / sizeof *pos)
+			return (XMLSD_ERR_RESOURCE);
+		for (size = ctx->npos * 2; size < base + n; size *= 2)
+			;
+		if ((pos = malloc(size * sizeof *pos)) == NULL)
+			return (XMLSD_ERR_RESOURCE);
+		memcpy(pos, ctx->pos, ctx->npos * sizeof *pos);
+		if (ctx->pos != ctx->stack)
+			free(ctx->pos);
+		ctx->pos = pos;
+		ctx->npos = size;
+	}
+	memset(&ctx->pos[base], 0, n * sizeof *ctx->pos);
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Whether `xe' passes step `qs', the position counters of its siblings
+ * start at `base'.
+ */
+static int
+xmlsd_query_match(struct xmlsd_query_ctx *ctx, struct xmlsd_query_step *qs,
+    struct xmlsd_element *xe, size_t base)
+{
+	struct xmlsd_query_pred	*qp;
+	struct xmlsd_attribute	*xa;
+	const char		*s;
+	size_t			 i, len;
+	int			 eq;
+
+	if (qs->name != NULL && (qs->namelen != xe->namelen ||
+	    memcmp(qs->name, xe->name, xe->namelen)))
+		return (0);
+
+	for (i = 0; i < qs->npreds; i++) {
+		qp = &qs->preds[i];
+		switch (qp->type) {
+		case XMLSD_QPRED_POS:
+			if (++ctx->pos[base + qp->slot] != qp->pos)
+				return (0);
+			break;
+		case XMLSD_QPRED_ATTR:
+			if (xmlsd_elem_get_attr(xe, qp->name) == NULL)
+				return (0);
+			break;
+		case XMLSD_QPRED_ATTR_EQ:
+		case XMLSD_QPRED_ATTR_NE:
+			/* values of another length are rejected unread */
+			xa = xmlsd_elem_find_attr(xe, qp->name);
+			eq = xa != NULL &&
+			    xmlsd_value_len(&xa->value) == qp->valuelen &&
+			    (s = xmlsd_value_span(&xa->value, &len)) != NULL &&
+			    !memcmp(s, qp->value, qp->valuelen);
+			if (eq != (qp->type == XMLSD_QPRED_ATTR_EQ))
+				return (0);
+			break;
+		}
+	}
+
+	return (1);
+}
+
+/* the slot of `xe' in the result set, empty if it is not there */
+static size_t
+xmlsd_query_slot(struct xmlsd_query_ctx *ctx, struct xmlsd_element *xe)
+{
+	size_t			 h;
+
+	h = ((uintptr_t)xe / sizeof *xe) * 2654435761u;
+	for (h &= ctx->setsize - 1; ctx->set[h] != NULL && ctx->set[h] != xe;
+	    h = (h + 1) & (ctx->setsize - 1))
+		;
+
+	return (h);
+}
+
+/* add `xe' to the result set unless it is in there already */
+static int
+xmlsd_query_add(struct xmlsd_query_ctx *ctx, struct xmlsd_element *xe)
+{
+	struct xmlsd_element	**set;
+	size_t			 i, size;
+
+	if ((ctx->nset + 1) * 2 > ctx->setsize) {
+		set = ctx->set;
+		size = ctx->setsize;
+		if (size > SIZE_MAX / 2 / sizeof *set)
+			return (XMLSD_ERR_RESOURCE);
+		ctx->setsize = size == 0 ? 64 : size * 2;
+		ctx->set = calloc(ctx->setsize, sizeof *set);
+		if (ctx->set == NULL) {
+			ctx->set = set;
+			ctx->setsize = size;
+			return (XMLSD_ERR_RESOURCE);
+		}
+		for (i = 0; i < size; i++) {
+			if (set[i] == NULL)
+				continue;
+			ctx->set[xmlsd_query_slot(ctx, set[i])] = set[i];
+		}
+		free(set);
+	}
+	i = xmlsd_query_slot(ctx, xe);
+	if (ctx->set[i] == NULL) {
+		ctx->set[i] = xe;
+		ctx->nset++;
+	}
+
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Report the result set in document order, all of it is below `xp' or the
+ * document if NULL, and empty it.
+ */
+static int
+xmlsd_query_report(struct xmlsd_query_ctx *ctx, struct xmlsd_element *xp)
+{
+	struct xmlsd_element	*xe;
+	struct xmlsd_walk	 xw;
+	int			 rv = 0;
+
+	if (ctx->nset == 0)
+		return (0);
+	xmlsd_walk_init(&xw, xp == NULL ? ctx->xd->root : xp, XMLSD_WALK_PRE);
+	while (rv == 0 && (xe = xmlsd_walk_next(&xw)) != NULL)
+		if (ctx->set[xmlsd_query_slot(ctx, xe)] == xe)
+			rv = ctx->fn(xe, ctx->arg);
+	memset(ctx->set, 0, ctx->setsize * sizeof *ctx->set);
+	ctx->nset = 0;
+
+	return (rv);
+}
+
+/* `xe' made it through step `i', hand it on */
+static int
+xmlsd_query_emit(struct xmlsd_query_ctx *ctx, size_t i,
+    struct xmlsd_element *xe)
+{
+	if (i + 1 == ctx->q->nsteps && ctx->q->gather != ctx->q->nsteps)
+		return (xmlsd_query_add(ctx, xe));
+	if (i + 1 == ctx->q->nsteps)
+		return (ctx->fn(xe, ctx->arg));
+	return (xmlsd_query_step(ctx, i + 1, xe));
+}
+
+/*
+ * Run step `i' and everything after it on the children or descendants of
+ * `xp', or of the document if it is NULL.
+ */
+static int
+xmlsd_query_step(struct xmlsd_query_ctx *ctx, size_t i,
+    struct xmlsd_element *xp)
+{
+	struct xmlsd_query_step	*qs = &ctx->q->steps[i];
+	struct xmlsd_element	*xe, *top;
+	struct xmlsd_walk	 xw;
+	size_t			 base = ctx->top, level;
+	int			 depth, rv = 0;
+
+	if (qs->axis == XMLSD_QAXIS_CHILD) {
+		if ((rv = xmlsd_query_counters(ctx, base, qs->npos)) != 0)
+			return (rv);
+		ctx->top = base + qs->npos;
+
+		if (xp == NULL) {
+			xe = ctx->xd->root;
+			if (xe != NULL && xmlsd_query_match(ctx, qs, xe, base))
+				rv = xmlsd_query_emit(ctx, i, xe);
+		} else if (qs->name != NULL) {
+			/* the child index makes this O(matches) */
+			for (xe = xmlsd_elem_find_child(xp, qs->name);
+			    xe != NULL && rv == 0;
+			    xe = xmlsd_elem_find_child_next(xp, xe))
+				if (xmlsd_query_match(ctx, qs, xe, base))
+					rv = xmlsd_query_emit(ctx, i, xe);
+		} else {
+			for (xe = TAILQ_FIRST(&xp->children);
+			    xe != NULL && rv == 0;
+			    xe = TAILQ_NEXT(xe, entry))
+				if (xmlsd_query_match(ctx, qs, xe, base))
+					rv = xmlsd_query_emit(ctx, i, xe);
+		}
+
+		ctx->top = base;
+		return (rv);
+	}
+
+	/*
+	 * Descendants, in document order.  Each level of the walk below `xp'
+	 * has its own set of position counters.
+	 *
+	 * Past the first descendant step `xp' may lie below an element this
+	 * step already walked, which found everything this walk would.  The
+	 * elements below an element of the first one end up in the result set
+	 * and are reported in document order once it is done.
+	 */
+	if (i > ctx->q->gather) {
+		top = ctx->last[i];
+		for (xe = xp; xe != NULL && top != NULL &&
+		    xe->depth > top->depth; xe = xe->parent)
+			;
+		if (top != NULL && xe == top)
+			return (0);
+		ctx->last[i] = xp;
+	}
+	if (xp == NULL) {
+		top = ctx->xd->root;
+		depth = -1;
+	} else {
+		top = xp;
+		depth = xp->depth;
+	}
+	if ((rv = xmlsd_query_counters(ctx, base, qs->npos)) != 0)
+		return (rv);
+	xmlsd_walk_init(&xw, top, XMLSD_WALK_PRE);
+	while (rv == 0 && (xe = xmlsd_walk_next(&xw)) != NULL) {
+		if (xe == xp)
+			continue;
+		level = xe->depth - depth - 1;
+		/* the children of xe start counting afresh */
+		rv = xmlsd_query_counters(ctx, base + (level + 1) * qs->npos,
+		    qs->npos);
+		if (rv != 0)
+			break;
+		ctx->top = base + (level + 2) * qs->npos;
+		if (xmlsd_query_match(ctx, qs, xe, base + level * qs->npos))
+			rv = xmlsd_query_emit(ctx, i, xe);
+	}
+
+	ctx->top = base;
+	if (rv == 0 && i == ctx->q->gather)
+		rv = xmlsd_query_report(ctx, xp);
+	return (rv);
+}
+
+/*
+ * Run `q' over `xd' and call `fn' with every element it selects and `arg'.
+ *
+ * Elements are reported once each, in document order.  Where a descendant
+ * step is followed by more steps the elements found below each element it
+ * selects are gathered and reported together, otherwise as they are found.
+ * The query stops as soon as `fn' returns non-zero and that value is
+ * returned.
+ * Leading child steps without predicates are answered from the path index
+ * if the document has one, children are found by name through the child
+ * index of wide elements.
+ *
+ * Returns 0 once all elements were reported, an error code if memory for
+ * deep position predicates or gathered elements ran out, or the return value
+ * of `fn'.
+ */
+int
+xmlsd_query_exec(struct xmlsd_query *q, struct xmlsd_document *xd,
+    int (*fn)(struct xmlsd_element *, void *), void *arg)
+{
+	struct xmlsd_query_ctx	 ctx;
+	struct xmlsd_element	**xe;
+	size_t			 i, n;
+	int			 rv = 0;
+
+	if (q == NULL || xd == NULL || fn == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	if (xd->root == NULL)
+		return (XMLSD_ERR_SUCCES);
+
+	memset(&ctx, 0, sizeof ctx);
+	ctx.q = q;
+	ctx.xd = xd;
+	ctx.fn = fn;
+	ctx.arg = arg;
+	ctx.pos = ctx.stack;
+	ctx.npos = XMLSD_QUERY_STACK;
+	if (q->gather != q->nsteps &&
+	    (ctx.last = calloc(q->nsteps, sizeof *ctx.last)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+
+	if (q->nprefix != 0 && xd->path_index != NULL) {
+		xe = xmlsd_doc_find_path(xd, q->prefix, &n);
+		for (i = 0; i < n && rv == 0; i++)
+			rv = xmlsd_query_emit(&ctx, q->nprefix - 1, xe[i]);
+	} else
+		rv = xmlsd_query_step(&ctx, 0, NULL);
+
+	if (ctx.pos != ctx.stack)
+		free(ctx.pos);
+	free(ctx.set);
+	free(ctx.last);
+	return (rv);
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Freeing documents on a thread of the library's own, so that tearing
+ * down a large tree does not show up in the latency of the caller.
+ * Documents wait in a bounded ring and the thread takes whatever is
+ * there in one go, freeing it with the lock released.  When the ring is
+ * full, or the thread cannot be started, the caller frees the document
+ * itself so memory waiting to be freed stays bounded.  The thread is
+ * started by the first document queued and runs until shut down.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define XMLSD_RECLAIM_QUEUE	(256)	/* most documents waiting */
+
+static struct {
+	pthread_mutex_t			 mtx;
+	pthread_cond_t			 work;	/* documents queued or quit */
+	pthread_cond_t			 idle;	/* all queued were freed */
+	pthread_t			 thread;
+	struct xmlsd_document		*queue[XMLSD_RECLAIM_QUEUE];
+	size_t				 head;	/* first waiting */
+	size_t				 n;	/* waiting */
+	int				 busy;	/* a batch is being freed */
+	int				 started;
+	int				 quit;
+} xmlsd_reclaim = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER
+};
+
+static void *
+xmlsd_reclaim_main(void *arg)
+{
+	struct xmlsd_document	*batch[XMLSD_RECLAIM_QUEUE];
+	size_t			 i, n;
+
+	pthread_mutex_lock(&xmlsd_reclaim.mtx);
+	for (;;) {
+		while (!xmlsd_reclaim.quit && xmlsd_reclaim.n == 0)
+			pthread_cond_wait(&xmlsd_reclaim.work,
+			    &xmlsd_reclaim.mtx);
+		if (xmlsd_reclaim.n == 0)
+			break;
+
+		/* take everything waiting, callers may queue meanwhile */
+		for (n = 0; n < xmlsd_reclaim.n; n++)
+			batch[n] = xmlsd_reclaim.queue[(xmlsd_reclaim.head +
+			    n) % XMLSD_RECLAIM_QUEUE];
+		xmlsd_reclaim.head = (xmlsd_reclaim.head + n) %
+		    XMLSD_RECLAIM_QUEUE;
+		xmlsd_reclaim.n = 0;
+		xmlsd_reclaim.busy = 1;
+		pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+
+		for (i = 0; i < n; i++)
+			xmlsd_doc_free(batch[i]);
+
+		pthread_mutex_lock(&xmlsd_reclaim.mtx);
+		xmlsd_reclaim.busy = 0;
+		if (xmlsd_reclaim.n == 0)
+			pthread_cond_broadcast(&xmlsd_reclaim.idle);
+	}
+	pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+
+	return (NULL);
+}
+
+/*
+ * Free `xd' on the reclaimer thread.  The caller gives up `xd' as with
+ * xmlsd_doc_free(), which is called directly if the queue is full or the
+ * thread cannot be started.
+ */
+void
+xmlsd_doc_free_async(struct xmlsd_document *xd)
+{
+	if (xd == NULL)
+		return;
+
+	pthread_mutex_lock(&xmlsd_reclaim.mtx);
+	if (!xmlsd_reclaim.started && !xmlsd_reclaim.quit) {
+		if (pthread_create(&xmlsd_reclaim.thread, NULL,
+		    xmlsd_reclaim_main, NULL) == 0)
+			xmlsd_reclaim.started = 1;
+	}
+	if (!xmlsd_reclaim.started || xmlsd_reclaim.quit ||
+	    xmlsd_reclaim.n == XMLSD_RECLAIM_QUEUE) {
+		pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+		xmlsd_doc_free(xd);
+		return;
+	}
+	xmlsd_reclaim.queue[(xmlsd_reclaim.head + xmlsd_reclaim.n) %
+	    XMLSD_RECLAIM_QUEUE] = xd;
+	if (xmlsd_reclaim.n++ == 0)
+		pthread_cond_signal(&xmlsd_reclaim.work);
+	pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+}
+
+/*
+ * Wait until every document queued by xmlsd_doc_free_async() so far has
+ * been freed.
+ */
+void
+xmlsd_doc_free_flush(void)
+{
+	pthread_mutex_lock(&xmlsd_reclaim.mtx);
+	while (xmlsd_reclaim.started &&
+	    (xmlsd_reclaim.n != 0 || xmlsd_reclaim.busy))
+		pthread_cond_wait(&xmlsd_reclaim.idle, &xmlsd_reclaim.mtx);
+	pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+}
+
+/*
+ * Free every queued document and stop the reclaimer thread.  Documents
+ * handed to xmlsd_doc_free_async() afterwards start it again.
+ */
+void
+xmlsd_doc_free_shutdown(void)
+{
+	pthread_mutex_lock(&xmlsd_reclaim.mtx);
+	if (!xmlsd_reclaim.started || xmlsd_reclaim.quit) {
+		pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+		return;
+	}
+	xmlsd_reclaim.quit = 1;
+	pthread_cond_signal(&xmlsd_reclaim.work);
+	pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+
+	pthread_join(xmlsd_reclaim.thread, NULL);
+
+	pthread_mutex_lock(&xmlsd_reclaim.mtx);
+	xmlsd_reclaim.started = 0;
+	xmlsd_reclaim.quit = 0;
+	pthread_cond_broadcast(&xmlsd_reclaim.idle);
+	pthread_mutex_unlock(&xmlsd_reclaim.mtx);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A slot holds the current version of a sealed document.  Readers take a
+ * reference to whatever is current without locking, a writer publishes a
+ * new version and drops the slot's reference to the old one once no
+ * reader can still be about to take one.
+ *
+ * Readers announce themselves in the counter of the current phase for
+ * the few instructions it takes to load the pointer and reference it.  A
+ * writer swaps the pointer, then twice moves readers to the other phase
+ * and waits for the counter of the one they left to drain.  Readers that
+ * count themselves after that see the new pointer, and new readers never
+ * hold up the writer since they count in the other phase.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+struct xmlsd_doc_slot {
+	pthread_mutex_t			 mtx;	/* serializes writers */
+	struct xmlsd_document		*doc;
+	unsigned int			 phase;
+	unsigned int			 active[2];	/* readers per phase */
+};
+
+/*
+ * Allocate an empty slot into `slotp'.
+ */
+int
+xmlsd_doc_slot_alloc(struct xmlsd_doc_slot **slotp)
+{
+	struct xmlsd_doc_slot	*slot;
+
+	if (slotp == NULL)
+		return (XMLSD_ERR_INTEGRITY);
+	if ((slot = calloc(1, sizeof *slot)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	pthread_mutex_init(&slot->mtx, NULL);
+
+	*slotp = slot;
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Free `slot' and drop its reference to the current document.  No thread
+ * may be using the slot.
+ */
+void
+xmlsd_doc_slot_free(struct xmlsd_doc_slot *slot)
+{
+	if (slot == NULL)
+		return;
+
+	xmlsd_doc_unref(slot->doc);
+	pthread_mutex_destroy(&slot->mtx);
+	free(slot);
+}
+
+/*
+ * Return the current document of `slot' with a reference taken for the
+ * caller, who drops it with xmlsd_doc_unref().  Returns NULL if nothing
+ * was published yet.  Never blocks.
+ */
+struct xmlsd_document *
+xmlsd_doc_slot_get(struct xmlsd_doc_slot *slot)
+{
+	struct xmlsd_document	*xd;
+	unsigned int		 i;
+
+	i = __atomic_load_n(&slot->phase, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&slot->active[i], 1, __ATOMIC_SEQ_CST);
+	if ((xd = __atomic_load_n(&slot->doc, __ATOMIC_SEQ_CST)) != NULL)
+		xmlsd_doc_ref(xd);
+	__atomic_sub_fetch(&slot->active[i], 1, __ATOMIC_RELEASE);
+
+	return (xd);
+}
+
+/*
+ * Publish `xd' as the current document of `slot'.  The slot takes over
+ * the caller's reference to it and drops its own reference to the
+ * previous document once no reader can still pick that one up.  `xd'
+ * must be sealed, or NULL to empty the slot.
+ */
+int
+xmlsd_doc_slot_set(struct xmlsd_doc_slot *slot, struct xmlsd_document *xd)
+{
+	struct xmlsd_document	*old;
+	unsigned int		 i;
+	int			 n;
+
+	if (slot == NULL || (xd != NULL && !xd->sealed))
+		return (XMLSD_ERR_INTEGRITY);
+
+	pthread_mutex_lock(&slot->mtx);
+	old = __atomic_exchange_n(&slot->doc, xd, __ATOMIC_SEQ_CST);
+	/* a reader may still count itself in the phase before last */
+	for (n = 0; n < 2; n++) {
+		i = __atomic_fetch_add(&slot->phase, 1, __ATOMIC_SEQ_CST) & 1;
+		while (__atomic_load_n(&slot->active[i], __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+	}
+	pthread_mutex_unlock(&slot->mtx);
+
+	xmlsd_doc_unref(old);
+	return (XMLSD_ERR_SUCCES);
+}
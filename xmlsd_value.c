@@ -0,0 +1,742 @@
+/*
+ * Copyright (c) 2011 Conformal Systems LLC <info@conformal.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "xmlsd.h"
+#include "xmlsd_internal.h"
+
+#include <ctype.h>
+#include <string.h>
+
+static const char	xmlsd_digits[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char	xmlsd_hexdigits[] = "0123456789abcdef";
+
+static const char	xmlsd_b64digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* base64 digit values, anything with the top bits set needs a closer look */
+#define B64_SP	(0x40)	/* white space, skipped */
+#define B64_EQ	(0x41)	/* padding */
+#define XX	(0x80)	/* invalid */
+#define SP	B64_SP
+#define EQ	B64_EQ
+static const uint8_t	xmlsd_b64val[256] = {
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, SP, SP, XX, XX, SP, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	SP, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, 62, XX, XX, XX, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, XX, XX, XX, EQ, XX, XX,
+	XX,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, XX,
+	XX, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+#undef EQ
+#undef SP
+#undef XX
+
+#define XX	(0xff)
+static const uint8_t	xmlsd_hexval[256] = {
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, XX, XX, XX, XX, XX, XX,
+	XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+#undef XX
+
+/*
+ * Format `num' as `type' into `buf' without NUL termination.
+ *
+ * This is equivalent to printf's %d, %u and 0x%x for the respective types
+ * but without the format parsing.  `buf' must be able to hold at least
+ * XMLSD_NUMBUF_LEN bytes.  Returns the number of characters written.
+ */
+size_t
+xmlsd_fmt_num(char *buf, int type, uint64_t num)
+{
+	char		 tmp[XMLSD_NUMBUF_LEN], *p = tmp + sizeof tmp;
+	uint64_t	 u = num;
+	size_t		 i, len;
+	int		 neg = 0;
+
+	if (type == XMLSD_VALUE_HEX) {
+		do {
+			*--p = xmlsd_hexdigits[u & 0xf];
+			u >>= 4;
+		} while (u != 0);
+		*--p = 'x';
+		*--p = '0';
+	} else {
+		if (type == XMLSD_VALUE_INT && (int64_t)num < 0) {
+			neg = 1;
+			u = -num;
+		}
+		/* two digits at a time */
+		while (u >= 100) {
+			i = (u % 100) * 2;
+			u /= 100;
+			*--p = xmlsd_digits[i + 1];
+			*--p = xmlsd_digits[i];
+		}
+		if (u >= 10) {
+			*--p = xmlsd_digits[u * 2 + 1];
+			*--p = xmlsd_digits[u * 2];
+		} else
+			*--p = '0' + u;
+		if (neg)
+			*--p = '-';
+	}
+
+	len = tmp + sizeof tmp - p;
+	memcpy(buf, p, len);
+	return (len);
+}
+
+/*
+ * Return the string form of `v', formatting native numbers and binary data
+ * on first use and copying borrowed strings so they can be NUL terminated.
+ * Returns NULL if no value has been set or the text could not be
+ * allocated.
+ */
+const char *
+xmlsd_value_get(struct xmlsd_value *v)
+{
+	char			*s;
+	size_t			 len;
+
+	if (v->flags & XMLSD_VALUE_F_BORROW) {
+		if (v->len < sizeof v->numbuf)
+			s = v->numbuf;
+		else if ((s = xmlsd_mm_malloc(v->mm, v->len + 1)) == NULL)
+			return (NULL);
+		else
+			v->flags |= XMLSD_VALUE_F_ALLOC;
+		memcpy(s, v->str, v->len);
+		s[v->len] = '\0';
+		v->str = s;
+		v->flags &= ~XMLSD_VALUE_F_BORROW;
+	} else if (v->str == NULL && v->type == XMLSD_VALUE_B64) {
+		len = xmlsd_b64_enclen(v->num.bin->len);
+		if ((v->str = xmlsd_mm_malloc(v->mm, len + 1)) == NULL)
+			return (NULL);
+		xmlsd_b64_encode(v->str, v->num.bin->data, v->num.bin->len);
+		v->str[len] = '\0';
+		v->len = len;
+		v->flags |= XMLSD_VALUE_F_ALLOC;
+	} else if (v->str == NULL && v->type > XMLSD_VALUE_STRING) {
+		len = xmlsd_fmt_num(v->numbuf, v->type, v->num.u);
+		v->numbuf[len] = '\0';
+		v->str = v->numbuf;
+		v->len = len;
+	}
+
+	return (v->str);
+}
+
+/*
+ * Make `v' safe to read from several threads at once: its text is made
+ * up front and decoding it no longer caches anything in it.
+ *
+ * Returns 0 on success, 1 on allocation failure.
+ */
+int
+xmlsd_value_seal(struct xmlsd_value *v)
+{
+	if (v->type != XMLSD_VALUE_NONE && xmlsd_value_get(v) == NULL)
+		return (1);
+	v->flags |= XMLSD_VALUE_F_SEALED;
+
+	return (0);
+}
+
+/*
+ * Replace `v' with a copy of the string `s'.
+ *
+ * Returns 0 on success, 1 on allocation failure in which case `v' is empty.
+ */
+int
+xmlsd_value_set(struct xmlsd_value *v, const char *s)
+{
+	return (xmlsd_value_set_len(v, s, strlen(s)));
+}
+
+/*
+ * Like xmlsd_value_set() for the `len' characters of `s'.  Strings short
+ * enough to fit are kept in numbuf, which strings do not otherwise use,
+ * longer ones go on the heap.
+ */
+int
+xmlsd_value_set_len(struct xmlsd_value *v, const char *s, size_t len)
+{
+	xmlsd_value_clear(v);
+
+	if (len < sizeof v->numbuf)
+		v->str = v->numbuf;
+	else if (len == SIZE_MAX ||
+	    (v->str = xmlsd_mm_malloc(v->mm, len + 1)) == NULL)
+		return (1);
+	else
+		v->flags |= XMLSD_VALUE_F_ALLOC;
+	memcpy(v->str, s, len);
+	v->str[len] = '\0';
+	v->len = len;
+	v->type = XMLSD_VALUE_STRING;
+
+	return (0);
+}
+
+/*
+ * Point `v' at the `len' characters at `s' without copying them, `s' must
+ * outlive `v'.  Borrowed strings are not NUL terminated, they are only
+ * copied if xmlsd_value_get() is asked for them.
+ */
+void
+xmlsd_value_borrow(struct xmlsd_value *v, const char *s, size_t len)
+{
+	xmlsd_value_clear(v);
+
+	v->str = (char *)s;
+	v->len = len;
+	v->type = XMLSD_VALUE_STRING;
+	v->flags |= XMLSD_VALUE_F_BORROW;
+}
+
+/*
+ * Return the string form of `v' and its length in `len' like
+ * xmlsd_value_get() does, except that borrowed strings are returned as
+ * they are and may not be NUL terminated.
+ */
+const char *
+xmlsd_value_span(struct xmlsd_value *v, size_t *len)
+{
+	if (!(v->flags & XMLSD_VALUE_F_BORROW) && xmlsd_value_get(v) == NULL) {
+		*len = 0;
+		return (NULL);
+	}
+
+	*len = v->len;
+	return (v->str);
+}
+
+/*
+ * Return the length of the string form of `v' without formatting binary
+ * data, or 0 if there is no value.
+ */
+size_t
+xmlsd_value_len(struct xmlsd_value *v)
+{
+	size_t			 len;
+
+	if (v->str == NULL && v->type == XMLSD_VALUE_B64)
+		return (xmlsd_b64_enclen(v->num.bin->len));
+	xmlsd_value_span(v, &len);
+	return (len);
+}
+
+/*
+ * Replace `v' with the native number `num'.  The string form is only
+ * created if it is asked for, generation writes the digits directly.
+ */
+void
+xmlsd_value_set_num(struct xmlsd_value *v, int type, uint64_t num)
+{
+	xmlsd_value_clear(v);
+
+	v->type = type;
+	v->num.u = num;
+}
+
+void
+xmlsd_value_clear(struct xmlsd_value *v)
+{
+	if (v->flags & XMLSD_VALUE_F_ALLOC)
+		xmlsd_mm_free(v->mm, v->str);
+	if (v->type == XMLSD_VALUE_B64)
+		xmlsd_mm_free(v->mm, v->num.bin);
+	v->str = NULL;
+	v->len = 0;
+	v->type = XMLSD_VALUE_NONE;
+	v->flags = 0;
+}
+
+/*
+ * Decode the `len' characters of `s' the way strtoll(s, &end, 10) would
+ * with all of `s' consumed.  Up to 18 digits cannot overflow so the loop
+ * does not check, longer numbers are checked afterwards.  Returns 0 or
+ * XMLSD_VALUE_F_INVALID, _UNDER or _OVER, in which case `out' is
+ * saturated like strtoll does.
+ */
+static int
+xmlsd_parse_dec(const char *s, size_t len, int64_t *out)
+{
+	const char		*p, *end = s + len;
+	uint64_t		 u = 0, limit, d;
+	int			 neg = 0;
+
+	while (s < end && isspace((unsigned char)*s))
+		s++;
+	if (s < end && (*s == '-' || *s == '+'))
+		neg = *s++ == '-';
+	while (end - s > 1 && *s == '0' && (unsigned char)(s[1] - '0') <= 9)
+		s++;
+
+	for (p = s; p < end && (d = (unsigned char)(*p - '0')) <= 9; p++)
+		u = u * 10 + d;
+	if (p == s || p != end)
+		return (XMLSD_VALUE_F_INVALID);
+
+	if (p - s >= 19) {
+		limit = neg ? (uint64_t)INT64_MAX + 1 : INT64_MAX;
+		for (u = 0; s < p; s++) {
+			d = *s - '0';
+			if (u > (limit - d) / 10) {
+				*out = neg ? INT64_MIN : INT64_MAX;
+				return (neg ? XMLSD_VALUE_F_UNDER :
+				    XMLSD_VALUE_F_OVER);
+			}
+			u = u * 10 + d;
+		}
+	}
+
+	*out = neg ? (int64_t)(0 - u) : (int64_t)u;
+	return (0);
+}
+
+/*
+ * Decode the `len' characters of `s' the way strtoull(s, &end, 16) would
+ * with all of `s' consumed, including the optional 0x prefix and negation.
+ */
+static int
+xmlsd_parse_hex(const char *s, size_t len, uint64_t *out)
+{
+	const char		*p, *end = s + len;
+	uint64_t		 u = 0, d;
+	int			 neg = 0;
+
+	while (s < end && isspace((unsigned char)*s))
+		s++;
+	if (s < end && (*s == '-' || *s == '+'))
+		neg = *s++ == '-';
+	if (end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X') &&
+	    xmlsd_hexval[(unsigned char)s[2]] < 16)
+		s += 2;
+	while (end - s > 1 && *s == '0' &&
+	    xmlsd_hexval[(unsigned char)s[1]] < 16)
+		s++;
+
+	for (p = s; p < end && (d = xmlsd_hexval[(unsigned char)*p]) < 16;
+	    p++)
+		u = u << 4 | d;
+	if (p == s || p != end)
+		return (XMLSD_VALUE_F_INVALID);
+	if (p - s > 16) {
+		*out = UINT64_MAX;
+		return (XMLSD_VALUE_F_OVER);
+	}
+
+	*out = neg ? 0 - u : u;
+	return (0);
+}
+
+/*
+ * Decode `v' as a decimal number into `out'.  Native numbers are used as
+ * they are, string values are only decoded the first time.
+ */
+static int
+xmlsd_value_dec(struct xmlsd_value *v, int64_t *out)
+{
+	const char		*s;
+	int			 st;
+
+	switch (v->type) {
+	case XMLSD_VALUE_INT:
+		*out = v->num.i;
+		return (0);
+	case XMLSD_VALUE_UINT:
+		if (v->num.u > INT64_MAX) {
+			*out = INT64_MAX;
+			return (XMLSD_VALUE_F_OVER);
+		}
+		*out = v->num.i;
+		return (0);
+	case XMLSD_VALUE_HEX:
+		/* "0x..." is not a decimal number */
+		return (XMLSD_VALUE_F_INVALID);
+	case XMLSD_VALUE_B64:
+		/* the number slot holds the data, nothing to cache in */
+		if ((s = xmlsd_value_get(v)) == NULL)
+			return (XMLSD_VALUE_F_INVALID);
+		return (xmlsd_parse_dec(s, v->len, out));
+	}
+
+	if ((v->flags & XMLSD_VALUE_F_KIND) != XMLSD_VALUE_F_DEC) {
+		if (v->flags & XMLSD_VALUE_F_SEALED)
+			return (xmlsd_parse_dec(v->str, v->len, out));
+		st = xmlsd_parse_dec(v->str, v->len, &v->num.i);
+		v->flags &= ~(XMLSD_VALUE_F_KIND | XMLSD_VALUE_F_STATUS);
+		v->flags |= XMLSD_VALUE_F_DEC | st;
+	}
+	*out = v->num.i;
+	return (v->flags & XMLSD_VALUE_F_STATUS);
+}
+
+/* decode `v' as a hexadecimal number into `out', see xmlsd_value_dec() */
+static int
+xmlsd_value_hex(struct xmlsd_value *v, uint64_t *out)
+{
+	const char		*s;
+	int			 st;
+
+	switch (v->type) {
+	case XMLSD_VALUE_HEX:
+		*out = v->num.u;
+		return (0);
+	case XMLSD_VALUE_INT:
+	case XMLSD_VALUE_UINT:
+	case XMLSD_VALUE_B64:
+		/* the text read as hex, rare enough not to cache */
+		if ((s = xmlsd_value_get(v)) == NULL)
+			return (XMLSD_VALUE_F_INVALID);
+		return (xmlsd_parse_hex(s, v->len, out));
+	}
+
+	if ((v->flags & XMLSD_VALUE_F_KIND) != XMLSD_VALUE_F_HEX) {
+		if (v->flags & XMLSD_VALUE_F_SEALED)
+			return (xmlsd_parse_hex(v->str, v->len, out));
+		st = xmlsd_parse_hex(v->str, v->len, &v->num.u);
+		v->flags &= ~(XMLSD_VALUE_F_KIND | XMLSD_VALUE_F_STATUS);
+		v->flags |= XMLSD_VALUE_F_HEX | st;
+	}
+	*out = v->num.u;
+	return (v->flags & XMLSD_VALUE_F_STATUS);
+}
+
+/*
+ * strtonum(3) on the value of `v'.  `v' must have a value.
+ */
+long long
+xmlsd_value_strtonum(struct xmlsd_value *v, long long minval,
+    long long maxval, const char **errstr)
+{
+	int64_t			 val = 0;
+	int			 st;
+
+	*errstr = NULL;
+	if (minval > maxval)
+		*errstr = "invalid";
+	else if ((st = xmlsd_value_dec(v, &val)) & XMLSD_VALUE_F_INVALID)
+		*errstr = "invalid";
+	else if ((st & XMLSD_VALUE_F_UNDER) || val < minval)
+		*errstr = "too small";
+	else if ((st & XMLSD_VALUE_F_OVER) || val > maxval)
+		*errstr = "too large";
+
+	return (*errstr != NULL ? 0 : val);
+}
+
+/*
+ * Decode `v' as a hexadecimal number between `minval' and `maxval'.  `v'
+ * must have a value.
+ */
+unsigned long long
+xmlsd_value_hexnum(struct xmlsd_value *v, unsigned long long minval,
+    unsigned long long maxval, const char **errstr)
+{
+	uint64_t		 val = 0;
+	int			 st;
+
+	*errstr = NULL;
+	if (minval > maxval)
+		*errstr = "invalid";
+	else if ((st = xmlsd_value_hex(v, &val)) & XMLSD_VALUE_F_INVALID)
+		*errstr = "invalid";
+	else if (val < minval)
+		*errstr = "toosmall";
+	else if ((st & XMLSD_VALUE_F_OVER) || val > maxval)
+		*errstr = "too large";
+
+	return (*errstr != NULL ? 0 : val);
+}
+
+/*
+ * Decode `v' as "true", "1", "false" or "0" into `b'.  `v' must have a
+ * value.  Returns 0 on success or XMLSD_ERR_INTEGRITY.
+ */
+int
+xmlsd_value_boolean(struct xmlsd_value *v, int *b)
+{
+	const char		*s;
+	size_t			 len;
+	int			 st = 0, val = 0;
+
+	switch (v->type) {
+	case XMLSD_VALUE_INT:
+	case XMLSD_VALUE_UINT:
+		if (v->num.u > 1)
+			return (XMLSD_ERR_INTEGRITY);
+		*b = v->num.u;
+		return (0);
+	case XMLSD_VALUE_HEX:
+	case XMLSD_VALUE_B64:
+		return (XMLSD_ERR_INTEGRITY);
+	}
+
+	if ((v->flags & XMLSD_VALUE_F_KIND) != XMLSD_VALUE_F_BOOL) {
+		s = v->str;
+		len = v->len;
+		if ((len == 4 && !memcmp(s, "true", 4)) ||
+		    (len == 1 && *s == '1'))
+			val = 1;
+		else if ((len == 5 && !memcmp(s, "false", 5)) ||
+		    (len == 1 && *s == '0'))
+			val = 0;
+		else
+			st = XMLSD_VALUE_F_INVALID;
+		if (v->flags & XMLSD_VALUE_F_SEALED) {
+			if (st)
+				return (XMLSD_ERR_INTEGRITY);
+			*b = val;
+			return (0);
+		}
+		v->num.u = val;
+		v->flags &= ~(XMLSD_VALUE_F_KIND | XMLSD_VALUE_F_STATUS);
+		v->flags |= XMLSD_VALUE_F_BOOL | st;
+	}
+	if (v->flags & XMLSD_VALUE_F_INVALID)
+		return (XMLSD_ERR_INTEGRITY);
+	*b = v->num.u;
+	return (0);
+}
+
+/* number of characters base64 needs for `len' bytes */
+size_t
+xmlsd_b64_enclen(size_t len)
+{
+	return ((len + 2) / 3 * 4);
+}
+
+/*
+ * Encode `len' bytes of `src' as padded base64 into `dst' without NUL
+ * termination.  `dst' must hold xmlsd_b64_enclen(len) characters, which
+ * is what is returned.
+ */
+size_t
+xmlsd_b64_encode(char *dst, const void *src, size_t len)
+{
+	const uint8_t		*s = src, *end = s + len - len % 3;
+	char			*d = dst;
+	uint32_t		 w;
+
+	/* three bytes to four characters without any branches */
+	for (; s < end; s += 3, d += 4) {
+		w = (uint32_t)s[0] << 16 | s[1] << 8 | s[2];
+		d[0] = xmlsd_b64digits[w >> 18];
+		d[1] = xmlsd_b64digits[(w >> 12) & 0x3f];
+		d[2] = xmlsd_b64digits[(w >> 6) & 0x3f];
+		d[3] = xmlsd_b64digits[w & 0x3f];
+	}
+
+	if (len % 3) {
+		w = (uint32_t)s[0] << 16;
+		if (len % 3 == 2)
+			w |= s[1] << 8;
+		d[0] = xmlsd_b64digits[w >> 18];
+		d[1] = xmlsd_b64digits[(w >> 12) & 0x3f];
+		d[2] = len % 3 == 2 ? xmlsd_b64digits[(w >> 6) & 0x3f] : '=';
+		d[3] = '=';
+		d += 4;
+	}
+
+	return (d - dst);
+}
+
+/*
+ * Decode `slen' characters of base64 in `src' into `dst', which has room
+ * for `dstlen' bytes.  White space is skipped and padding is optional.
+ * If `dst' is NULL nothing is written but the input is still checked.
+ * The number of bytes decoded, or needed, is returned in `outlen'.
+ *
+ * Returns XMLSD_ERR_SUCCES, XMLSD_ERR_INTEGRITY if `src' is not base64 or
+ * XMLSD_ERR_OVERFLOW if `dst' is too small.
+ */
+int
+xmlsd_b64_decode(const char *src, size_t slen, void *dst, size_t dstlen,
+    size_t *outlen)
+{
+	const uint8_t		*s = (const uint8_t *)src, *end = s + slen;
+	uint8_t			*d = dst, q[4], a, b, c, e;
+	size_t			 len = 0, n = 0, pad = 0;
+
+	while (s < end) {
+		/* whole quads of plain digits are the common case */
+		if (n == 0 && end - s >= 4 && d != NULL && dstlen - len >= 3) {
+			a = xmlsd_b64val[s[0]];
+			b = xmlsd_b64val[s[1]];
+			c = xmlsd_b64val[s[2]];
+			e = xmlsd_b64val[s[3]];
+			if (((a | b | c | e) & 0xc0) == 0) {
+				d[len] = a << 2 | b >> 4;
+				d[len + 1] = b << 4 | c >> 2;
+				d[len + 2] = c << 6 | e;
+				len += 3;
+				s += 4;
+				continue;
+			}
+		}
+
+		a = xmlsd_b64val[*s++];
+		if (a == B64_SP)
+			continue;
+		if (a == B64_EQ) {
+			pad++;
+			break;
+		}
+		if (a & 0x80)
+			return (XMLSD_ERR_INTEGRITY);
+		q[n++] = a;
+		if (n < 4)
+			continue;
+		if (d != NULL) {
+			if (dstlen - len < 3)
+				return (XMLSD_ERR_OVERFLOW);
+			d[len] = q[0] << 2 | q[1] >> 4;
+			d[len + 1] = q[1] << 4 | q[2] >> 2;
+			d[len + 2] = q[2] << 6 | q[3];
+		}
+		len += 3;
+		n = 0;
+	}
+
+	/* only padding and white space may follow the first '=' */
+	for (; s < end; s++) {
+		a = xmlsd_b64val[*s];
+		if (a == B64_EQ)
+			pad++;
+		else if (a != B64_SP)
+			return (XMLSD_ERR_INTEGRITY);
+	}
+	if (n == 1 || (pad != 0 && (n == 0 || n + pad != 4)))
+		return (XMLSD_ERR_INTEGRITY);
+
+	if (n > 1) {
+		if (d != NULL) {
+			if (dstlen - len < n - 1)
+				return (XMLSD_ERR_OVERFLOW);
+			d[len] = q[0] << 2 | q[1] >> 4;
+			if (n == 3)
+				d[len + 1] = q[1] << 4 | q[2] >> 2;
+		}
+		len += n - 1;
+	}
+
+	*outlen = len;
+	return (XMLSD_ERR_SUCCES);
+}
+
+/*
+ * Replace `v' with a copy of `len' bytes of `data', the text is only
+ * created if it is asked for, generation encodes the data directly.
+ *
+ * Returns 0 on success, 1 on allocation failure in which case `v' is empty.
+ */
+int
+xmlsd_value_set_b64(struct xmlsd_value *v, const void *data, size_t len)
+{
+	struct xmlsd_bin	*bin;
+
+	xmlsd_value_clear(v);
+
+	if (len > SIZE_MAX / 4 - sizeof *bin ||
+	    (bin = xmlsd_mm_malloc(v->mm, sizeof *bin + len)) == NULL)
+		return (1);
+	bin->len = len;
+	if (len != 0)
+		memcpy(bin->data, data, len);
+	v->type = XMLSD_VALUE_B64;
+	v->num.bin = bin;
+
+	return (0);
+}
+
+/*
+ * Decode `v' as base64 into `out', which has room for `*outlen' bytes.
+ * `v' must have a value.  With `out' NULL only the size is returned.
+ * On success, or if `out' is too small, `*outlen' is set to the decoded
+ * size.
+ *
+ * Returns XMLSD_ERR_SUCCES, XMLSD_ERR_INTEGRITY if `v' is not base64,
+ * XMLSD_ERR_OVERFLOW if `out' is too small or XMLSD_ERR_RESOURCE.
+ */
+int
+xmlsd_value_get_b64(struct xmlsd_value *v, void *out, size_t *outlen)
+{
+	const char		*s;
+	size_t			 len, slen;
+	int			 rv;
+
+	if (v->type == XMLSD_VALUE_B64) {
+		len = v->num.bin->len;
+		if (out != NULL && *outlen < len)
+			rv = XMLSD_ERR_OVERFLOW;
+		else {
+			if (out != NULL)
+				memcpy(out, v->num.bin->data, len);
+			rv = XMLSD_ERR_SUCCES;
+		}
+		*outlen = len;
+		return (rv);
+	}
+
+	if ((s = xmlsd_value_span(v, &slen)) == NULL)
+		return (XMLSD_ERR_RESOURCE);
+	rv = xmlsd_b64_decode(s, slen, out, *outlen, &len);
+	if (rv == XMLSD_ERR_OVERFLOW)
+		rv = xmlsd_b64_decode(s, slen, NULL, 0, &len) ==
+		    XMLSD_ERR_SUCCES ? XMLSD_ERR_OVERFLOW : XMLSD_ERR_INTEGRITY;
+	if (rv != XMLSD_ERR_INTEGRITY)
+		*outlen = len;
+
+	return (rv);
+}